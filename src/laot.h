@@ -0,0 +1,233 @@
+/*
+** $Id: laot.h $
+** Lua functions compiled ahead of time to C (see 'luac -C')
+** See Copyright Notice in lua.h
+*/
+
+#ifndef laot_h
+#define laot_h
+
+#include <math.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** A compiled function ('AOTFunction') runs the Lua frame 'L->ci' from
+** its saved 'pc' on, exactly as 'luaV_execute' would run its bytecode.
+** It gives control back to 'luaV_execute' to enter a called Lua
+** function, returning AOT_CALL, or after returning from its own frame,
+** returning the result of 'luaD_poscall'. The frame is reentered at
+** its saved 'pc' after the call returns or after a yield.
+*/
+#define AOT_CALL	(-1)
+
+/*
+** A function may also stop at any instruction returning AOT_INTERP,
+** with its saved 'pc' there, to let 'luaV_execute' interpret the frame
+** from that point (see 'ljit.c'); code made by 'luac -C' never does.
+*/
+#define AOT_INTERP	(-2)
+
+
+/*
+** Internal functions used by compiled code. Compiled code is loaded
+** as a C module, which cannot see the (hidden) internal functions of
+** the core, so it calls them through this table.
+*/
+typedef struct AOTRuntime {
+  int (*tonumber_) (const TValue *obj, lua_Number *n);
+  int (*tointeger) (const TValue *obj, lua_Integer *p, int mode);
+  void (*finishget) (lua_State *L, const TValue *t, TValue *key,
+                     StkId val, const TValue *slot);
+  void (*finishset) (lua_State *L, const TValue *t, TValue *key,
+                     StkId val, const TValue *slot);
+  int (*equalobj) (lua_State *L, const TValue *t1, const TValue *t2);
+  int (*lessthan) (lua_State *L, const TValue *l, const TValue *r);
+  int (*lessequal) (lua_State *L, const TValue *l, const TValue *r);
+  void (*concat) (lua_State *L, int total);
+  void (*objlen) (lua_State *L, StkId ra, const TValue *rb);
+  lua_Integer (*div) (lua_State *L, lua_Integer x, lua_Integer y);
+  lua_Integer (*mod) (lua_State *L, lua_Integer x, lua_Integer y);
+  lua_Integer (*shiftl) (lua_Integer x, lua_Integer y);
+  void (*forkey) (const TValue *state, const TValue *ctl, TValue *key);
+  int (*forlimit) (const TValue *obj, lua_Integer *p, lua_Integer step,
+                   int *stopnow);
+  int (*fornative) (lua_State *L, StkId ra, int nres);
+  LClosure *(*getcached) (Proto *p, UpVal **encup, StkId base);
+  void (*pushclosure) (lua_State *L, Proto *p, UpVal **encup, StkId base,
+                       StkId ra);
+  void (*newtable) (lua_State *L, Proto *p, int pc, StkId ra,
+                    unsigned int na, unsigned int nh);
+  int (*fb2int) (int x);
+  void (*trybinTM) (lua_State *L, const TValue *p1, const TValue *p2,
+                    StkId res, TMS event);
+  int (*precall) (lua_State *L, StkId func, int nresults);
+  int (*poscall) (lua_State *L, CallInfo *ci, StkId firstResult, int nres);
+  void (*call) (lua_State *L, StkId func, int nResults);
+  void (*growstack) (lua_State *L, int n);
+  void (*close) (lua_State *L, StkId level);
+  const TValue *(*get) (Table *t, const TValue *key);
+  const TValue *(*getstr) (Table *t, TString *key);
+  const TValue *(*getstrhint) (Table *t, TString *key, unsigned int *hint);
+  const TValue *(*getint) (Table *t, lua_Integer key);
+  void (*setint) (lua_State *L, Table *t, lua_Integer key, TValue *value);
+  void (*resizearray) (lua_State *L, Table *t, unsigned int nasize);
+  void (*step) (lua_State *L);
+  void (*barrierback_) (lua_State *L, Table *o);
+  void (*barriercard_) (lua_State *L, Table *t, const TValue *slot);
+  void (*upvalbarrier_) (lua_State *L, UpVal *uv);
+  void (*upvalread_) (lua_State *L, UpVal *uv);
+  void (*escape_) (lua_State *L, GCObject *o);
+  l_noret (*runerror) (lua_State *L, const char *fmt, ...);
+  void (*traceexec) (lua_State *L);
+} AOTRuntime;
+
+
+/* version of the interface between compiled code and the core */
+#define LUA_AOT_VERSION		(LUA_VERSION_NUM * 10 + 1)
+
+/* sizes of the structures that compiled code accesses directly */
+#define LUA_AOT_LAYOUT	(sizeof(AOTRuntime) + (sizeof(Proto) << 10) + \
+                         (sizeof(CallInfo) << 20))
+
+
+LUAI_DDEC const AOTRuntime luaV_aotruntime;
+
+/* returns NULL if compiled code does not match this core */
+LUA_API const AOTRuntime *(lua_aotruntime) (int version, size_t layout);
+
+
+/*
+** some macros for common tasks in 'luaV_execute' (and in compiled code)
+*/
+
+#define RA(i)	(base+GETARG_A(i))
+#define RB(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgR, base+GETARG_B(i))
+#define RC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgR, base+GETARG_C(i))
+#define RKB(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, \
+	ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
+#define RKC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgK, \
+	ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
+
+
+#define Protect(x)	{ {x;}; base = ci->u.l.base; }
+
+#define checkGC(L,c)  \
+	{ luaC_condGC(L, L->top = (c),  /* limit of live values */ \
+                         Protect(L->top = ci->top));  /* restore top */ \
+           luai_threadyield(L); }
+
+
+/*
+** copy of 'luaV_gettable', but protecting the call to potential
+** metamethod (which can reallocate the stack)
+*/
+#define gettableProtected(L,t,k,v)  { const TValue *slot; \
+  if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
+  else Protect(luaV_finishget(L,t,k,v,slot)); }
+
+
+/* same for 'luaV_settable' */
+#define settableProtected(L,t,k,v) { const TValue *slot; \
+  if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
+    Protect(luaV_finishset(L,t,k,v,slot)); }
+
+
+/*
+** versions of 'gettableProtected'/'settableProtected' for an upvalue
+** 't' (usually '_ENV') indexed by RK operand 'c' ('k' its value). A
+** constant short-string key (a global name) is first looked for in the
+** node where it was found the last time, kept in 'cl->p->kslot'.
+*/
+#define iskslot(t,c,k)	(ISK(c) && ttistable(t) && ttisshrstring(k))
+
+#define kslotget(t,c,k) \
+  luaH_getstrhint(hvalue(t), tsvalue(k), &cl->p->kslot[INDEXK(c)])
+
+#define gettabupProtected(L,t,c,k,v)  { const TValue *slot; \
+  if (!iskslot(t,c,k)) gettableProtected(L,t,k,v) \
+  else if (slot = kslotget(t,c,k), !ttisnil(slot)) { setobj2s(L, v, slot); } \
+  else Protect(luaV_finishget(L,t,k,v,slot)); }
+
+#define settabupProtected(L,t,c,k,v)  { const TValue *slot; \
+  if (!iskslot(t,c,k)) settableProtected(L,t,k,v) \
+  else if (slot = kslotget(t,c,k), !ttisnil(slot)) { \
+    luaC_barriercard(L, hvalue(t), slot, v); \
+    setobj2t(L, cast(TValue *,slot), v); } \
+  else Protect(luaV_finishset(L,t,k,v,slot)); }
+
+
+
+#if defined(LUA_AOT_MODULE)
+
+/*
+** Compiled code itself (generated by 'luac -C'), which reaches the
+** functions of the core through 'aot_rt'
+*/
+
+static const AOTRuntime *aot_rt;
+
+#define luaV_tonumber_		(aot_rt->tonumber_)
+#define luaV_tointeger		(aot_rt->tointeger)
+#define luaV_finishget		(aot_rt->finishget)
+#define luaV_finishset		(aot_rt->finishset)
+#define luaV_equalobj		(aot_rt->equalobj)
+#define luaV_lessthan		(aot_rt->lessthan)
+#define luaV_lessequal		(aot_rt->lessequal)
+#define luaV_concat		(aot_rt->concat)
+#define luaV_objlen		(aot_rt->objlen)
+#define luaV_div		(aot_rt->div)
+#define luaV_mod		(aot_rt->mod)
+#define luaV_shiftl		(aot_rt->shiftl)
+#define luaV_forkey		(aot_rt->forkey)
+#define forlimit		(aot_rt->forlimit)
+#define fornative		(aot_rt->fornative)
+#define getcached		(aot_rt->getcached)
+#define pushclosure		(aot_rt->pushclosure)
+#define newtable		(aot_rt->newtable)
+#define luaO_fb2int		(aot_rt->fb2int)
+#define luaT_trybinTM		(aot_rt->trybinTM)
+#define luaD_precall		(aot_rt->precall)
+#define luaD_poscall		(aot_rt->poscall)
+#define luaD_call		(aot_rt->call)
+#define luaD_growstack		(aot_rt->growstack)
+#define luaF_close		(aot_rt->close)
+#define luaH_get		(aot_rt->get)
+#define luaH_getstr		(aot_rt->getstr)
+#define luaH_getstrhint		(aot_rt->getstrhint)
+#define luaH_getint		(aot_rt->getint)
+#define luaH_setint		(aot_rt->setint)
+#define luaH_resizearray	(aot_rt->resizearray)
+#define luaC_step		(aot_rt->step)
+#define luaC_barrierback_	(aot_rt->barrierback_)
+#define luaC_barriercard_	(aot_rt->barriercard_)
+#define luaC_upvalbarrier_	(aot_rt->upvalbarrier_)
+#define luaC_upvalread_		(aot_rt->upvalread_)
+#define luaC_escape_		(aot_rt->escape_)
+#define luaG_runerror		(aot_rt->runerror)
+#define luaG_traceexec		(aot_rt->traceexec)
+
+
+/* fetch instruction 'inst' at position 'pc' and prepare its execution */
+#define aot_fetch(pc,inst)	{ \
+  i = (inst); \
+  ci->u.l.savedpc = code + (pc) + 1; \
+  if (L->hookmask & HOOKINSTR) \
+    Protect(luaG_traceexec(L)); \
+  ra = RA(i); }
+
+#endif
+
+#endif
@@ -17,10 +17,14 @@
 #include "lua.h"
 
 #include "lapi.h"
+#include "laot.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "lheap.h"
+#include "ljit.h"
+#include "lprof.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -138,6 +142,7 @@ LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
   api_check(from, to->ci->top - to->top >= n, "stack overflow");
   from->top -= n;
   for (i = 0; i < n; i++) {
+    luaC_escape(from, from->top + i);  /* arena objects leave the thread */
     setobj2s(to, to->top, from->top + i);
     to->top++;  /* stack already checked by previous 'api_check' */
   }
@@ -842,7 +847,7 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
   slot = luaH_set(L, hvalue(o), L->top - 2);
   setobj2t(L, slot, L->top - 1);
   invalidateTMcache(hvalue(o));
-  luaC_barrierback(L, hvalue(o), L->top-1);
+  luaC_barriercard(L, hvalue(o), slot, L->top-1);
   L->top -= 2;
   lua_unlock(L);
 }
@@ -850,12 +855,15 @@ LUA_API void lua_rawset (lua_State *L, int idx) {
 
 LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
   StkId o;
+  TValue k, *slot;
   lua_lock(L);
   api_checknelems(L, 1);
   o = index2addr(L, idx);
   api_check(L, ttistable(o), "table expected");
-  luaH_setint(L, hvalue(o), n, L->top - 1);
-  luaC_barrierback(L, hvalue(o), L->top-1);
+  setivalue(&k, n);
+  slot = luaH_set(L, hvalue(o), &k);
+  setobj2t(L, slot, L->top - 1);
+  luaC_barriercard(L, hvalue(o), slot, L->top-1);
   L->top--;
   lua_unlock(L);
 }
@@ -871,7 +879,7 @@ LUA_API void lua_rawsetp (lua_State *L, int idx, const void *p) {
   setpvalue(&k, cast(void *, p));
   slot = luaH_set(L, hvalue(o), &k);
   setobj2t(L, slot, L->top - 1);
-  luaC_barrierback(L, hvalue(o), L->top - 1);
+  luaC_barriercard(L, hvalue(o), slot, L->top - 1);
   L->top--;
   lua_unlock(L);
 }
@@ -908,6 +916,7 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
     }
     default: {
       G(L)->mt[ttnov(obj)] = mt;
+      if (mt) luaC_escape_(L, obj2gco(mt));
       break;
     }
   }
@@ -1062,6 +1071,16 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+LUA_API int lua_heapsnapshot (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  luaC_fullgc(L, 0);  /* only live objects go to the snapshot */
+  status = luaC_heapsnapshot(L, writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1138,6 +1157,23 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCTHREADS: {
+      res = luaC_gcthreads(L, data);
+      break;
+    }
+    case LUA_GCSWEEPTHREAD: {
+      res = luaC_sweepthread(L, data);
+      break;
+    }
+    case LUA_GCATOMICTIME: {
+      res = (g->gcatomictime > INT_MAX) ? INT_MAX : cast_int(g->gcatomictime);
+      break;
+    }
+    case LUA_GCFINBUDGET: {
+      res = g->gcfinbudget;
+      if (data >= 0) g->gcfinbudget = data;  /* negative only queries */
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1145,6 +1181,104 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+LUA_API int lua_allocprofile (lua_State *L, int interval) {
+  int old;
+  lua_lock(L);
+  old = luaC_allocprofile(L, interval);
+  lua_unlock(L);
+  return old;
+}
+
+
+LUA_API int lua_allocreport (lua_State *L, lua_Writer writer, void *data,
+                             int mode, int n) {
+  int status;
+  lua_lock(L);
+  status = luaC_allocreport(L, writer, data, mode, n);
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Start ('on' > 0) or stop ('on' == 0) recording operand types in
+** thread 'L'; returns whether it was recording. Like hooks, this is
+** per thread (new threads inherit it).
+*/
+LUA_API int lua_typeprofile (lua_State *L, int on) {
+  int old;
+  lua_lock(L);
+  old = (L->hookmask & MASKPROF) != 0;
+  if (on > 0)
+    L->hookmask |= MASKPROF;
+  else if (on == 0)
+    L->hookmask &= cast_byte(~MASKPROF);
+  lua_unlock(L);
+  return old;
+}
+
+
+LUA_API int lua_dumpprofile (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = L->top - 1;
+  if (isLfunction(o))
+    status = luaC_typedump(L, getproto(o), writer, data);
+  else
+    status = 1;
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Load a profile (made by 'lua_dumpprofile') into the Lua function at
+** index 'fidx' and its nested functions. Returns how many of them
+** matched the profile, or -1 if it is malformed.
+*/
+LUA_API int lua_loadprofile (lua_State *L, int fidx, const char *s,
+                             size_t len) {
+  StkId fi = index2addr(L, fidx);
+  int n;
+  if (!ttisLclosure(fi))
+    return 0;  /* C functions have no profile */
+  lua_lock(L);
+  n = luaC_typeload(L, clLvalue(fi)->p, s, len);
+  lua_unlock(L);
+  return n;
+}
+
+
+LUA_API void lua_getstats (lua_State *L, lua_Stats *s) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  *s = g->stats;
+  s->totalbytes = gettotalbytes(g);
+  s->atomictime = g->gcatomictime;
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_pusharena (lua_State *L) {
+  lua_lock(L);
+  luaC_pusharena(L);
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_poparena (lua_State *L) {
+  int n;
+  lua_lock(L);
+  api_check(L, L->arena != NULL, "no arena to pop");
+  n = luaC_poparena(L);
+  lua_unlock(L);
+  return n;
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1204,6 +1338,177 @@ LUA_API void lua_len (lua_State *L, int idx) {
 }
 
 
+/*
+** Grow the table at index 'idx' so that its array part has at least
+** 'narray' slots and its hash part has room for at least 'nrec'
+** entries. Never shrinks the table.
+*/
+LUA_API void lua_reservetable (lua_State *L, int idx, int narray, int nrec) {
+  StkId o;
+  Table *t;
+  unsigned int na, nh;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  t = hvalue(o);
+  na = t->sizearray;
+  nh = allocsizenode(t);
+  if (narray > 0 && cast(unsigned int, narray) > na)
+    na = cast(unsigned int, narray);
+  if (nrec > 0 && cast(unsigned int, nrec) > nh)
+    nh = cast(unsigned int, nrec);
+  if (na != t->sizearray || nh != cast(unsigned int, allocsizenode(t))) {
+    luaH_resize(L, t, na, nh);
+    luaC_checkGC(L);
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Try to sort elements 1 .. n of the table at index 'idx' with their
+** primitive order ('<' over integers, floats, or strings), without
+** metamethods. Returns 0 if the elements are not all in the array part
+** of the table or are not all of one of these types.
+*/
+LUA_API int lua_rawsort (lua_State *L, int idx, lua_Integer n) {
+  StkId o;
+  int res;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  res = (0 <= n && l_castS2U(n) <= MAX_INT) &&
+        luaH_sortarray(hvalue(o), cast(unsigned int, n));
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Try to push the concatenation 't[i] .. sep .. ... .. sep .. t[j]' of
+** the table at index 'idx'. Returns 0 (pushing nothing) if some of
+** those elements is not a string or a number.
+*/
+LUA_API int lua_rawconcat (lua_State *L, int idx, const char *sep,
+                           size_t lsep, lua_Integer i, lua_Integer j) {
+  StkId o;
+  TString *ts;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  if (i > j)
+    ts = luaS_newliteral(L, "");
+  else
+    ts = luaV_concattable(L, hvalue(o), sep, lsep, i, j);
+  if (ts != NULL) {
+    setsvalue2s(L, L->top, ts);
+    api_incr_top(L);
+    luaC_checkGC(L);
+  }
+  lua_unlock(L);
+  return (ts != NULL);
+}
+
+
+/*
+** Push the 'n' values 't[i], ..., t[i + n - 1]' of the table at index
+** 'idx', without metamethods. Values in the array part of the table
+** are copied in one block.
+*/
+LUA_API void lua_rawunpack (lua_State *L, int idx, lua_Integer i, int n) {
+  StkId o;
+  Table *t;
+  int k = 0;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  api_check(L, n <= L->stack_last - L->top, "stack overflow");
+  t = hvalue(o);
+  if (i >= 1 && l_castS2U(i) - 1u < t->sizearray) {  /* in array part? */
+    unsigned int na = t->sizearray - cast(unsigned int, i - 1);
+    k = (cast(unsigned int, n) < na) ? n : cast_int(na);
+    memcpy(L->top, &t->array[i - 1], k * sizeof(TValue));
+  }
+  for (; k < n; k++)  /* remaining values */
+    setobj2s(L, L->top + k, luaH_getint(t, i + k));
+  L->top += n;
+  lua_unlock(L);
+}
+
+
+/*
+** Raw version of 'table.move': 't2[t], ... = t1[f], ..., t1[e]' (with
+** f <= e), for tables 't1' at index 'idx1' and 't2' at index 'idx2'.
+** When the source is in the array part of 't1' and the destination
+** starts inside (or right after) the array part of 't2', the latter
+** grows as needed and the values are copied in one block. Either way,
+** one barrier for 't2' covers all the copied values.
+*/
+LUA_API void lua_rawmove (lua_State *L, int idx1, lua_Integer f,
+                          lua_Integer e, lua_Integer t, int idx2) {
+  StkId o1, o2;
+  Table *t1, *t2;
+  lua_Integer n = e - f + 1;
+  lua_lock(L);
+  o1 = index2addr(L, idx1);
+  o2 = index2addr(L, idx2);
+  api_check(L, ttistable(o1) && ttistable(o2), "table expected");
+  api_check(L, f <= e, "invalid interval");
+  t1 = hvalue(o1);
+  t2 = hvalue(o2);
+  if (isblack(t2))  /* 't2' may get new references */
+    luaC_barrierback_(L, t2);
+  if (f >= 1 && l_castS2U(e) <= t1->sizearray &&
+      t >= 1 && l_castS2U(t) - 1u <= t2->sizearray &&
+      l_castS2U(t) <= MAX_INT - l_castS2U(n)) {
+    unsigned int last = cast(unsigned int, t + n - 1);
+    if (last > t2->sizearray)  /* destination must grow? */
+      luaH_resizearray(L, t2, last);
+    memmove(&t2->array[t - 1], &t1->array[f - 1], n * sizeof(TValue));
+  }
+  else {
+    lua_Integer i;
+    int up = !(t > e || t <= f || t1 != t2);  /* copy backwards? */
+    for (i = 0; i < n; i++) {
+      lua_Integer k = up ? n - 1 - i : i;
+      TValue v;  /* copy it, as 'luaH_setint' may move table contents */
+      const TValue *slot = luaH_getint(t1, f + k);
+      setobj(L, &v, slot);
+      if (!ttisnil(&v) || luaH_getint(t2, t + k) != luaO_nilobject)
+        luaH_setint(L, t2, t + k, &v);
+    }
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Remove all entries from the table at index 'idx', keeping its
+** memory for reuse
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId o;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  luaH_clear(hvalue(o));
+  lua_unlock(L);
+}
+
+
+/*
+** Register the functions that implement 'next' and the 'ipairs'
+** iterator, so that generic 'for' loops can run them inline
+*/
+LUA_API void lua_setiterators (lua_State *L, lua_CFunction nextf,
+                                             lua_CFunction ipairsf) {
+  lua_lock(L);
+  G(L)->nextf = nextf;
+  G(L)->ipairsf = ipairsf;
+  lua_unlock(L);
+}
+
+
 LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
   lua_Alloc f;
   lua_lock(L);
@@ -1216,6 +1521,7 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaC_waitfrees(G(L));  /* old blocks must not meet the new function */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
@@ -1263,9 +1569,11 @@ static const char *aux_upvalue (StkId fi, int n, TValue **val,
 LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n) {
   const char *name;
   TValue *val = NULL;  /* to avoid warnings */
+  UpVal *uv = NULL;
   lua_lock(L);
-  name = aux_upvalue(index2addr(L, funcindex), n, &val, NULL, NULL);
+  name = aux_upvalue(index2addr(L, funcindex), n, &val, NULL, &uv);
   if (name) {
+    if (uv) luaC_upvalread(L, uv);
     setobj2s(L, L->top, val);
     api_incr_top(L);
   }
@@ -1338,3 +1646,56 @@ LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
 }
 
 
+/*
+** Get the size hints collected for the n-th table-constructor site
+** of the Lua function at index 'fidx'. Returns 0 if there is no such
+** site.
+*/
+LUA_API int lua_gettabhint (lua_State *L, int fidx, int n, int *line,
+                            int *narr, int *nrec) {
+  StkId fi = index2addr(L, fidx);
+  Proto *p;
+  TabSite *ts;
+  if (!ttisLclosure(fi))
+    return 0;  /* C functions have no table sites */
+  p = clLvalue(fi)->p;
+  if (!(1 <= n && n <= p->sizetabsites))
+    return 0;
+  ts = &p->tabsites[n - 1];
+  if (line) *line = getfuncline(p, ts->pc);
+  if (narr) *narr = cast_int(ts->sizearray);
+  if (nrec) *nrec = cast_int(ts->sizenode);
+  return 1;
+}
+
+
+/*
+** Get the status and counters of the trace for the n-th numeric 'for'
+** loop of the Lua function at index 'fidx' (see 'ljit.c'). Returns
+** NULL if there is no such loop or the function was not compiled.
+*/
+LUA_API const char *lua_gettrace (lua_State *L, int fidx, int n, int *line,
+                                  lua_Integer *entries, lua_Integer *exits,
+                                  lua_Integer *iterations) {
+  StkId fi = index2addr(L, fidx);
+  const char *status;
+  if (!ttisLclosure(fi))
+    return NULL;  /* C functions have no loops */
+  lua_lock(L);
+  status = luaJ_traceinfo(clLvalue(fi)->p, n, line, entries, exits,
+                          iterations);
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Internal functions for code compiled ahead of time (see 'laot.h'),
+** if that code was generated for this version and build of the core
+*/
+LUA_API const AOTRuntime *lua_aotruntime (int version, size_t layout) {
+  if (version != LUA_AOT_VERSION || layout != LUA_AOT_LAYOUT)
+    return NULL;
+  return &luaV_aotruntime;
+}
+
@@ -7,6 +7,10 @@
 #define lauxlib_c
 #define LUA_LIB
 
+#if defined(LUA_USE_LINUX) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for 'mremap' */
+#endif
+
 #include "lprefix.h"
 
 
@@ -1029,8 +1033,67 @@ LUALIB_API const char *luaL_gsub (lua_State *L, const char *s, const char *p,
 }
 
 
+/*
+** Blocks with at least LUAI_LARGEOBJ bytes are mapped directly from the
+** system, so that their pages go back to it as soon as they are freed
+** and, where there is 'mremap', they can grow without being copied.
+** Lua always gives the original size of a block ('osize'), which tells
+** how the block was allocated.
+*/
+#if defined(LUA_USE_POSIX) && defined(LUAI_LARGEOBJ)
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+#endif
+
+#if defined(MAP_ANONYMOUS)
+
+#define islarge(s)	((s) >= LUAI_LARGEOBJ)
+
+static void *largealloc (void *ptr, size_t osize, size_t nsize) {
+  void *nb;
+  if (ptr == NULL || !islarge(osize)) {  /* new block is the large one */
+    nb = mmap(NULL, nsize, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nb == MAP_FAILED)
+      return NULL;
+    if (ptr != NULL) {
+      memcpy(nb, ptr, osize);
+      free(ptr);
+    }
+    return nb;
+  }
+  else if (nsize == 0) {
+    munmap(ptr, osize);
+    return NULL;
+  }
+  else if (islarge(nsize)) {  /* both blocks are large */
+#if defined(MREMAP_MAYMOVE)
+    nb = mremap(ptr, osize, nsize, MREMAP_MAYMOVE);
+    return (nb == MAP_FAILED) ? NULL : nb;
+#else
+    nb = largealloc(NULL, 0, nsize);
+#endif
+  }
+  else  /* old block is large, new one is not */
+    nb = malloc(nsize);
+  if (nb != NULL) {
+    memcpy(nb, ptr, (osize < nsize) ? osize : nsize);
+    munmap(ptr, osize);
+  }
+  return nb;
+}
+
+#endif
+
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
-  (void)ud; (void)osize;  /* not used */
+  (void)ud; (void)osize;  /* not used (unless there is mmap) */
+#if defined(MAP_ANONYMOUS)
+  if (islarge(nsize) || (ptr != NULL && islarge(osize)))
+    return largealloc(ptr, osize, nsize);
+#endif
   if (nsize == 0) {
     free(ptr);
     return NULL;
@@ -170,23 +170,69 @@ static int luaB_rawset (lua_State *L) {
 }
 
 
+static void setstat (lua_State *L, const char *k, lua_Unsigned v) {
+  lua_pushinteger(L, (lua_Integer)v);
+  lua_setfield(L, -2, k);
+}
+
+
+static int gcstats (lua_State *L) {
+  static const int types[] = {LUA_TSTRING, LUA_TTABLE, LUA_TFUNCTION,
+    LUA_TUSERDATA, LUA_TTHREAD, LUA_NUMTAGS};  /* (last are prototypes) */
+  lua_Stats s;
+  int i;
+  lua_getstats(L, &s);
+  lua_createtable(L, 0, 15);
+  lua_createtable(L, 0, 6);  /* 'objects' */
+  lua_createtable(L, 0, 6);  /* 'bytes' */
+  for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++) {
+    int t = types[i];
+    const char *name = (t == LUA_NUMTAGS) ? "proto" : lua_typename(L, t);
+    setstat(L, name, s.bytes[t]);
+    lua_pushinteger(L, (lua_Integer)s.objects[t]);
+    lua_setfield(L, -3, name);
+  }
+  lua_setfield(L, -3, "bytes");
+  lua_setfield(L, -2, "objects");
+  setstat(L, "total", s.totalbytes);
+  setstat(L, "allocs", s.allocs);
+  setstat(L, "frees", s.frees);
+  setstat(L, "allocbytes", s.allocbytes);
+  setstat(L, "cycles", s.cycles);
+  setstat(L, "steps", s.steps);
+  setstat(L, "markbytes", s.markbytes);
+  setstat(L, "swept", s.swept);
+  setstat(L, "finalizers", s.finalizers);
+  setstat(L, "finpending", s.finpending);
+  setstat(L, "fintime", s.fintime);
+  setstat(L, "finmaxtime", s.finmaxtime);
+  setstat(L, "atomictime", s.atomictime);
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "isrunning", "threads", "sweepthread", "atomictime", "finbudget",
+    "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCISRUNNING, LUA_GCTHREADS, LUA_GCSWEEPTHREAD, LUA_GCATOMICTIME,
+    LUA_GCFINBUDGET, -1};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
-  int ex = (int)luaL_optinteger(L, 2, 0);
-  int res = lua_gc(L, o, ex);
+  int ex, res;
+  if (o < 0)  /* "stats"? */
+    return gcstats(L);
+  ex = (int)luaL_optinteger(L, 2, (o == LUA_GCFINBUDGET) ? -1 : 0);
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, (lua_Number)res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: case LUA_GCISRUNNING: {
+    case LUA_GCSTEP: case LUA_GCISRUNNING: case LUA_GCSWEEPTHREAD: {
       lua_pushboolean(L, res);
       return 1;
     }
@@ -493,6 +539,8 @@ LUAMOD_API int luaopen_base (lua_State *L) {
   /* set global _VERSION */
   lua_pushliteral(L, LUA_VERSION);
   lua_setfield(L, -2, "_VERSION");
+  /* let generic 'for' loops run 'next' and 'ipairs' natively */
+  lua_setiterators(L, luaB_next, ipairsaux);
   return 1;
 }
 
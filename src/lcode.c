@@ -11,7 +11,9 @@
 
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -33,6 +35,10 @@
 #define MAXREGS		255
 
 
+/* Maximum length of a string built by constant folding */
+#define MAXFOLDLEN	200
+
+
 #define hasjumps(e)	((e)->t != (e)->f)
 
 
@@ -55,6 +61,23 @@ static int tonumeral(const expdesc *e, TValue *v) {
 }
 
 
+/*
+** If expression is a constant of any type, fills 'v' with its value
+** and returns 1. Otherwise, returns 0.
+*/
+static int toconstant (FuncState *fs, const expdesc *e, TValue *v) {
+  if (hasjumps(e))
+    return 0;
+  switch (e->k) {
+    case VNIL: setnilvalue(v); return 1;
+    case VTRUE: setbvalue(v, 1); return 1;
+    case VFALSE: setbvalue(v, 0); return 1;
+    case VK: setobj(fs->ls->L, v, &fs->f->k[e->u.info]); return 1;
+    default: return tonumeral(e, v);
+  }
+}
+
+
 /*
 ** Create a OP_LOADNIL instruction, but try to optimize: if the previous
 ** instruction is also OP_LOADNIL and ranges are compatible, adjust
@@ -996,6 +1019,84 @@ static int constfolding (FuncState *fs, int op, expdesc *e1,
 }
 
 
+/*
+** Try to fold a comparison between constants; return 1 iff successful.
+** Order comparisons are folded only between numbers, as the order of
+** strings depends on the locale at run time.
+*/
+static int compfolding (FuncState *fs, BinOpr opr, expdesc *e1,
+                                                   const expdesc *e2) {
+  lua_State *L = fs->ls->L;
+  TValue v1, v2;
+  int res;
+  if (!toconstant(fs, e1, &v1) || !toconstant(fs, e2, &v2))
+    return 0;
+  if (opr == OPR_EQ || opr == OPR_NE)
+    res = (luaV_rawequalobj(&v1, &v2) == (opr == OPR_EQ));
+  else if (!ttisnumber(&v1) || !ttisnumber(&v2))
+    return 0;  /* not numbers or an error at run time */
+  else if (opr == OPR_LT) res = luaV_lessthan(L, &v1, &v2);
+  else if (opr == OPR_LE) res = luaV_lessequal(L, &v1, &v2);
+  else if (opr == OPR_GT) res = luaV_lessthan(L, &v2, &v1);
+  else res = luaV_lessequal(L, &v2, &v1);  /* OPR_GE */
+  e1->k = res ? VTRUE : VFALSE;
+  return 1;
+}
+
+
+/*
+** Write the text of constant 'v', if it is a string or an integer, at
+** 'buff' (with room for 'sz' bytes); returns its length or -1. (Floats
+** are left for run time, as their format depends on the build.)
+*/
+static int foldtext (const TValue *v, char *buff, size_t sz) {
+  char num[MAXNUMBER2STR];
+  const char *s;
+  size_t l;
+  if (ttisstring(v)) {
+    s = svalue(v);
+    l = vslen(v);
+  }
+  else if (ttisinteger(v)) {
+    s = num;
+    l = lua_integer2str(num, sizeof(num), ivalue(v));
+  }
+  else return -1;
+  if (l > sz) return -1;
+  memcpy(buff, s, l * sizeof(char));
+  return cast_int(l);
+}
+
+
+/*
+** Try to fold the concatenation of two constants; return 1 iff
+** successful. 'luaK_infix' already put 'e1' in a register; if it did it
+** with the last instruction, a LOADK that no jump reaches, that load is
+** removed.
+*/
+static int concatfolding (FuncState *fs, expdesc *e1, const expdesc *e2) {
+  char buff[MAXFOLDLEN];
+  Instruction last;
+  TValue v2;
+  int l1, l2;
+  if (e1->k != VNONRELOC || fs->pc - 1 <= fs->lasttarget ||
+      !toconstant(fs, e2, &v2))
+    return 0;
+  last = fs->f->code[fs->pc - 1];
+  if (GET_OPCODE(last) != OP_LOADK || GETARG_A(last) != e1->u.info)
+    return 0;
+  l1 = foldtext(&fs->f->k[GETARG_Bx(last)], buff, MAXFOLDLEN);
+  if (l1 < 0) return 0;
+  l2 = foldtext(&v2, buff + l1, MAXFOLDLEN - l1);
+  if (l2 < 0) return 0;
+  fs->pc--;  /* remove load of 'e1' */
+  freeexp(fs, e1);
+  e1->k = VK;
+  e1->u.info = luaK_stringK(fs, luaX_newstring(fs->ls, buff, l1 + l2));
+  return 1;
+}
+
+
 /*
 ** Emit code for unary expressions that "produce values"
 ** (everything but 'not').
@@ -1069,10 +1170,16 @@ void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e, int line) {
     case OPR_MINUS: case OPR_BNOT:  /* use 'ef' as fake 2nd operand */
       if (constfolding(fs, op + LUA_OPUNM, e, &ef))
         break;
-      /* FALLTHROUGH */
-    case OPR_LEN:
       codeunexpval(fs, cast(OpCode, op + OP_UNM), e, line);
       break;
+    case OPR_LEN:
+      if (e->k == VK && !hasjumps(e) && ttisstring(&fs->f->k[e->u.info])) {
+        e->u.ival = vslen(&fs->f->k[e->u.info]);  /* length of a constant */
+        e->k = VKINT;
+      }
+      else
+        codeunexpval(fs, OP_LEN, e, line);
+      break;
     case OPR_NOT: codenot(fs, e); break;
     default: lua_assert(0);
   }
@@ -1140,6 +1247,8 @@ void luaK_posfix (FuncState *fs, BinOpr op,
     }
     case OPR_CONCAT: {
       luaK_exp2val(fs, e2);
+      if (concatfolding(fs, e1, e2))
+        break;
       if (e2->k == VRELOCABLE &&
           GET_OPCODE(getinstruction(fs, e2)) == OP_CONCAT) {
         lua_assert(e1->u.info == GETARG_B(getinstruction(fs, e2))-1);
@@ -1163,7 +1272,8 @@ void luaK_posfix (FuncState *fs, BinOpr op,
     }
     case OPR_EQ: case OPR_LT: case OPR_LE:
     case OPR_NE: case OPR_GT: case OPR_GE: {
-      codecomp(fs, op, e1, e2);
+      if (!compfolding(fs, op, e1, e2))
+        codecomp(fs, op, e1, e2);
       break;
     }
     default: lua_assert(0);
@@ -1201,3 +1311,186 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================================
+** Inlining of small local functions
+** =======================================================================
+*/
+
+/* instruction 'i' may skip the next one */
+static int isskipper (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (testTMode(op) || (op == OP_LOADBOOL && GETARG_C(i)));
+}
+
+
+/* return target of jump instruction 'i' at 'pc', or -1 if not a jump */
+static int jumptarget (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+      return pc + 1 + GETARG_sBx(i);
+    default: return -1;
+  }
+}
+
+
+/* copy constant 'v' of an inlined function into the current function */
+static int copyk (FuncState *fs, const TValue *v) {
+  TValue key, val;
+  switch (ttype(v)) {
+    case LUA_TNIL: return nilK(fs);
+    case LUA_TBOOLEAN: return boolK(fs, bvalue(v));
+    default: {  /* numbers and strings are their own keys */
+      setobj(fs->ls->L, &key, v);
+      setobj(fs->ls->L, &val, v);
+      return addk(fs, &key, &val);
+    }
+  }
+}
+
+
+/*
+** Check whether a call to 'p' can be replaced by a copy of its code in
+** function 'fs', with the callee's registers moved to the top of the
+** caller's frame. 'p' must be a fixed-arity function without nested
+** functions that only reads its upvalues and always returns exactly one
+** value; its final (implicit) 'return' must be unreachable. If so, copy
+** its constants into 'fs' (before the arguments add their own ones, so
+** that they still fit in an RK operand), filling 'kmap' with their new
+** indices.
+*/
+int luaK_preinline (FuncState *fs, const Proto *p, int *kmap) {
+  int n = p->sizecode - 1;  /* instructions without the final 'return' */
+  int pc;
+  if (p->is_vararg || p->sizep > 0 || n < 1 || n > MAXINLINE ||
+      p->sizek > MAXINLINEK || p->sizeupvalues > MAXINLINE || fs->nk + p->sizek > MAXINDEXRK + 1 ||
+      fs->freereg + p->maxstacksize + 1 >= MAXREGS)
+    return 0;
+  if (GET_OPCODE(p->code[n - 1]) != OP_RETURN)
+    return 0;  /* may fall through to the final 'return' */
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_RETURN:
+        if (GETARG_B(i) != 2 || (pc > 0 && isskipper(p->code[pc - 1])))
+          return 0;
+        break;
+      case OP_SETLIST:
+        if (GETARG_C(i) == 0) return 0;
+        break;
+      case OP_LOADKX: case OP_SETUPVAL: case OP_TAILCALL:
+      case OP_CLOSURE: case OP_VARARG: case OP_EXTRAARG:
+        return 0;
+      default: break;
+    }
+    if (jumptarget(i, pc) == n || (isskipper(i) && pc + 2 == n))
+      return 0;  /* jumps to the final 'return' */
+  }
+  for (pc = 0; pc < p->sizek; pc++)
+    kmap[pc] = copyk(fs, &p->k[pc]);
+  return 1;
+}
+
+
+/* translate register or constant operand 'x' of an inlined instruction */
+static int inlinerk (int x, int base, const int *kmap) {
+  return ISK(x) ? RKASK(kmap[INDEXK(x)]) : base + x;
+}
+
+
+/*
+** Translate an instruction of an inlined function: registers are moved
+** up by 'base', constants are renumbered through 'kmap', and upvalues
+** become registers or upvalues of the current function, as given by
+** 'ups'. Integer opcodes become generic ones, as their operands are
+** checked again in the current function; so do superinstructions.
+*/
+static Instruction inlineinstr (Instruction i, int base, const int *kmap,
+                                const Upvaldesc *ups) {
+  OpCode op = genericop(GET_OPCODE(i));
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_GETUPVAL: {
+      const Upvaldesc *up = &ups[GETARG_B(i)];
+      return CREATE_ABC(up->instack ? OP_MOVE : OP_GETUPVAL,
+                        base + a, up->idx, 0);
+    }
+    case OP_GETTABUP: {
+      const Upvaldesc *up = &ups[GETARG_B(i)];
+      return CREATE_ABC(up->instack ? OP_GETTABLE : OP_GETTABUP, base + a,
+                        up->idx, inlinerk(GETARG_C(i), base, kmap));
+    }
+    case OP_SETTABUP: {
+      const Upvaldesc *up = &ups[a];
+      return CREATE_ABC(up->instack ? OP_SETTABLE : OP_SETTABUP, up->idx,
+                        inlinerk(GETARG_B(i), base, kmap),
+                        inlinerk(GETARG_C(i), base, kmap));
+    }
+    default: break;
+  }
+  switch (getOpMode(op)) {
+    case iABC: {
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      if (op != OP_EQ && op != OP_LT && op != OP_LE)
+        a += base;  /* 'A' is a register */
+      if (getBMode(op) == OpArgR) b += base;
+      else if (getBMode(op) == OpArgK) b = inlinerk(b, base, kmap);
+      if (getCMode(op) == OpArgR) c += base;
+      else if (getCMode(op) == OpArgK) c = inlinerk(c, base, kmap);
+      return CREATE_ABC(op, a, b, c);
+    }
+    case iABx:  /* OP_LOADK */
+      lua_assert(op == OP_LOADK);
+      return CREATE_ABx(op, base + a, kmap[GETARG_Bx(i)]);
+    default:  /* iAsBx; offsets are fixed by the caller */
+      if (op != OP_JMP || a != 0)  /* 'A' in a 'JMP' is a register + 1 */
+        a += base;
+      return CREATE_ABx(op, a, GETARG_Bx(i));
+  }
+}
+
+
+/*
+** Emit the code of function 'p' (prepared by 'luaK_preinline') in place
+** of a call, with its arguments already in registers 'base', 'base + 1',
+** ..., and its upvalues translated to the current function in 'ups'.
+** Each 'return' becomes a move of its value to 'base' plus a jump to the
+** end of the inlined code. Instructions keep the line information of the
+** inlined function.
+*/
+void luaK_inline (FuncState *fs, const Proto *p, int base,
+                  const int *kmap, const Upvaldesc *ups) {
+  int n = p->sizecode - 1;
+  int newpc[MAXINLINE + 1];  /* position of each instruction in new code */
+  int pc, k;
+  newpc[0] = fs->pc;
+  for (pc = 0; pc < n; pc++)
+    newpc[pc + 1] = newpc[pc] + inlinedsize(p->code[pc], pc, n);
+  if (base + p->maxstacksize > fs->f->maxstacksize)
+    fs->f->maxstacksize = cast_byte(base + p->maxstacksize);
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    int target = jumptarget(i, pc);
+    if (GET_OPCODE(i) == OP_RETURN) {
+      if (GETARG_A(i) != 0)
+        luaK_code(fs, CREATE_ABC(OP_MOVE, base, base + GETARG_A(i), 0));
+      if (pc != n - 1)
+        luaK_code(fs, CREATE_ABx(OP_JMP, 0, newpc[n] - (fs->pc + 1)
+                                            + MAXARG_sBx));
+    }
+    else {
+      i = inlineinstr(i, base, kmap, ups);
+      if (target >= 0)
+        SETARG_sBx(i, newpc[target] - (newpc[pc] + 1));
+      luaK_code(fs, i);
+    }
+    for (k = newpc[pc]; k < fs->pc; k++)  /* keep callee's line info */
+      fs->f->lineinfo[k] = p->lineinfo[pc];
+  }
+  fs->lasttarget = fs->pc;  /* end of inlined code may be a jump target */
+}
+
+/* }====================================================================== */
@@ -20,6 +20,23 @@
 #define NO_JUMP (-1)
 
 
+/*
+** Maximum size (in instructions, not counting the final 'return') and
+** number of constants of a function to be inlined
+*/
+#define MAXINLINE	24
+#define MAXINLINEK	32
+
+/*
+** Number of instructions that instruction 'i', at 'pc' of a function
+** with 'n' instructions (not counting the final 'return'), becomes once
+** inlined (see 'luaK_inline')
+*/
+#define inlinedsize(i,pc,n)  \
+	((GET_OPCODE(i) != OP_RETURN) ? 1 \
+	                              : (GETARG_A(i) != 0) + ((pc) != (n) - 1))
+
+
 /*
 ** grep "ORDER OPR" if you change these enums  (ORDER OP)
 */
@@ -83,6 +100,9 @@ LUAI_FUNC void luaK_infix (FuncState *fs, BinOpr op, expdesc *v);
 LUAI_FUNC void luaK_posfix (FuncState *fs, BinOpr op, expdesc *v1,
                             expdesc *v2, int line);
 LUAI_FUNC void luaK_setlist (FuncState *fs, int base, int nelems, int tostore);
+LUAI_FUNC int luaK_preinline (FuncState *fs, const Proto *p, int *kmap);
+LUAI_FUNC void luaK_inline (FuncState *fs, const Proto *p, int base,
+                            const int *kmap, const Upvaldesc *ups);
 
 
 #endif
@@ -148,7 +148,29 @@ static int luaB_corunning (lua_State *L) {
 }
 
 
+/*
+** Continuation of 'arena': the arena is popped once the call returns,
+** even if it raised an error or yielded in between.
+*/
+static int finisharena (lua_State *L, int status, lua_KContext extra) {
+  (void)extra;  /* not used */
+  lua_poparena(L);
+  if (status != LUA_OK && status != LUA_YIELD)  /* error? */
+    return lua_error(L);  /* propagate it */
+  return lua_gettop(L);  /* return all results */
+}
+
+
+static int luaB_coarena (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  lua_pusharena(L);
+  return finisharena(L, lua_pcallk(L, lua_gettop(L) - 1, LUA_MULTRET, 0,
+                                   0, finisharena), 0);
+}
+
+
 static const luaL_Reg co_funcs[] = {
+  {"arena", luaB_coarena},
   {"create", luaB_cocreate},
   {"resume", luaB_coresume},
   {"running", luaB_corunning},
@@ -298,6 +298,41 @@ static int db_upvaluejoin (lua_State *L) {
 }
 
 
+/*
+** gettabhint (f, n): returns the array and hash sizes collected for
+** the n-th table constructor of Lua function 'f', plus its line
+*/
+static int db_gettabhint (lua_State *L) {
+  int line, narr, nrec;
+  int n = (int)luaL_checkinteger(L, 2);
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  if (!lua_gettabhint(L, 1, n, &line, &narr, &nrec))
+    return 0;  /* no such site */
+  lua_pushinteger(L, narr);
+  lua_pushinteger(L, nrec);
+  lua_pushinteger(L, line);
+  return 3;
+}
+
+
+static int db_gettrace (lua_State *L) {
+  int line;
+  lua_Integer entries, exits, iterations;
+  const char *status;
+  int n = (int)luaL_checkinteger(L, 2);
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  status = lua_gettrace(L, 1, n, &line, &entries, &exits, &iterations);
+  if (status == NULL)
+    return 0;  /* no such loop */
+  lua_pushstring(L, status);
+  lua_pushinteger(L, line);
+  lua_pushinteger(L, entries);
+  lua_pushinteger(L, exits);
+  lua_pushinteger(L, iterations);
+  return 5;
+}
+
+
 /*
 ** Call hook function registered at hook table for the current
 ** thread (if there is one)
@@ -428,13 +463,110 @@ static int db_traceback (lua_State *L) {
 }
 
 
+static int writer (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;
+  return (fwrite(b, size, 1, (FILE *)f) != 1) && (size != 0);
+}
+
+
+static int db_heapsnapshot (lua_State *L) {
+  const char *fname = luaL_checkstring(L, 1);
+  FILE *f = fopen(fname, "wb");
+  int status;
+  if (f == NULL)
+    return luaL_fileresult(L, 0, fname);
+  status = lua_heapsnapshot(L, writer, f);
+  if (fclose(f) != 0 || status != 0)
+    return luaL_fileresult(L, 0, fname);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int db_allocprofile (lua_State *L) {
+  int interval = (int)luaL_optinteger(L, 1, -1);
+  luaL_argcheck(L, interval >= -1, 1, "invalid interval");
+  lua_pushinteger(L, lua_allocprofile(L, interval));
+  return 1;
+}
+
+
+static int addtobuffer (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+static int db_allocreport (lua_State *L) {
+  static const char *const modes[] = {"top", "folded", NULL};
+  static const int modesnum[] = {LUA_PROFTOP, LUA_PROFFOLDED};
+  int mode = modesnum[luaL_checkoption(L, 1, "top", modes)];
+  int n = (int)luaL_optinteger(L, 2, 0);
+  luaL_Buffer b;
+  lua_settop(L, 0);  /* buffer must be at the top */
+  luaL_buffinit(L, &b);
+  lua_allocreport(L, addtobuffer, &b, mode, n);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+/*
+** typeprofile ([thread,] on): starts or stops recording operand types
+** in a thread; returns whether it was recording
+*/
+static int db_typeprofile (lua_State *L) {
+  int arg;
+  lua_State *L1 = getthread(L, &arg);
+  int on = lua_isnone(L, arg + 1) ? -1 : lua_toboolean(L, arg + 1);
+  lua_pushboolean(L, lua_typeprofile(L1, on));
+  return 1;
+}
+
+
+static int db_dumpprofile (lua_State *L) {
+  luaL_Buffer b;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  lua_settop(L, 1);
+  luaL_buffinit(L, &b);
+  if (lua_dumpprofile(L, addtobuffer, &b) != 0)
+    return luaL_error(L, "unable to dump profile of given function");
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static int db_loadprofile (lua_State *L) {
+  size_t len;
+  const char *s;
+  int n;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  s = luaL_checklstring(L, 2, &len);
+  n = lua_loadprofile(L, 1, s, len);
+  if (n < 0) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "malformed profile");
+    return 2;
+  }
+  lua_pushinteger(L, n);
+  return 1;
+}
+
 static const luaL_Reg dblib[] = {
+  {"allocprofile", db_allocprofile},
+  {"allocreport", db_allocreport},
+  {"typeprofile", db_typeprofile},
+  {"dumpprofile", db_dumpprofile},
+  {"loadprofile", db_loadprofile},
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
   {"gethook", db_gethook},
   {"getinfo", db_getinfo},
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
+  {"gettabhint", db_gettabhint},
+  {"gettrace", db_gettrace},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
   {"upvaluejoin", db_upvaluejoin},
@@ -445,6 +577,7 @@ static const luaL_Reg dblib[] = {
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
+  {"heapsnapshot", db_heapsnapshot},
   {NULL, NULL}
 };
 
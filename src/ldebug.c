@@ -23,6 +23,7 @@
 #include "lfunc.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -53,6 +54,67 @@ static int currentline (CallInfo *ci) {
 }
 
 
+/*
+** {======================================================
+** Inlined calls
+** =======================================================
+*/
+
+/*
+** Index in 'p->inlines' of the inlined call whose code contains 'pc',
+** or -1 if there is none
+*/
+static int findinline (const Proto *p, int pc) {
+  int lo = 0;
+  int hi = p->sizeinlines;
+  while (lo < hi) {  /* binary search (entries are sorted and disjoint) */
+    int m = (lo + hi) / 2;
+    if (pc < p->inlines[m].startpc) hi = m;
+    else if (pc >= p->inlines[m].endpc) lo = m + 1;
+    else return m;
+  }
+  return -1;
+}
+
+
+/*
+** Inlined call running in the Lua function of 'ci', or -1 if none
+*/
+int luaG_inlinedcall (CallInfo *ci) {
+  Proto *p = ci_func(ci)->p;
+  return (p->sizeinlines == 0) ? -1 : findinline(p, currentpc(ci));
+}
+
+
+/*
+** Position in the inlined function 'p' of the instruction 'off'
+** positions after the start of its inlined code (see 'luaK_inline')
+*/
+static int inlinedpc (const Proto *p, int off) {
+  int n = p->sizecode - 1;
+  int pc;
+  for (pc = 0; pc < n - 1; pc++) {
+    off -= inlinedsize(p->code[pc], pc, n);
+    if (off < 0) break;
+  }
+  return pc;
+}
+
+
+/*
+** Function and current position of inlined call 'inl' running in 'ci'
+*/
+static Proto *inlinedfunc (CallInfo *ci, int inl, int *pc) {
+  Proto *p = ci_func(ci)->p;
+  const InlineInfo *ii = &p->inlines[inl];
+  Proto *ip = p->p[ii->fn];
+  *pc = inlinedpc(ip, currentpc(ci) - ii->startpc);
+  return ip;
+}
+
+/* }====================================================== */
+
+
 /*
 ** If function yielded, its 'func' can be in the 'extra' field. The
 ** next function restores 'func' to its correct value for debugging
@@ -88,7 +150,7 @@ LUA_API void lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   L->hook = func;
   L->basehookcount = count;
   resethookcount(L);
-  L->hookmask = cast_byte(mask);
+  L->hookmask = cast_byte(mask | (L->hookmask & MASKPROF));
 }
 
 
@@ -98,7 +160,7 @@ LUA_API lua_Hook lua_gethook (lua_State *L) {
 
 
 LUA_API int lua_gethookmask (lua_State *L) {
-  return L->hookmask;
+  return L->hookmask & ~MASKPROF;
 }
 
 
@@ -107,18 +169,32 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+/*
+** A Lua function running an inlined call counts as two levels: the
+** inlined call, above the function itself.
+*/
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
-  int status;
+  int status = 0;  /* no such level (by default) */
   CallInfo *ci;
   if (level < 0) return 0;  /* invalid (negative) level */
   lua_lock(L);
-  for (ci = L->ci; level > 0 && ci != &L->base_ci; ci = ci->previous)
-    level--;
-  if (level == 0 && ci != &L->base_ci) {  /* level found? */
-    status = 1;
-    ar->i_ci = ci;
+  swapextra(L);
+  for (ci = L->ci; ci != &L->base_ci; ci = ci->previous) {
+    int inl = isLua(ci) ? luaG_inlinedcall(ci) : -1;
+    if (inl >= 0 && level-- == 0) {  /* level is the inlined call? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inl = inl;
+      break;
+    }
+    if (level-- == 0) {  /* level found? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inl = -1;
+      break;
+    }
   }
-  else status = 0;  /* no such level */
+  swapextra(L);
   lua_unlock(L);
   return status;
 }
@@ -142,11 +218,22 @@ static const char *findvararg (CallInfo *ci, int n, StkId *pos) {
 }
 
 
-static const char *findlocal (lua_State *L, CallInfo *ci, int n,
+static const char *findlocal (lua_State *L, CallInfo *ci, int inl, int n,
                               StkId *pos) {
   const char *name = NULL;
   StkId base;
-  if (isLua(ci)) {
+  if (inl >= 0) {  /* inlined call? */
+    int pc;
+    Proto *ip = inlinedfunc(ci, inl, &pc);
+    if (n <= 0 || n > ip->maxstacksize)
+      return NULL;  /* no varargs; no such register */
+    base = ci->u.l.base + ci_func(ci)->p->inlines[inl].base;
+    name = luaF_getlocalname(ip, n, pc);
+    if (name == NULL) name = "(*temporary)";
+    *pos = base + (n - 1);
+    return name;
+  }
+  else if (isLua(ci)) {
     if (n < 0)  /* access to vararg values? */
       return findvararg(ci, -n, pos);
     else {
@@ -180,9 +267,12 @@ LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
   }
   else {  /* active function; get information through 'ar' */
     StkId pos = NULL;  /* to avoid warnings */
-    name = findlocal(L, ar->i_ci, n, &pos);
+    name = findlocal(L, ar->i_ci, ar->i_inl, n, &pos);
     if (name) {
-      setobj2s(L, L->top, pos);
+      if (ttisforpos(pos))  /* control of a native 'for' traversal? */
+        luaV_forkey(pos - 1, pos, L->top);  /* show its last key */
+      else
+        setobj2s(L, L->top, pos);
       api_incr_top(L);
     }
   }
@@ -197,7 +287,7 @@ LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n) {
   const char *name;
   lua_lock(L);
   swapextra(L);
-  name = findlocal(L, ar->i_ci, n, &pos);
+  name = findlocal(L, ar->i_ci, ar->i_inl, n, &pos);
   if (name) {
     setobjs2s(L, pos, L->top - 1);
     L->top--;  /* pop value */
@@ -245,9 +335,16 @@ static void collectvalidlines (lua_State *L, Closure *f) {
 }
 
 
-static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
+static const char *getfuncname (lua_State *L, CallInfo *ci, int inl,
+                                const char **name) {
   if (ci == NULL)  /* no 'ci'? */
     return NULL;  /* no info */
+  else if (inl >= 0) {  /* inlined call? (always through a local) */
+    Proto *p = ci_func(ci)->p;
+    const InlineInfo *ii = &p->inlines[inl];
+    *name = luaF_getlocalname(p, ii->fidx + 1, ii->startpc);
+    return (*name) ? "local" : NULL;
+  }
   else if (ci->callstatus & CIST_FIN) {  /* is this a finalizer? */
     *name = "__gc";
     return "metamethod";  /* report it as such */
@@ -259,8 +356,21 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
 }
 
 
+/*
+** Current line of the function running in 'ci' or, if 'inl' is not -1,
+** of its inlined call 'inl'. While running an inlined call, the function
+** itself is at the line of that call.
+*/
+static int frameline (CallInfo *ci, int inl) {
+  if (inl < 0 && (inl = luaG_inlinedcall(ci)) >= 0)
+    return ci_func(ci)->p->inlines[inl].line;
+  else
+    return currentline(ci);
+}
+
+
 static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
-                       Closure *f, CallInfo *ci) {
+                       Closure *f, CallInfo *ci, int inl) {
   int status = 1;
   for (; *what; what++) {
     switch (*what) {
@@ -269,7 +379,7 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci && isLua(ci)) ? currentline(ci) : -1;
+        ar->currentline = (ci && isLua(ci)) ? frameline(ci, inl) : -1;
         break;
       }
       case 'u': {
@@ -285,11 +395,11 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 't': {
-        ar->istailcall = (ci) ? ci->callstatus & CIST_TAIL : 0;
+        ar->istailcall = (ci && inl < 0) ? ci->callstatus & CIST_TAIL : 0;
         break;
       }
       case 'n': {
-        ar->namewhat = getfuncname(L, ci, &ar->name);
+        ar->namewhat = getfuncname(L, ci, inl, &ar->name);
         if (ar->namewhat == NULL) {
           ar->namewhat = "";  /* not found */
           ar->name = NULL;
@@ -310,6 +420,7 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
   int status;
   Closure *cl;
   CallInfo *ci;
+  int inl = -1;
   StkId func;
   lua_lock(L);
   swapextra(L);
@@ -324,9 +435,11 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
     ci = ar->i_ci;
     func = ci->func;
     lua_assert(ttisfunction(ci->func));
+    if ((inl = ar->i_inl) >= 0)  /* inlined call? */
+      func = ci->u.l.base + ci_func(ci)->p->inlines[inl].fidx;  /* its var. */
   }
   cl = ttisclosure(func) ? clvalue(func) : NULL;
-  status = auxgetinfo(L, what, ar, cl, ci);
+  status = auxgetinfo(L, what, ar, cl, ci, inl);
   if (strchr(what, 'f')) {
     setobjs2s(L, L->top, func);
     api_incr_top(L);
@@ -388,7 +501,7 @@ static int findsetreg (Proto *p, int lastpc, int reg) {
   int jmptarget = 0;  /* any code before this address is conditional */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = genericop(GET_OPCODE(i));
     int a = GETARG_A(i);
     switch (op) {
       case OP_LOADNIL: {
@@ -438,7 +551,7 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = genericop(GET_OPCODE(i));
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -450,7 +563,7 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
       case OP_GETTABLE: {
         int k = GETARG_C(i);  /* key index */
         int t = GETARG_B(i);  /* table index */
-        const char *vn = (op == OP_GETTABLE)  /* name of indexed variable */
+        const char *vn = (op != OP_GETTABUP)  /* name of indexed variable */
                          ? luaF_getlocalname(p, t + 1, pc)
                          : upvalname(p, t);
         kname(p, pc, k, name);
@@ -482,6 +595,34 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
 }
 
 
+/*
+** Find a name for register 'reg' at the current instruction of 'ci'.
+** In the code of an inlined call, the inlined function names its own
+** registers, and the registers of the caller it uses are its upvalues.
+*/
+static const char *regname (CallInfo *ci, int reg, const char **name) {
+  Proto *p = ci_func(ci)->p;
+  int inl = luaG_inlinedcall(ci);
+  if (inl >= 0) {
+    int ibase = p->inlines[inl].base;
+    int pc;
+    Proto *ip = inlinedfunc(ci, inl, &pc);
+    if (reg >= ibase)
+      return getobjname(ip, pc, reg - ibase, name);
+    else {
+      int i;
+      for (i = 0; i < ip->sizeupvalues; i++) {
+        if (ip->upvalues[i].instack && ip->upvalues[i].idx == reg) {
+          *name = upvalname(ip, i);
+          return "upvalue";
+        }
+      }
+    }
+  }
+  return getobjname(p, currentpc(ci), reg, name);
+}
+
+
 /*
 ** Try to find a name for a function based on the code that called it.
 ** (Only works when function was called by a Lua function.)
@@ -494,14 +635,15 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
   Proto *p = ci_func(ci)->p;  /* calling function */
   int pc = currentpc(ci);  /* calling instruction index */
   Instruction i = p->code[pc];  /* calling instruction */
+  OpCode op = genericop(GET_OPCODE(i));
   if (ci->callstatus & CIST_HOOKED) {  /* was it called inside a hook? */
     *name = "?";
     return "hook";
   }
-  switch (GET_OPCODE(i)) {
+  switch (op) {
     case OP_CALL:
     case OP_TAILCALL:
-      return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
+      return regname(ci, GETARG_A(i), name);  /* get function name */
     case OP_TFORCALL: {  /* for iterator */
       *name = "for iterator";
        return "for iterator";
@@ -516,7 +658,7 @@ static const char *funcnamefromcode (lua_State *L, CallInfo *ci,
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
     case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND:
     case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
-      int offset = cast_int(GET_OPCODE(i)) - cast_int(OP_ADD);  /* ORDER OP */
+      int offset = cast_int(op) - cast_int(OP_ADD);  /* ORDER OP */
       tm = cast(TMS, offset + cast_int(TM_ADD));  /* ORDER TM */
       break;
     }
@@ -575,8 +717,7 @@ static const char *varinfo (lua_State *L, const TValue *o) {
   if (isLua(ci)) {
     kind = getupvalname(ci, o, &name);  /* check whether 'o' is an upvalue */
     if (!kind && isinstack(ci, o))  /* no? try a register */
-      kind = getobjname(ci_func(ci)->p, currentpc(ci),
-                        cast_int(o - ci->u.l.base), &name);
+      kind = regname(ci, cast_int(o - ci->u.l.base), &name);
   }
   return (kind) ? luaO_pushfstring(L, " (%s '%s')", kind, name) : "";
 }
@@ -667,6 +808,8 @@ void luaG_traceexec (lua_State *L) {
   CallInfo *ci = L->ci;
   lu_byte mask = L->hookmask;
   int counthook = (--L->hookcount == 0 && (mask & LUA_MASKCOUNT));
+  if (mask & MASKPROF)
+    luaC_typerecord(L, ci);
   if (counthook)
     resethookcount(L);  /* reset count */
   else if (!(mask & LUA_MASKLINE))
@@ -17,6 +17,12 @@
 
 #define resethookcount(L)	(L->hookcount = L->basehookcount)
 
+/* internal bit of 'hookmask': record operand types (see 'lprof.c') */
+#define MASKPROF	(1 << 6)
+
+/* bits of 'hookmask' that need 'luaG_traceexec' before each instruction */
+#define HOOKINSTR	(LUA_MASKLINE | LUA_MASKCOUNT | MASKPROF)
+
 
 LUAI_FUNC l_noret luaG_typeerror (lua_State *L, const TValue *o,
                                                 const char *opname);
@@ -34,6 +40,7 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
                                                   TString *src, int line);
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC void luaG_traceexec (lua_State *L);
+LUAI_FUNC int luaG_inlinedcall (CallInfo *ci);
 
 
 #endif
@@ -156,6 +156,16 @@ static void DumpDebug (const Proto *f, DumpState *D) {
     DumpInt(f->locvars[i].startpc, D);
     DumpInt(f->locvars[i].endpc, D);
   }
+  n = (D->strip) ? 0 : f->sizeinlines;
+  DumpInt(n, D);
+  for (i = 0; i < n; i++) {
+    DumpInt(f->inlines[i].startpc, D);
+    DumpInt(f->inlines[i].endpc, D);
+    DumpInt(f->inlines[i].line, D);
+    DumpInt(f->inlines[i].fn, D);
+    DumpByte(f->inlines[i].base, D);
+    DumpByte(f->inlines[i].fidx, D);
+  }
   n = (D->strip) ? 0 : f->sizeupvalues;
   DumpInt(n, D);
   for (i = 0; i < n; i++)
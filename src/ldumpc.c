@@ -0,0 +1,616 @@
+/*
+** $Id: ldumpc.c $
+** save Lua chunks as C modules compiled ahead of time
+** See Copyright Notice in lua.h
+*/
+
+#define ldumpc_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lundump.h"
+
+
+/*
+** Each function of the chunk becomes a C function (see 'laot.h') with
+** one label per instruction. Each instruction expands the code of its
+** case in 'luaV_execute', with its operands as constants and jumps as
+** gotos. The module also embeds the chunk itself, with its debug
+** information, which it loads and then binds to the compiled code.
+*/
+
+
+typedef struct {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  int nf;  /* number of functions dumped so far */
+  size_t nbytes;  /* number of bytes of the embedded chunk */
+} DumpState;
+
+
+static void DumpBlock (const void *b, size_t size, DumpState *D) {
+  if (D->status == 0 && size > 0) {
+    lua_unlock(D->L);
+    D->status = (*D->writer)(D->L, b, size, D->data);
+    lua_lock(D->L);
+  }
+}
+
+
+static void DumpC (DumpState *D, const char *fmt, ...) {
+  char buff[1024];
+  int n;
+  va_list argp;
+  va_start(argp, fmt);
+  n = vsnprintf(buff, sizeof(buff), fmt, argp);
+  va_end(argp);
+  lua_assert(0 <= n && n < cast_int(sizeof(buff)));
+  DumpBlock(buff, cast(size_t, n), D);
+}
+
+
+/*
+** Writer for the embedded chunk, as the contents of a C array (called
+** by 'luaU_dump', which already unlocked the state)
+*/
+static int DumpBytes (lua_State *L, const void *b, size_t size, void *ud) {
+  DumpState *D = (DumpState *)ud;
+  const lu_byte *p = (const lu_byte *)b;
+  char buff[8];
+  size_t i;
+  for (i = 0; i < size && D->status == 0; i++) {
+    int n = snprintf(buff, sizeof(buff),
+                     (D->nbytes++ % 16 == 15) ? "%d,\n" : "%d,", p[i]);
+    D->status = (*D->writer)(L, buff, cast(size_t, n), D->data);
+  }
+  return D->status;
+}
+
+
+/* go to instruction 'pc' */
+#define DumpGoto(D,pc)	DumpC(D, "  goto L%d;\n", pc)
+
+
+/*
+** Code for the jump instruction at 'pc' (which may be the one following
+** a test)
+*/
+static void DumpJump (const Proto *f, int pc, DumpState *D) {
+  Instruction i = f->code[pc];
+  lua_assert(GET_OPCODE(i) == OP_JMP);
+  if (GETARG_A(i) != 0)
+    DumpC(D, "  luaF_close(L, base + %d);\n", GETARG_A(i) - 1);
+  DumpGoto(D, pc + 1 + GETARG_sBx(i));
+}
+
+
+static void DumpArith (DumpState *D, const char *intop, const char *fltop,
+                       const char *event) {
+  DumpC(D, "  { TValue *rb = RKB(i);\n"
+           "    TValue *rc = RKC(i);\n"
+           "    lua_Number nb; lua_Number nc;\n");
+  if (intop != NULL)
+    DumpC(D, "    if (ttisinteger(rb) && ttisinteger(rc)) {\n"
+             "      lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);\n"
+             "      setivalue(ra, %s);\n"
+             "    }\n"
+             "    else ", intop);
+  else
+    DumpC(D, "    ");
+  DumpC(D, "if (tonumber(rb, &nb) && tonumber(rc, &nc)) {\n"
+           "      %s\n"
+           "    }\n"
+           "    else { Protect(luaT_trybinTM(L, rb, rc, ra, %s)); } }\n",
+           fltop, event);
+}
+
+
+static void DumpBitwise (DumpState *D, const char *op, const char *event) {
+  DumpC(D, "  { TValue *rb = RKB(i);\n"
+           "    TValue *rc = RKC(i);\n"
+           "    lua_Integer ib; lua_Integer ic;\n"
+           "    if (tointeger(rb, &ib) && tointeger(rc, &ic)) {\n"
+           "      setivalue(ra, %s);\n"
+           "    }\n"
+           "    else { Protect(luaT_trybinTM(L, rb, rc, ra, %s)); } }\n",
+           op, event);
+}
+
+
+static void DumpInstruction (const Proto *f, int pc, DumpState *D) {
+  Instruction i = f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  if (isfused(op))  /* C code has no dispatch to save */
+    op = genericop(op);
+  DumpC(D, " L%d:  /* [%d] %s */\n", pc, getfuncline(f, pc),
+           luaP_opnames[op]);
+  if (op == OP_EXTRAARG) {  /* never executed by itself */
+    DumpC(D, "  lua_assert(0);\n");
+    return;
+  }
+  DumpC(D, "  aot_fetch(%d, 0x%08lx);\n", pc, (unsigned long)i);
+  switch (op) {
+    case OP_MOVE:
+      DumpC(D, "  setobjs2s(L, ra, RB(i));\n");
+      break;
+    case OP_LOADK:
+      DumpC(D, "  setobj2s(L, ra, k + GETARG_Bx(i));\n");
+      break;
+    case OP_LOADKX:
+      DumpC(D, "  setobj2s(L, ra, k + %d);\n", GETARG_Ax(f->code[pc + 1]));
+      DumpGoto(D, pc + 2);
+      break;
+    case OP_LOADBOOL:
+      DumpC(D, "  setbvalue(ra, GETARG_B(i));\n");
+      if (GETARG_C(i)) DumpGoto(D, pc + 2);  /* skip next instruction */
+      break;
+    case OP_LOADNIL:
+      DumpC(D, "  { int b = GETARG_B(i);\n"
+               "    do {\n"
+               "      setnilvalue(ra++);\n"
+               "    } while (b--); }\n");
+      break;
+    case OP_GETUPVAL:
+      DumpC(D, "  { UpVal *uv = cl->upvals[GETARG_B(i)];\n"
+               "    luaC_upvalread(L, uv);\n"
+               "    setobj2s(L, ra, uv->v); }\n");
+      break;
+    case OP_GETTABUP:
+      DumpC(D, "  { UpVal *uv = cl->upvals[GETARG_B(i)];\n"
+               "    TValue *upval = uv->v;\n"
+               "    TValue *rc = RKC(i);\n"
+               "    luaC_upvalread(L, uv);\n"
+               "    gettabupProtected(L, upval, GETARG_C(i), rc, ra); }\n");
+      break;
+    case OP_GETTABLE:
+      DumpC(D, "  { StkId rb = RB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    gettableProtected(L, rb, rc, ra); }\n");
+      break;
+    case OP_SETTABUP:
+      DumpC(D, "  { UpVal *uv = cl->upvals[GETARG_A(i)];\n"
+               "    TValue *upval = uv->v;\n"
+               "    TValue *rb = RKB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    luaC_upvalread(L, uv);\n"
+               "    settabupProtected(L, upval, GETARG_B(i), rb, rc); }\n");
+      break;
+    case OP_SETUPVAL:
+      DumpC(D, "  { UpVal *uv = cl->upvals[GETARG_B(i)];\n"
+               "    setobj(L, uv->v, ra);\n"
+               "    luaC_upvalbarrier(L, uv); }\n");
+      break;
+    case OP_SETTABLE:
+      DumpC(D, "  { TValue *rb = RKB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    settableProtected(L, ra, rb, rc); }\n");
+      break;
+    case OP_IGETTABLE:
+      DumpC(D, "  { const TValue *slot;\n"
+               "    StkId rb = RB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    if (luaV_fastget(L, rb, ivalue(rc), slot, luaH_getint)) {\n"
+               "      setobj2s(L, ra, slot);\n"
+               "    }\n"
+               "    else Protect(luaV_finishget(L, rb, rc, ra, slot)); }\n");
+      break;
+    case OP_ISETTABLE:
+      DumpC(D, "  { const TValue *slot;\n"
+               "    TValue *rb = RKB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    if (!luaV_fastset(L, ra, ivalue(rb), slot, luaH_getint, rc))\n"
+               "      Protect(luaV_finishset(L, ra, rb, rc, slot)); }\n");
+      break;
+    case OP_NEWTABLE:
+      DumpC(D, "  newtable(L, cl->p, %d, ra, luaO_fb2int(GETARG_B(i)),\n"
+               "           luaO_fb2int(GETARG_C(i)));\n"
+               "  checkGC(L, ra + 1);\n", pc);
+      break;
+    case OP_SELF:
+      DumpC(D, "  { const TValue *aux;\n"
+               "    StkId rb = RB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    TString *key = tsvalue(rc);  /* key must be a string */\n"
+               "    setobjs2s(L, ra + 1, rb);\n"
+               "    if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {\n"
+               "      setobj2s(L, ra, aux);\n"
+               "    }\n"
+               "    else Protect(luaV_finishget(L, rb, rc, ra, aux)); }\n");
+      break;
+    case OP_ADD:
+      DumpArith(D, "intop(+, ib, ic)",
+                "setfltvalue(ra, luai_numadd(L, nb, nc));", "TM_ADD");
+      break;
+    case OP_SUB:
+      DumpArith(D, "intop(-, ib, ic)",
+                "setfltvalue(ra, luai_numsub(L, nb, nc));", "TM_SUB");
+      break;
+    case OP_IADD: case OP_ISUB:
+      DumpC(D, "  setivalue(ra, intop(%c, ivalue(RKB(i)), ivalue(RKC(i))));\n",
+               (op == OP_IADD) ? '+' : '-');
+      break;
+    case OP_MUL:
+      DumpArith(D, "intop(*, ib, ic)",
+                "setfltvalue(ra, luai_nummul(L, nb, nc));", "TM_MUL");
+      break;
+    case OP_DIV:
+      DumpArith(D, NULL,
+                "setfltvalue(ra, luai_numdiv(L, nb, nc));", "TM_DIV");
+      break;
+    case OP_MOD:
+      DumpArith(D, "luaV_mod(L, ib, ic)",
+                "lua_Number m; luai_nummod(L, nb, nc, m); setfltvalue(ra, m);",
+                "TM_MOD");
+      break;
+    case OP_IDIV:
+      DumpArith(D, "luaV_div(L, ib, ic)",
+                "setfltvalue(ra, luai_numidiv(L, nb, nc));", "TM_IDIV");
+      break;
+    case OP_POW:
+      DumpArith(D, NULL,
+                "setfltvalue(ra, luai_numpow(L, nb, nc));", "TM_POW");
+      break;
+    case OP_BAND:
+      DumpBitwise(D, "intop(&, ib, ic)", "TM_BAND");
+      break;
+    case OP_BOR:
+      DumpBitwise(D, "intop(|, ib, ic)", "TM_BOR");
+      break;
+    case OP_BXOR:
+      DumpBitwise(D, "intop(^, ib, ic)", "TM_BXOR");
+      break;
+    case OP_SHL:
+      DumpBitwise(D, "luaV_shiftl(ib, ic)", "TM_SHL");
+      break;
+    case OP_SHR:
+      DumpBitwise(D, "luaV_shiftl(ib, -ic)", "TM_SHR");
+      break;
+    case OP_UNM:
+      DumpC(D, "  { TValue *rb = RB(i);\n"
+               "    lua_Number nb;\n"
+               "    if (ttisinteger(rb)) {\n"
+               "      lua_Integer ib = ivalue(rb);\n"
+               "      setivalue(ra, intop(-, 0, ib));\n"
+               "    }\n"
+               "    else if (tonumber(rb, &nb)) {\n"
+               "      setfltvalue(ra, luai_numunm(L, nb));\n"
+               "    }\n"
+               "    else { Protect(luaT_trybinTM(L, rb, rb, ra, TM_UNM)); } }\n");
+      break;
+    case OP_BNOT:
+      DumpC(D, "  { TValue *rb = RB(i);\n"
+               "    lua_Integer ib;\n"
+               "    if (tointeger(rb, &ib)) {\n"
+               "      setivalue(ra, intop(^, ~l_castS2U(0), ib));\n"
+               "    }\n"
+               "    else { Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT)); } }\n");
+      break;
+    case OP_NOT:
+      DumpC(D, "  { TValue *rb = RB(i);\n"
+               "    int res = l_isfalse(rb);\n"
+               "    setbvalue(ra, res); }\n");
+      break;
+    case OP_LEN:
+      DumpC(D, "  Protect(luaV_objlen(L, ra, RB(i)));\n");
+      break;
+    case OP_CONCAT:
+      DumpC(D, "  { int b = GETARG_B(i);\n"
+               "    int c = GETARG_C(i);\n"
+               "    StkId rb;\n"
+               "    L->top = base + c + 1;  /* mark the end of concat operands */\n"
+               "    Protect(luaV_concat(L, c - b + 1));\n"
+               "    ra = RA(i);  /* 'luaV_concat' may move the stack */\n"
+               "    rb = base + b;\n"
+               "    setobjs2s(L, ra, rb);\n"
+               "    checkGC(L, (ra >= rb ? ra + 1 : rb));\n"
+               "    L->top = ci->top; }\n");
+      break;
+    case OP_JMP:
+      DumpJump(f, pc, D);
+      break;
+    case OP_EQ:
+      DumpC(D, "  { TValue *rb = RKB(i);\n"
+               "    TValue *rc = RKC(i);\n"
+               "    int res;\n"
+               "    Protect(res = luaV_equalobj(L, rb, rc));\n"
+               "    if (res != GETARG_A(i)) goto L%d; }\n", pc + 2);
+      DumpJump(f, pc + 1, D);
+      break;
+    case OP_LT: case OP_LE:
+      DumpC(D, "  { int res;\n"
+               "    Protect(res = %s(L, RKB(i), RKC(i)));\n"
+               "    if (res != GETARG_A(i)) goto L%d; }\n",
+               (op == OP_LT) ? "luaV_lessthan" : "luaV_lessequal", pc + 2);
+      DumpJump(f, pc + 1, D);
+      break;
+    case OP_IEQ: case OP_ILT: case OP_ILE:
+      DumpC(D, "  if ((ivalue(RKB(i)) %s ivalue(RKC(i))) != GETARG_A(i))\n"
+               "    goto L%d;\n",
+               (op == OP_IEQ) ? "==" : (op == OP_ILT) ? "<" : "<=", pc + 2);
+      DumpJump(f, pc + 1, D);
+      break;
+    case OP_TEST:
+      DumpC(D, "  if (GETARG_C(i) ? l_isfalse(ra) : !l_isfalse(ra))\n"
+               "    goto L%d;\n", pc + 2);
+      DumpJump(f, pc + 1, D);
+      break;
+    case OP_TESTSET:
+      DumpC(D, "  { TValue *rb = RB(i);\n"
+               "    if (GETARG_C(i) ? l_isfalse(rb) : !l_isfalse(rb))\n"
+               "      goto L%d;\n"
+               "    setobjs2s(L, ra, rb); }\n", pc + 2);
+      DumpJump(f, pc + 1, D);
+      break;
+    case OP_CALL:
+      DumpC(D, "  { int b = GETARG_B(i);\n"
+               "    int nresults = GETARG_C(i) - 1;\n"
+               "    if (b != 0) L->top = ra+b;\n"
+               "    if (luaD_precall(L, ra, nresults)) {  /* C function? */\n"
+               "      if (nresults >= 0)\n"
+               "        L->top = ci->top;  /* adjust results */\n"
+               "      Protect((void)0);  /* update 'base' */\n"
+               "    }\n"
+               "    else return AOT_CALL; }\n");
+      break;
+    case OP_TAILCALL:
+      DumpC(D, "  { int b = GETARG_B(i);\n"
+               "    if (b != 0) L->top = ra+b;\n"
+               "    if (luaD_precall(L, ra, LUA_MULTRET)) {  /* C function? */\n"
+               "      Protect((void)0);  /* update 'base' */\n"
+               "    }\n"
+               "    else {\n"
+               "      CallInfo *nci = L->ci;  /* called frame */\n"
+               "      CallInfo *oci = nci->previous;  /* caller frame */\n"
+               "      StkId nfunc = nci->func;  /* called function */\n"
+               "      StkId ofunc = oci->func;  /* caller function */\n"
+               "      StkId lim = nci->u.l.base + getproto(nfunc)->numparams;\n"
+               "      int aux;\n"
+               "      if (cl->p->sizep > 0) luaF_close(L, oci->u.l.base);\n"
+               "      for (aux = 0; nfunc + aux < lim; aux++)\n"
+               "        setobjs2s(L, ofunc + aux, nfunc + aux);\n"
+               "      oci->u.l.base = ofunc + (nci->u.l.base - nfunc);\n"
+               "      oci->top = L->top = ofunc + (L->top - nfunc);\n"
+               "      oci->u.l.savedpc = nci->u.l.savedpc;\n"
+               "      oci->callstatus |= CIST_TAIL;\n"
+               "      L->ci = oci;  /* remove new frame */\n"
+               "      return AOT_CALL;\n"
+               "    } }\n");
+      break;
+    case OP_RETURN:
+      DumpC(D, "  { int b = GETARG_B(i);\n"
+               "    if (cl->p->sizep > 0) luaF_close(L, base);\n"
+               "    return luaD_poscall(L, ci, ra,\n"
+               "                        (b != 0 ? b - 1 : cast_int(L->top - ra))); }\n");
+      break;
+    case OP_FORLOOP: {
+      int target = pc + 1 + GETARG_sBx(i);
+      DumpC(D, "  if (ttisinteger(ra)) {  /* integer loop? */\n"
+               "    lua_Integer step = ivalue(ra + 2);\n"
+               "    lua_Integer idx = intop(+, ivalue(ra), step);\n"
+               "    lua_Integer limit = ivalue(ra + 1);\n"
+               "    if ((0 < step) ? (idx <= limit) : (limit <= idx)) {\n"
+               "      chgivalue(ra, idx);\n"
+               "      setivalue(ra + 3, idx);\n"
+               "      goto L%d;\n"
+               "    }\n"
+               "  }\n"
+               "  else {  /* floating loop */\n"
+               "    lua_Number step = fltvalue(ra + 2);\n"
+               "    lua_Number idx = luai_numadd(L, fltvalue(ra), step);\n"
+               "    lua_Number limit = fltvalue(ra + 1);\n"
+               "    if (luai_numlt(0, step) ? luai_numle(idx, limit)\n"
+               "                            : luai_numle(limit, idx)) {\n"
+               "      chgfltvalue(ra, idx);\n"
+               "      setfltvalue(ra + 3, idx);\n"
+               "      goto L%d;\n"
+               "    }\n"
+               "  }\n", target, target);
+      break;
+    }
+    case OP_FORPREP:
+      DumpC(D, "  { TValue *init = ra;\n"
+               "    TValue *plimit = ra + 1;\n"
+               "    TValue *pstep = ra + 2;\n"
+               "    lua_Integer ilimit;\n"
+               "    int stopnow;\n"
+               "    if (ttisinteger(init) && ttisinteger(pstep) &&\n"
+               "        forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {\n"
+               "      lua_Integer initv = (stopnow ? 0 : ivalue(init));\n"
+               "      setivalue(plimit, ilimit);\n"
+               "      setivalue(init, intop(-, initv, ivalue(pstep)));\n"
+               "    }\n"
+               "    else {\n"
+               "      lua_Number ninit; lua_Number nlimit; lua_Number nstep;\n"
+               "      if (!tonumber(plimit, &nlimit))\n"
+               "        luaG_runerror(L, \"'for' limit must be a number\");\n"
+               "      setfltvalue(plimit, nlimit);\n"
+               "      if (!tonumber(pstep, &nstep))\n"
+               "        luaG_runerror(L, \"'for' step must be a number\");\n"
+               "      setfltvalue(pstep, nstep);\n"
+               "      if (!tonumber(init, &ninit))\n"
+               "        luaG_runerror(L, \"'for' initial value must be a number\");\n"
+               "      setfltvalue(init, luai_numsub(L, ninit, nstep));\n"
+               "    } }\n");
+      DumpGoto(D, pc + 1 + GETARG_sBx(i));
+      break;
+    case OP_TFORCALL: {
+      Instruction loop = f->code[pc + 1];
+      int target = pc + 2 + GETARG_sBx(loop);
+      lua_assert(GET_OPCODE(loop) == OP_TFORLOOP);
+      DumpC(D, "  { StkId cb = ra + 3;  /* call base */\n"
+               "    int res = fornative(L, ra, GETARG_C(i));\n"
+               "    if (res > 0) goto L%d;  /* loop goes on */\n"
+               "    else if (res == 0) goto L%d;  /* loop ends */\n"
+               "    if (ttisforpos(ra + 2))\n"
+               "      luaV_forkey(ra + 1, ra + 2, ra + 2);\n"
+               "    setobjs2s(L, cb+2, ra+2);\n"
+               "    setobjs2s(L, cb+1, ra+1);\n"
+               "    setobjs2s(L, cb, ra);\n"
+               "    L->top = cb + 3;  /* func. + 2 args (state and index) */\n"
+               "    Protect(luaD_call(L, cb, GETARG_C(i)));\n"
+               "    L->top = ci->top;\n"
+               "    ra = base + %d;  /* OP_TFORLOOP */\n"
+               "    if (!ttisnil(ra + 1)) {  /* continue loop? */\n"
+               "      setobjs2s(L, ra, ra + 1);  /* save control variable */\n"
+               "      goto L%d;\n"
+               "    } }\n",
+               target, pc + 2, GETARG_A(loop), target);
+      DumpGoto(D, pc + 2);
+      break;
+    }
+    case OP_TFORLOOP:
+      DumpC(D, "  if (!ttisnil(ra + 1)) {  /* continue loop? */\n"
+               "    setobjs2s(L, ra, ra + 1);  /* save control variable */\n"
+               "    goto L%d;\n"
+               "  }\n", pc + 1 + GETARG_sBx(i));
+      break;
+    case OP_SETLIST: {
+      int c = GETARG_C(i);
+      if (c == 0) c = GETARG_Ax(f->code[pc + 1]);
+      DumpC(D, "  { int n = GETARG_B(i);\n"
+               "    unsigned int last;\n"
+               "    Table *h;\n"
+               "    if (n == 0) n = cast_int(L->top - ra) - 1;\n"
+               "    h = hvalue(ra);\n"
+               "    last = ((%d-1)*LFIELDS_PER_FLUSH) + n;\n"
+               "    if (last > h->sizearray)  /* needs more space? */\n"
+               "      luaH_resizearray(L, h, last);\n"
+               "    for (; n > 0; n--) {\n"
+               "      TValue *val = ra+n;\n"
+               "      luaH_setint(L, h, last--, val);\n"
+               "      luaC_barrierback(L, h, val);\n"
+               "    }\n"
+               "    L->top = ci->top; }\n", c);
+      if (GETARG_C(i) == 0) DumpGoto(D, pc + 2);  /* skip extra argument */
+      break;
+    }
+    case OP_CLOSURE:
+      DumpC(D, "  { Proto *p = cl->p->p[GETARG_Bx(i)];\n"
+               "    LClosure *ncl = getcached(p, cl->upvals, base);\n"
+               "    if (ncl == NULL)  /* no match? */\n"
+               "      pushclosure(L, p, cl->upvals, base, ra);\n"
+               "    else\n"
+               "      setclLvalue(L, ra, ncl);\n"
+               "    checkGC(L, ra + 1); }\n");
+      break;
+    case OP_VARARG:
+      DumpC(D, "  { int b = GETARG_B(i) - 1;  /* required results */\n"
+               "    int j;\n"
+               "    int n = cast_int(base - ci->func) - cl->p->numparams - 1;\n"
+               "    if (n < 0) n = 0;  /* no vararg arguments */\n"
+               "    if (b < 0) {  /* B == 0? */\n"
+               "      b = n;  /* get all var. arguments */\n"
+               "      Protect(luaD_checkstack(L, n));\n"
+               "      ra = RA(i);  /* previous call may change the stack */\n"
+               "      L->top = ra + n;\n"
+               "    }\n"
+               "    for (j = 0; j < b && j < n; j++)\n"
+               "      setobjs2s(L, ra + j, base - n + j);\n"
+               "    for (; j < b; j++)\n"
+               "      setnilvalue(ra + j); }\n");
+      break;
+    default: lua_assert(0);
+  }
+}
+
+
+static void DumpFunction (const Proto *f, DumpState *D) {
+  int pc;
+  int i;
+  DumpC(D, "\n\n/* function <%s:%d,%d> */\n",
+           (f->source != NULL) ? getstr(f->source) : "=?",
+           f->linedefined, f->lastlinedefined);
+  DumpC(D, "static int aot_f%d (lua_State *L) {\n"
+           "  CallInfo *ci = L->ci;\n"
+           "  LClosure *cl = clLvalue(ci->func);\n"
+           "  TValue *k = cl->p->k;\n"
+           "  StkId base = ci->u.l.base;\n"
+           "  const Instruction *code = cl->p->code;\n"
+           "  Instruction i;\n"
+           "  StkId ra;\n"
+           "  UNUSED(k);\n"
+           "  switch (ci->u.l.savedpc - code) {  /* resume at saved 'pc' */\n",
+           D->nf++);
+  for (pc = 0; pc < f->sizecode; pc++)
+    DumpC(D, "    case %d: goto L%d;\n", pc, pc);
+  DumpC(D, "  }\n");
+  for (pc = 0; pc < f->sizecode; pc++)
+    DumpInstruction(f, pc, D);
+  DumpC(D, "  UNUSED(ra);\n"
+           "  return 0;  /* not reached */\n"
+           "}\n");
+  for (i = 0; i < f->sizep; i++)
+    DumpFunction(f->p[i], D);
+}
+
+
+static void DumpOpen (const char *modname, DumpState *D) {
+  const char *c;
+  int i;
+  DumpC(D, "\n\nstatic const AOTFunction aot_code[] = {");
+  for (i = 0; i < D->nf; i++)
+    DumpC(D, (i % 8 == 0) ? "\n  aot_f%d," : " aot_f%d,", i);
+  DumpC(D, "\n};\n\n\n"
+           "static int aot_bind (Proto *f, int n) {\n"
+           "  int i;\n"
+           "  f->aot = aot_code[n++];\n"
+           "  for (i = 0; i < f->sizep; i++)\n"
+           "    n = aot_bind(f->p[i], n);\n"
+           "  return n;\n"
+           "}\n\n\n");
+  DumpC(D, "LUAMOD_API int luaopen_");
+  for (c = modname; *c; c++)  /* dots become underscores (see 'loadlib') */
+    DumpC(D, "%c", (*c == '.') ? '_' : *c);
+  DumpC(D, " (lua_State *L) {\n"
+           "  aot_rt = lua_aotruntime(LUA_AOT_VERSION, LUA_AOT_LAYOUT);\n"
+           "  if (aot_rt == NULL)\n"
+           "    return luaL_error(L, \"module compiled for another Lua core\");\n"
+           "  if (luaL_loadbufferx(L, (const char *)aot_chunk, sizeof(aot_chunk),\n"
+           "                       \"=%s\", \"b\") != LUA_OK)\n"
+           "    return lua_error(L);\n"
+           "  aot_bind(getproto(L->top - 1), 0);\n"
+           "  lua_insert(L, 1);  /* chunk gets all arguments to the loader */\n"
+           "  lua_call(L, lua_gettop(L) - 1, 1);\n"
+           "  return 1;\n"
+           "}\n\n", modname);
+}
+
+
+/*
+** dump Lua function as a C module 'modname' compiled ahead of time
+*/
+int luaU_dumpC (lua_State *L, const Proto *f, const char *modname,
+                lua_Writer w, void *data, int strip) {
+  DumpState D;
+  D.L = L;
+  D.writer = w;
+  D.data = data;
+  D.status = 0;
+  D.nf = 0;
+  D.nbytes = 0;
+  DumpC(&D, "/* module '%s' compiled ahead of time by luac */\n\n"
+            "#define LUA_AOT_MODULE\n\n"
+            "#include \"lua.h\"\n"
+            "#include \"lauxlib.h\"\n\n"
+            "#include \"laot.h\"\n\n\n"
+            "static const unsigned char aot_chunk[] = {\n", modname);
+  luaU_dump(L, f, DumpBytes, &D, strip);
+  DumpC(&D, "\n};\n");
+  DumpFunction(f, &D);
+  DumpOpen(modname, &D);
+  return D.status;
+}
+
@@ -11,13 +11,16 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -105,6 +108,12 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->aot = NULL;
+  f->mcode = NULL;
+  f->sizemcode = 0;
+  f->jitcount = LUAI_JITCOUNT;
+  f->loops = NULL;
+  f->sizeloops = 0;
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -115,6 +124,15 @@ Proto *luaF_newproto (lua_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->inlines = NULL;
+  f->sizeinlines = 0;
+  f->tabsites = NULL;
+  f->sizetabsites = 0;
+  f->feedback = NULL;
+  f->sizefeedback = 0;
+  f->kslot = NULL;
+  f->sizekslot = 0;
+  f->heat = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -123,16 +141,80 @@ Proto *luaF_newproto (lua_State *L) {
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
+  luaJ_free(L, f);
   luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
+  luaM_freearray(L, f->inlines, f->sizeinlines);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  luaM_freearray(L, f->tabsites, f->sizetabsites);
+  luaM_freearray(L, f->feedback, f->sizefeedback);
+  luaM_freearray(L, f->kslot, f->sizekslot);
   luaM_free(L, f);
 }
 
 
+/*
+** (Re)build the list of table-constructor sites of prototype 'f'
+** from its current code. Must be called whenever 'f->code' changes.
+*/
+void luaF_inittabsites (lua_State *L, Proto *f) {
+  int pc;
+  int n = 0;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    if (GET_OPCODE(f->code[pc]) == OP_NEWTABLE)
+      n++;
+  }
+  luaM_freearray(L, f->tabsites, f->sizetabsites);
+  f->tabsites = NULL;
+  f->sizetabsites = 0;
+  if (n == 0) return;
+  f->tabsites = luaM_newvector(L, n, TabSite);
+  f->sizetabsites = n;
+  for (pc = 0, n = 0; pc < f->sizecode; pc++) {
+    if (GET_OPCODE(f->code[pc]) == OP_NEWTABLE) {
+      TabSite *ts = &f->tabsites[n++];
+      ts->pc = pc;
+      ts->sizearray = ts->sizenode = 0;
+      ts->last = NULL;
+    }
+  }
+}
+
+
+/*
+** (Re)build the slot hints for the constants of prototype 'f' (see
+** 'luaH_getstrhint'). Must be called whenever 'f->k' changes size.
+*/
+void luaF_initkslots (lua_State *L, Proto *f) {
+  luaM_reallocvector(L, f->kslot, f->sizekslot, f->sizek, unsigned int);
+  f->sizekslot = f->sizek;
+  if (f->sizek > 0)
+    memset(f->kslot, 0, f->sizek * sizeof(unsigned int));
+}
+
+
+/*
+** Find the table-constructor site at position 'pc' of function 'f'.
+** Returns NULL if there is no such site.
+*/
+TabSite *luaF_gettabsite (const Proto *f, int pc) {
+  int i = 0;
+  int j = f->sizetabsites;
+  while (i < j) {  /* binary search over sites (sorted by 'pc') */
+    int m = (i + j) / 2;
+    if (f->tabsites[m].pc < pc) i = m + 1;
+    else j = m;
+  }
+  if (i < f->sizetabsites && f->tabsites[i].pc == pc)
+    return &f->tabsites[i];
+  else
+    return NULL;
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -56,6 +56,9 @@ LUAI_FUNC void luaF_close (lua_State *L, StkId level);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
+LUAI_FUNC void luaF_inittabsites (lua_State *L, Proto *f);
+LUAI_FUNC void luaF_initkslots (lua_State *L, Proto *f);
+LUAI_FUNC TabSite *luaF_gettabsite (const Proto *f, int pc);
 
 
 #endif
@@ -11,6 +11,7 @@
 
 
 #include <string.h>
+#include <time.h>
 
 #include "lua.h"
 
@@ -20,6 +21,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -44,6 +46,14 @@
 /* cost of calling one finalizer */
 #define GCFINALIZECOST	GCSWEEPCOST
 
+/*
+** with a time budget for finalizers, each step may use one more
+** 'gcfinbudget' for every FINBACKLOG objects waiting in 'tobefnz', up
+** to FINMAXSCALE budgets
+*/
+#define FINBACKLOG	64
+#define FINMAXSCALE	16
+
 
 /*
 ** macro to adjust 'stepmul': 'stepmul' is actually used like
@@ -63,14 +73,125 @@
 ** 'makewhite' erases all color bits then sets only the current white
 ** bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors  \
+	(~(bitmask(BLACKBIT) | WHITEBITS | bit2mask(WEAKCLEANBIT, DIRTYBIT)))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
 #define white2gray(x)	resetbits(x->marked, WHITEBITS)
+
+
+/*
+** only strings and userdata can be large; only userdata can move to
+** 'finobj', so only they are checked here
+*/
+#define islargeobj(o)  \
+	((o)->tt == LUA_TUSERDATA && sizeudata(gco2u(o)) >= LUAI_LARGEOBJ)
 #define black2gray(x)	resetbit(x->marked, BLACKBIT)
 
 
+/* only tables and closures go to arenas */
+#define arenatype(tt)  \
+	((tt) == LUA_TTABLE || (tt) == LUA_TLCL || (tt) == LUA_TCCL)
+
+/* is 'v' a slot in the stack of thread 'L'? */
+#define instack(L,v)	((L)->stack <= (v) && (v) < (L)->stack + (L)->stacksize)
+
+
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+
+/*
+** 'gcclock' gives the time, in microseconds, used to measure the
+** atomic step. ISO C only offers processor time, which also counts
+** helper threads; POSIX systems use a monotonic clock instead.
+*/
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+
+static lu_mem gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000 + cast(lu_mem, ts.tv_nsec / 1000);
+}
+
+#else
+
+#define gcclock()  \
+  cast(lu_mem, (double)clock() * 1000000.0 / (double)CLOCKS_PER_SEC)
+
+#endif
+
+
+/*
+** Parallel marking (see 'parallelmark') needs POSIX threads and the
+** atomic builtins of GCC-compatible compilers. 'claimwhite' turns a
+** white object gray atomically, returning false if some other marker
+** turned it gray first.
+**
+** A marker may read the color of an object while the marker that
+** claimed it changes it, so colors are read here with relaxed atomic
+** loads (as cheap as plain ones), and markers change them with atomic
+** operations ('setmarked'/'resetmarked'). The same goes for the flag
+** 'touched' of open upvalues, which closures traversed by different
+** markers can share.
+*/
+#if defined(LUA_USE_PTHREADS) && defined(__GNUC__)
+
+#define LUAI_PARMARK
+
+/* number of objects traversed before trying to mark in parallel */
+#if !defined(GCPARSERIAL)
+#define GCPARSERIAL	256
+#endif
+
+static int claimwhite (GCObject *o) {
+  lu_byte old = __atomic_load_n(&o->marked, __ATOMIC_RELAXED);
+  do {
+    if (!testbits(old, WHITEBITS))
+      return 0;
+  } while (!__atomic_compare_exchange_n(&o->marked, &old,
+                 cast_byte(old & ~WHITEBITS), 1,
+                 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+#define getmarked(o)	__atomic_load_n(&(o)->marked, __ATOMIC_RELAXED)
+
+#define setmarked(g,o,m)  \
+  ((g)->gcpmark ? (void)__atomic_fetch_or(&(o)->marked, m, __ATOMIC_RELAXED) \
+                : (void)setbits((o)->marked, m))
+
+#define resetmarked(g,o,m)  \
+  ((g)->gcpmark \
+    ? (void)__atomic_fetch_and(&(o)->marked, cast_byte(~(m)), __ATOMIC_RELAXED) \
+    : (void)resetbits((o)->marked, m))
+
+#define settouched(g,uv)  \
+  ((g)->gcpmark ? __atomic_store_n(&(uv)->u.open.touched, 1, __ATOMIC_RELAXED) \
+                : (void)((uv)->u.open.touched = 1))
+
+#undef iswhite
+#undef isblack
+#undef isgray
+#define iswhite(x)	testbits(getmarked(x), WHITEBITS)
+#define isblack(x)	testbit(getmarked(x), BLACKBIT)
+#define isgray(x)	(!testbits(getmarked(x), WHITEBITS | bitmask(BLACKBIT)))
+
+#else
+#define claimwhite(o)	(white2gray(o), 1)
+#define setmarked(g,o,m)	setbits((o)->marked, m)
+#define resetmarked(g,o,m)	resetbits((o)->marked, m)
+#define settouched(g,uv)	((uv)->u.open.touched = 1)
+#endif
+
+/* color changes of objects that markers may be traversing */
+#define markblack(g,o)	setmarked(g, o, bitmask(BLACKBIT))
+#define markgray(g,o)	resetmarked(g, o, bitmask(BLACKBIT))
+
+
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
 
 #define checkdeadkey(n)	lua_assert(!ttisdeadkey(gkey(n)) || ttisnil(gval(n)))
@@ -92,6 +213,9 @@
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
 static void reallymarkobject (global_State *g, GCObject *o);
+#if defined(LUAI_PARMARK)
+static void parallelmark (global_State *g);
+#endif
 
 
 /*
@@ -172,22 +296,62 @@ void luaC_barrierback_ (lua_State *L, Table *t) {
   global_State *g = G(L);
   lua_assert(isblack(t) && !isdead(g, t));
   black2gray(t);  /* make table gray (again) */
-  linkgclist(t, g->grayagain);
+  if (!testbits(t->marked, bit2mask(WEAKCLEANBIT, DIRTYBIT)))
+    linkgclist(t, g->grayagain);  /* not in a list yet */
+}
+
+
+/*
+** back barrier for a write into slot 'slot' of table 't'. If the table
+** has cards, only the card of that slot becomes dirty: the table stays
+** black and goes (once) to 'grayagain', where 'propagatemark' will
+** traverse only its dirty slices.
+*/
+void luaC_barriercard_ (lua_State *L, Table *t, const TValue *slot) {
+  global_State *g = G(L);
+  unsigned int c;
+  lua_assert(isblack(t) && !isdead(g, t));
+  if (t->cards == NULL || testbit(t->marked, WEAKCLEANBIT)) {
+    luaC_barrierback_(L, t);
+    return;
+  }
+  if (slot >= t->array && slot < t->array + t->sizearray)
+    c = cast(unsigned int, slot - t->array) >> CARDSHIFT;
+  else {
+    const Node *n = cast(const Node *, slot);  /* 'i_val' comes first */
+    lua_assert(n >= gnode(t, 0) && n < gnodelast(t));
+    c = numcards(t->sizearray) +
+        (cast(unsigned int, n - gnode(t, 0)) >> CARDSHIFT);
+  }
+  t->cards[c] = 1;
+  if (!testbit(t->marked, DIRTYBIT)) {
+    l_setbit(t->marked, DIRTYBIT);
+    linkgclist(t, g->grayagain);
+  }
 }
 
 
 /*
-** barrier for assignments to closed upvalues. Because upvalues are
-** shared among closures, it is impossible to know the color of all
-** closures pointing to it. So, we assume that the object being assigned
-** must be marked.
+** barrier for assignments to upvalues. Because upvalues are shared
+** among closures, it is impossible to know the color of all closures
+** pointing to a closed one. So, we assume that the object being assigned
+** must be marked (and, if local, that it escapes). Open upvalues only
+** get here for local objects, which escape if stored in the stack of
+** another thread.
 */
 void luaC_upvalbarrier_ (lua_State *L, UpVal *uv) {
   global_State *g = G(L);
   GCObject *o = gcvalue(uv->v);
-  lua_assert(!upisopen(uv));  /* ensured by macro luaC_upvalbarrier */
-  if (keepinvariant(g))
-    markobject(g, o);
+  if (upisopen(uv)) {
+    if (!instack(L, uv->v))
+      luaC_escape_(L, o);
+  }
+  else {
+    if (islocal(o))
+      luaC_escape_(L, o);
+    if (keepinvariant(g))
+      markobject(g, o);
+  }
 }
 
 
@@ -203,15 +367,28 @@ void luaC_fix (lua_State *L, GCObject *o) {
 
 /*
 ** create a new collectable object (with given type and size) and link
-** it to 'allgc' list.
+** it to 'allgc' list (or to the list of the thread's arena).
 */
 GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   global_State *g = G(L);
   GCObject *o = cast(GCObject *, luaM_newobject(L, novariant(tt), sz));
   o->marked = luaC_white(g);
   o->tt = tt;
-  o->next = g->allgc;
-  g->allgc = o;
+  g->stats.objects[novariant(tt)]++;
+  luaC_statbytes(g, tt, sz);
+  if (L->arena != NULL && arenatype(tt)) {
+    l_setbit(o->marked, LOCALBIT);
+    o->next = L->arena->objs;
+    L->arena->objs = o;
+  }
+  else if (sz >= LUAI_LARGEOBJ) {  /* large string or userdata? */
+    o->next = g->largegc;
+    g->largegc = o;
+  }
+  else {
+    o->next = g->allgc;
+    g->allgc = o;
+  }
   return o;
 }
 
@@ -234,22 +411,25 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
  reentry:
-  white2gray(o);
+  if (!g->gcpmark)
+    white2gray(o);
+  else if (!claimwhite(o))  /* some other marker got it first? */
+    return;
   switch (o->tt) {
     case LUA_TSHRSTR: {
-      gray2black(o);
+      markblack(g, o);
       g->GCmemtrav += sizelstring(gco2ts(o)->shrlen);
       break;
     }
     case LUA_TLNGSTR: {
-      gray2black(o);
+      markblack(g, o);
       g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
       break;
     }
     case LUA_TUSERDATA: {
       TValue uvalue;
       markobjectN(g, gco2u(o)->metatable);  /* mark its metatable */
-      gray2black(o);
+      markblack(g, o);
       g->GCmemtrav += sizeudata(gco2u(o));
       getuservalue(g->mainthread, gco2u(o), &uvalue);
       if (valiswhite(&uvalue)) {  /* markvalue(g, &uvalue); */
@@ -293,6 +473,26 @@ static void markmt (global_State *g) {
 }
 
 
+/*
+** mark the sources kept by the allocation profiler (new sites may come
+** at any time, so this is done in the atomic step)
+*/
+static void markallocprof (global_State *g) {
+  AllocProf *p = g->allocprof;
+  if (p != NULL) {
+    unsigned int i;
+    for (i = 0; i < p->size; i++) {
+      AllocSite *s;
+      for (s = p->bucket[i]; s != NULL; s = s->next) {
+        int f;
+        for (f = 0; f < s->nframes; f++)
+          markobjectN(g, s->frame[f].source);
+      }
+    }
+  }
+}
+
+
 /*
 ** mark all objects in list of being-finalized
 */
@@ -331,12 +531,37 @@ static void remarkupvals (global_State *g) {
 }
 
 
+/*
+** Tables traversed in the remark step (list 'weakclean') only have to
+** be cleared, unless they changed after that (the barrier turned them
+** gray) or are not weak-value tables any more; these go back to
+** 'grayagain' to be traversed again.
+*/
+static void remarkweak (global_State *g) {
+  GCObject *l = g->weakclean;
+  g->weakclean = NULL;
+  while (l != NULL) {
+    Table *h = gco2t(l);
+    const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+    l = h->gclist;
+    resetbit(h->marked, WEAKCLEANBIT);
+    if (isblack(h) && mode && ttisstring(mode) &&
+        strchr(svalue(mode), 'v') && !strchr(svalue(mode), 'k'))
+      linkgclist(h, g->weak);  /* unchanged; keys are already marked */
+    else {
+      black2gray(h);
+      linkgclist(h, g->grayagain);
+    }
+  }
+}
+
+
 /*
 ** mark root set and reset all gray lists, to start a new collection
 */
 static void restartcollection (global_State *g) {
   g->gray = g->grayagain = NULL;
-  g->weak = g->allweak = g->ephemeron = NULL;
+  g->weak = g->weakclean = g->allweak = g->ephemeron = NULL;
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
@@ -352,6 +577,23 @@ static void restartcollection (global_State *g) {
 ** =======================================================
 */
 
+/*
+** Weak mode of a table with metatable 'mt', as 'gfasttm'. Tables of
+** different markers can share 'mt', so markers only read the cache of
+** absent metamethods in 'mt->flags', never write it.
+*/
+static const TValue *getmode (global_State *g, Table *mt) {
+  if (!g->gcpmark)
+    return gfasttm(g, mt, TM_MODE);
+  else if (mt == NULL || (mt->flags & (1u << TM_MODE)))
+    return NULL;
+  else {
+    const TValue *mode = luaH_getshortstr(mt, g->tmname[TM_MODE]);
+    return ttisnil(mode) ? NULL : mode;
+  }
+}
+
+
 /*
 ** Traverse a table with weak values and link it to proper list. During
 ** propagate phase, keep it in 'grayagain' list, to be revisited in the
@@ -376,6 +618,15 @@ static void traverseweakvalue (global_State *g, Table *h) {
   }
   if (g->gcstate == GCSpropagate)
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
+  else if (g->gcstate == GCSremark) {
+    /* keys are marked; from now on the barrier tells whether the table
+       changes, so the atomic phase need not traverse it again */
+    markblack(g, h);
+    if (hasclears) {  /* still has to be cleared in atomic phase */
+      setmarked(g, h, bitmask(WEAKCLEANBIT));
+      linkgclist(h, g->weakclean);
+    }
+  }
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
 }
@@ -420,7 +671,7 @@ static int traverseephemeron (global_State *g, Table *h) {
     }
   }
   /* link table into proper list */
-  if (g->gcstate == GCSpropagate)
+  if (g->gcstate != GCSinsideatomic)
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasww)  /* table has white->white entries? */
     linkgclist(h, g->ephemeron);  /* have to propagate again */
@@ -430,12 +681,9 @@ static int traverseephemeron (global_State *g, Table *h) {
 }
 
 
-static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
-  unsigned int i;
-  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
-    markvalue(g, &h->array[i]);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+/* mark keys and values of nodes from 'n' up to (not including) 'limit' */
+static void marknodes (global_State *g, Node *n, Node *limit) {
+  for (; n < limit; n++) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
@@ -448,15 +696,25 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+static void traversestrongtable (global_State *g, Table *h) {
+  unsigned int i;
+  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
+    markvalue(g, &h->array[i]);
+  marknodes(g, gnode(h, 0), gnodelast(h));  /* traverse hash part */
+}
+
+
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
-  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  const TValue *mode = getmode(g, h->metatable);
   markobjectN(g, h->metatable);
+  if (h->cards != NULL)  /* whole table will be traversed */
+    memset(h->cards, 0, cardsof(h));
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
       ((weakkey = strchr(svalue(mode), 'k')),
        (weakvalue = strchr(svalue(mode), 'v')),
        (weakkey || weakvalue))) {  /* is really weak? */
-    black2gray(h);  /* keep table gray */
+    markgray(g, h);  /* keep table gray */
     if (!weakkey)  /* strong keys? */
       traverseweakvalue(g, h);
     else if (!weakvalue)  /* strong values? */
@@ -471,6 +729,43 @@ static lu_mem traversetable (global_State *g, Table *h) {
 }
 
 
+/*
+** Traverse only the dirty slices of a black table (see
+** 'luaC_barriercard_'). Weak tables, and tables that lost their cards
+** when resized, are traversed whole.
+*/
+static lu_mem traversecards (global_State *g, Table *h) {
+  unsigned int c, nc, nac;
+  lu_mem work = sizeof(Table);
+  if (h->cards == NULL || getmode(g, h->metatable) != NULL)
+    return traversetable(g, h);
+  nac = numcards(h->sizearray);
+  nc = cardsof(h);
+  for (c = 0; c < nc; c++) {
+    if (h->cards[c]) {
+      h->cards[c] = 0;
+      if (c < nac) {  /* slice of the array part */
+        unsigned int i = c << CARDSHIFT;
+        unsigned int lim = (h->sizearray - i < CARDSIZE) ? h->sizearray
+                                                         : i + CARDSIZE;
+        for (; i < lim; i++)
+          markvalue(g, &h->array[i]);
+        work += sizeof(TValue) * CARDSIZE;
+      }
+      else {  /* slice of the hash part */
+        Node *n = gnode(h, (c - nac) << CARDSHIFT);
+        Node *limit = gnodelast(h);
+        if (limit - n > cast_int(CARDSIZE))
+          limit = n + CARDSIZE;
+        marknodes(g, n, limit);
+        work += sizeof(Node) * CARDSIZE;
+      }
+    }
+  }
+  return work;
+}
+
+
 /*
 ** Traverse a prototype. (While a prototype is being build, its
 ** arrays can be larger than needed; the extra slots are filled with
@@ -480,6 +775,11 @@ static int traverseproto (global_State *g, Proto *f) {
   int i;
   if (f->cache && iswhite(f->cache))
     f->cache = NULL;  /* allow cache to be collected */
+  for (i = 0; i < f->sizetabsites; i++) {  /* table sites are weak, too */
+    Table *t = f->tabsites[i].last;
+    if (t && iswhite(t))
+      f->tabsites[i].last = NULL;
+  }
   markobjectN(g, f->source);
   for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
@@ -494,7 +794,11 @@ static int traverseproto (global_State *g, Proto *f) {
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
                          sizeof(LocVar) * f->sizelocvars +
-                         sizeof(Upvaldesc) * f->sizeupvalues;
+                         sizeof(InlineInfo) * f->sizeinlines +
+                         sizeof(Upvaldesc) * f->sizeupvalues +
+                         sizeof(TabSite) * f->sizetabsites +
+                         sizeof(unsigned int) * f->sizekslot +
+                         f->sizefeedback;
 }
 
 
@@ -518,7 +822,7 @@ static lu_mem traverseLclosure (global_State *g, LClosure *cl) {
     UpVal *uv = cl->upvals[i];
     if (uv != NULL) {
       if (upisopen(uv) && g->gcstate != GCSinsideatomic)
-        uv->u.open.touched = 1;  /* can be marked in 'remarkupvals' */
+        settouched(g, uv);  /* can be marked in 'remarkupvals' */
       else
         markvalue(g, uv->v);
     }
@@ -545,8 +849,9 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  else if (g->gckind != KGC_EMERGENCY)
+  else if (g->gckind != KGC_EMERGENCY && !g->gcpmark)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
+  /* (markers cannot reallocate; 'joinmarker' shrinks them instead) */
   return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
           sizeof(CallInfo) * th->nci);
 }
@@ -559,12 +864,21 @@ static lu_mem traversethread (global_State *g, lua_State *th) {
 static void propagatemark (global_State *g) {
   lu_mem size;
   GCObject *o = g->gray;
+  if (isblack(o)) {  /* a table with dirty cards? */
+    Table *h = gco2t(o);
+    lua_assert(o->tt == LUA_TTABLE && testbit(o->marked, DIRTYBIT));
+    g->gray = h->gclist;  /* remove from 'gray' list */
+    resetmarked(g, o, bitmask(DIRTYBIT));
+    g->GCmemtrav += traversecards(g, h);
+    return;
+  }
   lua_assert(isgray(o));
-  gray2black(o);
+  markblack(g, o);
   switch (o->tt) {
     case LUA_TTABLE: {
       Table *h = gco2t(o);
       g->gray = h->gclist;  /* remove from 'gray' list */
+      resetmarked(g, o, bitmask(DIRTYBIT));  /* will be traversed whole */
       size = traversetable(g, h);
       break;
     }
@@ -584,7 +898,7 @@ static void propagatemark (global_State *g) {
       lua_State *th = gco2th(o);
       g->gray = th->gclist;  /* remove from 'gray' list */
       linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
-      black2gray(o);
+      markgray(g, o);
       size = traversethread(g, th);
       break;
     }
@@ -600,7 +914,21 @@ static void propagatemark (global_State *g) {
 }
 
 
+/*
+** Traverse all gray objects. A long traversal (which can only happen
+** in a non-incremental step) is finished in parallel when there are
+** marker threads.
+*/
 static void propagateall (global_State *g) {
+#if defined(LUAI_PARMARK)
+  if (g->gcpool != NULL) {
+    int n = 0;
+    while (g->gray && n++ < GCPARSERIAL)
+      propagatemark(g);
+    if (g->gray)
+      parallelmark(g);
+  }
+#endif
   while (g->gray) propagatemark(g);
 }
 
@@ -625,6 +953,311 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if defined(LUAI_PARMARK)
+
+/* how often (in objects traversed) a marker checks for idle markers */
+#define GCSHARESTEP	32
+
+/* maximum number of gray lists waiting in the pool */
+#define GCMAXCHUNKS	64
+
+/* maximum number of marker threads */
+#define GCMAXTHREADS	64
+
+
+/*
+** Each marker runs the ordinary traversal functions over a private
+** copy of the global state (with 'gcpmark' set), so that its gray
+** lists and its count of traversed memory are its own. The objects
+** themselves are shared: a white object goes to the marker that
+** claims it (see 'claimwhite'), and only that marker changes it.
+** Colors read without synchronization are only hints: a marker that
+** sees a stale white just fails to claim the object.
+*/
+typedef struct GCMarker {
+  global_State g;  /* private copy of the global state */
+  struct GCPool *pool;
+  pthread_t thread;
+} GCMarker;
+
+
+typedef struct GCPool {
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* signals helpers a new round (or to quit) */
+  pthread_cond_t work;  /* signals new shared work (or end of round) */
+  pthread_cond_t done;  /* signals that all helpers ended the round */
+  unsigned long round;  /* number of current round */
+  int quit;  /* true when helpers must exit */
+  int size;  /* number of entries in 'marker' */
+  int n;  /* number of markers (helpers plus the main thread) */
+  int nidle;  /* markers without work in current round */
+  int nhungry;  /* markers waiting for shared work (read without lock) */
+  int nfinished;  /* helpers that finished current round */
+  int nchunks;  /* number of gray lists in 'chunk' */
+  GCObject *chunk[GCMAXCHUNKS];  /* gray lists shared by busy markers */
+  GCMarker marker[1];  /* markers; the first one is the main thread */
+} GCPool;
+
+
+#define sizepool(n)	(sizeof(GCPool) + cast(size_t, (n) - 1) * sizeof(GCMarker))
+
+
+/*
+** address of the field linking a gray object into its gray list
+*/
+static GCObject **getgclist (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+/*
+** Give all but the first object of the gray list of marker 'g' to
+** the pool, for some idle marker to take
+*/
+static void sharework (GCPool *pool, global_State *g) {
+  GCObject **rest = getgclist(g->gray);
+  if (*rest == NULL)
+    return;  /* nothing to share */
+  pthread_mutex_lock(&pool->lock);
+  if (pool->nchunks < GCMAXCHUNKS) {
+    pool->chunk[pool->nchunks++] = *rest;
+    *rest = NULL;
+    pthread_cond_signal(&pool->work);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+
+/*
+** Marking loop of each marker: traverse its own gray list, sharing it
+** when other markers are idle, and take shared work when it runs out
+** of it. The round ends when all markers are idle with no shared work
+** left.
+*/
+static void markloop (GCPool *pool, global_State *g) {
+  for (;;) {
+    int n = 0;
+    while (g->gray) {
+      propagatemark(g);
+      if (++n % GCSHARESTEP == 0 && g->gray &&
+          __atomic_load_n(&pool->nhungry, __ATOMIC_RELAXED) > 0)
+        sharework(pool, g);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->nidle++;
+    while (pool->nchunks == 0 && pool->nidle < pool->n) {
+      __atomic_add_fetch(&pool->nhungry, 1, __ATOMIC_RELAXED);
+      pthread_cond_wait(&pool->work, &pool->lock);
+      __atomic_sub_fetch(&pool->nhungry, 1, __ATOMIC_RELAXED);
+    }
+    if (pool->nchunks == 0) {  /* everybody idle? */
+      pthread_cond_broadcast(&pool->work);  /* round is over */
+      pthread_mutex_unlock(&pool->lock);
+      return;
+    }
+    g->gray = pool->chunk[--pool->nchunks];
+    pool->nidle--;
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+
+static void *markerthread (void *ud) {
+  GCMarker *m = cast(GCMarker *, ud);
+  GCPool *pool = m->pool;
+  unsigned long round = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->round == round && !pool->quit)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->quit)
+      break;
+    round = pool->round;
+    pthread_mutex_unlock(&pool->lock);
+    markloop(pool, &m->g);
+    pthread_mutex_lock(&pool->lock);
+    if (++pool->nfinished == pool->n - 1)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+
+/*
+** put the objects in list 'l' (linked through 'gclist') in front of
+** list 'p'
+*/
+static void joinlist (GCObject **p, GCObject *l) {
+  if (l != NULL) {
+    GCObject *o = l;
+    GCObject **next;
+    while (*(next = getgclist(o)) != NULL)
+      o = *next;
+    *next = *p;
+    *p = l;
+  }
+}
+
+
+/*
+** Move into the global state what marker 'mg' has collected: its
+** traversed memory and its lists of objects to be revisited (which
+** all started empty). Stacks of threads seen in the propagate phase
+** are shrunk here, as 'traversethread' does not do that in markers.
+*/
+static void joinmarker (global_State *g, global_State *mg) {
+  lua_State *th;
+  g->GCmemtrav += mg->GCmemtrav;
+  if (g->gcstate != GCSinsideatomic && g->gckind != KGC_EMERGENCY) {
+    GCObject *o;
+    for (o = mg->grayagain; o != NULL; o = *getgclist(o)) {
+      if (o->tt == LUA_TTHREAD)
+        luaD_shrinkstack(gco2th(o));
+    }
+  }
+  lua_assert(mg->gray == NULL);
+  joinlist(&g->grayagain, mg->grayagain);
+  joinlist(&g->weak, mg->weak);
+  joinlist(&g->weakclean, mg->weakclean);
+  joinlist(&g->allweak, mg->allweak);
+  joinlist(&g->ephemeron, mg->ephemeron);
+  if ((th = mg->twups) != NULL) {  /* threads relinked in atomic phase */
+    while (th->twups != NULL)
+      th = th->twups;
+    th->twups = g->twups;
+    g->twups = mg->twups;
+  }
+}
+
+
+/*
+** Traverse all gray objects with all markers in 'g->gcpool': the main
+** thread gets the gray list, and helpers get parts of it as they go.
+*/
+static void parallelmark (global_State *g) {
+  GCPool *pool = g->gcpool;
+  int i;
+  for (i = 0; i < pool->n; i++) {
+    global_State *mg = &pool->marker[i].g;
+    *mg = *g;
+    mg->gcpmark = 1;
+    mg->gray = mg->grayagain = NULL;
+    mg->weak = mg->allweak = mg->ephemeron = NULL;
+    mg->twups = NULL;
+    mg->GCmemtrav = 0;
+  }
+  pool->marker[0].g.gray = g->gray;
+  g->gray = NULL;
+  pthread_mutex_lock(&pool->lock);
+  pool->nidle = pool->nhungry = pool->nfinished = pool->nchunks = 0;
+  pool->round++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  markloop(pool, &pool->marker[0].g);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->nfinished < pool->n - 1)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->n; i++)
+    joinmarker(g, &pool->marker[i].g);
+}
+
+
+static void stopmarkers (lua_State *L, GCPool *pool) {
+  int i;
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 1; i < pool->n; i++)
+    pthread_join(pool->marker[i].thread, NULL);
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  luaM_freemem(L, pool, sizepool(pool->size));
+}
+
+
+/*
+** Create a pool with 'n' markers (or fewer, if the system cannot
+** create that many threads). Helpers block all signals, which are
+** left to the threads of the application.
+*/
+static GCPool *startmarkers (lua_State *L, int n) {
+  GCPool *pool = cast(GCPool *, luaM_malloc(L, sizepool(n)));
+  sigset_t all, old;
+  int i;
+  memset(pool, 0, sizepool(n));
+  pool->size = n;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (i = 1; i < n; i++) {
+    pool->marker[i].pool = pool;
+    if (pthread_create(&pool->marker[i].thread, NULL, markerthread,
+                       &pool->marker[i]) != 0)
+      break;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pool->n = i;  /* number of threads actually created, plus this one */
+  if (i == 1) {  /* could not create any thread? */
+    stopmarkers(L, pool);
+    return NULL;
+  }
+  return pool;
+}
+
+#endif
+
+
+/*
+** Set the number of threads used to mark objects (including the one
+** running the collector) and return the previous number. Without
+** support for threads, that is always 1.
+*/
+int luaC_gcthreads (lua_State *L, int n) {
+#if defined(LUAI_PARMARK)
+  global_State *g = G(L);
+  int old = (g->gcpool != NULL) ? g->gcpool->n : 1;
+  if (n > GCMAXTHREADS) n = GCMAXTHREADS;
+  if (n > 0 && n != old) {
+    if (g->gcpool != NULL) {
+      GCPool *pool = g->gcpool;
+      g->gcpool = NULL;
+      stopmarkers(L, pool);
+    }
+    if (n > 1)
+      g->gcpool = startmarkers(L, n);
+  }
+  return old;
+#else
+  UNUSED(L); UNUSED(n);
+  return 1;
+#endif
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -695,29 +1328,40 @@ static void freeLclosure (lua_State *L, LClosure *cl) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
-  switch (o->tt) {
-    case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
+  global_State *g = G(L);
+  int tt = o->tt;
+  size_t sz;  /* size given to 'luaC_newobj' */
+  switch (tt) {
+    case LUA_TPROTO: sz = sizeof(Proto); luaF_freeproto(L, gco2p(o)); break;
     case LUA_TLCL: {
+      sz = sizeLclosure(gco2lcl(o)->nupvalues);
       freeLclosure(L, gco2lcl(o));
       break;
     }
     case LUA_TCCL: {
-      luaM_freemem(L, o, sizeCclosure(gco2ccl(o)->nupvalues));
+      sz = sizeCclosure(gco2ccl(o)->nupvalues);
+      luaM_freemem(L, o, sz);
       break;
     }
-    case LUA_TTABLE: luaH_free(L, gco2t(o)); break;
-    case LUA_TTHREAD: luaE_freethread(L, gco2th(o)); break;
-    case LUA_TUSERDATA: luaM_freemem(L, o, sizeudata(gco2u(o))); break;
+    case LUA_TTABLE: sz = sizeof(Table); luaH_free(L, gco2t(o)); break;
+    case LUA_TTHREAD:  /* accounted by 'luaE_freethread' */
+      luaE_freethread(L, gco2th(o));
+      return;
+    case LUA_TUSERDATA: sz = sizeudata(gco2u(o)); luaM_freemem(L, o, sz); break;
     case LUA_TSHRSTR:
+      sz = sizelstring(gco2ts(o)->shrlen);
       luaS_remove(L, gco2ts(o));  /* remove it from hash table */
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
+      luaM_freemem(L, o, sz);
       break;
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+      sz = sizelstring(gco2ts(o)->u.lnglen);
+      luaM_freemem(L, o, sz);
       break;
     }
-    default: lua_assert(0);
+    default: lua_assert(0); return;
   }
+  g->stats.objects[novariant(tt)]--;
+  luaC_statbytes(g, tt, -cast(l_mem, sz));
 }
 
 
@@ -739,6 +1383,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
   while (*p != NULL && count-- > 0) {
     GCObject *curr = *p;
     int marked = curr->marked;
+    g->stats.swept++;
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
@@ -766,6 +1411,451 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Background freeing
+** =======================================================
+*/
+
+#if defined(LUA_USE_PTHREADS)
+
+/*
+** A block waiting to be freed; its own memory holds the link
+*/
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+  size_t size;
+} FreeBlock;
+
+
+/*
+** While a sweep step runs with 'gcdeferfree' set, 'luaM_realloc_'
+** gives the blocks it frees to 'luaC_deferfree', which accounts for
+** them at once but only collects them in 'batch'. At the end of the
+** step, 'sendfrees' moves the batch to 'queue', where a helper thread
+** takes it to call the allocator. (So, that allocator must accept
+** being called from several threads.)
+*/
+typedef struct GCFreer {
+  global_State *g;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* signals new blocks in 'queue' (or to quit) */
+  pthread_cond_t idle;  /* signals that helper freed all it had */
+  int quit;  /* true when helper must exit */
+  int busy;  /* true while helper is freeing blocks out of 'queue' */
+  FreeBlock *queue;  /* blocks for the helper */
+  FreeBlock *batch;  /* blocks from current sweep step */
+  FreeBlock *batchlast;  /* last block in 'batch' */
+} GCFreer;
+
+
+static void freeblocks (global_State *g, FreeBlock *b) {
+  while (b != NULL) {
+    FreeBlock *next = b->next;
+    (*g->frealloc)(g->ud, b, b->size, 0);
+    b = next;
+  }
+}
+
+
+static void *freerthread (void *ud) {
+  GCFreer *f = cast(GCFreer *, ud);
+  global_State *g = f->g;
+  pthread_mutex_lock(&f->lock);
+  for (;;) {
+    FreeBlock *b;
+    while (f->queue == NULL && !f->quit)
+      pthread_cond_wait(&f->work, &f->lock);
+    if (f->queue == NULL)  /* quitting with nothing left to free? */
+      break;
+    b = f->queue;
+    f->queue = NULL;
+    f->busy = 1;
+    pthread_mutex_unlock(&f->lock);
+    freeblocks(g, b);
+    pthread_mutex_lock(&f->lock);
+    f->busy = 0;
+    if (f->queue == NULL)
+      pthread_cond_broadcast(&f->idle);
+  }
+  pthread_mutex_unlock(&f->lock);
+  return NULL;
+}
+
+
+void *luaC_deferfree (global_State *g, void *block, size_t osize) {
+  GCFreer *f = g->gcfreer;
+  if (block == NULL || osize < sizeof(FreeBlock))  /* too small? */
+    (*g->frealloc)(g->ud, block, osize, 0);  /* free it right now */
+  else {
+    FreeBlock *b = cast(FreeBlock *, block);
+    b->size = osize;
+    b->next = f->batch;
+    if (f->batch == NULL)
+      f->batchlast = b;
+    f->batch = b;
+  }
+  return NULL;
+}
+
+
+/*
+** move blocks collected by the last sweep step to the helper
+*/
+static void sendfrees (global_State *g) {
+  GCFreer *f = g->gcfreer;
+  if (f != NULL && f->batch != NULL) {
+    pthread_mutex_lock(&f->lock);
+    f->batchlast->next = f->queue;
+    f->queue = f->batch;
+    pthread_cond_signal(&f->work);
+    pthread_mutex_unlock(&f->lock);
+    f->batch = NULL;
+  }
+}
+
+
+/*
+** wait until the helper has freed all blocks given to it
+*/
+void luaC_waitfrees (global_State *g) {
+  GCFreer *f = g->gcfreer;
+  if (f != NULL) {
+    pthread_mutex_lock(&f->lock);
+    while (f->queue != NULL || f->busy)
+      pthread_cond_wait(&f->idle, &f->lock);
+    pthread_mutex_unlock(&f->lock);
+  }
+}
+
+
+static void stopfreer (lua_State *L, GCFreer *f) {
+  pthread_mutex_lock(&f->lock);
+  f->quit = 1;
+  pthread_cond_signal(&f->work);
+  pthread_mutex_unlock(&f->lock);
+  pthread_join(f->thread, NULL);  /* helper frees what is left */
+  pthread_cond_destroy(&f->idle);
+  pthread_cond_destroy(&f->work);
+  pthread_mutex_destroy(&f->lock);
+  luaM_free(L, f);
+}
+
+
+static GCFreer *startfreer (lua_State *L) {
+  global_State *g = G(L);
+  GCFreer *f = luaM_new(L, GCFreer);
+  sigset_t all, old;
+  int res;
+  memset(f, 0, sizeof(GCFreer));
+  f->g = g;
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_cond_init(&f->work, NULL);
+  pthread_cond_init(&f->idle, NULL);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  res = pthread_create(&f->thread, NULL, freerthread, f);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (res != 0) {  /* could not create thread? */
+    pthread_cond_destroy(&f->idle);
+    pthread_cond_destroy(&f->work);
+    pthread_mutex_destroy(&f->lock);
+    luaM_free(L, f);
+    return NULL;
+  }
+  return f;
+}
+
+#else
+
+void *luaC_deferfree (global_State *g, void *block, size_t osize) {
+  return (*g->frealloc)(g->ud, block, osize, 0);
+}
+
+#define sendfrees(g)		((void)0)
+void luaC_waitfrees (global_State *g) { UNUSED(g); }
+
+#endif
+
+
+/*
+** Turn on or off ('on' < 0 leaves it as it is) the freeing of swept
+** objects by a helper thread and return whether it was on. Without
+** support for threads, it is always off.
+*/
+int luaC_sweepthread (lua_State *L, int on) {
+#if defined(LUA_USE_PTHREADS)
+  global_State *g = G(L);
+  int old = (g->gcfreer != NULL);
+  if (on >= 0 && on != old) {
+    if (old) {
+      GCFreer *f = g->gcfreer;
+      g->gcfreer = NULL;
+      stopfreer(L, f);
+    }
+    else
+      g->gcfreer = startfreer(L);
+  }
+  return old;
+#else
+  UNUSED(L); UNUSED(on);
+  return 0;
+#endif
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Arenas
+** =======================================================
+*/
+
+/*
+** State of a traversal making local objects escape. 'push' is false
+** while 'escapeall' runs, which needs no work list.
+*/
+typedef struct Escape {
+  global_State *g;
+  int n;  /* number of objects in 'g->arenastack' */
+  int push;  /* whether to keep escaped objects in the work list */
+  int failed;  /* some escaped object could not be kept in the list */
+  int changed;  /* some object escaped */
+} Escape;
+
+
+/*
+** The work list is allocated directly with 'frealloc': a barrier must
+** not trigger a collection nor raise an error.
+*/
+static int growarenastack (global_State *g) {
+  int size = (g->sizearenastack == 0) ? 64 : 2 * g->sizearenastack;
+  GCObject **s = cast(GCObject **, (*g->frealloc)(g->ud, g->arenastack,
+                        g->sizearenastack * sizeof(GCObject *),
+                        size * sizeof(GCObject *)));
+  if (s == NULL || size <= g->sizearenastack)
+    return 0;
+  g->arenastack = s;
+  g->sizearenastack = size;
+  return 1;
+}
+
+
+static void escapeobj (Escape *e, GCObject *o) {
+  if (islocal(o)) {
+    resetbit(o->marked, LOCALBIT);
+    e->changed = 1;
+    if (!e->push)
+      return;
+    if (e->n < e->g->sizearenastack || growarenastack(e->g))
+      e->g->arenastack[e->n++] = o;
+    else
+      e->failed = 1;  /* 'escapeall' will visit it */
+  }
+}
+
+
+#define escapevalue(e,v)  \
+	{ if (iscollectable(v)) escapeobj(e, gcvalue(v)); }
+
+
+/*
+** Lua closures have nothing to visit: closed upvalues never hold
+** local objects, and open ones live in a stack.
+*/
+static void escaperefs (Escape *e, GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      Node *n, *limit = gnodelast(h);
+      unsigned int i;
+      if (h->metatable)
+        escapeobj(e, obj2gco(h->metatable));
+      for (i = 0; i < h->sizearray; i++)
+        escapevalue(e, &h->array[i]);
+      for (n = gnode(h, 0); n < limit; n++) {
+        escapevalue(e, gkey(n));  /* dead keys are not collectable */
+        escapevalue(e, gval(n));
+      }
+      break;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        escapevalue(e, &cl->upvalue[i]);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Slow path for when the work list cannot grow: escaped objects stay
+** in their arena lists until the arena is popped, so visit all of them
+** again and again until no local object is left behind.
+*/
+static void escapeall (global_State *g) {
+  Escape e;
+  e.g = g; e.push = 0;
+  do {
+    Arena *a;
+    e.changed = 0;
+    for (a = g->arenas; a != NULL; a = a->next) {
+      GCObject *o;
+      for (o = a->objs; o != NULL; o = o->next) {
+        if (!islocal(o))
+          escaperefs(&e, o);
+      }
+    }
+  } while (e.changed);
+}
+
+
+/*
+** Make local object 'o', and all local objects reachable from it, no
+** longer local, so that its arena will keep them.
+*/
+void luaC_escape_ (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  Escape e;
+  e.g = g; e.n = 0; e.push = 1; e.failed = 0;
+  escapeobj(&e, o);
+  while (e.n > 0)
+    escaperefs(&e, g->arenastack[--e.n]);
+  if (e.failed)
+    escapeall(g);
+}
+
+
+/*
+** a thread read an open upvalue; the value escapes if it came from
+** the stack of another thread
+*/
+void luaC_upvalread_ (lua_State *L, UpVal *uv) {
+  if (!instack(L, uv->v))
+    luaC_escape_(L, gcvalue(uv->v));
+}
+
+
+void luaC_pusharena (lua_State *L) {
+  global_State *g = G(L);
+  Arena *a = L->arena;
+  if (a == NULL) {
+    a = luaM_new(L, Arena);
+    a->L = L;
+    a->objs = NULL;
+    a->depth = 0;
+    a->spoiled = 0;
+    a->previous = NULL;
+    a->next = g->arenas;
+    if (g->arenas)
+      g->arenas->previous = a;
+    g->arenas = a;
+    L->arena = a;
+  }
+  a->depth++;
+}
+
+
+/*
+** Remove arena 'a' from its thread, freeing its local objects (unless it
+** is spoiled) and moving all others to 'allgc'. Returns the number of
+** objects freed.
+*/
+static int releasearena (lua_State *L, Arena *a) {
+  global_State *g = G(L);
+  GCObject *o, *next;
+  int nfreed = 0;
+  if (a->previous)
+    a->previous->next = a->next;
+  else
+    g->arenas = a->next;
+  if (a->next)
+    a->next->previous = a->previous;
+  a->L->arena = NULL;
+  for (o = a->objs; o != NULL; o = next) {
+    next = o->next;
+    if (islocal(o) && !a->spoiled) {
+      freeobj(L, o);
+      nfreed++;
+    }
+    else {
+      resetbit(o->marked, LOCALBIT);
+      o->next = g->allgc;
+      g->allgc = o;
+    }
+  }
+  luaM_free(L, a);
+  return nfreed;
+}
+
+
+/*
+** Pop the arena of thread 'L'. Objects still reachable from its stack
+** survive; while the collector is marking, so do objects it has
+** already reached (they may be in gray lists). Everything else that
+** never escaped is unreachable and is freed right away.
+*/
+int luaC_poparena (lua_State *L) {
+  global_State *g = G(L);
+  Arena *a = L->arena;
+  lua_assert(a != NULL && a->depth > 0);
+  if (--a->depth > 0)
+    return 0;  /* nested arenas are merged with the outermost one */
+  if (!a->spoiled) {
+    StkId v;
+    for (v = L->stack; v < L->top; v++)
+      luaC_escape(L, v);
+    if (keepinvariant(g)) {
+      GCObject *o;
+      for (o = a->objs; o != NULL; o = o->next) {
+        if (!iswhite(o))
+          luaC_escape_(L, o);
+      }
+    }
+  }
+  return releasearena(L, a);
+}
+
+
+/*
+** Thread 'L1' is being freed (or the state closed) with an arena still
+** active: its objects may still be in use elsewhere, so keep them all.
+*/
+void luaC_closearena (lua_State *L, lua_State *L1) {
+  Arena *a = L1->arena;
+  a->spoiled = 1;
+  releasearena(L, a);
+}
+
+
+/*
+** find the pointer to object 'o' in the list of its arena, or NULL if it
+** is in no arena. (Objects that escaped stay in their arena lists, and
+** nothing else marks them as arena objects.)
+*/
+static GCObject **findinarena (global_State *g, GCObject *o) {
+  Arena *a;
+  if (!arenatype(o->tt))
+    return NULL;
+  for (a = g->arenas; a != NULL; a = a->next) {
+    GCObject **p;
+    for (p = &a->objs; *p != NULL; p = &(*p)->next) {
+      if (*p == o)
+        return p;
+    }
+  }
+  lua_assert(!islocal(o));  /* local objects are in their arenas */
+  return NULL;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Finalization
@@ -789,6 +1879,7 @@ static GCObject *udata2finalize (global_State *g) {
   GCObject *o = g->tobefnz;  /* get first element */
   lua_assert(tofinalize(o));
   g->tobefnz = o->next;  /* remove it from 'tobefnz' list */
+  g->stats.finpending--;
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
@@ -812,6 +1903,7 @@ static void GCTM (lua_State *L, int propagateerrors) {
   tm = luaT_gettmbyobj(L, &v, TM_GC);
   if (tm != NULL && ttisfunction(tm)) {  /* is there a finalizer? */
     int status;
+    lu_mem t0, dt;
     lu_byte oldah = L->allowhook;
     int running  = g->gcrunning;
     L->allowhook = 0;  /* stop debug hooks during GC metamethod */
@@ -820,8 +1912,14 @@ static void GCTM (lua_State *L, int propagateerrors) {
     setobj2s(L, L->top + 1, &v);  /* ... and its argument */
     L->top += 2;  /* and (next line) call the finalizer */
     L->ci->callstatus |= CIST_FIN;  /* will run a finalizer */
+    t0 = gcclock();
     status = luaD_pcall(L, dothecall, NULL, savestack(L, L->top - 2), 0);
+    dt = gcclock() - t0;
     L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
+    g->stats.finalizers++;
+    g->stats.fintime += dt;
+    if (dt > g->stats.finmaxtime)
+      g->stats.finmaxtime = dt;
     L->allowhook = oldah;  /* restore hooks */
     g->gcrunning = running;  /* restore state */
     if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
@@ -839,12 +1937,28 @@ static void GCTM (lua_State *L, int propagateerrors) {
 
 
 /*
-** call a few (up to 'g->gcfinnum') finalizers
+** call a few finalizers: up to 'g->gcfinnum' of them or, if there is a
+** time budget, as many as fit in it. The budget grows with the backlog
+** so that finalization keeps up with a program creating finalizable
+** objects faster than the budget can handle.
 */
 static int runafewfinalizers (lua_State *L) {
   global_State *g = G(L);
   unsigned int i;
   lua_assert(!g->tobefnz || g->gcfinnum > 0);
+  if (g->gcfinbudget > 0 && g->tobefnz != NULL) {  /* bounded by time? */
+    lu_mem scale = 1 + g->stats.finpending / FINBACKLOG;
+    lu_mem budget = cast(lu_mem, g->gcfinbudget) *
+                    ((scale < FINMAXSCALE) ? scale : FINMAXSCALE);
+    lu_mem t0 = gcclock();
+    for (i = 0; g->tobefnz; i++) {
+      if (i > 0 && gcclock() - t0 >= budget)  /* budget spent? */
+        break;  /* (but always make some progress) */
+      GCTM(L, 1);  /* call one finalizer */
+    }
+    g->gcfinnum = (!g->tobefnz) ? 0 : 1;
+    return i;
+  }
   for (i = 0; g->tobefnz && i < g->gcfinnum; i++)
     GCTM(L, 1);  /* call one finalizer */
   g->gcfinnum = (!g->tobefnz) ? 0  /* nothing more to finalize? */
@@ -890,6 +2004,7 @@ static void separatetobefnz (global_State *g, int all) {
       curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
       *lastnext = curr;
       lastnext = &curr->next;
+      g->stats.finpending++;
     }
   }
 }
@@ -912,8 +2027,13 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
         g->sweepgc = sweeptolive(L, g->sweepgc);  /* change 'sweepgc' */
     }
     /* search for pointer pointing to 'o' */
-    for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
-    *p = o->next;  /* remove 'o' from 'allgc' list */
+    if (islocal(o))
+      luaC_escape_(L, o);  /* arenas never free objects with finalizers */
+    if ((p = findinarena(g, o)) == NULL) {  /* not in an arena? */
+      p = islargeobj(o) ? &g->largegc : &g->allgc;
+      for (; *p != o; p = &(*p)->next) { /* empty */ }
+    }
+    *p = o->next;  /* remove 'o' from its list */
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
@@ -958,14 +2078,21 @@ static void setpause (global_State *g) {
 */
 static void entersweep (lua_State *L) {
   global_State *g = G(L);
+  Arena *a;
   g->gcstate = GCSswpallgc;
   lua_assert(g->sweepgc == NULL);
+  /* large objects are few; free the dead ones right now */
+  sweepwholelist(L, &g->largegc);
+  for (a = g->arenas; a != NULL; a = a->next)  /* arenas too */
+    sweepwholelist(L, &a->objs);
   g->sweepgc = sweeplist(L, &g->allgc, 1);
 }
 
 
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  while (g->arenas != NULL)  /* move all arena objects to 'allgc' */
+    luaC_closearena(L, g->arenas->L);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
@@ -974,8 +2101,13 @@ void luaC_freeallobjects (lua_State *L) {
   g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
+  sweepwholelist(L, &g->largegc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
   lua_assert(g->strt.nuse == 0);
+  (*g->frealloc)(g->ud, g->arenastack,
+                 g->sizearenastack * sizeof(GCObject *), 0);
+  g->arenastack = NULL;
+  g->sizearenastack = 0;
 }
 
 
@@ -983,15 +2115,18 @@ static l_mem atomic (lua_State *L) {
   global_State *g = G(L);
   l_mem work;
   GCObject *origweak, *origall;
-  GCObject *grayagain = g->grayagain;  /* save original list */
+  GCObject *grayagain;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
+  remarkweak(g);
+  grayagain = g->grayagain;  /* save original list */
   g->GCmemtrav = 0;  /* start counting work */
   markobject(g, L);  /* mark running thread */
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  markallocprof(g);
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
   propagateall(g);  /* propagate changes */
@@ -1030,7 +2165,10 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
                          int nextstate, GCObject **nextlist) {
   if (g->sweepgc) {
     l_mem olddebt = g->GCdebt;
+    g->gcdeferfree = (g->gcfreer != NULL);
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+    g->gcdeferfree = 0;
+    sendfrees(g);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
     if (g->sweepgc)  /* is there still something to sweep? */
       return (GCSWEEPMAX * GCSWEEPCOST);
@@ -1055,14 +2193,33 @@ static lu_mem singlestep (lua_State *L) {
       g->GCmemtrav = 0;
       lua_assert(g->gray);
       propagatemark(g);
-       if (g->gray == NULL)  /* no more gray objects? */
-        g->gcstate = GCSatomic;  /* finish propagate phase */
+      if (g->gray == NULL) {  /* no more gray objects? */
+        /* traverse again, incrementally, what was touched meanwhile,
+           so that the atomic step finds most of it already marked */
+        g->gray = g->grayagain;
+        g->grayagain = NULL;
+        g->gcstate = GCSremark;
+      }
+      g->stats.markbytes += g->GCmemtrav;
       return g->GCmemtrav;  /* memory traversed in this step */
     }
+    case GCSremark: {
+      g->GCmemtrav = 0;
+      if (g->gray != NULL)
+        propagatemark(g);
+      if (g->gray == NULL)  /* no more gray objects? */
+        g->gcstate = GCSatomic;  /* finish propagate phase */
+      g->stats.markbytes += g->GCmemtrav;
+      return g->GCmemtrav;
+    }
     case GCSatomic: {
       lu_mem work;
+      lu_mem t0;
       propagateall(g);  /* make sure gray list is empty */
+      t0 = gcclock();
       work = atomic(L);  /* work is what was traversed by 'atomic' */
+      g->gcatomictime = gcclock() - t0;
+      g->stats.markbytes += work;
       entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */;
       return work;
@@ -1089,6 +2246,7 @@ static lu_mem singlestep (lua_State *L) {
       }
       else {  /* emergency mode or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        g->stats.cycles++;
         return 0;
       }
     }
@@ -1135,6 +2293,7 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  g->stats.steps++;
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1168,10 +2327,16 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+  g->GCmemtrav = 0;
+  propagateall(g);  /* mark everything in one go */
+  g->stats.markbytes += g->GCmemtrav;
+  g->gcstate = GCSatomic;
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
+  if (isemergency)
+    luaC_waitfrees(g);  /* memory must be really free */
   g->gckind = KGC_NORMAL;
   setpause(g);
 }
@@ -37,13 +37,14 @@
 ** Possible states of the Garbage Collector
 */
 #define GCSpropagate	0
-#define GCSatomic	1
-#define GCSswpallgc	2
-#define GCSswpfinobj	3
-#define GCSswptobefnz	4
-#define GCSswpend	5
-#define GCScallfin	6
-#define GCSpause	7
+#define GCSremark	1
+#define GCSatomic	2
+#define GCSswpallgc	3
+#define GCSswpfinobj	4
+#define GCSswptobefnz	5
+#define GCSswpend	6
+#define GCScallfin	7
+#define GCSpause	8
 
 
 #define issweepphase(g)  \
@@ -79,6 +80,9 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define WEAKCLEANBIT	4  /* weak table is in list 'weakclean' */
+#define DIRTYBIT	5  /* black table with dirty cards in 'grayagain' */
+#define LOCALBIT	6  /* arena object only reachable from its thread */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +95,8 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define islocal(x)	testbit((x)->marked, LOCALBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -115,31 +121,96 @@
 #define luaC_checkGC(L)		luaC_condGC(L,(void)0,(void)0)
 
 
+/*
+** Storing an arena-local object into an object that is not local
+** (or into a closed upvalue, or into the stack of another thread) makes
+** it escape its arena. Nothing is local while no arena is active.
+*/
+#define arenaescape(L,p,o)  \
+	(G(L)->arenas != NULL && islocal(o) && !islocal(p))
+
+#define luaC_localbarrier(L,p,v) (  \
+	(iscollectable(v) && arenaescape(L,p,gcvalue(v))) ?  \
+	luaC_escape_(L,gcvalue(v)) : cast_void(0))
+
+#define luaC_escape(L,v) (  \
+	(iscollectable(v) && islocal(gcvalue(v))) ?  \
+	luaC_escape_(L,gcvalue(v)) : cast_void(0))
+
 #define luaC_barrier(L,p,v) (  \
+	luaC_localbarrier(L,p,v),  \
 	(iscollectable(v) && isblack(p) && iswhite(gcvalue(v))) ?  \
 	luaC_barrier_(L,obj2gco(p),gcvalue(v)) : cast_void(0))
 
 #define luaC_barrierback(L,p,v) (  \
+	luaC_localbarrier(L,p,v),  \
 	(iscollectable(v) && isblack(p) && iswhite(gcvalue(v))) ? \
 	luaC_barrierback_(L,p) : cast_void(0))
 
+#define luaC_barriercard(L,p,s,v) (  \
+	luaC_localbarrier(L,p,v),  \
+	(iscollectable(v) && isblack(p) && iswhite(gcvalue(v))) ? \
+	luaC_barriercard_(L,p,s) : cast_void(0))
+
 #define luaC_objbarrier(L,p,o) (  \
+	arenaescape(L,p,o) ? luaC_escape_(L,obj2gco(o)) : cast_void(0),  \
 	(isblack(p) && iswhite(o)) ? \
 	luaC_barrier_(L,obj2gco(p),obj2gco(o)) : cast_void(0))
 
 #define luaC_upvalbarrier(L,uv) ( \
-	(iscollectable((uv)->v) && !upisopen(uv)) ? \
+	(iscollectable((uv)->v) && (!upisopen(uv) ||  \
+	   (G(L)->arenas != NULL && islocal(gcvalue((uv)->v))))) ? \
          luaC_upvalbarrier_(L,uv) : cast_void(0))
 
+/*
+** A thread reading an open upvalue may get a local object from the
+** stack of another thread; that also makes the object escape.
+*/
+#define luaC_upvalread(L,uv) ( \
+	(upisopen(uv) && G(L)->arenas != NULL && iscollectable((uv)->v) &&  \
+	 islocal(gcvalue((uv)->v))) ? \
+         luaC_upvalread_(L,uv) : cast_void(0))
+
+
+/*
+** An arena collects the tables and closures created by a thread
+** between 'lua_pusharena' and 'lua_poparena'. Its objects are linked in
+** 'objs' instead of 'allgc'; those still local when the arena is popped
+** are freed together, the others move to 'allgc'.
+*/
+typedef struct Arena {
+  struct Arena *next;  /* list of all active arenas */
+  struct Arena *previous;
+  lua_State *L;  /* thread owning the arena */
+  GCObject *objs;  /* objects created in the arena */
+  int depth;  /* number of nested pushes */
+  lu_byte spoiled;  /* true if its objects cannot be freed */
+} Arena;
+
+
+/* account 'n' (maybe negative) bytes to objects of type 'tt' */
+#define luaC_statbytes(g,tt,n) \
+	((g)->stats.bytes[novariant(tt)] += cast(size_t, (n)))
+
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC int luaC_gcthreads (lua_State *L, int n);
+LUAI_FUNC int luaC_sweepthread (lua_State *L, int on);
+LUAI_FUNC void *luaC_deferfree (global_State *g, void *block, size_t osize);
+LUAI_FUNC void luaC_waitfrees (global_State *g);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
+LUAI_FUNC void luaC_barriercard_ (lua_State *L, Table *t, const TValue *slot);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
+LUAI_FUNC void luaC_upvalread_ (lua_State *L, UpVal *uv);
+LUAI_FUNC void luaC_escape_ (lua_State *L, GCObject *o);
+LUAI_FUNC void luaC_pusharena (lua_State *L);
+LUAI_FUNC int luaC_poparena (lua_State *L);
+LUAI_FUNC void luaC_closearena (lua_State *L, lua_State *L1);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
 
@@ -0,0 +1,395 @@
+/*
+** $Id: lheap.c $
+** Heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#define lheap_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lheap.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+
+
+/*
+** A snapshot is the signature, a version byte, the number 'n' of objects
+** and then n + 1 records. Record 0 is the root set; records 1 to n are
+** the objects. Each record has the object's type tag, its size, the id
+** of the object through which it is first reached from the roots (0 for
+** the roots themselves, n + 1 if it is not strongly reachable), for
+** strings their length and first LUA_HEAPPREVIEW bytes, and then its
+** references (see lheap.h) up to an HR_END. All numbers are unsigned
+** varints, 7 bits per byte with the least significant ones first.
+*/
+
+
+#define HEAPBUFFER	1024
+
+typedef struct HeapState {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  int writing;  /* false while searching the paths from the roots */
+  unsigned int size;  /* size of the work arrays */
+  unsigned int n;  /* number of objects */
+  unsigned int mask;  /* size of 'slot' minus 1 */
+  unsigned int from;  /* object whose references are being visited */
+  unsigned int qtail;  /* end of 'queue' */
+  GCObject **objs;  /* objects by id (1 to n) */
+  unsigned int *slot;  /* ids by object address (open addressing) */
+  unsigned int *parent;  /* object through which each one was reached */
+  unsigned int *queue;  /* objects still to be visited */
+  size_t nbuff;  /* bytes in 'buff' */
+  lu_byte buff[HEAPBUFFER];
+} HeapState;
+
+
+#define hashobj(H,o)	((point2uint(o) * 2654435761u) & (H)->mask)
+
+
+static void flush (HeapState *H) {
+  if (H->status == 0 && H->nbuff > 0) {
+    lua_unlock(H->L);
+    H->status = (*H->writer)(H->L, H->buff, H->nbuff, H->data);
+    lua_lock(H->L);
+  }
+  H->nbuff = 0;
+}
+
+
+static void putbyte (HeapState *H, int b) {
+  if (H->nbuff == HEAPBUFFER)
+    flush(H);
+  H->buff[H->nbuff++] = cast_byte(b);
+}
+
+
+static void putvarint (HeapState *H, lua_Unsigned x) {
+  while (x >= 0x80) {
+    putbyte(H, cast_int(x & 0x7f) | 0x80);
+    x >>= 7;
+  }
+  putbyte(H, cast_int(x));
+}
+
+
+static void putblock (HeapState *H, const char *b, size_t size) {
+  while (size-- > 0)
+    putbyte(H, cast_uchar(*b++));
+}
+
+
+static unsigned int findid (HeapState *H, GCObject *o) {
+  unsigned int i = hashobj(H, o);
+  while (H->slot[i] != 0) {
+    if (H->objs[H->slot[i]] == o)
+      return H->slot[i];
+    i = (i + 1) & H->mask;
+  }
+  return 0;  /* not a known object */
+}
+
+
+static void addobj (HeapState *H, GCObject *o) {
+  unsigned int i = hashobj(H, o);
+  H->objs[++H->n] = o;
+  while (H->slot[i] != 0)
+    i = (i + 1) & H->mask;
+  H->slot[i] = H->n;
+}
+
+
+/*
+** Visit one reference of object 'H->from'. While searching paths, a
+** strong reference to an object not reached yet makes 'H->from' its
+** parent; while writing, the reference goes to the snapshot.
+*/
+static void addref (HeapState *H, int kind, lua_Unsigned arg,
+                    GCObject *o) {
+  unsigned int id = findid(H, o);
+  if (id == 0)
+    return;
+  if (!H->writing) {
+    if (!(kind & HR_WEAK) && H->parent[id] == H->n + 1) {
+      H->parent[id] = H->from;
+      H->queue[H->qtail++] = id;
+    }
+  }
+  else {
+    putbyte(H, kind);
+    if (hrhasarg(kind & ~HR_WEAK))
+      putvarint(H, arg);
+    putvarint(H, id);
+  }
+}
+
+
+#define addvalue(H,k,a,v)  \
+  { if (iscollectable(v)) addref(H, k, a, gcvalue(v)); }
+
+#define zigzag(i)  \
+  ((l_castS2U(i) << 1) ^ l_castS2U((i) < 0 ? -1 : 0))
+
+
+static void tablerefs (HeapState *H, Table *h) {
+  global_State *g = G(H->L);
+  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  int wk = 0, wv = 0;
+  unsigned int i;
+  Node *n, *limit = gnode(h, cast(size_t, sizenode(h)));
+  if (mode && ttisstring(mode)) {
+    wk = (strchr(svalue(mode), 'k') != NULL) ? HR_WEAK : 0;
+    wv = (strchr(svalue(mode), 'v') != NULL) ? HR_WEAK : 0;
+    wv |= wk;  /* ephemeron values are kept only through their keys */
+  }
+  if (h->metatable)
+    addref(H, HR_META, 0, obj2gco(h->metatable));
+  for (i = 0; i < h->sizearray; i++)
+    addvalue(H, HR_INT | wv, zigzag(cast(lua_Integer, i) + 1), &h->array[i]);
+  for (n = gnode(h, 0); n < limit; n++) {
+    const TValue *k = gkey(n);
+    if (ttisnil(gval(n)) || ttisdeadkey(k))
+      continue;
+    if (ttisinteger(k))
+      addvalue(H, HR_INT | wv, zigzag(ivalue(k)), gval(n))
+    else if (iscollectable(k)) {
+      addvalue(H, HR_KEY | wv, findid(H, gcvalue(k)), gval(n));
+      addref(H, HR_ISKEY | wk, 0, gcvalue(k));
+    }
+    else
+      addvalue(H, HR_OTHER | wv, 0, gval(n));
+  }
+}
+
+
+static void protorefs (HeapState *H, Proto *f) {
+  int i;
+  if (f->source)
+    addref(H, HR_DEBUG, 0, obj2gco(f->source));
+  for (i = 0; i < f->sizek; i++)
+    addvalue(H, HR_CONST, i, &f->k[i]);
+  for (i = 0; i < f->sizep; i++) {
+    if (f->p[i])
+      addref(H, HR_PROTO, i + 1, obj2gco(f->p[i]));
+  }
+  for (i = 0; i < f->sizeupvalues; i++) {
+    if (f->upvalues[i].name)
+      addref(H, HR_DEBUG, 0, obj2gco(f->upvalues[i].name));
+  }
+  for (i = 0; i < f->sizelocvars; i++) {
+    if (f->locvars[i].varname)
+      addref(H, HR_DEBUG, 0, obj2gco(f->locvars[i].varname));
+  }
+}
+
+
+static void objrefs (HeapState *H, GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: tablerefs(H, gco2t(o)); break;
+    case LUA_TUSERDATA: {
+      Udata *u = gco2u(o);
+      TValue uv;
+      if (u->metatable)
+        addref(H, HR_META, 0, obj2gco(u->metatable));
+      getuservalue(H->L, u, &uv);
+      addvalue(H, HR_UVALUE, 0, &uv);
+      break;
+    }
+    case LUA_TLCL: {
+      LClosure *cl = gco2lcl(o);
+      int i;
+      if (cl->p)
+        addref(H, HR_PROTO, 0, obj2gco(cl->p));
+      for (i = 0; i < cl->nupvalues; i++) {
+        if (cl->upvals[i])
+          addvalue(H, HR_UPVAL, i + 1, cl->upvals[i]->v);
+      }
+      break;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        addvalue(H, HR_UPVAL, i + 1, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      StkId s;
+      if (th->stack == NULL)
+        break;
+      for (s = th->stack; s < th->top; s++)
+        addvalue(H, HR_STACK, s - th->stack, s);
+      break;
+    }
+    case LUA_TPROTO: protorefs(H, gco2p(o)); break;
+    default: break;  /* strings have no references */
+  }
+}
+
+
+static void rootrefs (HeapState *H) {
+  global_State *g = G(H->L);
+  GCObject *o;
+  int i;
+  addvalue(H, HR_REGISTRY, 0, &g->l_registry);
+  addref(H, HR_MAINTHREAD, 0, obj2gco(g->mainthread));
+  for (i = 0; i < LUA_NUMTAGS; i++) {
+    if (g->mt[i])
+      addref(H, HR_BASICMT, i, obj2gco(g->mt[i]));
+  }
+  for (o = g->tobefnz; o != NULL; o = o->next)
+    addref(H, HR_FINALIZE, 0, o);
+  for (o = g->fixedgc; o != NULL; o = o->next)
+    addref(H, HR_FIXED, 0, o);
+}
+
+
+static size_t objsize (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TSHRSTR: return sizelstring(gco2ts(o)->shrlen);
+    case LUA_TLNGSTR: return sizelstring(gco2ts(o)->u.lnglen);
+    case LUA_TUSERDATA: return sizeudata(gco2u(o));
+    case LUA_TLCL: return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_TCCL: return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      return sizeof(Table) + sizeof(TValue) * h->sizearray +
+             sizeof(Node) * cast(size_t, allocsizenode(h)) +
+             ((h->cards != NULL) ? cardsof(h) : 0);
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      return sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+             sizeof(CallInfo) * th->nci;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+             sizeof(Proto *) * f->sizep + sizeof(TValue) * f->sizek +
+             sizeof(int) * f->sizelineinfo +
+             sizeof(LocVar) * f->sizelocvars +
+             sizeof(Upvaldesc) * f->sizeupvalues +
+             sizeof(TabSite) * f->sizetabsites +
+             sizeof(unsigned int) * f->sizekslot + f->sizefeedback;
+    }
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+static void countlist (GCObject *o, unsigned int *n) {
+  for (; o != NULL; o = o->next)
+    (*n)++;
+}
+
+
+static void addlist (HeapState *H, GCObject *o) {
+  for (; o != NULL; o = o->next)
+    addobj(H, o);
+}
+
+
+/*
+** Number all objects, search the first path from the roots to each
+** one (a breadth-first search), and then write them.
+*/
+static void f_snapshot (lua_State *L, void *ud) {
+  HeapState *H = cast(HeapState *, ud);
+  global_State *g = G(L);
+  unsigned int n = 1;  /* main thread is not in any list */
+  unsigned int i, head = 0;
+  Arena *a;
+  countlist(g->allgc, &n);
+  countlist(g->largegc, &n);
+  countlist(g->finobj, &n);
+  countlist(g->tobefnz, &n);
+  countlist(g->fixedgc, &n);
+  for (a = g->arenas; a != NULL; a = a->next)
+    countlist(a->objs, &n);
+  H->size = n;
+  H->mask = 1;
+  while (H->mask < 2 * n)
+    H->mask <<= 1;
+  H->mask--;
+  H->objs = luaM_newvector(L, n + 1, GCObject *);
+  H->slot = luaM_newvector(L, H->mask + 1, unsigned int);
+  H->parent = luaM_newvector(L, n + 2, unsigned int);
+  H->queue = luaM_newvector(L, n, unsigned int);
+  memset(H->slot, 0, (H->mask + 1) * sizeof(unsigned int));
+  addobj(H, obj2gco(g->mainthread));
+  addlist(H, g->allgc);
+  addlist(H, g->largegc);
+  addlist(H, g->finobj);
+  addlist(H, g->tobefnz);
+  addlist(H, g->fixedgc);
+  for (a = g->arenas; a != NULL; a = a->next)
+    addlist(H, a->objs);
+  lua_assert(H->n <= n);
+  n = H->n;  /* an emergency collection may have freed some objects */
+  for (i = 1; i <= n; i++)
+    H->parent[i] = n + 1;  /* not reached */
+  H->from = 0;
+  rootrefs(H);
+  while (head < H->qtail) {
+    H->from = H->queue[head++];
+    objrefs(H, H->objs[H->from]);
+  }
+  H->writing = 1;
+  putblock(H, LUA_HEAPSIG, sizeof(LUA_HEAPSIG) - sizeof(char));
+  putbyte(H, LUA_HEAPVERSION);
+  putvarint(H, n);
+  putvarint(H, 0); putvarint(H, 0); putvarint(H, 0);  /* root record */
+  rootrefs(H);
+  putbyte(H, HR_END);
+  for (i = 1; i <= n && H->status == 0; i++) {
+    GCObject *o = H->objs[i];
+    putvarint(H, o->tt);
+    putvarint(H, objsize(o));
+    putvarint(H, H->parent[i]);
+    if (o->tt == LUA_TSHRSTR || o->tt == LUA_TLNGSTR) {
+      size_t l = tsslen(gco2ts(o));
+      putvarint(H, l);
+      putblock(H, getstr(gco2ts(o)), (l < LUA_HEAPPREVIEW) ? l
+                                                           : LUA_HEAPPREVIEW);
+    }
+    objrefs(H, o);
+    putbyte(H, HR_END);
+  }
+  flush(H);
+}
+
+
+int luaC_heapsnapshot (lua_State *L, lua_Writer w, void *data) {
+  HeapState H;
+  int status;
+  memset(&H, 0, sizeof(H));
+  H.L = L;
+  H.writer = w;
+  H.data = data;
+  status = luaD_rawrunprotected(L, f_snapshot, &H);
+  if (H.queue) luaM_freearray(L, H.queue, H.size);
+  if (H.parent) luaM_freearray(L, H.parent, H.size + 2);
+  if (H.slot) luaM_freearray(L, H.slot, H.mask + 1);
+  if (H.objs) luaM_freearray(L, H.objs, H.size + 1);
+  if (status != LUA_OK)
+    luaD_throw(L, status);
+  return H.status;
+}
+
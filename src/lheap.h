@@ -0,0 +1,55 @@
+/*
+** $Id: lheap.h $
+** Heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lheap_h
+#define lheap_h
+
+#include "lua.h"
+
+
+/* data to catch snapshot errors */
+#define LUA_HEAPSIG	"\x1bLHS"
+#define LUA_HEAPVERSION	1
+
+/* maximum number of bytes of a string kept in a snapshot */
+#define LUA_HEAPPREVIEW	32
+
+
+/*
+** Kinds of reference, as written in a snapshot. Each reference is its
+** kind, an argument for some kinds, and the id of the object referred.
+*/
+typedef enum {
+  HR_END,	/* end of the references of an object */
+  HR_OTHER,	/* value under a key that is neither integer nor object */
+  HR_KEY,	/* value under an object key (arg: id of the key) */
+  HR_INT,	/* value under an integer key (arg: key, zigzag coded) */
+  HR_ISKEY,	/* key of a table entry */
+  HR_META,	/* metatable */
+  HR_UVALUE,	/* user value of a userdata */
+  HR_UPVAL,	/* upvalue of a closure (arg: index) */
+  HR_STACK,	/* stack slot of a thread (arg: index) */
+  HR_PROTO,	/* prototype (arg: 0 for a closure, index+1 for nested) */
+  HR_CONST,	/* constant of a prototype (arg: index) */
+  HR_DEBUG,	/* source or debug name of a prototype */
+  HR_REGISTRY,	/* root: the registry */
+  HR_MAINTHREAD,	/* root: the main thread */
+  HR_BASICMT,	/* root: metatable of a basic type (arg: type) */
+  HR_FINALIZE,	/* root: object waiting for its finalizer */
+  HR_FIXED	/* root: object that is never collected */
+} HeapRef;
+
+/* flag for references that do not keep the object alive */
+#define HR_WEAK		0x80
+
+/* kinds of reference followed by an argument */
+#define hrhasarg(k)	((k) == HR_KEY || (k) == HR_INT || (k) == HR_BASICMT || \
+			 ((k) >= HR_UPVAL && (k) <= HR_CONST))
+
+
+LUAI_FUNC int luaC_heapsnapshot (lua_State *L, lua_Writer w, void *data);
+
+#endif
@@ -0,0 +1,1892 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler of hot Lua functions to machine code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* for 'MAP_ANONYMOUS' */
+#endif
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "laot.h"
+#include "ldebug.h"
+#include "lfunc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lprof.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+
+
+/*
+** A hot prototype is compiled to x86-64 code with the protocol of
+** functions compiled ahead of time (see 'laot.h'): the code runs the
+** frame 'L->ci' from its saved 'pc'. Each instruction becomes a
+** template with a guarded fast path (integer and float arithmetic and
+** comparisons, array access with integer keys, numeric loops, moves
+** and jumps). When a guard fails, or for any other instruction, the
+** code saves the 'pc' of that instruction and returns AOT_INTERP, so
+** that 'luaV_execute' runs it (and what follows) with its own handler.
+** The interpreter enters the code again at its next backward jump or
+** when the frame is reentered. Fast paths never call C, so they do
+** not allocate, raise errors, or move the stack, and errors unwind
+** only interpreter frames. With line or count hooks, or while the
+** thread records types, the code does not run at all; it checks for
+** them on entry and at backward jumps.
+*/
+
+
+/* registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define R12	12
+#define R13	13
+#define R14	14
+#define R15	15
+
+#define RL	RBX	/* the lua_State */
+#define RCI	R12	/* its 'ci' */
+#define RBASE	R13	/* base of the frame */
+#define RCL	R14	/* the closure */
+
+/* condition codes */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_ALWAYS	(-1)
+
+#define negcc(cc)	((cc) ^ 1)
+
+
+/* maximum size of the code for one instruction */
+#define MAXINSTRSIZE	384
+
+/* maximum number of jumps to other instructions in one instruction */
+#define MAXINSTRJUMPS	16
+
+/* size of the exit stub of one instruction */
+#define EXITSIZE	10
+
+
+/* offset in the stack of register 'r' and of its tag */
+#define VAL(r)		((r) * cast_int(sizeof(TValue)))
+#define TT(r)		(VAL(r) + cast_int(offsetof(TValue, tt_)))
+
+
+/* jump to be patched: target is an instruction, or the exit of one */
+typedef struct Fixup {
+  int pos;  /* position of the 32-bit displacement */
+  int target;  /* pc of target, or -1 - pc for its exit */
+} Fixup;
+
+
+typedef struct JitState {
+  Proto *p;
+  lu_byte *code;  /* machine code being generated */
+  int n;  /* its size */
+  int *label;  /* position of the code of each instruction */
+  Fixup *fix;
+  int nfix;
+  int pc;  /* instruction being compiled */
+  int pc0;  /* instruction of the first exit */
+} JitState;
+
+
+#define exitpc(pc)	(-1 - (pc))
+
+
+static void e1 (JitState *J, int b) {
+  J->code[J->n++] = cast_byte(b);
+}
+
+
+static void e4 (JitState *J, int v) {
+  memcpy(J->code + J->n, &v, sizeof(v));
+  J->n += 4;
+}
+
+
+static void e8 (JitState *J, lua_Integer v) {
+  memcpy(J->code + J->n, &v, sizeof(v));
+  J->n += 8;
+}
+
+
+/* 'prefix', REX, and opcode (of one or two bytes) */
+static void eop (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  int rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+  if (pfx) e1(J, pfx);
+  if (rex != 0x40) e1(J, rex);
+  if (op > 0xff) e1(J, op >> 8);
+  e1(J, op & 0xff);
+}
+
+
+/* instruction with operands 'reg' (or extension) and '[base + disp]' */
+static void emem (JitState *J, int pfx, int w, int op, int reg, int base,
+                  int disp) {
+  eop(J, pfx, w, op, reg, base);
+  e1(J, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) e1(J, 0x24);  /* SIB byte for RSP or R12 */
+  e4(J, disp);
+}
+
+
+/* instruction with operands 'reg' and 'rm', both registers */
+static void ereg (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  eop(J, pfx, w, op, reg, rm);
+  e1(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+#define ldq(J,r,b,d)	emem(J, 0, 1, 0x8B, r, b, d)
+#define stq(J,r,b,d)	emem(J, 0, 1, 0x89, r, b, d)
+#define ldsd(J,x,b,d)	emem(J, 0xF2, 0, 0x0F10, x, b, d)
+#define stsd(J,x,b,d)	emem(J, 0xF2, 0, 0x0F11, x, b, d)
+
+
+static void movimm (JitState *J, int r, lua_Integer v) {
+  e1(J, 0x48 | ((r & 8) ? 1 : 0));
+  e1(J, 0xB8 + (r & 7));
+  e8(J, v);
+}
+
+
+/* compare tag of value at '[base + disp]' with 'tag' */
+static void cmptag (JitState *J, int base, int disp, int tag) {
+  emem(J, 0, 0, 0x81, 7, base, disp + cast_int(offsetof(TValue, tt_)));
+  e4(J, tag);
+}
+
+
+static void settag (JitState *J, int base, int disp, int tag) {
+  emem(J, 0, 0, 0xC7, 0, base, disp + cast_int(offsetof(TValue, tt_)));
+  e4(J, tag);
+}
+
+
+/* copy a value from '[sbase + sdisp]' to '[dbase + ddisp]' */
+static void copyvalue (JitState *J, int dbase, int ddisp, int sbase,
+                       int sdisp) {
+  ldq(J, RAX, sbase, sdisp);
+  ldq(J, RDX, sbase, sdisp + 8);
+  stq(J, RAX, dbase, ddisp);
+  stq(J, RDX, dbase, ddisp + 8);
+}
+
+
+/* set register 'ra' to constant 'k' */
+static void setconst (JitState *J, int ra, const TValue *k) {
+  lua_Integer v;
+  memcpy(&v, &k->value_, sizeof(v));
+  movimm(J, RAX, v);
+  stq(J, RAX, RBASE, VAL(ra));
+  settag(J, RBASE, VAL(ra), rttype(k));
+}
+
+
+/*
+** Jump with condition 'cc' (or always) to 'target', which is the pc of
+** an instruction or the exit of one
+*/
+static void jumpto (JitState *J, int cc, int target) {
+  if (cc == CC_ALWAYS)
+    e1(J, 0xE9);
+  else {
+    e1(J, 0x0F);
+    e1(J, 0x80 + cc);
+  }
+  J->fix[J->nfix].pos = J->n;
+  J->fix[J->nfix++].target = target;
+  e4(J, 0);
+}
+
+
+/* jump forward inside the code of an instruction; returns its position */
+static int jumpfwd (JitState *J, int cc) {
+  if (cc == CC_ALWAYS)
+    e1(J, 0xE9);
+  else {
+    e1(J, 0x0F);
+    e1(J, 0x80 + cc);
+  }
+  e4(J, 0);
+  return J->n - 4;
+}
+
+
+/* make a forward jump go to the current position */
+static void here (JitState *J, int pos) {
+  int rel = J->n - (pos + 4);
+  memcpy(J->code + pos, &rel, sizeof(rel));
+}
+
+
+/* leave the code (at 'pc') if there are hooks to run */
+static void checkhooks (JitState *J, int pc) {
+  emem(J, 0, 0, 0xF7, 0, RL, cast_int(offsetof(lua_State, hookmask)));
+  e4(J, HOOKINSTR);
+  jumpto(J, CC_NE, exitpc(pc));
+}
+
+
+/*
+** Jump to 'target' if 'cc'; backward jumps check for hooks first, so
+** that (asynchronous) hooks do not wait for a loop to end
+*/
+static void branch (JitState *J, int cc, int target) {
+  if (target > J->pc) {
+    jumpto(J, cc, target);
+    return;
+  }
+  else {
+    int skip = (cc != CC_ALWAYS) ? jumpfwd(J, negcc(cc)) : -1;
+    checkhooks(J, target);
+    jumpto(J, CC_ALWAYS, target);
+    if (skip >= 0) here(J, skip);
+  }
+}
+
+
+/*
+** {======================================================
+** Operands
+** =======================================================
+*/
+
+/* constant for an RK operand, or NULL if it is a register */
+#define rkconst(J,x)	(ISK(x) ? &(J)->p->k[INDEXK(x)] : NULL)
+
+
+/* load integer operand 'x' into 'r' (known to be an integer) */
+static void loadi (JitState *J, int r, int x) {
+  const TValue *k = rkconst(J, x);
+  if (k != NULL)
+    movimm(J, r, ivalue(k));
+  else
+    ldq(J, r, RBASE, VAL(x));
+}
+
+
+/* load integer operand 'x' into 'r', leaving the code if it is not one */
+static void loadint (JitState *J, int r, int x) {
+  if (!ISK(x)) {
+    cmptag(J, RBASE, VAL(x), LUA_TNUMINT);
+    jumpto(J, CC_NE, exitpc(J->pc));
+  }
+  loadi(J, r, x);
+}
+
+
+/* load constant float 'n' into register 'x' of SSE */
+static void loadfltk (JitState *J, int x, lua_Number n) {
+  lua_Integer v;
+  memcpy(&v, &n, sizeof(v));
+  movimm(J, RAX, v);
+  ereg(J, 0x66, 1, 0x0F6E, x, RAX);  /* movq x, rax */
+}
+
+
+/*
+** load numeric operand 'x' as a float into register 'xr' of SSE,
+** converting integers; leave the code if it is not a number
+*/
+static void loadnum (JitState *J, int xr, int x) {
+  const TValue *k = rkconst(J, x);
+  if (k != NULL)
+    loadfltk(J, xr, ttisinteger(k) ? cast_num(ivalue(k)) : fltvalue(k));
+  else {
+    int isflt, done;
+    cmptag(J, RBASE, VAL(x), LUA_TNUMFLT);
+    isflt = jumpfwd(J, CC_E);
+    cmptag(J, RBASE, VAL(x), LUA_TNUMINT);
+    jumpto(J, CC_NE, exitpc(J->pc));
+    emem(J, 0xF2, 1, 0x0F2A, xr, RBASE, VAL(x));  /* cvtsi2sd */
+    done = jumpfwd(J, CC_ALWAYS);
+    here(J, isflt);
+    ldsd(J, xr, RBASE, VAL(x));
+    here(J, done);
+  }
+}
+
+
+/* load float operand 'x' into register 'xr' of SSE; must be a float */
+static void loadflt (JitState *J, int xr, int x) {
+  const TValue *k = rkconst(J, x);
+  if (k != NULL)
+    loadfltk(J, xr, fltvalue(k));
+  else {
+    cmptag(J, RBASE, VAL(x), LUA_TNUMFLT);
+    jumpto(J, CC_NE, exitpc(J->pc));
+    ldsd(J, xr, RBASE, VAL(x));
+  }
+}
+
+
+/* operand may be an integer? (not a constant of another type) */
+static int mayint (JitState *J, int x) {
+  const TValue *k = rkconst(J, x);
+  return (k == NULL || ttisinteger(k));
+}
+
+
+static int maynumber (JitState *J, int x) {
+  const TValue *k = rkconst(J, x);
+  return (k == NULL || ttisnumber(k));
+}
+
+
+/* operand may be a float? (not an integer constant) */
+static int mayfloat (JitState *J, int x) {
+  const TValue *k = rkconst(J, x);
+  return (k == NULL || ttisfloat(k));
+}
+
+
+/*
+** Types seen by operand B ('shift' 0) or C ('shift' FB_C) of the
+** current instruction in a loaded profile (see 'lprof.c'); any type
+** if there is no profile for it
+*/
+static int seen (JitState *J, int shift) {
+  Proto *p = J->p;
+  int fb = (J->pc < p->sizefeedback) ? p->feedback[J->pc] : 0;
+  return (fb == 0) ? FB_ALL : fbtypes(fb, shift);
+}
+
+
+/* operand 'x' is a register where the profile saw only floats? */
+#define onlyflt(J,x,shift)  (!ISK(x) && !(seen(J, shift) & FB_INT))
+
+/* operand 'x' saw only integers? */
+#define onlyint(J,x,shift)  (ISK(x) || seen(J, shift) == FB_INT)
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Instructions
+** =======================================================
+*/
+
+/*
+** Arithmetic: 'iop' is the opcode (of x86-64) for integers (or -1 if
+** the operation always works on floats); 'fop' is the SSE opcode for
+** floats. With a profile, operands seen only as floats (or only as
+** integers) get code for just that case.
+*/
+static int arith (JitState *J, Instruction i, int iop, int fop) {
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  int fltb = onlyflt(J, b, 0), fltc = onlyflt(J, c, FB_C);
+  if (!maynumber(J, b) || !maynumber(J, c))
+    return 0;
+  if (iop >= 0 && mayint(J, b) && mayint(J, c) && !fltb && !fltc) {
+    int tofloat[2];
+    int nf = 0;
+    if (onlyint(J, b, 0) && onlyint(J, c, FB_C)) {  /* no float path? */
+      loadint(J, RAX, b);
+      loadint(J, RCX, c);
+      if (iop == 0x0FAF)  /* imul rax, rcx */
+        ereg(J, 0, 1, iop, RAX, RCX);
+      else  /* op rax, rcx */
+        ereg(J, 0, 1, iop, RCX, RAX);
+      stq(J, RAX, RBASE, VAL(a));
+      settag(J, RBASE, VAL(a), LUA_TNUMINT);
+      return 1;
+    }
+    if (!ISK(b)) {
+      cmptag(J, RBASE, VAL(b), LUA_TNUMINT);
+      tofloat[nf++] = jumpfwd(J, CC_NE);
+    }
+    if (!ISK(c)) {
+      cmptag(J, RBASE, VAL(c), LUA_TNUMINT);
+      tofloat[nf++] = jumpfwd(J, CC_NE);
+    }
+    loadi(J, RAX, b);
+    loadi(J, RCX, c);
+    if (iop == 0x0FAF)  /* imul rax, rcx */
+      ereg(J, 0, 1, iop, RAX, RCX);
+    else  /* op rax, rcx */
+      ereg(J, 0, 1, iop, RCX, RAX);
+    stq(J, RAX, RBASE, VAL(a));
+    settag(J, RBASE, VAL(a), LUA_TNUMINT);
+    jumpto(J, CC_ALWAYS, J->pc + 1);
+    while (nf > 0) here(J, tofloat[--nf]);
+  }
+  if (fltb) loadflt(J, 0, b); else loadnum(J, 0, b);
+  if (fltc) loadflt(J, 1, c); else loadnum(J, 1, c);
+  ereg(J, 0xF2, 0, fop, 0, 1);  /* op xmm0, xmm1 */
+  stsd(J, 0, RBASE, VAL(a));
+  settag(J, RBASE, VAL(a), LUA_TNUMFLT);
+  return 1;
+}
+
+
+/* OP_IADD and OP_ISUB: operands are known to be integers */
+static void iarith (JitState *J, Instruction i, int iop) {
+  loadi(J, RAX, GETARG_B(i));
+  loadi(J, RCX, GETARG_C(i));
+  ereg(J, 0, 1, iop, RCX, RAX);  /* op rax, rcx */
+  stq(J, RAX, RBASE, VAL(GETARG_A(i)));
+  settag(J, RBASE, VAL(GETARG_A(i)), LUA_TNUMINT);
+}
+
+
+/* bitwise operations, on integers only */
+static int bitwise (JitState *J, Instruction i, int iop) {
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  if (!mayint(J, b) || !mayint(J, c))
+    return 0;
+  loadint(J, RAX, b);
+  loadint(J, RCX, c);
+  ereg(J, 0, 1, iop, RCX, RAX);
+  stq(J, RAX, RBASE, VAL(a));
+  settag(J, RBASE, VAL(a), LUA_TNUMINT);
+  return 1;
+}
+
+
+static void unm (JitState *J, Instruction i) {
+  int a = GETARG_A(i), b = GETARG_B(i);
+  int notint;
+  cmptag(J, RBASE, VAL(b), LUA_TNUMINT);
+  notint = jumpfwd(J, CC_NE);
+  ldq(J, RAX, RBASE, VAL(b));
+  ereg(J, 0, 1, 0xF7, 3, RAX);  /* neg rax */
+  stq(J, RAX, RBASE, VAL(a));
+  settag(J, RBASE, VAL(a), LUA_TNUMINT);
+  jumpto(J, CC_ALWAYS, J->pc + 1);
+  here(J, notint);
+  cmptag(J, RBASE, VAL(b), LUA_TNUMFLT);
+  jumpto(J, CC_NE, exitpc(J->pc));
+  ldq(J, RAX, RBASE, VAL(b));
+  ereg(J, 0, 1, 0x0FBA, 7, RAX);  /* btc rax, 63 (flip sign) */
+  e1(J, 63);
+  stq(J, RAX, RBASE, VAL(a));
+  settag(J, RBASE, VAL(a), LUA_TNUMFLT);
+}
+
+
+/*
+** Jump to the 'false' label (returned) if value at '[base + disp]' is
+** false; fall through otherwise
+*/
+static int testfalse (JitState *J, int base, int disp, int *isfalse2) {
+  int isfalse, istrue;
+  cmptag(J, base, disp, LUA_TNIL);
+  isfalse = jumpfwd(J, CC_E);
+  cmptag(J, base, disp, LUA_TBOOLEAN);
+  istrue = jumpfwd(J, CC_NE);
+  emem(J, 0, 0, 0x81, 7, base, disp);  /* cmp dword [base + disp], 0 */
+  e4(J, 0);
+  *isfalse2 = jumpfwd(J, CC_E);
+  here(J, istrue);
+  return isfalse;
+}
+
+
+static void lognot (JitState *J, Instruction i) {
+  int a = GETARG_A(i), b = GETARG_B(i);
+  int isfalse, isfalse2, done;
+  isfalse = testfalse(J, RBASE, VAL(b), &isfalse2);
+  movimm(J, RAX, 0);
+  done = jumpfwd(J, CC_ALWAYS);
+  here(J, isfalse);
+  here(J, isfalse2);
+  movimm(J, RAX, 1);
+  here(J, done);
+  stq(J, RAX, RBASE, VAL(a));
+  settag(J, RBASE, VAL(a), LUA_TBOOLEAN);
+}
+
+
+/* target of jump instruction at 'pc', or -1 if it closes upvalues */
+static int jumptarget (JitState *J, int pc) {
+  Instruction i = J->p->code[pc];
+  lua_assert(GET_OPCODE(i) == OP_JMP);
+  return (GETARG_A(i) != 0) ? -1 : pc + 1 + GETARG_sBx(i);
+}
+
+
+/* OP_TEST and OP_TESTSET */
+static int test (JitState *J, Instruction i, int set) {
+  int a = GETARG_A(i), c = GETARG_C(i);
+  int r = set ? GETARG_B(i) : a;
+  int target = jumptarget(J, J->pc + 1);
+  int isfalse, isfalse2, jump;
+  if (target < 0) return 0;
+  isfalse = testfalse(J, RBASE, VAL(r), &isfalse2);
+  if (c) {  /* jump if true */
+    jump = jumpfwd(J, CC_ALWAYS);
+    here(J, isfalse); here(J, isfalse2);
+    jumpto(J, CC_ALWAYS, J->pc + 2);
+    here(J, jump);
+  }
+  else {  /* jump if false */
+    jumpto(J, CC_ALWAYS, J->pc + 2);
+    here(J, isfalse); here(J, isfalse2);
+  }
+  if (set) copyvalue(J, RBASE, VAL(a), RBASE, VAL(r));
+  branch(J, CC_ALWAYS, target);
+  return 1;
+}
+
+
+/*
+** OP_EQ, OP_LT, and OP_LE, for two integers or two floats (or only
+** the case seen in a profile); 'icc' is the condition of the integer
+** comparison
+*/
+static int compare (JitState *J, Instruction i, int icc) {
+  OpCode op = GET_OPCODE(i);
+  int cond = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  int target = jumptarget(J, J->pc + 1);
+  int skip = J->pc + 2;
+  if (target < 0 || !maynumber(J, b) || !maynumber(J, c))
+    return 0;
+  if (mayint(J, b) && mayint(J, c) &&
+      !onlyflt(J, b, 0) && !onlyflt(J, c, FB_C)) {
+    int tofloat[2];
+    int nf = 0;
+    int ok = (mayfloat(J, b) && mayfloat(J, c) &&  /* float path needed? */
+              !(onlyint(J, b, 0) && onlyint(J, c, FB_C)));
+    if (!ISK(b)) {
+      cmptag(J, RBASE, VAL(b), LUA_TNUMINT);
+      tofloat[nf++] = jumpfwd(J, CC_NE);
+    }
+    if (!ISK(c)) {
+      cmptag(J, RBASE, VAL(c), LUA_TNUMINT);
+      tofloat[nf++] = jumpfwd(J, CC_NE);
+    }
+    loadi(J, RAX, b);
+    loadi(J, RCX, c);
+    ereg(J, 0, 1, 0x39, RCX, RAX);  /* cmp rax, rcx */
+    branch(J, cond ? icc : negcc(icc), target);
+    jumpto(J, CC_ALWAYS, skip);
+    while (nf > 0) here(J, tofloat[--nf]);
+    if (!ok) {
+      jumpto(J, CC_ALWAYS, exitpc(J->pc));
+      return 1;
+    }
+  }
+  else if (!mayfloat(J, b) || !mayfloat(J, c))
+    return 0;  /* integer constant against float */
+  loadflt(J, 0, b);
+  loadflt(J, 1, c);
+  if (op == OP_EQ) {
+    ereg(J, 0x66, 0, 0x0F2E, 0, 1);  /* ucomisd xmm0, xmm1 */
+    if (cond) {  /* jump if equal */
+      jumpto(J, CC_P, skip);
+      branch(J, CC_E, target);
+    }
+    else {  /* jump if different */
+      branch(J, CC_P, target);
+      branch(J, CC_NE, target);
+    }
+  }
+  else {
+    /* 'b < c' is 'c > b' (false if unordered); same for '<=' */
+    int fcc = (op == OP_LT) ? CC_A : CC_AE;
+    ereg(J, 0x66, 0, 0x0F2E, 1, 0);  /* ucomisd xmm1, xmm0 */
+    branch(J, cond ? fcc : negcc(fcc), target);
+  }
+  jumpto(J, CC_ALWAYS, skip);
+  return 1;
+}
+
+
+/* OP_IEQ, OP_ILT, and OP_ILE: operands are known to be integers */
+static int icompare (JitState *J, Instruction i, int icc) {
+  int target = jumptarget(J, J->pc + 1);
+  if (target < 0) return 0;
+  loadi(J, RAX, GETARG_B(i));
+  loadi(J, RCX, GETARG_C(i));
+  ereg(J, 0, 1, 0x39, RCX, RAX);  /* cmp rax, rcx */
+  branch(J, GETARG_A(i) ? icc : negcc(icc), target);
+  jumpto(J, CC_ALWAYS, J->pc + 2);
+  return 1;
+}
+
+
+/*
+** Compute in RCX the address of the slot for integer key 'x' in the
+** array part of table at register 't' (leaving the code if there is
+** no such slot or it is nil); 'isint' tells that the key is known to
+** be an integer
+*/
+static int arrayslot (JitState *J, int t, int x, int isint) {
+  const TValue *k = rkconst(J, x);
+  if (!mayint(J, x))
+    return 0;
+  cmptag(J, RBASE, VAL(t), ctb(LUA_TTABLE));
+  jumpto(J, CC_NE, exitpc(J->pc));
+  ldq(J, RCX, RBASE, VAL(t));  /* table */
+  if (k != NULL)
+    movimm(J, RAX, l_castU2S(l_castS2U(ivalue(k)) - 1));
+  else {
+    if (isint) loadi(J, RAX, x);
+    else loadint(J, RAX, x);
+    ereg(J, 0, 1, 0x83, 5, RAX);  /* sub rax, 1 */
+    e1(J, 1);
+  }
+  emem(J, 0, 0, 0x8B, RDX, RCX, cast_int(offsetof(Table, sizearray)));
+  ereg(J, 0, 1, 0x39, RDX, RAX);  /* cmp rax, rdx (unsigned) */
+  jumpto(J, CC_AE, exitpc(J->pc));
+  ldq(J, RCX, RCX, cast_int(offsetof(Table, array)));
+  ereg(J, 0, 1, 0xC1, 4, RAX);  /* shl rax, 4 */
+  e1(J, 4);
+  ereg(J, 0, 1, 0x01, RAX, RCX);  /* add rcx, rax */
+  cmptag(J, RCX, 0, LUA_TNIL);
+  jumpto(J, CC_E, exitpc(J->pc));  /* nil entries may have metamethods */
+  return 1;
+}
+
+
+static int gettable (JitState *J, Instruction i) {
+  if (!arrayslot(J, GETARG_B(i), GETARG_C(i),
+                 GET_OPCODE(i) == OP_IGETTABLE))
+    return 0;
+  copyvalue(J, RBASE, VAL(GETARG_A(i)), RCX, 0);
+  return 1;
+}
+
+
+/*
+** Only values that are not collectable are stored, so that there is
+** no need for barriers
+*/
+static int settable (JitState *J, Instruction i) {
+  int c = GETARG_C(i);
+  const TValue *k = rkconst(J, c);
+  if (k != NULL && iscollectable(k))
+    return 0;
+  if (!arrayslot(J, GETARG_A(i), GETARG_B(i),
+                 GET_OPCODE(i) == OP_ISETTABLE))
+    return 0;
+  if (k != NULL) {
+    lua_Integer v;
+    memcpy(&v, &k->value_, sizeof(v));
+    movimm(J, RAX, v);
+    stq(J, RAX, RCX, 0);
+    settag(J, RCX, 0, rttype(k));
+  }
+  else {
+    emem(J, 0, 0, 0xF7, 0, RBASE, TT(c));  /* test dword [tag], ... */
+    e4(J, BIT_ISCOLLECTABLE);
+    jumpto(J, CC_NE, exitpc(J->pc));
+    copyvalue(J, RCX, 0, RBASE, VAL(c));
+  }
+  return 1;
+}
+
+
+/* address of upvalue 'n' into RCX; leave the code if there are arenas */
+static void upvalue (JitState *J, int n) {
+  ldq(J, RAX, RL, cast_int(offsetof(lua_State, l_G)));
+  emem(J, 0, 1, 0x81, 7, RAX, cast_int(offsetof(global_State, arenas)));
+  e4(J, 0);  /* cmp qword [arenas], 0 */
+  jumpto(J, CC_NE, exitpc(J->pc));
+  ldq(J, RCX, RCL, cast_int(offsetof(LClosure, upvals)) +
+                   n * cast_int(sizeof(UpVal *)));
+  ldq(J, RCX, RCX, cast_int(offsetof(UpVal, v)));
+}
+
+
+static void setupval (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  emem(J, 0, 0, 0xF7, 0, RBASE, TT(a));
+  e4(J, BIT_ISCOLLECTABLE);  /* no barriers for collectable values */
+  jumpto(J, CC_NE, exitpc(J->pc));
+  upvalue(J, GETARG_B(i));
+  copyvalue(J, RCX, 0, RBASE, VAL(a));
+}
+
+
+/* find the record of the loop ending at 'pc' */
+static JitLoop *findloop (Proto *p, int pc) {
+  int i;
+  for (i = 0; i < p->sizeloops; i++) {
+    if (p->loops[i].pc == pc)
+      return &p->loops[i];
+  }
+  return NULL;
+}
+
+
+/*
+** Integer loops only. Each iteration also counts down the iterations
+** left to trace the loop; the interpreter runs the instruction when
+** that count ends (see 'luaJ_trace').
+*/
+static void forloop (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  JitLoop *lp = findloop(J->p, J->pc);
+  int neg, done, go;
+  cmptag(J, RBASE, VAL(a), LUA_TNUMINT);
+  jumpto(J, CC_NE, exitpc(J->pc));
+  if (lp != NULL) {
+    movimm(J, RAX, cast(lua_Integer, cast(size_t, &lp->count)));
+    emem(J, 0, 0, 0x81, 5, RAX, 0);  /* sub dword [rax], 1 */
+    e4(J, 1);
+    jumpto(J, CC_LE, exitpc(J->pc));
+  }
+  ldq(J, RAX, RBASE, VAL(a));
+  ldq(J, RCX, RBASE, VAL(a + 2));  /* step */
+  ereg(J, 0, 1, 0x01, RCX, RAX);  /* add rax, rcx */
+  ldq(J, RDX, RBASE, VAL(a + 1));  /* limit */
+  ereg(J, 0, 1, 0x85, RCX, RCX);  /* test rcx, rcx */
+  neg = jumpfwd(J, CC_LE);
+  ereg(J, 0, 1, 0x39, RDX, RAX);  /* cmp rax, rdx */
+  done = jumpfwd(J, CC_G);
+  go = jumpfwd(J, CC_ALWAYS);
+  here(J, neg);
+  ereg(J, 0, 1, 0x39, RAX, RDX);  /* cmp rdx, rax */
+  jumpto(J, CC_G, J->pc + 1);
+  here(J, go);
+  stq(J, RAX, RBASE, VAL(a));
+  stq(J, RAX, RBASE, VAL(a + 3));
+  settag(J, RBASE, VAL(a + 3), LUA_TNUMINT);
+  branch(J, CC_ALWAYS, J->pc + 1 + GETARG_sBx(i));
+  here(J, done);
+}
+
+
+/*
+** Code for instruction at 'J->pc'; returns false if it has no fast path
+*/
+static int instruction (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE:
+      copyvalue(J, RBASE, VAL(a), RBASE, VAL(GETARG_B(i)));
+      return 1;
+    case OP_LOADK:
+      setconst(J, a, &J->p->k[GETARG_Bx(i)]);
+      return 1;
+    case OP_LOADBOOL:
+      movimm(J, RAX, GETARG_B(i));
+      stq(J, RAX, RBASE, VAL(a));
+      settag(J, RBASE, VAL(a), LUA_TBOOLEAN);
+      if (GETARG_C(i)) jumpto(J, CC_ALWAYS, J->pc + 2);
+      return 1;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        settag(J, RBASE, VAL(a++), LUA_TNIL);
+      } while (b--);
+      return 1;
+    }
+    case OP_GETUPVAL:
+      upvalue(J, GETARG_B(i));
+      copyvalue(J, RBASE, VAL(a), RCX, 0);
+      return 1;
+    case OP_SETUPVAL:
+      setupval(J, i);
+      return 1;
+    case OP_GETTABLE: return gettable(J, i);
+    case OP_SETTABLE: return settable(J, i);
+    case OP_ADD: return arith(J, i, 0x01, 0x0F58);
+    case OP_SUB: return arith(J, i, 0x29, 0x0F5C);
+    case OP_MUL: return arith(J, i, 0x0FAF, 0x0F59);
+    case OP_DIV: return arith(J, i, -1, 0x0F5E);
+    case OP_BAND: return bitwise(J, i, 0x21);
+    case OP_BOR: return bitwise(J, i, 0x09);
+    case OP_BXOR: return bitwise(J, i, 0x31);
+    case OP_UNM:
+      unm(J, i);
+      return 1;
+    case OP_NOT:
+      lognot(J, i);
+      return 1;
+    case OP_JMP:
+      if (a != 0) return 0;  /* must close upvalues */
+      branch(J, CC_ALWAYS, J->pc + 1 + GETARG_sBx(i));
+      return 1;
+    case OP_EQ: return compare(J, i, CC_E);
+    case OP_LT: return compare(J, i, CC_L);
+    case OP_LE: return compare(J, i, CC_LE);
+    case OP_TEST: return test(J, i, 0);
+    case OP_TESTSET: return test(J, i, 1);
+    case OP_FORLOOP:
+      forloop(J, i);
+      return 1;
+    case OP_IADD:
+      iarith(J, i, 0x01);
+      return 1;
+    case OP_ISUB:
+      iarith(J, i, 0x29);
+      return 1;
+    case OP_IEQ: return icompare(J, i, CC_E);
+    case OP_ILT: return icompare(J, i, CC_L);
+    case OP_ILE: return icompare(J, i, CC_LE);
+    case OP_IGETTABLE: return gettable(J, i);
+    case OP_ISETTABLE: return settable(J, i);
+    case OP_MOVECALL: case OP_LOADKCALL: case OP_GETUPGET:
+      SET_OPCODE(i, genericop(GET_OPCODE(i)));  /* only its first half */
+      return instruction(J, i);
+    default: return 0;
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Entries, exits, and installation
+** =======================================================
+*/
+
+/* load in RCX the address of the code of the prototype */
+static void loadcode (JitState *J) {
+  ldq(J, RCX, RCL, cast_int(offsetof(LClosure, p)));
+  ldq(J, RCX, RCX, cast_int(offsetof(Proto, code)));
+}
+
+
+/*
+** Save callee-saved registers and load the frame; traces also count
+** their iterations in R15
+*/
+static void enter (JitState *J, int trace) {
+  e1(J, 0x53);  /* push rbx */
+  e1(J, 0x41); e1(J, 0x54);  /* push r12 */
+  e1(J, 0x41); e1(J, 0x55);  /* push r13 */
+  e1(J, 0x41); e1(J, 0x56);  /* push r14 */
+  if (trace) {
+    e1(J, 0x41); e1(J, 0x57);  /* push r15 */
+    ereg(J, 0, 1, 0x31, R15, R15);  /* xor r15, r15 */
+  }
+  ereg(J, 0, 1, 0x89, 7, RL);  /* mov rbx, rdi */
+  ldq(J, RCI, RL, cast_int(offsetof(lua_State, ci)));
+  ldq(J, RBASE, RCI, cast_int(offsetof(CallInfo, u.l.base)));
+  ldq(J, RCL, RCI, cast_int(offsetof(CallInfo, func)));
+  ldq(J, RCL, RCL, 0);  /* closure */
+}
+
+
+/*
+** Restore callee-saved registers and return AOT_INTERP (or, for
+** traces, the number of iterations, in R15)
+*/
+static void leave (JitState *J, int trace) {
+  if (trace) {
+    ereg(J, 0, 1, 0x89, R15, RAX);  /* mov rax, r15 */
+    e1(J, 0x41); e1(J, 0x5F);  /* pop r15 */
+  }
+  else {
+    e1(J, 0xB8); e4(J, AOT_INTERP);  /* mov eax, AOT_INTERP */
+  }
+  e1(J, 0x41); e1(J, 0x5E);  /* pop r14 */
+  e1(J, 0x41); e1(J, 0x5D);  /* pop r13 */
+  e1(J, 0x41); e1(J, 0x5C);  /* pop r12 */
+  e1(J, 0x5B);  /* pop rbx */
+  e1(J, 0xC3);  /* ret */
+}
+
+
+/*
+** Entry of a function: go to the code of its saved 'pc' through a
+** table of offsets (whose position is returned, to be patched later)
+*/
+static int prologue (JitState *J) {
+  int table, hooks;
+  enter(J, 0);
+  emem(J, 0, 0, 0xF7, 0, RL, cast_int(offsetof(lua_State, hookmask)));
+  e4(J, HOOKINSTR);
+  hooks = jumpfwd(J, CC_NE);  /* with hooks, let the interpreter run */
+  ldq(J, RAX, RCI, cast_int(offsetof(CallInfo, u.l.savedpc)));
+  loadcode(J);
+  ereg(J, 0, 1, 0x29, RCX, RAX);  /* sub rax, rcx */
+  e1(J, 0x48); e1(J, 0x8D); e1(J, 0x0D);  /* lea rcx, [rip + table] */
+  table = J->n;
+  e4(J, 0);
+  e1(J, 0x48); e1(J, 0x63); e1(J, 0x04); e1(J, 0x01);  /* movsxd rax, [rcx+rax] */
+  ereg(J, 0, 1, 0x01, RCX, RAX);  /* add rax, rcx */
+  e1(J, 0xFF); e1(J, 0xE0);  /* jmp rax */
+  here(J, hooks);
+  leave(J, 0);
+  return table;
+}
+
+
+/*
+** Exits: the exit of each instruction from 'J->pc0' to 'last' saves
+** its pc and leaves; returns the position of the first one
+*/
+static int exits (JitState *J, int last, int trace) {
+  int first = J->n;
+  int common = first + (last - J->pc0 + 1) * EXITSIZE;
+  int pc;
+  for (pc = J->pc0; pc <= last; pc++) {
+    e1(J, 0xB8); e4(J, pc);  /* mov eax, pc */
+    e1(J, 0xE9); e4(J, common - (J->n + 4));  /* jmp common */
+  }
+  loadcode(J);
+  e1(J, 0x48); e1(J, 0x8D); e1(J, 0x04); e1(J, 0x81);  /* lea rax, [rcx+rax*4] */
+  stq(J, RAX, RCI, cast_int(offsetof(CallInfo, u.l.savedpc)));
+  leave(J, trace);
+  return first;
+}
+
+
+/* patch all jumps to instructions and to exits (starting at 'exit') */
+static void patch (JitState *J, int exit) {
+  int k;
+  for (k = 0; k < J->nfix; k++) {
+    Fixup *f = &J->fix[k];
+    int target = (f->target >= 0) ? J->label[f->target]
+                       : exit + EXITSIZE * (exitpc(f->target) - J->pc0);
+    int rel = target - (f->pos + 4);
+    memcpy(J->code + f->pos, &rel, sizeof(rel));
+  }
+}
+
+
+/* copy the code to executable memory; returns NULL if that fails */
+static void *install (JitState *J) {
+  void *mcode = mmap(NULL, J->n, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mcode == MAP_FAILED)
+    return NULL;
+  memcpy(mcode, J->code, J->n);
+  if (mprotect(mcode, J->n, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mcode, J->n);
+    return NULL;
+  }
+  return mcode;
+}
+
+
+/* templates assume these sizes */
+#define sizesok()  \
+	(sizeof(TValue) == 16 && sizeof(Instruction) == 4 &&  \
+	 sizeof(lua_Integer) == 8 && sizeof(lua_Number) == 8)
+
+
+static const char tcounting[] = "counting";
+static const char tcompiled[] = "compiled";
+
+
+/* create the records of the numeric loops of 'p' */
+static void newloops (lua_State *L, Proto *p) {
+  int pc, n = 0;
+  for (pc = 0; pc < p->sizecode; pc++)
+    if (GET_OPCODE(p->code[pc]) == OP_FORLOOP) n++;
+  if (n == 0) return;
+  p->loops = luaM_newvector(L, n, JitLoop);
+  p->sizeloops = n;
+  for (pc = 0, n = 0; pc < p->sizecode; pc++) {
+    if (GET_OPCODE(p->code[pc]) == OP_FORLOOP) {
+      JitLoop *lp = &p->loops[n++];
+      lp->pc = pc;
+      lp->count = LUAI_TRACECOUNT;
+      lp->tries = lp->misses = 0;
+      lp->status = tcounting;
+      lp->trace = NULL;
+      lp->mcode = NULL;
+      lp->sizemcode = 0;
+      lp->entries = lp->exits = lp->iterations = 0;
+    }
+  }
+}
+
+
+/*
+** Compile prototype 'p' (which became hot); returns true if it has
+** compiled code now
+*/
+int luaJ_compile (lua_State *L, Proto *p) {
+  int nc = p->sizecode;
+  size_t maxsize = cast(size_t, nc) * (MAXINSTRSIZE + EXITSIZE + 4) + 256;
+  size_t sizefix = cast(size_t, nc) * MAXINSTRJUMPS;
+  size_t sizeblock;
+  lu_byte *block;
+  void *mcode;
+  JitState J;
+  int table, k;
+  lua_assert(p->aot == NULL);
+  if (!sizesok())
+    return 0;
+  newloops(L, p);
+  maxsize = (maxsize + 15) & ~cast(size_t, 15);  /* align what follows */
+  sizeblock = maxsize + sizefix * sizeof(Fixup) + nc * sizeof(int);
+  block = luaM_newvector(L, sizeblock, lu_byte);
+  J.p = p;
+  J.code = block;
+  J.n = 0;
+  J.fix = cast(Fixup *, block + maxsize);
+  J.label = cast(int *, block + maxsize + sizefix * sizeof(Fixup));
+  J.nfix = 0;
+  J.pc0 = 0;
+  table = prologue(&J);
+  for (J.pc = 0; J.pc < nc; J.pc++) {
+    Instruction i = p->code[J.pc];
+    J.label[J.pc] = J.n;
+    if (GET_OPCODE(i) == OP_EXTRAARG || !instruction(&J, i))
+      jumpto(&J, CC_ALWAYS, exitpc(J.pc));  /* interpret it */
+    lua_assert(J.n - J.label[J.pc] <= MAXINSTRSIZE);
+    lua_assert(J.nfix <= (J.pc + 1) * MAXINSTRJUMPS);
+  }
+  patch(&J, exits(&J, nc - 1, 0));
+  while (J.n % 4 != 0) e1(&J, 0xCC);  /* align table (with 'int3') */
+  k = J.n - (table + 4);  /* displacement of table from 'lea' */
+  memcpy(J.code + table, &k, sizeof(k));
+  for (k = 0, table = J.n; k < nc; k++)
+    e4(&J, J.label[k] - table);
+  mcode = install(&J);
+  if (mcode != NULL) {
+    p->mcode = mcode;
+    p->sizemcode = J.n;
+    p->aot = (__extension__ (AOTFunction)mcode);
+  }
+  luaM_freearray(L, block, sizeblock);
+  return (p->aot != NULL);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Traces of numeric loops
+** =======================================================
+*/
+
+/*
+** A hot integer 'for' loop whose body has no branches gets its own
+** trace. The trace is recorded by running one iteration of the body
+** over a copy of the registers of the frame, which gives the type of
+** every value the body handles; the code is then specialized to those
+** types. Registers that the body reads before writing are checked
+** once, when the trace is entered, and so is the sign of the step;
+** inside the loop only values loaded from tables and upvalues need
+** checks. Arithmetic on loop invariants is computed once before the
+** loop, as are the array parts of tables that the loop does not
+** change (the code never calls anything, so no table can be resized
+** meanwhile) and the bounds checks of accesses indexed by the loop
+** variable. All values stay in the stack, so a side exit (a failed
+** check) only saves the 'pc' of its instruction, and the interpreter
+** goes on from there. A trace that exits too often is dropped.
+*/
+
+
+/* machine registers of a trace */
+#define RIDX	8	/* r8: loop index */
+#define RLIMIT	9	/* r9: loop limit */
+#define RSTEP	10	/* r10: loop step */
+
+/* machine registers for the array parts of invariant tables */
+static const int arrayregs[] = {11, 6, 7};  /* r11, rsi, rdi */
+#define NARRAYREGS	cast_int(sizeof(arrayregs) / sizeof(arrayregs[0]))
+
+/*
+** A side exit after less than LUAI_TRACEMINRUN iterations is a miss;
+** after LUAI_TRACEMISSES misses, the loop is traced again (as its types
+** probably changed), up to LUAI_MAXRETRACE times
+*/
+#if !defined(LUAI_TRACEMINRUN)
+#define LUAI_TRACEMINRUN	4
+#endif
+
+#if !defined(LUAI_TRACEMISSES)
+#define LUAI_TRACEMISSES	100
+#endif
+
+#define NOTAG	(-1)
+
+#define isnumtag(t)	((t) == LUA_TNUMINT || (t) == LUA_TNUMFLT)
+
+
+typedef struct TraceState {
+  JitState J;
+  int a;  /* base register of the loop */
+  int first;  /* first instruction of its body */
+  int last;  /* its OP_FORLOOP */
+  int stepup;  /* true if the step is positive */
+  int upvals;  /* true if the body uses upvalues */
+  int nregs;  /* number of registers of the frame */
+  lu_byte *nwrites;  /* number of writes to each register in the loop */
+  lu_byte *readfirst;  /* registers read by the loop before written */
+  lu_byte *invariant;  /* registers with the same value in all iterations */
+  lu_byte *bounded;  /* tables whose bounds are checked before the loop */
+  int *arrayreg;  /* machine register with array of each table (or -1) */
+  int *entry;  /* tag of each register when the trace starts */
+  int *known;  /* tag known to be in the stack for each register */
+  lu_byte *hoisted;  /* instructions computed before the loop */
+  lu_byte *inbounds;  /* accesses whose bounds are checked before */
+  int *tags;  /* recorded tags of operands 'B' and 'C' and of result */
+  const char *abort;  /* why the loop cannot be traced */
+} TraceState;
+
+
+#define tagB(T,pc)	((T)->tags[3 * ((pc) - (T)->first)])
+#define tagC(T,pc)	((T)->tags[3 * ((pc) - (T)->first) + 1])
+#define tagR(T,pc)	((T)->tags[3 * ((pc) - (T)->first) + 2])
+
+
+/*
+** Traces take integer opcodes as their generic ones: their guards
+** already give them the types of all operands
+*/
+static Instruction generic (Instruction i) {
+  SET_OPCODE(i, genericop(GET_OPCODE(i)));
+  return i;
+}
+
+
+/* note a read of RK operand 'x' */
+static void useread (TraceState *T, int x) {
+  if (!ISK(x) && T->nwrites[x] == 0)
+    T->readfirst[x] = 1;
+}
+
+
+static void usewrite (TraceState *T, int r) {
+  if (T->nwrites[r] < 255) T->nwrites[r]++;
+}
+
+
+/*
+** Find which registers the loop reads and writes; false if it cannot
+** be traced
+*/
+static int scan (TraceState *T) {
+  const Instruction *code = T->J.p->code;
+  int pc;
+  for (pc = T->first; pc < T->last; pc++) {
+    Instruction i = generic(code[pc]);
+    int a = GETARG_A(i);
+    switch (GET_OPCODE(i)) {
+      case OP_MOVE: case OP_NOT: case OP_UNM:
+        useread(T, GETARG_B(i));
+        usewrite(T, a);
+        break;
+      case OP_LOADK:
+        usewrite(T, a);
+        break;
+      case OP_LOADBOOL:
+        if (GETARG_C(i)) {
+          T->abort = "branch in loop";
+          return 0;
+        }
+        usewrite(T, a);
+        break;
+      case OP_LOADNIL: {
+        int b = GETARG_B(i);
+        do {
+          usewrite(T, a++);
+        } while (b--);
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      case OP_BAND: case OP_BOR: case OP_BXOR: case OP_GETTABLE:
+        useread(T, GETARG_B(i));
+        useread(T, GETARG_C(i));
+        usewrite(T, a);
+        break;
+      case OP_SETTABLE:
+        useread(T, a);
+        useread(T, GETARG_B(i));
+        useread(T, GETARG_C(i));
+        break;
+      case OP_GETUPVAL:
+        T->upvals = 1;
+        usewrite(T, a);
+        break;
+      case OP_SETUPVAL:
+        T->upvals = 1;
+        useread(T, a);
+        break;
+      case OP_JMP: case OP_EQ: case OP_LT: case OP_LE: case OP_TEST:
+      case OP_TESTSET: case OP_FORLOOP: case OP_FORPREP:
+      case OP_TFORCALL: case OP_TFORLOOP:
+        T->abort = "branch in loop";
+        return 0;
+      default:
+        T->abort = "unsupported instruction";
+        return 0;
+    }
+  }
+  useread(T, T->a);  /* OP_FORLOOP */
+  useread(T, T->a + 1);
+  useread(T, T->a + 2);
+  usewrite(T, T->a);
+  usewrite(T, T->a + 3);
+  return 1;
+}
+
+
+/* RK operand in the copy 'regs' of the registers */
+#define simRK(T,regs,x)	(ISK(x) ? &(T)->J.p->k[INDEXK(x)] : &(regs)[x])
+
+
+/*
+** Slot for key 'key' of table 't' in the array part, checking it can be
+** used by the trace
+*/
+static const TValue *simslot (TraceState *T, const TValue *t,
+                              const TValue *key) {
+  Table *h;
+  lua_Integer n;
+  if (!ttistable(t)) {
+    T->abort = "indexed value is not a table";
+    return NULL;
+  }
+  if (!ttisinteger(key)) {
+    T->abort = "key is not an integer";
+    return NULL;
+  }
+  h = hvalue(t);
+  n = ivalue(key);
+  if (!(l_castS2U(n) - 1u < h->sizearray)) {
+    T->abort = "key out of array part";
+    return NULL;
+  }
+  if (ttisnil(&h->array[n - 1])) {
+    T->abort = "nil value in array";
+    return NULL;
+  }
+  return &h->array[n - 1];
+}
+
+
+/*
+** Record the loop: run its body once over copy 'regs' of the
+** registers, collecting the tags of all values
+*/
+static int record (lua_State *L, TraceState *T, TValue *regs) {
+  Proto *p = T->J.p;
+  LClosure *cl = clLvalue(L->ci->func);
+  int pc, r;
+  for (r = 0; r < T->nregs; r++)
+    T->entry[r] = rttype(&regs[r]);
+  for (pc = T->first; pc < T->last; pc++) {
+    Instruction i = generic(p->code[pc]);
+    TValue *ra = &regs[GETARG_A(i)];
+    const TValue *rb, *rc;
+    OpCode op = GET_OPCODE(i);
+    tagB(T, pc) = tagC(T, pc) = NOTAG;
+    switch (op) {
+      case OP_MOVE:
+        rb = &regs[GETARG_B(i)];
+        tagB(T, pc) = rttype(rb);
+        setobj(L, ra, rb);
+        break;
+      case OP_LOADK:
+        setobj(L, ra, &p->k[GETARG_Bx(i)]);
+        break;
+      case OP_LOADBOOL:
+        setbvalue(ra, GETARG_B(i));
+        break;
+      case OP_LOADNIL: {
+        int b = GETARG_B(i);
+        do {
+          setnilvalue(ra++);
+        } while (b--);
+        break;
+      }
+      case OP_NOT:
+        rb = &regs[GETARG_B(i)];
+        tagB(T, pc) = rttype(rb);
+        setbvalue(ra, l_isfalse(rb));
+        break;
+      case OP_UNM:
+        rb = rc = &regs[GETARG_B(i)];
+        goto arith;
+      case OP_BAND: case OP_BOR: case OP_BXOR:
+        rb = simRK(T, regs, GETARG_B(i));
+        rc = simRK(T, regs, GETARG_C(i));
+        if (!ttisinteger(rb) || !ttisinteger(rc)) {
+          T->abort = "bitwise operation on non-integers";
+          return 0;
+        }
+        goto arith;
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        rb = simRK(T, regs, GETARG_B(i));
+        rc = simRK(T, regs, GETARG_C(i));
+       arith:
+        if (!ttisnumber(rb) || !ttisnumber(rc)) {
+          T->abort = "arithmetic on non-numbers";
+          return 0;
+        }
+        tagB(T, pc) = rttype(rb);
+        tagC(T, pc) = rttype(rc);
+        luaO_arith(L, op - OP_ADD + LUA_OPADD, rb, rc, ra);
+        break;
+      case OP_GETTABLE: {
+        const TValue *slot;
+        rb = &regs[GETARG_B(i)];
+        rc = simRK(T, regs, GETARG_C(i));
+        if ((slot = simslot(T, rb, rc)) == NULL)
+          return 0;
+        tagB(T, pc) = rttype(rb);
+        tagC(T, pc) = rttype(rc);
+        setobj(L, ra, slot);
+        break;
+      }
+      case OP_SETTABLE:
+        rb = simRK(T, regs, GETARG_B(i));
+        rc = simRK(T, regs, GETARG_C(i));
+        if (simslot(T, ra, rb) == NULL)
+          return 0;
+        if (iscollectable(rc)) {  /* would need barriers */
+          T->abort = "collectable value stored in table";
+          return 0;
+        }
+        tagB(T, pc) = rttype(rb);
+        tagC(T, pc) = rttype(rc);
+        break;  /* the table itself is not changed */
+      case OP_GETUPVAL:
+        setobj(L, ra, cl->upvals[GETARG_B(i)]->v);
+        break;
+      case OP_SETUPVAL:
+        if (iscollectable(ra)) {  /* would need barriers */
+          T->abort = "collectable value stored in upvalue";
+          return 0;
+        }
+        break;
+      default: lua_assert(0);
+    }
+    tagR(T, pc) = rttype(ra);
+  }
+  setivalue(&regs[T->a + 3], 0);  /* OP_FORLOOP */
+  for (r = 0; r < T->nregs; r++) {
+    if (T->readfirst[r] && rttype(&regs[r]) != T->entry[r]) {
+      T->abort = "unstable types";
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+/* RK operand 'x' has the same value in all iterations? */
+static int isinvariant (TraceState *T, int x) {
+  return (ISK(x) || T->invariant[x]);
+}
+
+
+/*
+** Loop-invariant code motion: an instruction is computed before the
+** loop if it computes a number from invariant operands into a register
+** that is written only by it, not read before it, and not live before
+** the loop (locals of the body and temporaries live above the control
+** registers of the loop, so the early write is not visible)
+*/
+static void hoist (TraceState *T) {
+  const Instruction *code = T->J.p->code;
+  int pc, r;
+  for (r = 0; r < T->nregs; r++)
+    T->invariant[r] = (T->nwrites[r] == 0);
+  for (pc = T->first; pc < T->last; pc++) {
+    Instruction i = generic(code[pc]);
+    int a = GETARG_A(i);
+    int ok;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADK:
+        ok = ttisnumber(&T->J.p->k[GETARG_Bx(i)]);
+        break;
+      case OP_MOVE:
+        ok = (isinvariant(T, GETARG_B(i)) && isnumtag(tagB(T, pc)));
+        break;
+      case OP_UNM:
+        ok = isinvariant(T, GETARG_B(i));
+        break;
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      case OP_BAND: case OP_BOR: case OP_BXOR:
+        ok = (isinvariant(T, GETARG_B(i)) && isinvariant(T, GETARG_C(i)));
+        break;
+      default:
+        ok = 0;
+    }
+    if (ok && a >= T->a + 4 && T->nwrites[a] == 1 && !T->readfirst[a]) {
+      T->hoisted[pc - T->first] = 1;
+      T->invariant[a] = 1;
+    }
+  }
+}
+
+
+/*
+** Tables indexed in the loop that it does not change get their array
+** parts in machine registers; accesses indexed by the loop variable
+** have their bounds checked before the loop
+*/
+static void hoisttables (TraceState *T) {
+  const Instruction *code = T->J.p->code;
+  int pc, r, nregs = 0;
+  int idxinvariant = (T->nwrites[T->a + 3] == 1);  /* only OP_FORLOOP? */
+  for (r = 0; r < T->nregs; r++)
+    T->arrayreg[r] = -1;
+  for (pc = T->first; pc < T->last; pc++) {
+    Instruction i = generic(code[pc]);
+    int t, key;
+    if (GET_OPCODE(i) == OP_GETTABLE) {
+      t = GETARG_B(i); key = GETARG_C(i);
+    }
+    else if (GET_OPCODE(i) == OP_SETTABLE) {
+      t = GETARG_A(i); key = GETARG_B(i);
+    }
+    else continue;
+    if (T->nwrites[t] != 0) continue;  /* table may change */
+    if (T->arrayreg[t] < 0 && nregs < NARRAYREGS)
+      T->arrayreg[t] = arrayregs[nregs++];
+    if (T->arrayreg[t] >= 0 && key == T->a + 3 && idxinvariant) {
+      T->inbounds[pc - T->first] = 1;
+      T->bounded[t] = 1;
+    }
+  }
+}
+
+
+/* store tag 'tag' of register 'r', unless it is already there */
+static void tracetag (TraceState *T, int r, int tag) {
+  if (T->known[r] != tag) {
+    settag(&T->J, RBASE, VAL(r), tag);
+    T->known[r] = tag;
+  }
+}
+
+
+/* load numeric operand 'x' (with tag 'tag') as a float in 'xr' */
+static void tracenum (TraceState *T, int xr, int x, int tag) {
+  JitState *J = &T->J;
+  const TValue *k = rkconst(J, x);
+  if (k != NULL)
+    loadfltk(J, xr, ttisinteger(k) ? cast_num(ivalue(k)) : fltvalue(k));
+  else if (tag == LUA_TNUMINT)
+    emem(J, 0xF2, 1, 0x0F2A, xr, RBASE, VAL(x));  /* cvtsi2sd */
+  else
+    ldsd(J, xr, RBASE, VAL(x));
+}
+
+
+static void tracearith (TraceState *T, Instruction i) {
+  JitState *J = &T->J;
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  OpCode op = GET_OPCODE(i);
+  if (op == OP_UNM) {
+    ldq(J, RAX, RBASE, VAL(b));
+    if (tagR(T, J->pc) == LUA_TNUMINT)
+      ereg(J, 0, 1, 0xF7, 3, RAX);  /* neg rax */
+    else {
+      ereg(J, 0, 1, 0x0FBA, 7, RAX);  /* btc rax, 63 (flip sign) */
+      e1(J, 63);
+    }
+    stq(J, RAX, RBASE, VAL(a));
+  }
+  else if (tagR(T, J->pc) == LUA_TNUMINT) {
+    loadi(J, RAX, b);
+    loadi(J, RCX, c);
+    switch (op) {
+      case OP_ADD: ereg(J, 0, 1, 0x01, RCX, RAX); break;
+      case OP_SUB: ereg(J, 0, 1, 0x29, RCX, RAX); break;
+      case OP_MUL: ereg(J, 0, 1, 0x0FAF, RAX, RCX); break;
+      case OP_BAND: ereg(J, 0, 1, 0x21, RCX, RAX); break;
+      case OP_BOR: ereg(J, 0, 1, 0x09, RCX, RAX); break;
+      case OP_BXOR: ereg(J, 0, 1, 0x31, RCX, RAX); break;
+      default: lua_assert(0);
+    }
+    stq(J, RAX, RBASE, VAL(a));
+  }
+  else {
+    static const int fops[] = {0x0F58, 0x0F5C, 0x0F59};  /* add, sub, mul */
+    tracenum(T, 0, b, tagB(T, J->pc));
+    tracenum(T, 1, c, tagC(T, J->pc));
+    ereg(J, 0xF2, 0, (op == OP_DIV) ? 0x0F5E : fops[op - OP_ADD], 0, 1);
+    stsd(J, 0, RBASE, VAL(a));
+  }
+  tracetag(T, a, tagR(T, J->pc));
+}
+
+
+/* address in RCX of the slot of key 'x' in table at register 't' */
+static void traceslot (TraceState *T, int t, int x) {
+  JitState *J = &T->J;
+  int areg = T->arrayreg[t];
+  if (T->inbounds[J->pc - T->first])
+    ereg(J, 0, 1, 0x89, RIDX, RAX);  /* mov rax, r8 */
+  else
+    loadi(J, RAX, x);
+  ereg(J, 0, 1, 0x83, 5, RAX);  /* sub rax, 1 */
+  e1(J, 1);
+  if (!T->inbounds[J->pc - T->first]) {
+    ldq(J, RDX, RBASE, VAL(t));  /* table */
+    emem(J, 0, 0, 0x8B, RDX, RDX, cast_int(offsetof(Table, sizearray)));
+    ereg(J, 0, 1, 0x39, RDX, RAX);  /* cmp rax, rdx (unsigned) */
+    jumpto(J, CC_AE, exitpc(J->pc));
+  }
+  if (areg >= 0)
+    ereg(J, 0, 1, 0x89, areg, RCX);  /* mov rcx, areg */
+  else {
+    ldq(J, RCX, RBASE, VAL(t));
+    ldq(J, RCX, RCX, cast_int(offsetof(Table, array)));
+  }
+  ereg(J, 0, 1, 0xC1, 4, RAX);  /* shl rax, 4 */
+  e1(J, 4);
+  ereg(J, 0, 1, 0x01, RAX, RCX);  /* add rcx, rax */
+}
+
+
+/* address of upvalue 'n' into RCX (arenas were checked on entry) */
+static void traceupval (TraceState *T, int n) {
+  JitState *J = &T->J;
+  ldq(J, RCX, RCL, cast_int(offsetof(LClosure, upvals)) +
+                   n * cast_int(sizeof(UpVal *)));
+  ldq(J, RCX, RCX, cast_int(offsetof(UpVal, v)));
+}
+
+
+/* load into the register 'a' the value at RCX, which must have 'tag' */
+static void traceload (TraceState *T, int a, int tag) {
+  JitState *J = &T->J;
+  cmptag(J, RCX, 0, tag);
+  jumpto(J, CC_NE, exitpc(J->pc));
+  ldq(J, RAX, RCX, 0);
+  stq(J, RAX, RBASE, VAL(a));
+  tracetag(T, a, tag);
+}
+
+
+static void traceinstruction (TraceState *T, Instruction i) {
+  JitState *J = &T->J;
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE:
+      ldq(J, RAX, RBASE, VAL(GETARG_B(i)));
+      stq(J, RAX, RBASE, VAL(a));
+      tracetag(T, a, tagR(T, J->pc));
+      break;
+    case OP_LOADK: {
+      const TValue *k = &J->p->k[GETARG_Bx(i)];
+      lua_Integer v;
+      memcpy(&v, &k->value_, sizeof(v));
+      movimm(J, RAX, v);
+      stq(J, RAX, RBASE, VAL(a));
+      tracetag(T, a, rttype(k));
+      break;
+    }
+    case OP_LOADBOOL:
+      movimm(J, RAX, GETARG_B(i));
+      stq(J, RAX, RBASE, VAL(a));
+      tracetag(T, a, LUA_TBOOLEAN);
+      break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        tracetag(T, a++, LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_NOT: {
+      int tb = tagB(T, J->pc);
+      if (tb == LUA_TBOOLEAN) {
+        emem(J, 0, 0, 0x81, 7, RBASE, VAL(GETARG_B(i)));  /* cmp b, 0 */
+        e4(J, 0);
+        e1(J, 0x0F); e1(J, 0x94); e1(J, 0xC0);  /* sete al */
+        e1(J, 0x0F); e1(J, 0xB6); e1(J, 0xC0);  /* movzx eax, al */
+      }
+      else movimm(J, RAX, tb == LUA_TNIL);
+      stq(J, RAX, RBASE, VAL(a));
+      tracetag(T, a, LUA_TBOOLEAN);
+      break;
+    }
+    case OP_GETTABLE:
+      traceslot(T, GETARG_B(i), GETARG_C(i));
+      traceload(T, a, tagR(T, J->pc));
+      break;
+    case OP_SETTABLE: {
+      int c = GETARG_C(i);
+      const TValue *k = rkconst(J, c);
+      traceslot(T, a, GETARG_B(i));
+      cmptag(J, RCX, 0, LUA_TNIL);
+      jumpto(J, CC_E, exitpc(J->pc));  /* absent keys may have metamethods */
+      if (k != NULL) {
+        lua_Integer v;
+        memcpy(&v, &k->value_, sizeof(v));
+        movimm(J, RAX, v);
+      }
+      else ldq(J, RAX, RBASE, VAL(c));
+      stq(J, RAX, RCX, 0);
+      settag(J, RCX, 0, tagC(T, J->pc));
+      break;
+    }
+    case OP_GETUPVAL:
+      traceupval(T, GETARG_B(i));
+      traceload(T, a, tagR(T, J->pc));
+      break;
+    case OP_SETUPVAL:
+      traceupval(T, GETARG_B(i));
+      copyvalue(J, RCX, 0, RBASE, VAL(a));
+      break;
+    default:
+      tracearith(T, i);
+      break;
+  }
+}
+
+
+/* code before the loop: checks on entry and hoisted computations */
+static void preheader (TraceState *T) {
+  JitState *J = &T->J;
+  int r, pc;
+  J->pc = T->first;  /* exits here leave the frame as it was */
+  for (r = 0; r < T->nregs; r++) {
+    T->known[r] = NOTAG;
+    if (T->readfirst[r]) {
+      cmptag(J, RBASE, VAL(r), T->entry[r]);
+      jumpto(J, CC_NE, exitpc(T->first));
+      T->known[r] = T->entry[r];
+    }
+  }
+  if (T->upvals) {  /* upvalues need barriers while there are arenas */
+    ldq(J, RAX, RL, cast_int(offsetof(lua_State, l_G)));
+    emem(J, 0, 1, 0x81, 7, RAX, cast_int(offsetof(global_State, arenas)));
+    e4(J, 0);  /* cmp qword [arenas], 0 */
+    jumpto(J, CC_NE, exitpc(T->first));
+  }
+  ldq(J, RIDX, RBASE, VAL(T->a));
+  ldq(J, RLIMIT, RBASE, VAL(T->a + 1));
+  ldq(J, RSTEP, RBASE, VAL(T->a + 2));
+  ereg(J, 0, 1, 0x85, RSTEP, RSTEP);  /* test r10, r10 */
+  jumpto(J, T->stepup ? CC_LE : CC_G, exitpc(T->first));
+  for (r = 0; r < T->nregs; r++) {
+    if (T->arrayreg[r] >= 0) {
+      ldq(J, RAX, RBASE, VAL(r));  /* table */
+      if (T->bounded[r]) {  /* check all keys from index to limit */
+        emem(J, 0, 0, 0x8B, RDX, RAX, cast_int(offsetof(Table, sizearray)));
+        ereg(J, 0, 1, 0x39, RDX, T->stepup ? RLIMIT : RIDX);
+        jumpto(J, CC_G, exitpc(T->first));  /* last key > size? */
+        ereg(J, 0, 1, 0x83, 7, T->stepup ? RIDX : RLIMIT);  /* cmp _, 1 */
+        e1(J, 1);
+        jumpto(J, CC_L, exitpc(T->first));  /* first key < 1? */
+      }
+      ldq(J, T->arrayreg[r], RAX, cast_int(offsetof(Table, array)));
+    }
+  }
+  for (pc = T->first; pc < T->last; pc++) {
+    if (T->hoisted[pc - T->first]) {
+      J->pc = pc;
+      traceinstruction(T, generic(J->p->code[pc]));
+    }
+  }
+}
+
+
+/* the loop itself */
+static void traceloop (TraceState *T) {
+  JitState *J = &T->J;
+  int loop, r, pc;
+  for (r = 0; r < T->nregs; r++) {  /* tags at the start of each iteration */
+    if (!T->readfirst[r] && !T->invariant[r])
+      T->known[r] = NOTAG;
+  }
+  loop = J->n;
+  for (pc = T->first; pc < T->last; pc++) {
+    if (!T->hoisted[pc - T->first]) {
+      J->pc = pc;
+      traceinstruction(T, generic(J->p->code[pc]));
+    }
+  }
+  J->pc = T->last;
+  ereg(J, 0, 1, 0x01, RSTEP, RIDX);  /* add r8, r10 */
+  ereg(J, 0, 1, 0x39, RLIMIT, RIDX);  /* cmp r8, r9 */
+  jumpto(J, T->stepup ? CC_G : CC_L, exitpc(T->last + 1));  /* loop ends */
+  stq(J, RIDX, RBASE, VAL(T->a));
+  stq(J, RIDX, RBASE, VAL(T->a + 3));
+  tracetag(T, T->a + 3, LUA_TNUMINT);
+  ereg(J, 0, 1, 0xFF, 0, R15);  /* inc r15 (iterations) */
+  checkhooks(J, T->first);
+  e1(J, 0xE9); e4(J, loop - (J->n + 4));  /* jmp loop */
+}
+
+
+/*
+** Trace the loop of 'lp', with the frame of 'ci' at the start of its
+** body; returns false if that is not possible (setting the reason)
+*/
+static int compiletrace (lua_State *L, CallInfo *ci, Proto *p,
+                         JitLoop *lp) {
+  Instruction i = p->code[lp->pc];
+  int len = -GETARG_sBx(i);  /* instructions in body plus OP_FORLOOP */
+  int nregs = p->maxstacksize;
+  size_t maxsize = cast(size_t, len + nregs) * (MAXINSTRSIZE / 4) +
+                   cast(size_t, len) * (MAXINSTRSIZE + EXITSIZE) + 512;
+  size_t sizefix = cast(size_t, len + nregs + 8) * MAXINSTRJUMPS;
+  size_t sizeblock, pos;
+  lu_byte *block;
+  TValue *regs;
+  void *mcode = NULL;
+  TraceState T;
+  if (len - 1 > LUAI_MAXTRACE) {
+    lp->status = "loop too long";
+    return 0;
+  }
+  maxsize = (maxsize + 15) & ~cast(size_t, 15);  /* align what follows */
+  sizeblock = maxsize + nregs * sizeof(TValue) + sizefix * sizeof(Fixup) +
+              cast(size_t, 3 * nregs + 3 * len) * sizeof(int) +
+              cast(size_t, 4 * nregs + 2 * len);
+  block = luaM_newvector(L, sizeblock, lu_byte);
+  memset(block, 0, sizeblock);
+  pos = maxsize;
+  regs = cast(TValue *, block + pos); pos += nregs * sizeof(TValue);
+  T.J.fix = cast(Fixup *, block + pos); pos += sizefix * sizeof(Fixup);
+  T.entry = cast(int *, block + pos); pos += nregs * sizeof(int);
+  T.known = cast(int *, block + pos); pos += nregs * sizeof(int);
+  T.arrayreg = cast(int *, block + pos); pos += nregs * sizeof(int);
+  T.tags = cast(int *, block + pos); pos += 3 * len * sizeof(int);
+  T.nwrites = block + pos; pos += nregs;
+  T.readfirst = block + pos; pos += nregs;
+  T.invariant = block + pos; pos += nregs;
+  T.bounded = block + pos; pos += nregs;
+  T.hoisted = block + pos; pos += len;
+  T.inbounds = block + pos; pos += len;
+  lua_assert(pos == sizeblock);
+  memcpy(regs, ci->u.l.base, nregs * sizeof(TValue));
+  T.J.p = p;
+  T.J.code = block;
+  T.J.n = 0;
+  T.J.label = NULL;
+  T.J.nfix = 0;
+  T.a = GETARG_A(i);
+  T.first = lp->pc + 1 - len;
+  T.last = lp->pc;
+  T.stepup = (ivalue(ci->u.l.base + T.a + 2) > 0);
+  T.upvals = 0;
+  T.nregs = nregs;
+  T.abort = NULL;
+  T.J.pc0 = T.first;
+  if (scan(&T) && record(L, &T, regs)) {
+    JitState *J = &T.J;
+    hoist(&T);
+    hoisttables(&T);
+    enter(J, 1);
+    preheader(&T);
+    traceloop(&T);
+    patch(J, exits(J, T.last + 1, 1));
+    lua_assert(J->n <= cast_int(maxsize) && J->nfix <= cast_int(sizefix));
+    mcode = install(J);
+    if (mcode == NULL)
+      T.abort = "cannot allocate executable memory";
+    else {
+      lp->mcode = mcode;
+      lp->sizemcode = J->n;
+      lp->trace = (__extension__ (lua_Integer (*) (lua_State *))mcode);
+      lp->status = tcompiled;
+      lp->tries++;
+    }
+  }
+  luaM_freearray(L, block, sizeblock);
+  if (T.abort != NULL) lp->status = T.abort;
+  return (mcode != NULL);
+}
+
+
+/* drop the trace of 'lp', which keeps missing */
+static void droptrace (JitLoop *lp) {
+  munmap(lp->mcode, lp->sizemcode);
+  lp->mcode = NULL;
+  lp->trace = NULL;
+  lp->misses = 0;
+  if (lp->tries < LUAI_MAXRETRACE) {  /* trace it again later */
+    lp->status = tcounting;
+    lp->count = LUAI_TRACECOUNT;
+  }
+  else
+    lp->status = "too many side exits";
+}
+
+
+/*
+** Called by the interpreter after the integer loop ending at 'pc' jumps
+** back. If the loop has a trace (or became hot now and could be
+** traced), runs it and returns true; the frame then goes on from its
+** saved 'pc'.
+*/
+int luaJ_trace (lua_State *L, CallInfo *ci, int pc) {
+  Proto *p = clLvalue(ci->func)->p;
+  JitLoop *lp = findloop(p, pc);
+  lua_Integer n;
+  if (lp == NULL || lp->count > 0)
+    return 0;  /* not hot yet */
+  if (lp->status == tcounting)  /* loop just became hot? */
+    compiletrace(L, ci, p, lp);
+  if (lp->status != tcompiled) {
+    lp->count = MAX_INT;  /* do not come back here */
+    return 0;
+  }
+  lp->count = 1;  /* compiled code comes back here at its next iteration */
+  n = (*lp->trace)(L);
+  lp->entries++;
+  lp->iterations += n;
+  if (ci->u.l.savedpc != p->code + pc + 1) {  /* side exit? */
+    lp->exits++;
+    if (n < LUAI_TRACEMINRUN && ++lp->misses >= LUAI_TRACEMISSES)
+      droptrace(lp);
+  }
+  return 1;
+}
+
+
+/*
+** Status and counters of the trace for the n-th numeric loop of 'p'
+** (NULL if there is no such loop)
+*/
+const char *luaJ_traceinfo (Proto *p, int n, int *line, lua_Integer *entries,
+                            lua_Integer *exits, lua_Integer *iterations) {
+  JitLoop *lp;
+  if (!(1 <= n && n <= p->sizeloops))
+    return NULL;
+  lp = &p->loops[n - 1];
+  if (line) *line = getfuncline(p, lp->pc);
+  if (entries) *entries = lp->entries;
+  if (exits) *exits = lp->exits;
+  if (iterations) *iterations = lp->iterations;
+  return lp->status;
+}
+
+/* }====================================================== */
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  int i;
+  if (p->mcode != NULL)
+    munmap(p->mcode, p->sizemcode);
+  for (i = 0; i < p->sizeloops; i++) {
+    if (p->loops[i].mcode != NULL)
+      munmap(p->loops[i].mcode, p->loops[i].sizemcode);
+  }
+  luaM_freearray(L, p->loops, p->sizeloops);
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler of hot Lua functions to machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* number of calls plus backward jumps that make a function hot */
+#if !defined(LUAI_JITCOUNT)
+#define LUAI_JITCOUNT	100
+#endif
+
+/* iterations of a numeric loop in compiled code that make it hot */
+#if !defined(LUAI_TRACECOUNT)
+#define LUAI_TRACECOUNT	200
+#endif
+
+/* number of times a loop may be traced again after its types change */
+#if !defined(LUAI_MAXRETRACE)
+#define LUAI_MAXRETRACE	3
+#endif
+
+/* maximum number of instructions in the body of a traced loop */
+#if !defined(LUAI_MAXTRACE)
+#define LUAI_MAXTRACE	100
+#endif
+
+
+/*
+** A numeric 'for' loop of a compiled function, which may get its own
+** trace (see 'ljit.c')
+*/
+typedef struct JitLoop {
+  int pc;  /* position of its OP_FORLOOP */
+  int count;  /* iterations left before tracing it (in compiled code) */
+  int tries;  /* number of times it was traced */
+  int misses;  /* early side exits of its current trace */
+  const char *status;  /* "counting", "compiled", or why it was aborted */
+  lua_Integer (*trace) (lua_State *L);  /* its code; returns iterations */
+  void *mcode;  /* machine code of 'trace' */
+  size_t sizemcode;
+  lua_Integer entries;  /* number of runs of the trace */
+  lua_Integer exits;  /* runs that left the loop before its end */
+  lua_Integer iterations;  /* iterations run by the trace */
+} JitLoop;
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** Count one more call or backward jump of a function, compiling it
+** when it becomes hot; true if it was compiled now
+*/
+#define luaJ_count(L,p)  \
+	((p)->jitcount > 0 && --(p)->jitcount == 0 && luaJ_compile(L, p))
+
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC int luaJ_trace (lua_State *L, CallInfo *ci, int pc);
+LUAI_FUNC const char *luaJ_traceinfo (Proto *p, int n, int *line,
+                                      lua_Integer *entries,
+                                      lua_Integer *exits,
+                                      lua_Integer *iterations);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#else
+
+#define luaJ_count(L,p)		0
+#define luaJ_traceinfo(p,n,l,en,ex,it)	NULL
+#define luaJ_free(L,p)		((void)0)
+
+#endif
+
+#endif
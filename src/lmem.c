@@ -19,6 +19,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lprof.h"
 #include "lstate.h"
 
 
@@ -83,7 +84,12 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
 #endif
-  newblock = (*g->frealloc)(g->ud, block, osize, nsize);
+  if (nsize > realosize)  /* sample before the block (maybe a stack) moves */
+    luaC_profalloc(L, g, nsize - realosize);
+  if (nsize == 0 && g->gcdeferfree)  /* freeing a swept object? */
+    newblock = luaC_deferfree(g, block, osize);
+  else
+    newblock = (*g->frealloc)(g->ud, block, osize, nsize);
   if (newblock == NULL && nsize > 0) {
     lua_assert(nsize > realosize);  /* cannot fail when shrinking a block */
     if (g->version) {  /* is state fully built? */
@@ -95,6 +101,12 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - realosize;
+  if (nsize > realosize) {
+    g->stats.allocbytes += nsize - realosize;
+    if (realosize == 0) g->stats.allocs++;
+  }
+  else if (nsize == 0 && realosize > 0)
+    g->stats.frees++;
   return newblock;
 }
 
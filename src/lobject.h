@@ -53,6 +53,15 @@
 // 这个地方是对9中Lua类型的tag位（4和5）进行设置
 // 比如说LUA_TFUNCTION这个类型，45位为0时代表lua闭包，为1时代表C函数，为2时代表C闭包
 // 所以下面的操作是对tag位进行扩展的
+/*
+** LUA_TNIL variants:
+** 0 - nil
+** 1 - traversal position kept by a generic 'for' in its control
+**     variable (see 'fornative' in lvm.c); never visible to Lua code
+*/
+#define LUA_TFORPOS	(LUA_TNIL | (1 << 4))
+
+
 /* Variant tags for functions */
 #define LUA_TLCL	(LUA_TFUNCTION | (0 << 4))  /* Lua closure */
 #define LUA_TLCF	(LUA_TFUNCTION | (1 << 4))  /* light C function */
@@ -177,6 +186,7 @@ typedef struct lua_TValue {
 #define ttisfulluserdata(o)	checktag((o), ctb(LUA_TUSERDATA))
 #define ttisthread(o)		checktag((o), ctb(LUA_TTHREAD))
 #define ttisdeadkey(o)		checktag((o), LUA_TDEADKEY)
+#define ttisforpos(o)		checktag((o), LUA_TFORPOS)
 
 
 // check_exp是一个断言，定义在limits.h中
@@ -241,6 +251,9 @@ typedef struct lua_TValue {
 
 #define setnilvalue(obj) settt_(obj, LUA_TNIL)
 
+#define setforpos(obj,x) \
+  { TValue *io=(obj); val_(io).i=(x); settt_(io, LUA_TFORPOS); }
+
 #define setfvalue(obj,x) \
   { TValue *io=(obj); val_(io).f=(x); settt_(io, LUA_TLCF); }
 
@@ -461,6 +474,40 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Description of a call to a nested function whose code was inlined in
+** a function prototype (used for debug information, which shows the
+** inlined code as running in a frame of its own)
+*/
+typedef struct InlineInfo {
+  int startpc;  /* first instruction of the inlined code */
+  int endpc;  /* first instruction after it */
+  int line;  /* line of the call */
+  int fn;  /* index in 'p' of the inlined function */
+  lu_byte base;  /* register of its first parameter */
+  lu_byte fidx;  /* register of the local variable holding it */
+} InlineInfo;
+
+
+/*
+** Size feedback for a table-constructor site (an OP_NEWTABLE
+** instruction) of a function prototype
+*/
+typedef struct TabSite {
+  int pc;  /* position of the OP_NEWTABLE instruction */
+  unsigned int sizearray;  /* array size reached by tables from this site */
+  unsigned int sizenode;  /* number of hash entries in those tables */
+  struct Table *last;  /* last table created here (weak reference) */
+} TabSite;
+
+
+/*
+** Code of a function prototype compiled ahead of time to C (see
+** 'laot.h')
+*/
+typedef int (*AOTFunction) (lua_State *L);
+
+
 /*
 ** Function Prototypes
 */
@@ -491,6 +538,11 @@ typedef struct Proto {
   int sizelineinfo;
   int sizep;  /* size of 'p' */
   int sizelocvars;
+  int sizeinlines;  /* size of 'inlines' */
+  int sizetabsites;  /* size of 'tabsites' */
+  int sizefeedback;  /* size of 'feedback' */
+  int sizekslot;  /* size of 'kslot' */
+  int heat;  /* instructions run while recording types */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
@@ -498,8 +550,18 @@ typedef struct Proto {
   struct Proto **p;  /* functions defined inside the function */
   int *lineinfo;  /* map from opcodes to source lines (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
+  InlineInfo *inlines;  /* inlined calls, sorted by 'startpc' (debug info.) */
   Upvaldesc *upvalues;  /* upvalue information */
+  TabSite *tabsites;  /* table-constructor sites (sorted by 'pc') */
+  lu_byte *feedback;  /* operand types seen by each instruction (or NULL) */
+  unsigned int *kslot;  /* node where each constant key was last found */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  AOTFunction aot;  /* compiled code for this function (or NULL) */
+  void *mcode;  /* machine code made by the JIT (see 'ljit.c') */
+  size_t sizemcode;
+  int jitcount;  /* calls and backward jumps left to compile it */
+  int sizeloops;  /* size of 'loops' */
+  struct JitLoop *loops;  /* its numeric loops, once compiled */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -587,6 +649,7 @@ typedef struct Table {
   Node *node;
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
+  lu_byte *cards;  /* dirty marks for slices of a large table (or NULL) */
   GCObject *gclist;
 } Table;
 
@@ -614,6 +677,9 @@ LUAI_DDEC const TValue luaO_nilobject_;
 /* size of buffer for 'luaO_utf8esc' function */
 #define UTF8BUFFSZ	8
 
+/* maximum length of the conversion of a number to a string */
+#define MAXNUMBER2STR	50
+
 LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_utf8esc (char *buff, unsigned long x);
@@ -622,6 +688,7 @@ LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, TValue *res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
 LUAI_FUNC int luaO_hexavalue (int c);
+LUAI_FUNC size_t luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC void luaO_tostring (lua_State *L, StkId obj);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
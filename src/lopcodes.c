@@ -65,6 +65,16 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "IADD",
+  "ISUB",
+  "IEQ",
+  "ILT",
+  "ILE",
+  "IGETTABLE",
+  "ISETTABLE",
+  "MOVECALL",
+  "LOADKCALL",
+  "GETUPGET",
   NULL
 };
 
@@ -120,5 +130,21 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_IADD */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ISUB */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_IEQ */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_ILT */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_ILE */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_IGETTABLE */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_ISETTABLE */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_LOADKCALL */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETUPGET */
+};
+
+
+LUAI_DDEF const lu_byte luaP_genericop[NUM_OPCODES - OP_IADD] = {
+  OP_ADD, OP_SUB, OP_EQ, OP_LT, OP_LE, OP_GETTABLE, OP_SETTABLE,
+  OP_MOVE, OP_LOADK, OP_GETTABUP
 };
 
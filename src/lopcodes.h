@@ -230,11 +230,23 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_IADD,/*	A B C	R(A) := RK(B) + RK(C)		(integers)	*/
+OP_ISUB,/*	A B C	R(A) := RK(B) - RK(C)		(integers)	*/
+OP_IEQ,/*	A B C	if ((RK(B) == RK(C)) ~= A) then pc++	(integers) */
+OP_ILT,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++	(integers) */
+OP_ILE,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++	(integers) */
+OP_IGETTABLE,/*	A B C	R(A) := R(B)[RK(C)]		(integer key)	*/
+OP_ISETTABLE,/*	A B C	R(A)[RK(B)] := RK(C)		(integer key)	*/
+
+OP_MOVECALL,/*	A B	OP_MOVE, then the OP_CALL after it		*/
+OP_LOADKCALL,/*	A Bx	OP_LOADK, then the OP_CALL after it		*/
+OP_GETUPGET/*	A B C	OP_GETTABUP, then the OP_GETTABLE after it	*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_GETUPGET) + 1)
 
 
 
@@ -254,6 +266,15 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) In OP_LOADKX, the next 'instruction' is always EXTRAARG.
 
+  (*) The integer opcodes (OP_IADD to OP_ISETTABLE) are versions of
+  their generic ones for operands (or keys) that the compiler proved to
+  be integers (see 'luaK_intops'); they do not check those types.
+
+  (*) The superinstructions (OP_MOVECALL to OP_GETUPGET) are their
+  first opcode when followed by their second one (see 'luaK_fuse'),
+  which they also run. That second instruction stays in the code, so
+  jumps may still go to it.
+
   (*) For comparisons, A specifies what condition the test should accept
   (true or false).
 
@@ -290,6 +311,15 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
+/* generic opcode of each integer opcode and superinstruction */
+LUAI_DDEC const lu_byte luaP_genericop[NUM_OPCODES - OP_IADD];
+
+#define isintop(o)	((o) >= OP_IADD && (o) <= OP_ISETTABLE)
+#define isfused(o)	((o) >= OP_MOVECALL)
+#define genericop(o)  \
+	((o) >= OP_IADD ? cast(OpCode, luaP_genericop[(o) - OP_IADD]) : (o))
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
@@ -0,0 +1,1018 @@
+/*
+** $Id: lopt.c $
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#define lopt_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lfunc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lopt.h"
+#include "lstate.h"
+
+
+/*
+** The optimizer rewrites finished prototypes, so it must keep every
+** shape the VM and the debug interface rely on: a test is always
+** followed by its jump, LOADKX and SETLIST (with C == 0) by their
+** EXTRAARG, TFORCALL by its TFORLOOP and TAILCALL by its RETURN.
+** Registers of active local variables are never renamed, and line
+** information and local-variable ranges move with the code.
+*/
+
+
+/* flags for each instruction */
+#define REACHED		1	/* instruction may be executed */
+#define TARGET		2	/* reached by a jump, not only by falling through */
+#define PINNED		4	/* must stay right after its predecessor */
+#define DELETED		8	/* will be removed */
+
+
+/* maximum distance between a MOVE and the instruction feeding it */
+#define MAXWINDOW	8
+
+
+/* sets of registers */
+#define REGBYTES	((MAXARG_A + 1) / 8)
+
+typedef struct RegSet {
+  lu_byte b[REGBYTES];
+} RegSet;
+
+
+typedef struct OptState {
+  lua_State *L;
+  Proto *f;
+  int n;  /* number of instructions */
+  lu_byte *flag;  /* flags of each instruction */
+  RegSet *live;  /* registers live on entry to each instruction */
+  RegSet captured;  /* registers captured by nested functions */
+  Instruction *hoisted;  /* instructions moved in front of loops */
+  int *hoistpc;  /* instruction in front of which each of them goes */
+  int nhoisted;
+} OptState;
+
+
+static void clearset (RegSet *s) {
+  memset(s->b, 0, sizeof(s->b));
+}
+
+
+static void addreg (RegSet *s, int r) {
+  s->b[r / 8] |= cast_byte(1u << (r % 8));
+}
+
+
+static int hasreg (const RegSet *s, int r) {
+  return (s->b[r / 8] >> (r % 8)) & 1;
+}
+
+
+static void addrange (RegSet *s, int from, int to) {
+  for (; from <= to && from <= MAXARG_A; from++)
+    addreg(s, from);
+}
+
+
+static void addrk (RegSet *s, int x) {
+  if (!ISK(x)) addreg(s, x);
+}
+
+
+static void addset (RegSet *s, const RegSet *other) {
+  int i;
+  for (i = 0; i < REGBYTES; i++)
+    s->b[i] |= other->b[i];
+}
+
+
+/*
+** Registers read ('use') and registers always written ('def') by
+** instruction 'i'. Open operands (B or C equal to 0 in calls, returns,
+** varargs and lists) count as all registers from A up. Writes that may
+** not happen (TESTSET, loop instructions) are not in 'def'.
+*/
+static void effects (const OptState *os, Instruction i, RegSet *use,
+                                                        RegSet *def) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  clearset(use);
+  clearset(def);
+  switch (genericop(GET_OPCODE(i))) {
+    case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: {
+      addreg(use, b);
+      addreg(def, a);
+      break;
+    }
+    case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL:
+    case OP_GETUPVAL: case OP_NEWTABLE: {
+      addreg(def, a);
+      break;
+    }
+    case OP_LOADNIL: {
+      addrange(def, a, a + b);
+      break;
+    }
+    case OP_GETTABUP: {
+      addrk(use, c);
+      addreg(def, a);
+      break;
+    }
+    case OP_GETTABLE: {
+      addreg(use, b);
+      addrk(use, c);
+      addreg(def, a);
+      break;
+    }
+    case OP_SETTABUP: case OP_EQ: case OP_LT: case OP_LE: {
+      addrk(use, b);
+      addrk(use, c);
+      break;
+    }
+    case OP_SETUPVAL: case OP_TEST: {
+      addreg(use, a);
+      break;
+    }
+    case OP_SETTABLE: {
+      addreg(use, a);
+      addrk(use, b);
+      addrk(use, c);
+      break;
+    }
+    case OP_SELF: {
+      addreg(use, b);
+      addrk(use, c);
+      addrange(def, a, a + 1);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      addrk(use, b);
+      addrk(use, c);
+      addreg(def, a);
+      break;
+    }
+    case OP_CONCAT: {
+      addrange(use, b, c);
+      addreg(def, a);
+      break;
+    }
+    case OP_TESTSET: {
+      addreg(use, b);
+      break;
+    }
+    case OP_CALL: {
+      addrange(use, a, (b != 0) ? a + b - 1 : MAXARG_A);
+      addrange(def, a, (c != 0) ? a + c - 2 : MAXARG_A);
+      break;
+    }
+    case OP_TAILCALL: {
+      addrange(use, a, (b != 0) ? a + b - 1 : MAXARG_A);
+      break;
+    }
+    case OP_RETURN: {
+      addrange(use, a, (b != 0) ? a + b - 2 : MAXARG_A);
+      break;
+    }
+    case OP_FORLOOP: case OP_FORPREP: {
+      addrange(use, a, a + 2);
+      break;
+    }
+    case OP_TFORCALL: {
+      addrange(use, a, a + 2);
+      addrange(def, a + 3, a + 2 + c);
+      break;
+    }
+    case OP_TFORLOOP: {
+      addreg(use, a + 1);
+      break;
+    }
+    case OP_SETLIST: {
+      addrange(use, a, (b != 0) ? a + b : MAXARG_A);
+      break;
+    }
+    case OP_CLOSURE: {
+      Proto *p = os->f->p[GETARG_Bx(i)];
+      int j;
+      for (j = 0; j < p->sizeupvalues; j++) {
+        if (p->upvalues[j].instack)
+          addreg(use, p->upvalues[j].idx);
+      }
+      addreg(def, a);
+      break;
+    }
+    case OP_VARARG: {
+      addrange(def, a, (b != 0) ? a + b - 2 : MAXARG_A);
+      break;
+    }
+    default: break;  /* OP_JMP, OP_EXTRAARG */
+  }
+}
+
+
+/*
+** Registers that instruction 'i' may change: its definitions, its
+** conditional writes, and the registers above the frame slots used by
+** called functions (calls, and metamethods called by OP_CONCAT, which
+** run with the stack top right after its operands).
+*/
+static void clobbers (const OptState *os, Instruction i, RegSet *set) {
+  RegSet use;
+  int a = GETARG_A(i);
+  effects(os, i, &use, set);
+  switch (genericop(GET_OPCODE(i))) {
+    case OP_TESTSET: case OP_FORPREP: case OP_TFORLOOP: {
+      addreg(set, a);
+      break;
+    }
+    case OP_FORLOOP: {
+      addreg(set, a);
+      addreg(set, a + 3);
+      break;
+    }
+    case OP_CONCAT: {
+      addrange(set, GETARG_B(i), MAXARG_A);
+      break;
+    }
+    case OP_CALL: case OP_TAILCALL: case OP_TFORCALL: {
+      addrange(set, a, MAXARG_A);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Does instruction 'i' need the next instruction to stay right after
+** it? (Tests skip or take the following jump, and the others read or
+** run it as part of their own work.)
+*/
+static int isskipper (Instruction i) {
+  switch (genericop(GET_OPCODE(i))) {
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TEST: case OP_TESTSET:
+    case OP_LOADKX: case OP_TFORCALL: case OP_TAILCALL:
+      return 1;
+    case OP_LOADBOOL:
+      return (GETARG_C(i) != 0);
+    case OP_SETLIST:
+      return (GETARG_C(i) == 0);
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Fill 's' with the instructions that may run after the one at 'pc';
+** returns how many there are.
+*/
+static int successors (const Proto *f, int pc, int *s) {
+  Instruction i = f->code[pc];
+  switch (genericop(GET_OPCODE(i))) {
+    case OP_JMP: case OP_FORPREP: {
+      s[0] = pc + 1 + GETARG_sBx(i);
+      return 1;
+    }
+    case OP_RETURN:
+      return 0;
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TEST: case OP_TESTSET: {
+      s[0] = pc + 1;
+      s[1] = pc + 2;
+      return 2;
+    }
+    case OP_FORLOOP: case OP_TFORLOOP: {
+      s[0] = pc + 1;
+      s[1] = pc + 1 + GETARG_sBx(i);
+      return 2;
+    }
+    case OP_LOADKX: {
+      s[0] = pc + 2;
+      return 1;
+    }
+    case OP_LOADBOOL: case OP_SETLIST: {
+      if (isskipper(i)) {
+        s[0] = pc + 2;
+        return 1;
+      }
+      break;
+    }
+    default: break;
+  }
+  s[0] = pc + 1;
+  return 1;
+}
+
+
+/*
+** Number of local variables active at instruction 'pc'; they are the
+** ones in the lowest registers.
+*/
+static int nactive (const Proto *f, int pc) {
+  int i;
+  int n = 0;
+  for (i = 0; i < f->sizelocvars && f->locvars[i].startpc <= pc; i++) {
+    if (pc < f->locvars[i].endpc)
+      n++;
+  }
+  return n;
+}
+
+
+/*
+** Mark reachable instructions, jump targets and instructions pinned to
+** their predecessors.
+*/
+static void analyze (OptState *os) {
+  Proto *f = os->f;
+  int *stack = luaM_newvector(os->L, os->n, int);
+  int top = 0;
+  memset(os->flag, 0, os->n);
+  os->flag[0] = REACHED;
+  stack[top++] = 0;
+  while (top > 0) {
+    int s[3];
+    int pc = stack[--top];
+    int ns = successors(f, pc, s);
+    int k;
+    if (isskipper(f->code[pc]) && pc + 1 < os->n) {
+      os->flag[pc + 1] |= PINNED;
+      s[ns++] = pc + 1;
+    }
+    for (k = 0; k < ns; k++) {
+      int t = s[k];
+      if (t < 0 || t >= os->n) continue;  /* cannot happen in valid code */
+      if (t != pc + 1) os->flag[t] |= TARGET;
+      if (!(os->flag[t] & REACHED)) {
+        os->flag[t] |= REACHED;
+        stack[top++] = t;
+      }
+    }
+  }
+  luaM_freearray(os->L, stack, os->n);
+  clearset(&os->captured);
+  for (top = 0; top < f->sizep; top++) {
+    Proto *p = f->p[top];
+    int j;
+    for (j = 0; j < p->sizeupvalues; j++) {
+      if (p->upvalues[j].instack)
+        addreg(&os->captured, p->upvalues[j].idx);
+    }
+  }
+}
+
+
+/*
+** Registers live right after instruction 'pc'. Registers captured by
+** nested functions are always live.
+*/
+static void liveout (const OptState *os, int pc, RegSet *out) {
+  int s[2];
+  int ns = successors(os->f, pc, s);
+  *out = os->captured;
+  while (ns-- > 0)
+    addset(out, &os->live[s[ns]]);
+}
+
+
+static void liveness (OptState *os) {
+  int changed;
+  memset(os->live, 0, os->n * sizeof(RegSet));
+  do {
+    int pc;
+    changed = 0;
+    for (pc = os->n - 1; pc >= 0; pc--) {
+      RegSet use, def, out;
+      int k;
+      if (!(os->flag[pc] & REACHED)) continue;
+      liveout(os, pc, &out);
+      effects(os, os->f->code[pc], &use, &def);
+      for (k = 0; k < REGBYTES; k++) {
+        lu_byte x = cast_byte(use.b[k] | (out.b[k] & ~def.b[k]));
+        if (x != os->live[pc].b[k]) {
+          os->live[pc].b[k] = x;
+          changed = 1;
+        }
+      }
+    }
+  } while (changed);
+}
+
+
+/*
+** Make jumps to unconditional jumps go straight to the final target,
+** and replace jumps to a fixed-size return by a copy of that return.
+*/
+static int threadjumps (OptState *os) {
+  Proto *f = os->f;
+  int changed = 0;
+  int pc;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = f->code[pc];
+    int t, steps;
+    if (GET_OPCODE(i) != OP_JMP) continue;
+    t = pc + 1 + GETARG_sBx(i);
+    for (steps = 0; steps < os->n; steps++) {
+      Instruction ti = f->code[t];
+      int next;
+      if (GET_OPCODE(ti) != OP_JMP || GETARG_A(ti) != 0) break;
+      next = t + 1 + GETARG_sBx(ti);
+      if (next == t) break;  /* infinite loop */
+      t = next;
+    }
+    if (t != pc + 1 + GETARG_sBx(i)) {
+      SETARG_sBx(f->code[pc], t - (pc + 1));
+      changed = 1;
+    }
+    if (GET_OPCODE(f->code[t]) == OP_RETURN && GETARG_B(f->code[t]) != 0 &&
+        !(pc > 0 && isskipper(f->code[pc - 1])) &&
+        (GETARG_A(i) == 0 || f->sizep > 0)) {  /* return closes upvalues */
+      f->code[pc] = f->code[t];
+      if (f->lineinfo != NULL && f->sizelineinfo == os->n)
+        f->lineinfo[pc] = f->lineinfo[t];
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Can the value written by instruction 'i' into its register A go to
+** any other register? (True for instructions that write only A and
+** whose other operands do not depend on A.)
+*/
+static int retargetable (Instruction i) {
+  switch (genericop(GET_OPCODE(i))) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETTABUP:
+    case OP_GETTABLE: case OP_NEWTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: case OP_CONCAT:
+    case OP_CLOSURE:
+      return 1;
+    case OP_LOADBOOL:
+      return (GETARG_C(i) == 0);
+    case OP_LOADNIL:
+      return (GETARG_B(i) == 0);
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Copy propagation and register coalescing: for 'MOVE dst src' where
+** 'src' is a temporary that dies there, make the instruction computing
+** 'src' (in the same basic block, not too far away) write 'dst'
+** directly and remove the move.
+*/
+static int propagatecopies (OptState *os) {
+  Proto *f = os->f;
+  int changed = 0;
+  int m;
+  for (m = 1; m < os->n; m++) {
+    Instruction i = f->code[m];
+    RegSet out;
+    int dst, src, d;
+    if (GET_OPCODE(i) != OP_MOVE || os->flag[m] != REACHED)
+      continue;  /* not a reachable move in the middle of a block */
+    dst = GETARG_A(i);
+    src = GETARG_B(i);
+    liveout(os, m, &out);
+    if (dst == src || hasreg(&out, src) || src < nactive(f, m))
+      continue;
+    for (d = m - 1; d >= 0 && d >= m - MAXWINDOW; d--) {
+      Instruction di = f->code[d];
+      RegSet use, clob;
+      int s[2];
+      if (d < m - 1 && (os->flag[d + 1] & (TARGET | PINNED)))
+        break;  /* block starts after 'd' */
+      if (os->flag[d] & DELETED) continue;
+      if (isskipper(di) || successors(f, d, s) != 1 || s[0] != d + 1)
+        break;
+      if (GETARG_A(di) == src && retargetable(di)) {
+        if (src >= nactive(f, d)) {
+          SETARG_A(f->code[d], dst);
+          os->flag[m] |= DELETED;
+          changed = 1;
+        }
+        break;
+      }
+      effects(os, di, &use, &clob);
+      clobbers(os, di, &clob);
+      if (hasreg(&use, src) || hasreg(&clob, src) ||
+          hasreg(&use, dst) || hasreg(&clob, dst))
+        break;
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Fold a LOADNIL into the previous one when their ranges touch.
+*/
+static int mergenils (OptState *os) {
+  Proto *f = os->f;
+  int changed = 0;
+  int pc;
+  for (pc = 1; pc < os->n; pc++) {
+    Instruction i = f->code[pc];
+    Instruction prev = f->code[pc - 1];
+    int lo, hi;
+    if (GET_OPCODE(i) != OP_LOADNIL || os->flag[pc] != REACHED ||
+        GET_OPCODE(prev) != OP_LOADNIL || os->flag[pc - 1] & DELETED)
+      continue;
+    lo = GETARG_A(prev);
+    hi = lo + GETARG_B(prev);
+    if (GETARG_A(i) > hi + 1 || GETARG_A(i) + GETARG_B(i) + 1 < lo)
+      continue;  /* ranges do not touch */
+    if (GETARG_A(i) < lo) lo = GETARG_A(i);
+    if (GETARG_A(i) + GETARG_B(i) > hi) hi = GETARG_A(i) + GETARG_B(i);
+    if (hi - lo > MAXARG_B) continue;
+    f->code[pc - 1] = CREATE_ABC(OP_LOADNIL, lo, hi - lo, 0);
+    os->flag[pc] |= DELETED;
+    changed = 1;
+  }
+  return changed;
+}
+
+
+/*
+** Move loads of constants out of numeric 'for' loops. A LOADK can go in
+** front of the loop when its register is written nowhere else in the
+** loop, is dead on entry and at every exit, and no call in the loop may
+** reuse it for its frame.
+*/
+static int hoistconstants (OptState *os) {
+  Proto *f = os->f;
+  int changed = 0;
+  int p;
+  for (p = 0; p < os->n; p++) {
+    RegSet once, twice, exitlive;
+    int q, pc;
+    if (GET_OPCODE(f->code[p]) != OP_FORPREP || os->flag[p] != REACHED)
+      continue;
+    q = p + 1 + GETARG_sBx(f->code[p]);  /* its OP_FORLOOP */
+    clearset(&once);
+    clearset(&twice);
+    clearset(&exitlive);
+    for (pc = p + 1; pc <= q; pc++) {
+      Instruction i = f->code[pc];
+      RegSet clob;
+      int s[2];
+      int ns, k;
+      switch (GET_OPCODE(i)) {
+        case OP_CALL: case OP_TAILCALL: case OP_TFORCALL: case OP_VARARG:
+          goto nextloop;
+        default: break;
+      }
+      if (!(os->flag[pc] & REACHED)) continue;
+      clobbers(os, i, &clob);
+      for (k = 0; k < REGBYTES; k++) {
+        twice.b[k] |= once.b[k] & clob.b[k];
+        once.b[k] |= clob.b[k];
+      }
+      ns = successors(f, pc, s);
+      while (ns-- > 0) {
+        if (s[ns] <= p || s[ns] > q)
+          addset(&exitlive, &os->live[s[ns]]);
+      }
+    }
+    for (pc = p + 1; pc < q; pc++) {
+      Instruction i = f->code[pc];
+      int r = GETARG_A(i);
+      if (GET_OPCODE(i) != OP_LOADK || !(os->flag[pc] & REACHED) ||
+          (os->flag[pc] & (PINNED | DELETED)))
+        continue;
+      if (hasreg(&twice, r) || hasreg(&os->live[p], r) ||
+          hasreg(&exitlive, r) || hasreg(&os->captured, r))
+        continue;
+      if (os->n + os->nhoisted + 1 >= MAXARG_sBx)
+        return changed;  /* keep jump offsets in range */
+      os->hoisted[os->nhoisted] = i;
+      os->hoistpc[os->nhoisted++] = p;
+      os->flag[pc] |= DELETED;
+      changed = 1;
+    }
+   nextloop: ;
+  }
+  return changed;
+}
+
+
+/*
+** Remove unreachable instructions, jumps to the next instruction and
+** moves of a register to itself.
+*/
+static int deadcode (OptState *os) {
+  Proto *f = os->f;
+  int changed = 0;
+  int pc;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = f->code[pc];
+    if (os->flag[pc] & DELETED) continue;
+    if (!(os->flag[pc] & REACHED) ||
+        (!(os->flag[pc] & PINNED) &&
+         ((GET_OPCODE(i) == OP_JMP && GETARG_A(i) == 0 &&
+           GETARG_sBx(i) == 0) ||
+          (GET_OPCODE(i) == OP_MOVE && GETARG_A(i) == GETARG_B(i))))) {
+      os->flag[pc] |= DELETED;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Build the new code without deleted instructions and with hoisted
+** ones in place, fixing jumps, line information and local-variable
+** ranges. Jumps to a deleted instruction go to the next one kept; jumps
+** to a loop go to the instructions hoisted in front of it.
+*/
+static void rebuild (OptState *os) {
+  lua_State *L = os->L;
+  Proto *f = os->f;
+  int n = os->n;
+  int haslines = (f->lineinfo != NULL && f->sizelineinfo == n);
+  int *map = luaM_newvector(L, n + 1, int);
+  Instruction *code;
+  int *lines = NULL;
+  int pc, k, h, newn;
+  for (pc = 0, h = 0, newn = 0; pc < n; pc++) {
+    map[pc] = newn;
+    for (; h < os->nhoisted && os->hoistpc[h] == pc; h++)
+      newn++;
+    if (!(os->flag[pc] & DELETED))
+      newn++;
+  }
+  map[n] = newn;
+  code = luaM_newvector(L, newn, Instruction);
+  if (haslines)
+    lines = luaM_newvector(L, newn, int);
+  for (pc = 0, h = 0, k = 0; pc < n; pc++) {
+    for (; h < os->nhoisted && os->hoistpc[h] == pc; h++) {
+      if (haslines) lines[k] = f->lineinfo[pc];
+      code[k++] = os->hoisted[h];
+    }
+    if (!(os->flag[pc] & DELETED)) {
+      Instruction i = f->code[pc];
+      switch (GET_OPCODE(i)) {
+        case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP: {
+          SETARG_sBx(i, map[pc + 1 + GETARG_sBx(i)] - (k + 1));
+          break;
+        }
+        default: break;
+      }
+      if (haslines) lines[k] = f->lineinfo[pc];
+      code[k++] = i;
+    }
+  }
+  lua_assert(k == newn);
+  for (k = 0; k < f->sizelocvars; k++) {
+    f->locvars[k].startpc = map[f->locvars[k].startpc];
+    f->locvars[k].endpc = map[f->locvars[k].endpc];
+  }
+  luaM_freearray(L, map, n + 1);
+  luaM_freearray(L, f->code, f->sizecode);
+  f->code = code;
+  f->sizecode = newn;
+  if (haslines) {
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+    f->lineinfo = lines;
+    f->sizelineinfo = newn;
+  }
+  luaF_inittabsites(L, f);
+}
+
+
+/*
+** {======================================================
+** Integer opcodes
+** =======================================================
+*/
+
+/*
+** A forward analysis finds the registers that surely hold integers
+** before each instruction: only integer constants, copies of integers,
+** integer loop indices and integer results of integer operands make
+** them. Registers captured by nested functions never count, as these
+** functions may change them at any call or metamethod.
+*/
+
+
+/* is register or constant operand 'x' known to be an integer? */
+static int isintrk (const Proto *f, const RegSet *ints, int x) {
+  if (ISK(x))
+    return (INDEXK(x) < f->sizek && ttisinteger(&f->k[INDEXK(x)]));
+  else
+    return hasreg(ints, x);
+}
+
+
+/*
+** Update 'ints', the registers known to hold integers before the
+** instruction at 'pc', to the ones after it on its way to 'target'
+*/
+static void intsafter (const OptState *os, int pc, int target,
+                                                   RegSet *ints) {
+  const Proto *f = os->f;
+  Instruction i = f->code[pc];
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int isint = 0;  /* does it leave an integer in 'a'? */
+  RegSet clob;
+  int k;
+  switch (genericop(GET_OPCODE(i))) {
+    case OP_MOVE: case OP_UNM: case OP_BNOT: {
+      isint = hasreg(ints, b);
+      break;
+    }
+    case OP_LOADK: {
+      int bx = GETARG_Bx(i);
+      isint = (bx < f->sizek && ttisinteger(&f->k[bx]));
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
+      isint = (isintrk(f, ints, b) && isintrk(f, ints, c));
+      break;
+    }
+    case OP_FORPREP: {  /* integer loop if initial value and step are */
+      isint = (hasreg(ints, a) && hasreg(ints, a + 2));
+      break;
+    }
+    case OP_FORLOOP: {  /* an integer index stays an integer */
+      isint = hasreg(ints, a);
+      break;
+    }
+    default: break;
+  }
+  clobbers(os, i, &clob);
+  if (GET_OPCODE(i) == OP_FORPREP)  /* it may convert all its values */
+    addrange(&clob, a, a + 2);
+  for (k = 0; k < REGBYTES; k++)
+    ints->b[k] &= cast_byte(~clob.b[k]);
+  if (isint) {
+    addreg(ints, a);
+    if (GET_OPCODE(i) == OP_FORPREP)
+      addrange(ints, a + 1, a + 2);
+    else if (GET_OPCODE(i) == OP_FORLOOP && target != pc + 1)
+      addreg(ints, a + 3);  /* external index, set when looping */
+  }
+  for (k = 0; k < REGBYTES; k++)
+    ints->b[k] &= cast_byte(~os->captured.b[k]);
+}
+
+
+/* best opcode for instruction 'i' when registers 'ints' hold integers */
+static OpCode intopcode (const Proto *f, Instruction i,
+                         const RegSet *ints) {
+  OpCode op = genericop(GET_OPCODE(i));
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  switch (op) {
+    case OP_ADD: case OP_SUB: {
+      if (isintrk(f, ints, b) && isintrk(f, ints, c))
+        return (op == OP_ADD) ? OP_IADD : OP_ISUB;
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      if (isintrk(f, ints, b) && isintrk(f, ints, c))
+        return cast(OpCode, op - OP_EQ + OP_IEQ);  /* ORDER OP */
+      break;
+    }
+    case OP_GETTABLE: {
+      if (isintrk(f, ints, c))
+        return OP_IGETTABLE;
+      break;
+    }
+    case OP_SETTABLE: {
+      if (isintrk(f, ints, b))
+        return OP_ISETTABLE;
+      break;
+    }
+    default: break;
+  }
+  return op;
+}
+
+
+/*
+** Give integer opcodes to the instructions of 'f' whose operands are
+** known integers (and generic ones to all others) or, if 'check',
+** only check that its integer opcodes have such operands. Returns
+** false if that check fails.
+*/
+static int intpass (lua_State *L, Proto *f, int check) {
+  OptState os;
+  RegSet *ints;
+  int n = f->sizecode;
+  int ok = 1;
+  int changed, pc;
+  os.L = L;
+  os.f = f;
+  os.n = n;
+  os.flag = luaM_newvector(L, n, lu_byte);
+  ints = luaM_newvector(L, n, RegSet);
+  analyze(&os);
+  memset(ints, 0xFF, n * sizeof(RegSet));  /* unknown yet: all of them */
+  clearset(&ints[0]);  /* nothing is known on entry */
+  do {
+    changed = 0;
+    for (pc = 0; pc < n; pc++) {
+      int s[2];
+      int ns;
+      if (!(os.flag[pc] & REACHED)) continue;
+      ns = successors(f, pc, s);
+      while (ns-- > 0) {
+        RegSet out = ints[pc];
+        int t = s[ns];
+        int k;
+        if (t < 0 || t >= n) continue;  /* cannot happen in valid code */
+        intsafter(&os, pc, t, &out);
+        for (k = 0; k < REGBYTES; k++) {
+          lu_byte x = cast_byte(ints[t].b[k] & out.b[k]);
+          if (x != ints[t].b[k]) {
+            ints[t].b[k] = x;
+            changed = 1;
+          }
+        }
+      }
+    }
+  } while (changed);
+  for (pc = 0; pc < n; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode op = (os.flag[pc] & REACHED) ? intopcode(f, *i, &ints[pc])
+                                       : genericop(GET_OPCODE(*i));
+    if (!check)
+      SET_OPCODE(*i, op);
+    else if (isintop(GET_OPCODE(*i)) && op != GET_OPCODE(*i) &&
+             (os.flag[pc] & REACHED))
+      ok = 0;
+  }
+  luaM_freearray(L, os.flag, n);
+  luaM_freearray(L, ints, n);
+  return ok;
+}
+
+
+/*
+** Use integer opcodes in 'f' (but not in functions nested in it)
+** wherever their operands are known to be integers
+*/
+void luaK_intops (lua_State *L, Proto *f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    switch (genericop(GET_OPCODE(f->code[pc]))) {
+      case OP_ADD: case OP_SUB: case OP_EQ: case OP_LT: case OP_LE:
+      case OP_GETTABLE: case OP_SETTABLE:
+        intpass(L, f, 0);
+        return;
+      default: break;
+    }
+  }
+}
+
+
+/*
+** Check that the integer opcodes of 'f' (a precompiled function) only
+** get operands that are known to be integers
+*/
+int luaK_checkintops (lua_State *L, Proto *f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    if (isintop(GET_OPCODE(f->code[pc])))
+      return intpass(L, f, 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Superinstructions
+** =======================================================
+*/
+
+/* superinstruction for 'op' followed by 'next' (or 'op' itself) */
+static OpCode fusedop (OpCode op, OpCode next) {
+  switch (op) {
+    case OP_MOVE: return (next == OP_CALL) ? OP_MOVECALL : op;
+    case OP_LOADK: return (next == OP_CALL) ? OP_LOADKCALL : op;
+    case OP_GETTABUP: return (next == OP_GETTABLE) ? OP_GETUPGET : op;
+    default: return op;
+  }
+}
+
+
+/*
+** Give superinstructions to the pairs of instructions of 'f' (but not
+** of functions nested in it) that have one, and generic opcodes to the
+** instructions that are no longer the first of such a pair. The pairs
+** are the most frequent ones (that the interpreter does not already run
+** together) in the code of a corpus of programs: the last argument of
+** a call and the call, and a field of a global table. Must run again
+** whenever 'f->code' changes.
+*/
+void luaK_fuse (Proto *f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode op = GET_OPCODE(*i);
+    if (isfused(op))
+      op = genericop(op);
+    if (pc + 1 < f->sizecode)
+      op = fusedop(op, GET_OPCODE(f->code[pc + 1]));
+    SET_OPCODE(*i, op);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** One round of all transformations over 'f'; returns whether anything
+** changed.
+*/
+static int optpass (lua_State *L, Proto *f) {
+  OptState os;
+  int changed;
+  os.L = L;
+  os.f = f;
+  os.n = f->sizecode;
+  os.nhoisted = 0;
+  os.flag = luaM_newvector(L, os.n, lu_byte);
+  os.live = luaM_newvector(L, os.n, RegSet);
+  os.hoisted = luaM_newvector(L, os.n, Instruction);
+  os.hoistpc = luaM_newvector(L, os.n, int);
+  changed = threadjumps(&os);
+  analyze(&os);
+  liveness(&os);
+  if (propagatecopies(&os) | mergenils(&os) |
+      hoistconstants(&os) | deadcode(&os)) {
+    rebuild(&os);
+    changed = 1;
+  }
+  luaM_freearray(L, os.flag, os.n);
+  luaM_freearray(L, os.live, os.n);
+  luaM_freearray(L, os.hoisted, os.n);
+  luaM_freearray(L, os.hoistpc, os.n);
+  return changed;
+}
+
+
+/*
+** Optimize the code of 'f' and of all functions nested in it; returns
+** whether any of that code changed. Superinstructions (see 'luaK_fuse')
+** are split before the passes and made again after them. Then, the code inlined in 'f' may
+** no longer match the functions it came from, so 'f' loses the debug
+** information of its inlined calls.
+*/
+static int optimize (lua_State *L, Proto *f) {
+  int i;
+  int changed = 0;
+  for (i = 0; i < f->sizep; i++)
+    changed |= optimize(L, f->p[i]);
+  for (i = 0; i < f->sizecode; i++) {  /* passes look for plain opcodes */
+    OpCode op = GET_OPCODE(f->code[i]);
+    if (isfused(op))
+      SET_OPCODE(f->code[i], genericop(op));
+  }
+  for (i = 0; i < MAXOPTPASSES && optpass(L, f); i++)
+    changed = 1;
+  luaK_intops(L, f);  /* the code changed under its integer opcodes */
+  luaK_fuse(f);
+  if (changed) {
+    luaM_freearray(L, f->inlines, f->sizeinlines);
+    f->inlines = NULL;
+    f->sizeinlines = 0;
+  }
+  return changed;
+}
+
+
+/*
+** Optimize the code of 'f' and of all functions nested in it.
+*/
+void luaK_optimize (lua_State *L, Proto *f) {
+  optimize(L, f);
+}
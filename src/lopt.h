@@ -0,0 +1,22 @@
+/*
+** $Id: lopt.h $
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lopt_h
+#define lopt_h
+
+#include "lobject.h"
+
+
+/* maximum number of passes over each function */
+#define MAXOPTPASSES	4
+
+
+LUAI_FUNC void luaK_optimize (lua_State *L, Proto *f);
+LUAI_FUNC void luaK_intops (lua_State *L, Proto *f);
+LUAI_FUNC int luaK_checkintops (lua_State *L, Proto *f);
+LUAI_FUNC void luaK_fuse (Proto *f);
+
+#endif
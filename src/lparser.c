@@ -22,6 +22,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lopt.h"
 #include "lparser.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -175,12 +176,16 @@ static int registerlocalvar (LexState *ls, TString *varname) {
 static void new_localvar (LexState *ls, TString *name) {
   FuncState *fs = ls->fs;
   Dyndata *dyd = ls->dyd;
+  Vardesc *vd;
   int reg = registerlocalvar(ls, name);
   checklimit(fs, dyd->actvar.n + 1 - fs->firstlocal,
                   MAXVARS, "local variables");
   luaM_growvector(ls->L, dyd->actvar.arr, dyd->actvar.n + 1,
                   dyd->actvar.size, Vardesc, MAX_INT, "local variables");
-  dyd->actvar.arr[dyd->actvar.n++].idx = cast(short, reg);
+  vd = &dyd->actvar.arr[dyd->actvar.n++];
+  vd->idx = cast(short, reg);
+  vd->k.k = VVOID;  /* not bound to a constant (yet) */
+  vd->fn = -1;  /* nor to a function */
 }
 
 
@@ -192,8 +197,13 @@ static void new_localvarliteral_ (LexState *ls, const char *name, size_t sz) {
 	new_localvarliteral_(ls, "" v, (sizeof(v)/sizeof(char))-1)
 
 
+static Vardesc *getvardesc (FuncState *fs, int i) {
+  return &fs->ls->dyd->actvar.arr[fs->firstlocal + i];
+}
+
+
 static LocVar *getlocvar (FuncState *fs, int i) {
-  int idx = fs->ls->dyd->actvar.arr[fs->firstlocal + i].idx;
+  int idx = getvardesc(fs, i)->idx;
   lua_assert(idx < fs->nlocvars);
   return &fs->f->locvars[idx];
 }
@@ -208,8 +218,87 @@ static void adjustlocalvars (LexState *ls, int nvars) {
 }
 
 
+/*
+** Function variable 'var' (an index in 'actvar') was assigned to or
+** captured: calls inlined through it must become regular calls.
+*/
+static void assigninlined (LexState *ls, int var) {
+  Dyndata *dyd = ls->dyd;
+  int i;
+  for (i = 0; i < dyd->inl.n; i++) {
+    if (dyd->inl.arr[i].var == var)
+      dyd->inl.arr[i].deopt = 1;
+  }
+}
+
+
+/*
+** Variables from 'actvar.n' on went out of scope and cannot be assigned
+** anymore: calls inlined through them are kept as they are (unless they
+** still need their regular calls).
+*/
+static void forgetinlined (LexState *ls) {
+  Dyndata *dyd = ls->dyd;
+  int i, n = 0;
+  for (i = 0; i < dyd->inl.n; i++) {
+    Inlinedesc *id = &dyd->inl.arr[i];
+    if (id->var >= dyd->actvar.n) {
+      id->var = -1;
+      if (!id->deopt)
+        continue;  /* nothing else to do for it */
+    }
+    dyd->inl.arr[n++] = *id;
+  }
+  dyd->inl.n = n;
+}
+
+
+/*
+** Generate, after the end of function 'fs', the regular calls for its
+** inlined calls whose function variables were assigned to or captured,
+** and replace the first instruction of each of those inlined calls by a
+** jump to its regular call, dropping its debug information. (As function
+** variables are locals of 'fs', all its other inlined calls were already
+** forgotten; inlined calls of enclosing functions are kept.)
+*/
+static void inlinestubs (FuncState *fs) {
+  Dyndata *dyd = fs->ls->dyd;
+  InlineInfo *ii = fs->f->inlines;
+  int i, n = 0;
+  for (i = 0; i < dyd->inl.n; i++) {
+    Inlinedesc *id = &dyd->inl.arr[i];
+    int stub = fs->pc;
+    int a, pc, offset;
+    if (id->p != fs->f) {  /* from an enclosing function? */
+      dyd->inl.arr[n++] = *id;  /* keep it */
+      continue;
+    }
+    lua_assert(id->deopt);
+    for (a = id->nargs; a > 0; a--)  /* make room for the function */
+      luaK_codeABC(fs, OP_MOVE, id->base + a, id->base + a - 1, 0);
+    luaK_codeABC(fs, OP_MOVE, id->base, id->fidx, 0);
+    luaK_codeABC(fs, OP_CALL, id->base, id->nargs + 1, 2);
+    luaK_jumpto(fs, id->endpc);
+    for (pc = stub; pc < fs->pc; pc++)
+      fs->f->lineinfo[pc] = id->line;
+    offset = stub - (id->pc + 1);
+    if (offset > MAXARG_sBx)
+      luaX_syntaxerror(fs->ls, "control structure too long");
+    fs->f->code[id->pc] = CREATE_ABx(OP_JMP, 0, offset + MAXARG_sBx);
+    ii[id->info].endpc = ii[id->info].startpc;  /* not inlined anymore */
+  }
+  dyd->inl.n = n;
+  for (i = 0, n = 0; i < fs->ninlines; i++) {
+    if (ii[i].startpc < ii[i].endpc)
+      ii[n++] = ii[i];
+  }
+  fs->ninlines = n;
+}
+
+
 static void removevars (FuncState *fs, int tolevel) {
   fs->ls->dyd->actvar.n -= (fs->nactvar - tolevel);
+  forgetinlined(fs->ls);
   while (fs->nactvar > tolevel)
     getlocvar(fs, --fs->nactvar)->endpc = fs->pc;
 }
@@ -257,9 +346,15 @@ static int searchvar (FuncState *fs, TString *n) {
 */
 static void markupval (FuncState *fs, int level) {
   BlockCnt *bl = fs->bl;
+  Vardesc *vd = getvardesc(fs, level);
   while (bl->nactvar > level)
     bl = bl->previous;
   bl->upval = 1;
+  if (vd->fn >= 0) {  /* captured function variable? */
+    /* 'debug.setupvalue' can change it now: stop inlining calls to it */
+    vd->fn = -1;
+    assigninlined(fs->ls, fs->firstlocal + level);
+  }
 }
 
 
@@ -306,6 +401,105 @@ static void singlevar (LexState *ls, expdesc *var) {
 }
 
 
+/*
+** {======================================================================
+** Local variables bound to constants
+** =======================================================================
+*/
+
+/*
+** Returns 1 if 'e' is a constant that is true, 0 if it is a constant
+** that is false, and -1 if it is not a constant.
+*/
+static int constcond (const expdesc *e) {
+  if (e->t != e->f)
+    return -1;  /* has jumps */
+  switch (e->k) {
+    case VNIL: case VFALSE: return 0;
+    case VTRUE: case VK: case VKFLT: case VKINT: return 1;
+    default: return -1;
+  }
+}
+
+
+/*
+** Bind constant 'e' (if it is one) to the 'i'-th of the last 'nvars'
+** variables declared, which are not active yet.
+*/
+static void bindconst (LexState *ls, int nvars, int i, const expdesc *e) {
+  if (constcond(e) >= 0)
+    ls->dyd->actvar.arr[ls->dyd->actvar.n - nvars + i].k = *e;
+}
+
+
+/*
+** Variable 'v' is being assigned to: the local variable behind it (in
+** this function or, for an upvalue, in an enclosing one) is no longer
+** bound to a constant or to a function.
+*/
+static void unbindvar (FuncState *fs, const expdesc *v) {
+  Vardesc *vd;
+  int reg;
+  if (v->k == VLOCAL)
+    reg = v->u.info;
+  else if (v->k == VUPVAL) {
+    Upvaldesc *up = &fs->f->upvalues[v->u.info];
+    while (!up->instack && fs->prev != NULL) {
+      fs = fs->prev;
+      up = &fs->f->upvalues[up->idx];
+    }
+    if (fs->prev == NULL)  /* upvalue of the main chunk ('_ENV')? */
+      return;  /* not a local variable */
+    fs = fs->prev;  /* function where the variable is local */
+    reg = up->idx;
+  }
+  else return;  /* global or indexed variable */
+  vd = getvardesc(fs, reg);
+  vd->k.k = VVOID;
+  if (vd->fn >= 0) {
+    vd->fn = -1;
+    assigninlined(fs->ls, fs->firstlocal + reg);
+  }
+}
+
+
+/*
+** Check whether a use of local variable 'vidx' here is sure to see the
+** value bound to it. That is not the case if a loop or a label was
+** opened after the variable was declared: an assignment later in that
+** loop, or before a 'goto' back to that label, could reach this use.
+*/
+static int stablevar (FuncState *fs, int vidx) {
+  Labellist *ll = &fs->ls->dyd->label;
+  BlockCnt *bl;
+  int i;
+  for (bl = fs->bl; bl->nactvar > vidx; bl = bl->previous) {
+    if (bl->isloop)
+      return 0;
+  }
+  while (bl->previous != NULL)  /* go to the function's outermost block */
+    bl = bl->previous;
+  for (i = bl->firstlabel; i < ll->n; i++) {
+    if (ll->arr[i].pc >= getlocvar(fs, vidx)->startpc)
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** If local variable 'v' is bound to a constant, replace it by that
+** constant.
+*/
+static void foldlocal (FuncState *fs, expdesc *v) {
+  Vardesc *vd = getvardesc(fs, v->u.info);
+  if (vd->k.k != VVOID && stablevar(fs, v->u.info))
+    *v = vd->k;
+}
+
+/* }====================================================================== */
+
+
 static void adjust_assign (LexState *ls, int nvars, int nexps, expdesc *e) {
   FuncState *fs = ls->fs;
   int extra = nvars - nexps;
@@ -493,6 +687,51 @@ static void leaveblock (FuncState *fs) {
 }
 
 
+/*
+** Code that can never run (a branch on a constant condition, the
+** second operand of 'false and x') is generated as usual and then
+** discarded, going back to a mark taken before it.
+*/
+typedef struct DeadMark {
+  int pc;  /* first instruction of the dead code */
+  int nk;  /* number of constants before it */
+  int np;  /* number of nested functions before it */
+  short nlocvars;  /* number of local-variable records before it */
+  int ngt;  /* number of pending gotos before it */
+  int ninl;  /* number of recorded inlined calls before it */
+} DeadMark;
+
+
+static void markdead (FuncState *fs, DeadMark *m) {
+  m->pc = fs->pc;
+  m->nk = fs->nk;
+  m->np = fs->np;
+  m->nlocvars = fs->nlocvars;
+  m->ngt = fs->ls->dyd->gt.n;
+  m->ninl = fs->ls->dyd->inl.n;
+}
+
+
+/*
+** Discard code generated since mark 'm'. This is not possible when it
+** left pending gotos (or breaks), which will be patched later. Jumps
+** from before the mark can only go to its first instruction (through
+** 'jpc'), which becomes the next instruction to be generated.
+*/
+static int dropdead (FuncState *fs, const DeadMark *m) {
+  if (fs->ls->dyd->gt.n != m->ngt)
+    return 0;
+  fs->pc = m->pc;
+  fs->lasttarget = fs->pc;  /* jumps may still go to this position */
+  fs->nk = m->nk;  /* (stale entries in 'ls->h' are checked by 'addk') */
+  fs->np = m->np;
+  fs->nlocvars = m->nlocvars;
+  if (fs->ls->dyd->inl.n > m->ninl)  /* inlined calls in the dead code? */
+    fs->ls->dyd->inl.n = m->ninl;
+  return 1;
+}
+
+
 /*
 ** adds a new prototype into list of prototypes
 */
@@ -539,6 +778,7 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->np = 0;
   fs->nups = 0;
   fs->nlocvars = 0;
+  fs->ninlines = 0;
   fs->nactvar = 0;
   fs->firstlocal = ls->dyd->actvar.n;
   fs->bl = NULL;
@@ -555,6 +795,7 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   luaK_ret(fs, 0, 0);  /* final return */
   leaveblock(fs);
+  inlinestubs(fs);
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
@@ -565,8 +806,15 @@ static void close_func (LexState *ls) {
   f->sizep = fs->np;
   luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars, LocVar);
   f->sizelocvars = fs->nlocvars;
+  luaM_reallocvector(L, f->inlines, f->sizeinlines, fs->ninlines,
+                     InlineInfo);
+  f->sizeinlines = fs->ninlines;
   luaM_reallocvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
   f->sizeupvalues = fs->nups;
+  luaF_inittabsites(L, f);
+  luaF_initkslots(L, f);
+  luaK_intops(L, f);
+  luaK_fuse(f);
   lua_assert(fs->bl == NULL);
   ls->fs = fs->prev;
   luaC_checkGC(L);
@@ -814,28 +1062,30 @@ static int explist (LexState *ls, expdesc *v) {
 }
 
 
-static void funcargs (LexState *ls, expdesc *f, int line) {
-  FuncState *fs = ls->fs;
-  expdesc args;
-  int base, nparams;
+/*
+** Parse the arguments of a call into 'args' (the last one still open)
+** and return their number.
+*/
+static int callargs (LexState *ls, expdesc *args, int line) {
+  int n = 1;
   switch (ls->t.token) {
     case '(': {  /* funcargs -> '(' [ explist ] ')' */
       luaX_next(ls);
-      if (ls->t.token == ')')  /* arg list is empty? */
-        args.k = VVOID;
-      else {
-        explist(ls, &args);
-        luaK_setmultret(fs, &args);
+      if (ls->t.token == ')') {  /* arg list is empty? */
+        args->k = VVOID;
+        n = 0;
       }
+      else
+        n = explist(ls, args);
       check_match(ls, ')', '(', line);
       break;
     }
     case '{': {  /* funcargs -> constructor */
-      constructor(ls, &args);
+      constructor(ls, args);
       break;
     }
     case TK_STRING: {  /* funcargs -> STRING */
-      codestring(ls, &args, ls->t.seminfo.ts);
+      codestring(ls, args, ls->t.seminfo.ts);
       luaX_next(ls);  /* must use 'seminfo' before 'next' */
       break;
     }
@@ -843,10 +1093,21 @@ static void funcargs (LexState *ls, expdesc *f, int line) {
       luaX_syntaxerror(ls, "function arguments expected");
     }
   }
+  return n;
+}
+
+
+static void funcargs (LexState *ls, expdesc *f, int line) {
+  FuncState *fs = ls->fs;
+  expdesc args;
+  int base, nparams;
+  callargs(ls, &args, line);
   lua_assert(f->k == VNONRELOC);
   base = f->u.info;  /* base register for call */
-  if (hasmultret(args.k))
+  if (hasmultret(args.k)) {
+    luaK_setmultret(fs, &args);
     nparams = LUA_MULTRET;  /* open call */
+  }
   else {
     if (args.k != VVOID)
       luaK_exp2nextreg(fs, &args);  /* close last argument */
@@ -859,6 +1120,72 @@ static void funcargs (LexState *ls, expdesc *f, int line) {
 }
 
 
+/*
+** Try to expand a call to variable 'v' in place. The variable must be
+** a local of the current function bound to a small 'local function'
+** (see 'luaK_preinline') and never captured by a closure (see
+** 'markupval'; this also rules out recursive functions). So, only an
+** assignment in this function can change it: not even the debug library
+** reaches it, except through 'debug.setlocal', which inlined calls
+** ignore. When the call may run after such an assignment or capture
+** (see 'stablevar'), it is recorded so that it can become a regular call
+** if that appears later. Debug information in 'f->inlines' lets the
+** inlined code run as if the function had been called (see 'ldebug.c').
+*/
+static int inlinecall (LexState *ls, expdesc *v, int line) {
+  FuncState *fs = ls->fs;
+  int vidx = v->u.info;
+  int kmap[MAXINLINEK];
+  expdesc args;
+  Proto *p;
+  InlineInfo *ii;
+  int base, pc, nexps, spec;
+  if (v->k != VLOCAL || getvardesc(fs, vidx)->fn < 0)
+    return 0;  /* not bound to a function */
+  p = fs->f->p[getvardesc(fs, vidx)->fn];
+  spec = !stablevar(fs, vidx);
+  if (spec && p->sizecode == 2 && GETARG_A(p->code[0]) == 0)
+    return 0;  /* no code to be replaced by a jump to a regular call */
+  if (!luaK_preinline(fs, p, kmap))
+    return 0;
+  base = fs->freereg;
+  nexps = callargs(ls, &args, line);
+  adjust_assign(ls, p->numparams, nexps, &args);  /* one value per param. */
+  pc = fs->pc;
+  luaK_inline(fs, p, base, kmap, p->upvalues);
+  init_exp(v, VNONRELOC, base);
+  fs->freereg = base + 1;  /* leaves one result */
+  luaM_growvector(ls->L, fs->f->inlines, fs->ninlines, fs->f->sizeinlines,
+                  InlineInfo, MAX_INT, "inlined calls");
+  ii = &fs->f->inlines[fs->ninlines++];
+  ii->startpc = pc;
+  ii->endpc = fs->pc;
+  ii->line = line;
+  ii->fn = getvardesc(fs, vidx)->fn;
+  ii->base = cast_byte(base);
+  ii->fidx = cast_byte(vidx);
+  if (spec) {
+    Dyndata *dyd = ls->dyd;
+    Inlinedesc *id;
+    luaK_checkstack(fs, p->numparams);  /* room for the regular call */
+    luaM_growvector(ls->L, dyd->inl.arr, dyd->inl.n + 1, dyd->inl.size,
+                    Inlinedesc, MAX_INT, "inlined calls");
+    id = &dyd->inl.arr[dyd->inl.n++];
+    id->p = fs->f;
+    id->pc = pc;
+    id->endpc = fs->pc;
+    id->line = line;
+    id->var = fs->firstlocal + vidx;
+    id->info = fs->ninlines - 1;
+    id->base = cast_byte(base);
+    id->nargs = p->numparams;
+    id->fidx = cast_byte(vidx);
+    id->deopt = 0;
+  }
+  return 1;
+}
+
+
 
 
 /*
@@ -890,16 +1217,22 @@ static void primaryexp (LexState *ls, expdesc *v) {
 }
 
 
-static void suffixedexp (LexState *ls, expdesc *v) {
+/*
+** Returns whether the expression ends with an inlined call (which,
+** like a regular call, can be used as a statement).
+*/
+static int suffixedexp (LexState *ls, expdesc *v) {
   /* suffixedexp ->
        primaryexp { '.' NAME | '[' exp ']' | ':' NAME funcargs | funcargs } */
   FuncState *fs = ls->fs;
   int line = ls->linenumber;
+  int inlined = 0;
   primaryexp(ls, v);
   for (;;) {
     switch (ls->t.token) {
       case '.': {  /* fieldsel */
         fieldsel(ls, v);
+        inlined = 0;
         break;
       }
       case '[': {  /* '[' exp1 ']' */
@@ -907,6 +1240,7 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         luaK_exp2anyregup(fs, v);
         yindex(ls, &key);
         luaK_indexed(fs, v, &key);
+        inlined = 0;
         break;
       }
       case ':': {  /* ':' NAME funcargs */
@@ -915,14 +1249,18 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         checkname(ls, &key);
         luaK_self(fs, v, &key);
         funcargs(ls, v, line);
+        inlined = 0;
         break;
       }
       case '(': case TK_STRING: case '{': {  /* funcargs */
-        luaK_exp2nextreg(fs, v);
-        funcargs(ls, v, line);
+        inlined = inlinecall(ls, v, line);
+        if (!inlined) {
+          luaK_exp2nextreg(fs, v);
+          funcargs(ls, v, line);
+        }
         break;
       }
-      default: return;
+      default: return inlined;
     }
   }
 }
@@ -976,6 +1314,8 @@ static void simpleexp (LexState *ls, expdesc *v) {
     }
     default: {
       suffixedexp(ls, v);
+      if (v->k == VLOCAL)
+        foldlocal(ls->fs, v);
       return;
     }
   }
@@ -1064,10 +1404,23 @@ static BinOpr subexpr (LexState *ls, expdesc *v, int limit) {
     BinOpr nextop;
     int line = ls->linenumber;
     luaX_next(ls);
-    luaK_infix(ls->fs, op, v);
-    /* read sub-expression with higher priority */
-    nextop = subexpr(ls, &v2, priority[op].right);
-    luaK_posfix(ls->fs, op, v, &v2, line);
+    if ((op == OPR_AND && constcond(v) == 0) ||
+        (op == OPR_OR && constcond(v) == 1)) {
+      /* result is 'v'; 2nd operand is never evaluated */
+      FuncState *fs = ls->fs;
+      lu_byte freereg = fs->freereg;
+      DeadMark m;
+      markdead(fs, &m);
+      nextop = subexpr(ls, &v2, priority[op].right);
+      dropdead(fs, &m);  /* always works: expressions leave no gotos */
+      fs->freereg = freereg;
+    }
+    else {
+      luaK_infix(ls->fs, op, v);
+      /* read sub-expression with higher priority */
+      nextop = subexpr(ls, &v2, priority[op].right);
+      luaK_posfix(ls->fs, op, v, &v2, line);
+    }
     op = nextop;
   }
   leavelevel(ls);
@@ -1147,6 +1500,7 @@ static void check_conflict (LexState *ls, struct LHS_assign *lh, expdesc *v) {
 static void assignment (LexState *ls, struct LHS_assign *lh, int nvars) {
   expdesc e;
   check_condition(ls, vkisvar(lh->v.k), "syntax error");
+  unbindvar(ls->fs, &lh->v);
   if (testnext(ls, ',')) {  /* assignment -> ',' suffixedexp assignment */
     struct LHS_assign nv;
     nv.prev = lh;
@@ -1246,8 +1600,8 @@ static void whilestat (LexState *ls, int line) {
   BlockCnt bl;
   luaX_next(ls);  /* skip WHILE */
   whileinit = luaK_getlabel(fs);
+  enterblock(fs, &bl, 1);  /* condition is part of the loop */
   condexit = cond(ls);
-  enterblock(fs, &bl, 1);
   checknext(ls, TK_DO);
   block(ls);
   luaK_jumpto(fs, whileinit);
@@ -1379,15 +1733,26 @@ static void forstat (LexState *ls, int line) {
 }
 
 
-static void test_then_block (LexState *ls, int *escapelist) {
+/*
+** Returns whether the condition is a true constant, so that no later
+** branch can run. 'dead' tells that an earlier branch always runs; then
+** this one is parsed only to be discarded, as is a branch whose
+** condition is a false constant.
+*/
+static int test_then_block (LexState *ls, int *escapelist, int dead) {
   /* test_then_block -> [IF | ELSEIF] cond THEN block */
   BlockCnt bl;
   FuncState *fs = ls->fs;
+  DeadMark m;
   expdesc v;
   int jf;  /* instruction to skip 'then' code (if condition is false) */
+  int k;
+  markdead(fs, &m);
   luaX_next(ls);  /* skip IF or ELSEIF */
   expr(ls, &v);  /* read condition */
   checknext(ls, TK_THEN);
+  k = constcond(&v);
+  if (k == 0) dead = 1;
   if (ls->t.token == TK_GOTO || ls->t.token == TK_BREAK) {
     luaK_goiffalse(ls->fs, &v);  /* will jump to label if condition is true */
     enterblock(fs, &bl, 0);  /* must enter block before 'goto' */
@@ -1395,7 +1760,8 @@ static void test_then_block (LexState *ls, int *escapelist) {
     while (testnext(ls, ';')) {}  /* skip colons */
     if (block_follow(ls, 0)) {  /* 'goto' is the entire block? */
       leaveblock(fs);
-      return;  /* and that is it */
+      if (dead) dropdead(fs, &m);
+      return (k == 1);  /* and that is it */
     }
     else  /* must skip over 'then' part if condition is false */
       jf = luaK_jump(fs);
@@ -1407,10 +1773,13 @@ static void test_then_block (LexState *ls, int *escapelist) {
   }
   statlist(ls);  /* 'then' part */
   leaveblock(fs);
+  if (dead && dropdead(fs, &m))
+    return 0;  /* nothing left of this branch */
   if (ls->t.token == TK_ELSE ||
       ls->t.token == TK_ELSEIF)  /* followed by 'else'/'elseif'? */
     luaK_concat(fs, escapelist, luaK_jump(fs));  /* must jump over it */
   luaK_patchtohere(fs, jf);
+  return (k == 1);
 }
 
 
@@ -1418,11 +1787,17 @@ static void ifstat (LexState *ls, int line) {
   /* ifstat -> IF cond THEN block {ELSEIF cond THEN block} [ELSE block] END */
   FuncState *fs = ls->fs;
   int escapelist = NO_JUMP;  /* exit list for finished parts */
-  test_then_block(ls, &escapelist);  /* IF cond THEN block */
-  while (ls->t.token == TK_ELSEIF)
-    test_then_block(ls, &escapelist);  /* ELSEIF cond THEN block */
-  if (testnext(ls, TK_ELSE))
-    block(ls);  /* 'else' part */
+  int dead;  /* some earlier branch always runs? */
+  dead = test_then_block(ls, &escapelist, 0);  /* IF cond THEN block */
+  while (ls->t.token == TK_ELSEIF)  /* ELSEIF cond THEN block */
+    dead = test_then_block(ls, &escapelist, dead) || dead;
+  if (ls->t.token == TK_ELSE) {  /* 'else' part */
+    DeadMark m;
+    markdead(fs, &m);
+    luaX_next(ls);  /* skip ELSE */
+    block(ls);
+    if (dead) dropdead(fs, &m);
+  }
   check_match(ls, TK_END, TK_IF, line);
   luaK_patchtohere(fs, escapelist);  /* patch escape list to 'if' end */
 }
@@ -1433,6 +1808,8 @@ static void localfunc (LexState *ls) {
   FuncState *fs = ls->fs;
   new_localvar(ls, str_checkname(ls));  /* new local variable */
   adjustlocalvars(ls, 1);  /* enter its scope */
+  /* bind it to its function (unless the body assigns to it) */
+  getvardesc(fs, fs->nactvar - 1)->fn = cast(short, fs->np);
   body(ls, &b, 0, ls->linenumber);  /* function created in next register */
   /* debug information will only see the variable after this point! */
   getlocvar(fs, b.u.info)->startpc = fs->pc;
@@ -1448,9 +1825,22 @@ static void localstat (LexState *ls) {
     new_localvar(ls, str_checkname(ls));
     nvars++;
   } while (testnext(ls, ','));
-  if (testnext(ls, '='))
-    nexps = explist(ls, &e);
+  if (testnext(ls, '=')) {  /* explist, binding constants to variables */
+    nexps = 0;
+    do {
+      if (nexps > 0)
+        luaK_exp2nextreg(ls->fs, &e);
+      expr(ls, &e);
+      if (nexps < nvars)
+        bindconst(ls, nvars, nexps, &e);
+      nexps++;
+    } while (testnext(ls, ','));
+  }
   else {
+    int i;
+    init_exp(&e, VNIL, 0);
+    for (i = 0; i < nvars; i++)
+      bindconst(ls, nvars, i, &e);  /* all are nil */
     e.k = VVOID;
     nexps = 0;
   }
@@ -1479,6 +1869,7 @@ static void funcstat (LexState *ls, int line) {
   expdesc v, b;
   luaX_next(ls);  /* skip FUNCTION */
   ismethod = funcname(ls, &v);
+  unbindvar(ls->fs, &v);
   body(ls, &b, ismethod, line);
   luaK_storevar(ls->fs, &v, &b);
   luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
@@ -1489,12 +1880,12 @@ static void exprstat (LexState *ls) {
   /* stat -> func | assignment */
   FuncState *fs = ls->fs;
   struct LHS_assign v;
-  suffixedexp(ls, &v.v);
+  int inlined = suffixedexp(ls, &v.v);
   if (ls->t.token == '=' || ls->t.token == ',') { /* stat -> assignment ? */
     v.prev = NULL;
     assignment(ls, &v, 1);
   }
-  else {  /* stat -> func */
+  else if (!inlined) {  /* stat -> func */
     check_condition(ls, v.v.k == VCALL, "syntax error");
     SETARG_C(getinstruction(fs, &v.v), 1);  /* call statement uses no results */
   }
@@ -1638,12 +2029,13 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   lua_assert(iswhite(funcstate.f));  /* do not need barrier here */
   lexstate.buff = buff;
   lexstate.dyd = dyd;
-  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  dyd->actvar.n = dyd->gt.n = dyd->label.n = dyd->inl.n = 0;
   luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
   lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
   lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+  lua_assert(dyd->inl.n == 0);
   L->top--;  /* remove scanner's table */
   return cl;  /* closure is on the stack, too */
 }
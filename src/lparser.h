@@ -71,6 +71,8 @@ typedef struct expdesc {
 /* description of active local variable */
 typedef struct Vardesc {
   short idx;  /* variable index in stack */
+  expdesc k;  /* constant bound to the variable ('k.k == VVOID' if none) */
+  short fn;  /* index in 'f->p' of the local function bound to it, or -1 */
 } Vardesc;
 
 
@@ -91,6 +93,26 @@ typedef struct Labellist {
 } Labellist;
 
 
+/*
+** description of a call inlined while its function variable could still
+** be assigned to (or captured); if it is, the inlined code is replaced
+** by a jump to a regular call ("stub") emitted after the end of the
+** function
+*/
+typedef struct Inlinedesc {
+  Proto *p;  /* function containing the inlined code */
+  int pc;  /* first instruction of the inlined code */
+  int endpc;  /* first instruction after it */
+  int line;  /* line of the call */
+  int var;  /* index in 'actvar' of the function variable (-1 if gone) */
+  int info;  /* index of its debug information in 'p->inlines' */
+  lu_byte base;  /* register of the first argument (and of the result) */
+  lu_byte nargs;  /* number of arguments */
+  lu_byte fidx;  /* register of the function variable */
+  lu_byte deopt;  /* true if the variable was assigned to or captured */
+} Inlinedesc;
+
+
 /* dynamic structures used by the parser */
 typedef struct Dyndata {
   struct {  /* list of active local variables */
@@ -100,6 +122,11 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  struct {  /* list of inlined calls that may need a regular call */
+    Inlinedesc *arr;
+    int n;
+    int size;
+  } inl;
 } Dyndata;
 
 
@@ -120,6 +147,7 @@ typedef struct FuncState {
   int np;  /* number of elements in 'p' */
   int firstlocal;  /* index of first local var (in Dyndata array) */
   short nlocvars;  /* number of elements in 'f->locvars' */
+  int ninlines;  /* number of elements in 'f->inlines' */
   lu_byte nactvar;  /* number of active local variables */
   lu_byte nups;  /* number of upvalues */
   lu_byte freereg;  /* first free register */
@@ -0,0 +1,708 @@
+/*
+** $Id: lprof.c $
+** Allocation-site and type profilers
+** See Copyright Notice in lua.h
+*/
+
+#define lprof_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lctype.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lprof.h"
+#include "lstate.h"
+#include "lvm.h"
+
+
+/*
+** While on, the profiler takes a sample every 'interval' bytes
+** allocated: 'luaM_realloc_' counts down 'g->profdebt' and, when it
+** runs out, calls 'luaC_allocsample' (before the block is reallocated,
+** so that the call stack is still in place). The sample charges those
+** bytes to the call stack of the running thread. Sites keep the source
+** of their functions, which the collector marks in 'atomic'.
+**
+** The profiler's own memory comes straight from the allocator, so it is
+** neither counted as Lua memory nor sampled.
+*/
+
+
+#define MINBUCKETS	64
+
+#define sitesize(n)  \
+	(offsetof(AllocSite, frame) + sizeof(ProfFrame) * ((n) > 0 ? (n) : 1))
+
+
+static void *profalloc (global_State *g, void *block, size_t osize,
+                        size_t nsize) {
+  return (*g->frealloc)(g->ud, block, osize, nsize);
+}
+
+
+/*
+** Collect the frames of 'L', innermost first
+*/
+static int getframes (lua_State *L, ProfFrame *fr) {
+  CallInfo *ci;
+  int n = 0;
+  for (ci = L->ci; ci != &L->base_ci && n < PROFDEPTH; ci = ci->previous) {
+    if (isLua(ci)) {
+      Proto *p = clLvalue(ci->func)->p;
+      int pc = pcRel(ci->u.l.savedpc, p);
+      fr[n].source = p->source;
+      fr[n].line = (pc >= 0) ? getfuncline(p, pc) : p->linedefined;
+    }
+    else {
+      fr[n].source = NULL;
+      fr[n].line = -1;
+    }
+    n++;
+  }
+  return n;
+}
+
+
+static unsigned int hashframes (const ProfFrame *fr, int n) {
+  unsigned int h = cast(unsigned int, n);
+  int i;
+  for (i = 0; i < n; i++)
+    h = (h * 31) ^ (point2uint(fr[i].source) +
+                    cast(unsigned int, fr[i].line) * 2654435761u);
+  return h;
+}
+
+
+static int sameframes (const AllocSite *s, const ProfFrame *fr, int n) {
+  int i;
+  if (s->nframes != n)
+    return 0;
+  for (i = 0; i < n; i++) {
+    if (s->frame[i].source != fr[i].source || s->frame[i].line != fr[i].line)
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Double the number of buckets; if there is no memory for that, keep
+** the old ones (only the chains get longer)
+*/
+static void growbuckets (global_State *g, AllocProf *p) {
+  unsigned int nsize = p->size * 2;
+  AllocSite **nb = cast(AllocSite **,
+                        profalloc(g, NULL, 0, nsize * sizeof(AllocSite *)));
+  unsigned int i;
+  if (nb == NULL)
+    return;
+  memset(nb, 0, nsize * sizeof(AllocSite *));
+  for (i = 0; i < p->size; i++) {
+    AllocSite *s = p->bucket[i];
+    while (s != NULL) {
+      AllocSite *next = s->next;
+      s->next = nb[s->hash % nsize];
+      nb[s->hash % nsize] = s;
+      s = next;
+    }
+  }
+  profalloc(g, p->bucket, p->size * sizeof(AllocSite *), 0);
+  p->bucket = nb;
+  p->size = nsize;
+}
+
+
+void luaC_allocsample (lua_State *L) {
+  global_State *g = G(L);
+  AllocProf *p = g->allocprof;
+  ProfFrame fr[PROFDEPTH];
+  AllocSite *s;
+  lu_mem weight = 0;
+  unsigned int h;
+  int n;
+  if (p == NULL || p->interval == 0) {  /* profiler is off? */
+    g->profdebt = MAX_LMEM;
+    return;
+  }
+  do {  /* each interval run out is one sample */
+    g->profdebt += p->interval;
+    weight += p->interval;
+  } while (g->profdebt <= 0);
+  n = getframes(L, fr);
+  h = hashframes(fr, n);
+  for (s = p->bucket[h % p->size]; s != NULL; s = s->next) {
+    if (s->hash == h && sameframes(s, fr, n))
+      break;
+  }
+  if (s == NULL) {  /* new site? */
+    if (p->nsites >= p->size)
+      growbuckets(g, p);
+    s = cast(AllocSite *, profalloc(g, NULL, 0, sitesize(n)));
+    if (s == NULL)
+      return;  /* drop this sample */
+    s->hash = h;
+    s->nframes = n;
+    s->bytes = s->count = 0;
+    if (n > 0)
+      memcpy(s->frame, fr, n * sizeof(ProfFrame));
+    s->next = p->bucket[h % p->size];
+    p->bucket[h % p->size] = s;
+    p->nsites++;
+  }
+  s->bytes += weight;
+  s->count++;
+}
+
+
+void luaC_freeallocprof (global_State *g) {
+  AllocProf *p = g->allocprof;
+  if (p != NULL) {
+    unsigned int i;
+    for (i = 0; i < p->size; i++) {
+      AllocSite *s = p->bucket[i];
+      while (s != NULL) {
+        AllocSite *next = s->next;
+        profalloc(g, s, sitesize(s->nframes), 0);
+        s = next;
+      }
+    }
+    profalloc(g, p->bucket, p->size * sizeof(AllocSite *), 0);
+    profalloc(g, p, sizeof(AllocProf), 0);
+    g->allocprof = NULL;
+  }
+}
+
+
+/*
+** Set the sampling interval and return the previous one. A positive
+** interval turns the profiler on (discarding old samples if it was
+** off); zero turns it off, keeping its samples for a report; a
+** negative interval changes nothing.
+*/
+int luaC_allocprofile (lua_State *L, int interval) {
+  global_State *g = G(L);
+  int old = (g->allocprof != NULL) ? cast_int(g->allocprof->interval) : 0;
+  if (interval < 0)
+    return old;
+  if (interval > 0 && old == 0) {  /* turning it on? */
+    AllocProf *p;
+    luaC_freeallocprof(g);  /* discard old samples */
+    p = cast(AllocProf *, profalloc(g, NULL, 0, sizeof(AllocProf)));
+    if (p == NULL)
+      luaD_throw(L, LUA_ERRMEM);
+    p->bucket = cast(AllocSite **,
+                     profalloc(g, NULL, 0, MINBUCKETS * sizeof(AllocSite *)));
+    if (p->bucket == NULL) {
+      profalloc(g, p, sizeof(AllocProf), 0);
+      luaD_throw(L, LUA_ERRMEM);
+    }
+    memset(p->bucket, 0, MINBUCKETS * sizeof(AllocSite *));
+    p->size = MINBUCKETS;
+    p->nsites = 0;
+    g->allocprof = p;
+  }
+  if (g->allocprof != NULL)
+    g->allocprof->interval = interval;
+  g->profdebt = (interval > 0) ? interval : MAX_LMEM;
+  return old;
+}
+
+
+/*
+** {======================================================
+** Reports
+** =======================================================
+*/
+
+/* enough for a line with all frames of a site */
+#define LINESIZE	(PROFDEPTH * (LUA_IDSIZE + 16) + 64)
+
+typedef struct Report {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  size_t n;  /* bytes in 'line' */
+  char line[LINESIZE];
+} Report;
+
+
+static void addstr (Report *R, const char *s) {
+  size_t l = strlen(s);
+  if (R->n + l < LINESIZE) {
+    memcpy(R->line + R->n, s, l);
+    R->n += l;
+  }
+}
+
+
+static void addint (Report *R, lua_Integer i) {
+  char buff[LUAI_MAXSHORTLEN];
+  lua_integer2str(buff, sizeof(buff), i);
+  addstr(R, buff);
+}
+
+
+static void addframe (Report *R, const ProfFrame *f) {
+  if (f->source == NULL)
+    addstr(R, "[C]");
+  else {
+    char buff[LUA_IDSIZE];
+    luaO_chunkid(buff, getstr(f->source), LUA_IDSIZE);
+    addstr(R, buff);
+    addstr(R, ":");
+    addint(R, f->line);
+  }
+}
+
+
+static void endline (Report *R) {
+  addstr(R, "\n");
+  if (R->status == 0) {
+    lua_unlock(R->L);
+    R->status = (*R->writer)(R->L, R->line, R->n, R->data);
+    lua_lock(R->L);
+  }
+  R->n = 0;
+}
+
+
+/*
+** Folded stacks: frames from the outermost to the innermost, separated
+** by ';', and then the bytes sampled there
+*/
+static void reportfolded (Report *R, AllocProf *p) {
+  unsigned int i;
+  for (i = 0; i < p->size && R->status == 0; i++) {
+    AllocSite *s;
+    for (s = p->bucket[i]; s != NULL && R->status == 0; s = s->next) {
+      int f;
+      for (f = s->nframes - 1; f >= 0; f--) {
+        addframe(R, &s->frame[f]);
+        if (f > 0) addstr(R, ";");
+      }
+      if (s->nframes == 0)
+        addstr(R, "[C]");
+      addstr(R, " ");
+      addint(R, cast(lua_Integer, s->bytes));
+      endline(R);
+    }
+  }
+}
+
+
+typedef struct TopSite {
+  ProfFrame where;  /* innermost Lua frame */
+  lu_mem bytes;
+  lu_mem count;
+} TopSite;
+
+
+static int cmpwhere (const void *a, const void *b) {
+  const ProfFrame *fa = &cast(const TopSite *, a)->where;
+  const ProfFrame *fb = &cast(const TopSite *, b)->where;
+  if (fa->source != fb->source)
+    return (point2uint(fa->source) < point2uint(fb->source)) ? -1 : 1;
+  return (fa->line > fb->line) - (fa->line < fb->line);
+}
+
+
+static int cmpbytes (const void *a, const void *b) {
+  lu_mem ba = cast(const TopSite *, a)->bytes;
+  lu_mem bb = cast(const TopSite *, b)->bytes;
+  return (ba < bb) - (ba > bb);
+}
+
+
+/*
+** Top sites: samples grouped by the innermost Lua line of their stacks
+** (allocations inside C functions go to the Lua line calling them)
+*/
+static void reporttop (Report *R, AllocProf *p, TopSite *t, int max) {
+  unsigned int i, m = 0, k = 0;
+  for (i = 0; i < p->size; i++) {
+    AllocSite *s;
+    for (s = p->bucket[i]; s != NULL; s = s->next) {
+      int f = 0;
+      while (f < s->nframes && s->frame[f].source == NULL)
+        f++;  /* skip C frames */
+      if (f < s->nframes)
+        t[m].where = s->frame[f];
+      else {
+        t[m].where.source = NULL;
+        t[m].where.line = -1;
+      }
+      t[m].bytes = s->bytes;
+      t[m].count = s->count;
+      m++;
+    }
+  }
+  qsort(t, m, sizeof(TopSite), cmpwhere);
+  for (i = 0; i < m; i++) {  /* merge equal sites */
+    if (k > 0 && cmpwhere(&t[k - 1], &t[i]) == 0) {
+      t[k - 1].bytes += t[i].bytes;
+      t[k - 1].count += t[i].count;
+    }
+    else
+      t[k++] = t[i];
+  }
+  qsort(t, k, sizeof(TopSite), cmpbytes);
+  for (i = 0; i < k && (max <= 0 || i < cast(unsigned int, max)) &&
+              R->status == 0; i++) {
+    addint(R, cast(lua_Integer, t[i].bytes));
+    addstr(R, " ");
+    addint(R, cast(lua_Integer, t[i].count));
+    addstr(R, " ");
+    addframe(R, &t[i].where);
+    endline(R);
+  }
+}
+
+
+typedef struct ReportArgs {
+  Report *R;
+  AllocProf *p;
+  TopSite *t;  /* work array for top sites (one per site) */
+  int mode;
+  int n;
+} ReportArgs;
+
+
+static void f_report (lua_State *L, void *ud) {
+  ReportArgs *a = cast(ReportArgs *, ud);
+  UNUSED(L);
+  if (a->mode == LUA_PROFFOLDED)
+    reportfolded(a->R, a->p);
+  else
+    reporttop(a->R, a->p, a->t, a->n);
+}
+
+
+/*
+** Sampling stops while the report runs, as the writer may allocate
+** (and so change the sites being listed).
+*/
+int luaC_allocreport (lua_State *L, lua_Writer w, void *data, int mode,
+                      int n) {
+  global_State *g = G(L);
+  AllocProf *p = g->allocprof;
+  l_mem interval;
+  Report R;
+  ReportArgs a;
+  size_t tsize;
+  int status;
+  if (p == NULL)
+    return 0;  /* nothing to report */
+  tsize = (p->nsites > 0 ? p->nsites : 1) * sizeof(TopSite);
+  a.t = NULL;
+  if (mode != LUA_PROFFOLDED) {
+    a.t = cast(TopSite *, profalloc(g, NULL, 0, tsize));
+    if (a.t == NULL)
+      luaD_throw(L, LUA_ERRMEM);
+  }
+  R.L = L;
+  R.writer = w;
+  R.data = data;
+  R.status = 0;
+  R.n = 0;
+  a.R = &R; a.p = p; a.mode = mode; a.n = n;
+  interval = p->interval;
+  p->interval = 0;
+  status = luaD_rawrunprotected(L, f_report, &a);
+  p->interval = interval;
+  g->profdebt = (interval > 0) ? interval : MAX_LMEM;
+  if (a.t != NULL)
+    profalloc(g, a.t, tsize, 0);
+  if (status != LUA_OK)
+    luaD_throw(L, status);
+  return R.status;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Type profiles
+** =======================================================
+*/
+
+/*
+** While a thread records types (bit 'MASKPROF' of its 'hookmask'),
+** 'luaG_traceexec' runs before each instruction of its Lua functions
+** and calls 'luaC_typerecord', which counts the instructions run by
+** each function ('heat') and adds the types of the operands of
+** arithmetic and comparison instructions to their 'feedback' bytes.
+**
+** A profile is a text with that data, plus the sizes reached by the
+** table-constructor sites, for a function and all functions nested in
+** it (in pre-order):
+**
+**   luaprofile 1
+**   function <index> <linedefined> <sizecode> <code hash> <heat>
+**   types <pc> <feedback>
+**   table <pc> <array size> <hash size>
+**
+** Loaded into a new compilation of the same code, it makes hot
+** functions compile at their first call, lets the JIT emit code for
+** only the types seen, and presizes the tables of each site. Functions
+** whose code differs (in size or hash) are left alone; other mismatches
+** can only cost speed, as the JIT guards all its assumptions.
+*/
+
+#define PROFVERSION	1
+
+/* larger table sizes in a profile are ignored */
+#define MAXPROFSIZE	(1u << 24)
+
+
+static int typebits (const TValue *o) {
+  if (ttisinteger(o)) return FB_INT;
+  else if (ttisfloat(o)) return FB_FLT;
+  else return FB_OTHER;
+}
+
+
+/*
+** Record the instruction about to run in Lua function 'ci' (the one
+** before its 'savedpc'). Integer opcodes are not recorded: their
+** operand types are already known.
+*/
+void luaC_typerecord (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(ci->func)->p;
+  int pc = pcRel(ci->u.l.savedpc, p);
+  Instruction i = p->code[pc];
+  int fb;
+  if (p->heat < MAX_INT)
+    p->heat++;
+  switch (GET_OPCODE(i)) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_EQ: case OP_LT: case OP_LE: {
+      int b = GETARG_B(i), c = GETARG_C(i);
+      StkId base = ci->u.l.base;
+      fb = typebits(ISK(b) ? p->k + INDEXK(b) : base + b);
+      fb |= typebits(ISK(c) ? p->k + INDEXK(c) : base + c) << FB_C;
+      break;
+    }
+    default: return;
+  }
+  if (p->feedback == NULL) {  /* first record for this function? */
+    p->feedback = luaM_newvector(L, p->sizecode, lu_byte);
+    p->sizefeedback = p->sizecode;
+    memset(p->feedback, 0, p->sizecode);
+  }
+  if (pc < p->sizefeedback)
+    p->feedback[pc] |= cast_byte(fb);
+}
+
+
+/* FNV-1a hash of the code of 'p' (identifies it in a profile) */
+static unsigned int codehash (const Proto *p) {
+  unsigned int h = 2166136261u;
+  int pc;
+  for (pc = 0; pc < p->sizecode; pc++)
+    h = (h ^ cast(unsigned int, p->code[pc])) * 16777619u;
+  return h;
+}
+
+
+static void addnums (Report *R, const char *what, const lua_Integer *v,
+                     int n) {
+  int i;
+  addstr(R, what);
+  for (i = 0; i < n; i++) {
+    addstr(R, " ");
+    addint(R, v[i]);
+  }
+  endline(R);
+}
+
+
+static void dumptypes (Report *R, Proto *p, lua_Integer *n) {
+  lua_Integer v[5];
+  int i;
+  v[0] = (*n)++;
+  v[1] = p->linedefined;
+  v[2] = p->sizecode;
+  v[3] = codehash(p);
+  v[4] = p->heat;
+  addnums(R, "function", v, 5);
+  for (i = 0; i < p->sizefeedback; i++) {
+    if (p->feedback[i] != 0) {
+      v[0] = i;
+      v[1] = p->feedback[i];
+      addnums(R, "types", v, 2);
+    }
+  }
+  for (i = 0; i < p->sizetabsites; i++) {
+    TabSite *ts = &p->tabsites[i];
+    if (ts->last != NULL)
+      luaV_updatetabsite(ts);  /* count the last table, too */
+    if (ts->sizearray != 0 || ts->sizenode != 0) {
+      v[0] = ts->pc;
+      v[1] = ts->sizearray;
+      v[2] = ts->sizenode;
+      addnums(R, "table", v, 3);
+    }
+  }
+  for (i = 0; i < p->sizep; i++)
+    dumptypes(R, p->p[i], n);
+}
+
+
+int luaC_typedump (lua_State *L, Proto *p, lua_Writer w, void *data) {
+  Report R;
+  lua_Integer n = 0;
+  lua_Integer version = PROFVERSION;
+  R.L = L;
+  R.writer = w;
+  R.data = data;
+  R.status = 0;
+  R.n = 0;
+  addnums(&R, "luaprofile", &version, 1);
+  dumptypes(&R, p, &n);
+  return R.status;
+}
+
+
+typedef struct ProfReader {
+  const char *s;  /* next character of the profile */
+  const char *e;  /* its end */
+} ProfReader;
+
+
+/* read the next word of the profile and check that it is 'w' */
+static int isword (ProfReader *r, const char *w) {
+  size_t l = strlen(w);
+  while (r->s < r->e && lisspace(cast_uchar(*r->s)))
+    r->s++;
+  if (cast(size_t, r->e - r->s) < l || memcmp(r->s, w, l) != 0 ||
+      (r->s + l < r->e && !lisspace(cast_uchar(r->s[l]))))
+    return 0;
+  r->s += l;
+  return 1;
+}
+
+
+/* read 'n' unsigned numbers; false if they are not there */
+static int readnums (ProfReader *r, unsigned int *v, int n) {
+  for (; n > 0; n--, v++) {
+    unsigned int x = 0;
+    while (r->s < r->e && lisspace(cast_uchar(*r->s)))
+      r->s++;
+    if (r->s == r->e || !lisdigit(cast_uchar(*r->s)))
+      return 0;
+    do {
+      unsigned int d = cast(unsigned int, *r->s++ - '0');
+      if (x > (UINT_MAX - d) / 10)
+        return 0;  /* overflow */
+      x = x * 10 + d;
+    } while (r->s < r->e && lisdigit(cast_uchar(*r->s)));
+    if (r->s < r->e && !lisspace(cast_uchar(*r->s)))
+      return 0;
+    *v = x;
+  }
+  return 1;
+}
+
+
+/* the 'n'-th function, in pre-order, of the tree rooted at 'p' */
+static Proto *nthproto (Proto *p, unsigned int *n) {
+  int i;
+  if ((*n)-- == 0)
+    return p;
+  for (i = 0; i < p->sizep; i++) {
+    Proto *q = nthproto(p->p[i], n);
+    if (q != NULL) return q;
+  }
+  return NULL;
+}
+
+
+/*
+** Read a profile for the tree rooted at 'p', applying it if 'apply'.
+** Returns the number of functions matched, or -1 if the profile is
+** malformed.
+*/
+static int readprofile (lua_State *L, Proto *p, ProfReader r, int apply) {
+  Proto *f = NULL;  /* function receiving the current entries */
+  unsigned int v[5];
+  int matched = 0;
+  if (!isword(&r, "luaprofile") || !readnums(&r, v, 1) ||
+      v[0] != PROFVERSION)
+    return -1;
+  for (;;) {
+    while (r.s < r.e && lisspace(cast_uchar(*r.s)))
+      r.s++;
+    if (r.s == r.e)
+      return matched;
+    else if (isword(&r, "function")) {
+      if (!readnums(&r, v, 5)) return -1;
+      f = nthproto(p, &v[0]);
+      if (f != NULL && cast(unsigned int, f->linedefined) == v[1] &&
+          cast(unsigned int, f->sizecode) == v[2] && codehash(f) == v[3]) {
+        matched++;
+        if (apply && v[4] >= LUAI_PROFHEAT && f->jitcount > 1)
+          f->jitcount = 1;  /* compile it at its next call */
+      }
+      else
+        f = NULL;  /* not the profiled code; skip its entries */
+    }
+    else if (isword(&r, "types")) {
+      if (!readnums(&r, v, 2)) return -1;
+      if (apply && f != NULL && v[0] < cast(unsigned int, f->sizecode)) {
+        if (f->feedback == NULL) {
+          f->feedback = luaM_newvector(L, f->sizecode, lu_byte);
+          f->sizefeedback = f->sizecode;
+          memset(f->feedback, 0, f->sizecode);
+        }
+        f->feedback[v[0]] |= cast_byte(v[1] & (FB_ALL | FB_ALL << FB_C));
+      }
+    }
+    else if (isword(&r, "table")) {
+      TabSite *ts;
+      if (!readnums(&r, v, 3)) return -1;
+      if (apply && f != NULL && v[0] <= MAX_INT &&
+          (ts = luaF_gettabsite(f, cast_int(v[0]))) != NULL) {
+        if (ts->sizearray < v[1] && v[1] <= MAXPROFSIZE)
+          ts->sizearray = v[1];
+        if (ts->sizenode < v[2] && v[2] <= MAXPROFSIZE)
+          ts->sizenode = v[2];
+      }
+    }
+    else
+      return -1;
+  }
+}
+
+
+/*
+** Load profile 's' into the tree of functions rooted at 'p'. Nothing
+** is applied if the profile is malformed.
+*/
+int luaC_typeload (lua_State *L, Proto *p, const char *s, size_t len) {
+  ProfReader r;
+  r.s = s;
+  r.e = s + len;
+  if (readprofile(L, p, r, 0) < 0)
+    return -1;
+  return readprofile(L, p, r, 1);
+}
+
+/* }====================================================== */
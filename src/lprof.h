@@ -0,0 +1,84 @@
+/*
+** $Id: lprof.h $
+** Allocation-site and type profilers
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lprof_h
+#define lprof_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* maximum number of frames kept for each sample (innermost ones) */
+#define PROFDEPTH	32
+
+
+typedef struct ProfFrame {
+  TString *source;  /* source of a Lua function (NULL for a C function) */
+  int line;  /* current line in that function */
+} ProfFrame;
+
+
+/*
+** A call stack where allocations were sampled, with the bytes and number
+** of samples attributed to it. 'frame[0]' is the innermost frame.
+*/
+typedef struct AllocSite {
+  struct AllocSite *next;  /* next site in the same bucket */
+  unsigned int hash;
+  int nframes;
+  lu_mem bytes;
+  lu_mem count;
+  ProfFrame frame[1];  /* 'nframes' frames (at least one slot) */
+} AllocSite;
+
+
+typedef struct AllocProf {
+  l_mem interval;  /* bytes between samples */
+  unsigned int size;  /* number of buckets */
+  unsigned int nsites;
+  AllocSite **bucket;
+} AllocProf;
+
+
+/*
+** Called by 'luaM_realloc_' each time 'g->profdebt' runs out; keep it
+** out of the way of allocations while the profiler is off.
+*/
+#define luaC_profalloc(L,g,n)  \
+	{ if (((g)->profdebt -= cast(l_mem, n)) <= 0) luaC_allocsample(L); }
+
+LUAI_FUNC void luaC_allocsample (lua_State *L);
+LUAI_FUNC int luaC_allocprofile (lua_State *L, int interval);
+LUAI_FUNC int luaC_allocreport (lua_State *L, lua_Writer w, void *data,
+                                int mode, int n);
+LUAI_FUNC void luaC_freeallocprof (global_State *g);
+
+
+/*
+** Types seen by the operands of an instruction, in its 'feedback' byte:
+** those of operand B in the low bits and those of operand C shifted by
+** 'FB_C'
+*/
+#define FB_INT		1
+#define FB_FLT		2
+#define FB_OTHER	4
+#define FB_ALL		(FB_INT | FB_FLT | FB_OTHER)
+#define FB_C		3
+
+#define fbtypes(fb,shift)	(((fb) >> (shift)) & FB_ALL)
+
+/* instructions run in a profile that make a function hot */
+#if !defined(LUAI_PROFHEAT)
+#define LUAI_PROFHEAT	1000
+#endif
+
+LUAI_FUNC void luaC_typerecord (lua_State *L, CallInfo *ci);
+LUAI_FUNC int luaC_typedump (lua_State *L, Proto *p, lua_Writer w,
+                             void *data);
+LUAI_FUNC int luaC_typeload (lua_State *L, Proto *p, const char *s,
+                             size_t len);
+
+#endif
@@ -22,6 +22,7 @@
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -107,6 +108,7 @@ void luaE_setdebt (global_State *g, l_mem debt) {
 
 CallInfo *luaE_extendCI (lua_State *L) {
   CallInfo *ci = luaM_new(L, CallInfo);
+  luaC_statbytes(G(L), LUA_TTHREAD, sizeof(CallInfo));
   lua_assert(L->ci->next == NULL);
   L->ci->next = ci;
   ci->previous = L->ci;
@@ -126,6 +128,7 @@ void luaE_freeCI (lua_State *L) {
   while ((ci = next) != NULL) {
     next = ci->next;
     luaM_free(L, ci);
+    luaC_statbytes(G(L), LUA_TTHREAD, -cast(l_mem, sizeof(CallInfo)));
     L->nci--;
   }
 }
@@ -140,6 +143,7 @@ void luaE_shrinkCI (lua_State *L) {
   /* while there are two nexts */
   while (ci->next != NULL && (next2 = ci->next->next) != NULL) {
     luaM_free(L, ci->next);  /* free next */
+    luaC_statbytes(G(L), LUA_TTHREAD, -cast(l_mem, sizeof(CallInfo)));
     L->nci--;
     ci->next = next2;  /* remove 'next' from the list */
     next2->previous = ci;
@@ -153,6 +157,7 @@ static void stack_init (lua_State *L1, lua_State *L) {
   /* initialize stack array */
   L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
   L1->stacksize = BASIC_STACK_SIZE;
+  luaC_statbytes(G(L), LUA_TTHREAD, BASIC_STACK_SIZE * sizeof(TValue));
   for (i = 0; i < BASIC_STACK_SIZE; i++)
     setnilvalue(L1->stack + i);  /* erase new stack */
   L1->top = L1->stack;
@@ -175,6 +180,7 @@ static void freestack (lua_State *L) {
   luaE_freeCI(L);
   lua_assert(L->nci == 0);
   luaM_freearray(L, L->stack, L->stacksize);  /* free stack array */
+  luaC_statbytes(G(L), LUA_TTHREAD, -cast(l_mem, L->stacksize * sizeof(TValue)));
 }
 
 
@@ -226,6 +232,7 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->stacksize = 0;
   L->twups = L;  /* thread has no upvalues */
   L->errorJmp = NULL;
+  L->arena = NULL;
   L->nCcalls = 0;
   L->hook = NULL;
   L->hookmask = 0;
@@ -243,11 +250,17 @@ static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeallobjects(L);  /* collect all objects */
+  luaC_gcthreads(L, 1);  /* stop marker threads */
+  luaC_sweepthread(L, 0);  /* stop freeing thread */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaC_freeallocprof(g);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
+  lua_assert(g->stats.bytes[LUA_TTABLE] == 0 &&
+             g->stats.bytes[LUA_TSTRING] == 0 &&
+             g->stats.bytes[LUA_TTHREAD] == sizeof(LX));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
@@ -264,6 +277,8 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   /* link it on list 'allgc' */
   L1->next = g->allgc;
   g->allgc = obj2gco(L1);
+  g->stats.objects[LUA_TTHREAD]++;
+  luaC_statbytes(g, LUA_TTHREAD, sizeof(LX));
   /* anchor it on L stack */
   setthvalue(L, L->top, L1);
   api_incr_top(L);
@@ -286,9 +301,13 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   LX *l = fromstate(L1);
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
+  if (L1->arena)  /* thread died inside an arena? */
+    luaC_closearena(L, L1);  /* keep its objects */
   luai_userstatefree(L, L1);
   freestack(L1);
   luaM_free(L, l);
+  G(L)->stats.objects[LUA_TTHREAD]--;
+  luaC_statbytes(G(L), LUA_TTHREAD, -cast(l_mem, sizeof(LX)));
 }
 
 
@@ -315,19 +334,33 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
+  g->gcpool = NULL;
+  g->gcfreer = NULL;
+  g->gcpmark = g->gcdeferfree = 0;
+  g->nextf = g->ipairsf = NULL;
   g->version = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_NORMAL;
-  g->allgc = g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->allgc = g->largegc = g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
-  g->weak = g->ephemeron = g->allweak = NULL;
+  g->weak = g->weakclean = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
+  g->gcfinbudget = LUAI_GCFINBUDGET;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcatomictime = 0;
+  memset(&g->stats, 0, sizeof(g->stats));
+  g->stats.objects[LUA_TTHREAD] = 1;  /* main thread */
+  g->stats.bytes[LUA_TTHREAD] = sizeof(LX);
+  g->profdebt = MAX_LMEM;
+  g->allocprof = NULL;
+  g->arenas = NULL;
+  g->arenastack = NULL;
+  g->sizearenastack = 0;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
@@ -166,12 +166,16 @@ typedef struct global_State {
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte gcpmark;  /* true in the private copies used by parallel markers */
+  lu_byte gcdeferfree;  /* true while frees go to 'gcfreer' */
   GCObject *allgc;  /* list of all collectable objects */
+  GCObject *largegc;  /* list of large strings and userdata */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
   GCObject *gray;  /* list of gray objects */
   GCObject *grayagain;  /* list of objects to be traversed atomically */
   GCObject *weak;  /* list of tables with weak values */
+  GCObject *weakclean;  /* weak-value tables remarked before atomic */
   GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
@@ -180,7 +184,19 @@ typedef struct global_State {
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int gcfinbudget;  /* time for finalizers in each GC step (microseconds) */
+  lu_mem gcatomictime;  /* duration of last atomic step (microseconds) */
+  lua_Stats stats;  /* counters for 'lua_getstats' */
+  l_mem profdebt;  /* bytes to allocate before next profiler sample */
+  struct AllocProf *allocprof;  /* allocation-site profiler */
+  struct Arena *arenas;  /* list of active arenas */
+  GCObject **arenastack;  /* work list to visit local objects */
+  int sizearenastack;
+  struct GCPool *gcpool;  /* helper threads for parallel marking */
+  struct GCFreer *gcfreer;  /* helper thread freeing swept objects */
   lua_CFunction panic;  /* to be called in unprotected errors */
+  lua_CFunction nextf;  /* 'next' run natively by generic 'for' */
+  lua_CFunction ipairsf;  /* 'ipairs' iterator run natively too */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
   TString *memerrmsg;  /* memory-error message */
@@ -207,6 +223,7 @@ struct lua_State {
   GCObject *gclist;
   struct lua_State *twups;  /* list of threads with open upvalues */
   struct lua_longjmp *errorJmp;  /* current error recover point */
+  struct Arena *arena;  /* arena receiving new objects (or NULL) */
   CallInfo base_ci;  /* CallInfo for first level (C calling Lua) */
   volatile lua_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
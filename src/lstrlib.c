@@ -43,7 +43,6 @@ capture 是将一个pattern用小括号括起来, 然后如果源子串match了
 /* macro to 'unsign' a character 宏“unsign”字符 */
 #define uchar(c)	((unsigned char)(c))
 
-6222 620810016942472
 /*
 ** Some sizes are better limited to fit in 'int', but must also fit in
 ** 'size_t'. (We assume that 'lua_Integer' cannot be smaller than 'int'.)
@@ -25,6 +25,7 @@
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -156,7 +157,7 @@ static unsigned int arrayindex (const TValue *key) {
 ** elements in the array part, then elements in the hash part. The
 ** beginning of a traversal is signaled by 0.
 */
-static unsigned int findindex (lua_State *L, Table *t, StkId key) {
+unsigned int luaH_keypos (lua_State *L, Table *t, const TValue *key) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
   i = arrayindex(key);
@@ -183,26 +184,55 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
-  unsigned int i = findindex(L, t, key);  /* find original element */
+/*
+** Traversal step starting at position 'i' (0 for the first element,
+** or a value returned by 'luaH_keypos' or by a previous step): puts
+** the next key-value pair in 'key' and 'key + 1' and returns its
+** position, or returns 0 when there are no more elements.
+*/
+unsigned int luaH_nextpos (lua_State *L, Table *t, unsigned int i,
+                                                   StkId key) {
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
       setivalue(key, i + 1);
       setobj2s(L, key+1, &t->array[i]);
-      return 1;
+      return i + 1;
     }
   }
   for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
-      return 1;
+      return (i + 1) + t->sizearray;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+/*
+** Inverse of 'luaH_keypos': key of the element at position 'i', or
+** nil if there is no such (live) element.
+*/
+void luaH_poskey (Table *t, unsigned int i, TValue *key) {
+  if (0 < i && i <= t->sizearray) {
+    setivalue(key, i);
+  }
+  else if (i != 0 && (i -= t->sizearray + 1) < cast(unsigned int, sizenode(t))
+                  && !ttisdeadkey(gkey(gnode(t, i)))) {
+    setobj(NULL, key, gkey(gnode(t, i)));  /* may be nil in a dummy node */
+  }
+  else
+    setnilvalue(key);
+}
+
+
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  /* find original element and go on from there */
+  return luaH_nextpos(L, t, luaH_keypos(L, t, key), key) != 0;
+}
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -344,6 +374,37 @@ static void auxsetnode (lua_State *L, void *ud) {
 }
 
 
+/*
+** Cards follow the layout of the table, so they are dropped while it is
+** resized (the barrier then falls back to the whole table) and built
+** again afterwards. If the table still has dirty cards, all new cards
+** start dirty.
+*/
+static void setcards (lua_State *L, Table *t) {
+  lua_assert(t->cards == NULL);
+  if (t->sizearray + allocsizenode(t) >= MINCARDSLOTS) {
+    unsigned int nc = cardsof(t);
+    t->cards = luaM_newvector(L, nc, lu_byte);
+    memset(t->cards, testbit(t->marked, DIRTYBIT) ? 1 : 0, nc);
+  }
+}
+
+
+/* memory used by the array and hash parts (and cards) of a table */
+#define partssize(t)  \
+	(sizeof(TValue) * (t)->sizearray + \
+	 sizeof(Node) * cast(size_t, allocsizenode(t)) + \
+	 (((t)->cards != NULL) ? cardsof(t) : 0))
+
+
+static void freecards (lua_State *L, Table *t) {
+  if (t->cards != NULL) {
+    luaM_freearray(L, t->cards, cardsof(t));
+    t->cards = NULL;
+  }
+}
+
+
 void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                           unsigned int nhsize) {
   unsigned int i;
@@ -352,12 +413,15 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
   unsigned int oldasize = t->sizearray;
   int oldhsize = allocsizenode(t);
   Node *nold = t->node;  /* save old hash ... */
+  luaC_statbytes(G(L), LUA_TTABLE, -cast(l_mem, partssize(t)));
+  freecards(L, t);
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
   asn.t = t; asn.nhsize = nhsize;
   if (luaD_rawrunprotected(L, auxsetnode, &asn) != LUA_OK) {  /* mem. error? */
     setarrayvector(L, t, oldasize);  /* array back to its original size */
+    luaC_statbytes(G(L), LUA_TTABLE, partssize(t));
     luaD_throw(L, LUA_ERRMEM);  /* rethrow memory error */
   }
   if (nasize < oldasize) {  /* array part must shrink? */
@@ -381,6 +445,8 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
   }
   if (oldhsize > 0)  /* not the dummy node? */
     luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+  setcards(L, t);
+  luaC_statbytes(G(L), LUA_TTABLE, partssize(t));
 }
 
 
@@ -425,12 +491,40 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->cards = NULL;
   setnodevector(L, t, 0);
   return t;
 }
 
 
+/*
+** Remove all entries from table 't' without releasing its array and
+** hash parts. Keys are erased too (instead of being left as dead keys),
+** so that every node is free again for new insertions. Only nils are
+** written, so no barrier is needed.
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t)) {
+    int j;
+    int size = sizenode(t);
+    for (j = 0; j < size; j++) {
+      Node *n = gnode(t, j);
+      gnext(n) = 0;
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+  t->flags = cast_byte(~0);  /* table has no metamethod fields now */
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
+  luaC_statbytes(G(L), LUA_TTABLE, -cast(l_mem, partssize(t)));
+  freecards(L, t);
   if (!isdummy(t))
     luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
   luaM_freearray(L, t->array, t->sizearray);
@@ -504,7 +598,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
     }
   }
   setnodekey(L, &mp->i_key, key);
-  luaC_barrierback(L, t, key);
+  luaC_barriercard(L, t, gval(mp), key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
 }
@@ -553,6 +647,29 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 }
 
 
+/*
+** Same as 'luaH_getshortstr', but first tries the node '*hint', where
+** the key was found the last time. When the key is not there, it is
+** looked up as usual and, if found, '*hint' is set to its node. As a
+** key lives in at most one node, checking the key of that node is
+** enough to validate the hint, even after a rehash or with a different
+** table (the hint is just a guess).
+*/
+const TValue *luaH_getstrhint (Table *t, TString *key, unsigned int *hint) {
+  const TValue *v;
+  lua_assert(key->tt == LUA_TSHRSTR);
+  if (*hint < cast(unsigned int, sizenode(t))) {
+    Node *n = gnode(t, *hint);
+    if (ttisshrstring(gkey(n)) && eqshrstr(tsvalue(gkey(n)), key))
+      return gval(n);
+  }
+  v = luaH_getshortstr(t, key);
+  if (v != luaO_nilobject)  /* found? remember its node */
+    *hint = cast(unsigned int, cast(const Node *, v) - gnode(t, 0));
+  return v;
+}
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
@@ -677,6 +794,275 @@ lua_Unsigned luaH_getn (Table *t) {
 
 
 
+/*
+** {=============================================================
+** Sorting of array parts
+** (pattern-defeating quicksort, after Orson Peters' 'pdqsort')
+** ==============================================================
+*/
+
+/* kinds of homogeneous arrays that can be sorted directly */
+#define SORTINT		0
+#define SORTFLT		1
+#define SORTSTR		2
+
+/* intervals smaller than this are sorted by insertion */
+#define INSLIMIT	24
+
+/* intervals larger than this use Tukey's ninther as pivot */
+#define NINTHERLIMIT	128
+
+/* maximum number of moves for a "partial" insertion sort */
+#define PARTIALLIMIT	8
+
+
+/* primitive order for arrays of kind 'k' */
+static int sortlt (int k, const TValue *a, const TValue *b) {
+  switch (k) {
+    case SORTINT: return ivalue(a) < ivalue(b);
+    case SORTFLT: return luai_numlt(fltvalue(a), fltvalue(b));
+    default: return (tsvalue(a) != tsvalue(b) &&
+                     luaV_strcmp(tsvalue(a), tsvalue(b)) < 0);
+  }
+}
+
+
+static void swapv (TValue *a, TValue *b) {
+  TValue temp = *a;
+  *a = *b;
+  *b = temp;
+}
+
+
+static void sort2 (int k, TValue *a, TValue *b) {
+  if (sortlt(k, b, a))
+    swapv(a, b);
+}
+
+
+static void sort3 (int k, TValue *a, TValue *b, TValue *c) {
+  sort2(k, a, b);
+  sort2(k, b, c);
+  sort2(k, a, b);
+}
+
+
+static void inssort (int k, TValue *lo, TValue *up) {
+  TValue *i;
+  for (i = lo + 1; i <= up; i++) {
+    TValue *j = i;
+    TValue temp = *i;
+    for (; j > lo && sortlt(k, &temp, j - 1); j--)
+      *j = *(j - 1);
+    *j = temp;
+  }
+}
+
+
+/*
+** Insertion sort that gives up (returning 0) after moving too many
+** elements; used to finish intervals that seem already sorted
+*/
+static int partialinssort (int k, TValue *lo, TValue *up) {
+  TValue *i;
+  size_t moves = 0;
+  for (i = lo + 1; i <= up; i++) {
+    TValue *j = i;
+    TValue temp = *i;
+    if (moves > PARTIALLIMIT)
+      return 0;
+    for (; j > lo && sortlt(k, &temp, j - 1); j--)
+      *j = *(j - 1);
+    *j = temp;
+    moves += i - j;
+  }
+  return 1;
+}
+
+
+static void siftdown (int k, TValue *a, size_t i, size_t n) {
+  size_t c;
+  while ((c = 2 * i + 1) < n) {
+    if (c + 1 < n && sortlt(k, &a[c], &a[c + 1]))
+      c++;  /* larger child */
+    if (!sortlt(k, &a[i], &a[c]))
+      break;
+    swapv(&a[i], &a[c]);
+    i = c;
+  }
+}
+
+
+static void heapsort (int k, TValue *lo, TValue *up) {
+  size_t n = up - lo + 1;
+  size_t i;
+  for (i = n / 2; i > 0; i--)
+    siftdown(k, lo, i - 1, n);
+  for (i = n - 1; i > 0; i--) {
+    swapv(&lo[0], &lo[i]);
+    siftdown(k, lo, 0, i);
+  }
+}
+
+
+/*
+** Partition [lo, up] around pivot P = *lo, putting elements equal to
+** P on its right. Sets '*done' when no element was out of place.
+** Returns the final position of P. The choice of pivot ensures there
+** are elements >= P after 'lo', which stop the first scan.
+*/
+static TValue *partright (int k, TValue *lo, TValue *up, int *done) {
+  TValue p = *lo;
+  TValue *i = lo;
+  TValue *j = up + 1;
+  while (sortlt(k, ++i, &p)) ;
+  if (i - 1 == lo)
+    while (i < j && !sortlt(k, --j, &p)) ;
+  else  /* there is an element < P in [lo + 1, i - 1] to stop the scan */
+    while (!sortlt(k, --j, &p)) ;
+  *done = (i >= j);
+  while (i < j) {
+    swapv(i, j);
+    while (sortlt(k, ++i, &p)) ;
+    while (!sortlt(k, --j, &p)) ;
+  }
+  *lo = *(i - 1);
+  *(i - 1) = p;
+  return i - 1;
+}
+
+
+/*
+** Partition [lo, up] around pivot P = *lo, putting elements equal to
+** P on its left. Used when P is equal to the element just before
+** 'lo' (and so no element in the interval is smaller than P).
+*/
+static TValue *partleft (int k, TValue *lo, TValue *up) {
+  TValue p = *lo;
+  TValue *i = lo;
+  TValue *j = up + 1;
+  while (sortlt(k, &p, --j)) ;
+  if (j == up)
+    while (i < j && !sortlt(k, &p, ++i)) ;
+  else
+    while (!sortlt(k, &p, ++i)) ;
+  while (i < j) {
+    swapv(i, j);
+    while (sortlt(k, &p, --j)) ;
+    while (!sortlt(k, &p, ++i)) ;
+  }
+  *lo = *j;
+  *j = p;
+  return j;
+}
+
+
+static void auxsort (int k, TValue *lo, TValue *up, int bad, int leftmost) {
+  while ((size_t)(up - lo) + 1 >= INSLIMIT) {
+    size_t n = up - lo + 1;
+    size_t ln, rn;
+    TValue *mid = lo + n / 2;
+    TValue *p;
+    int done;
+    if (n > NINTHERLIMIT) {  /* use ninther, moving it to 'lo' */
+      sort3(k, lo, mid, up);
+      sort3(k, lo + 1, mid - 1, up - 1);
+      sort3(k, lo + 2, mid + 1, up - 2);
+      sort3(k, mid - 1, mid, mid + 1);
+      swapv(lo, mid);
+    }
+    else  /* use median of three, moving it to 'lo' */
+      sort3(k, mid, lo, up);
+    if (!leftmost && !sortlt(k, lo - 1, lo)) {
+      /* pivot equals an element on the left; all of them go there */
+      lo = partleft(k, lo, up) + 1;
+      continue;
+    }
+    p = partright(k, lo, up, &done);
+    ln = p - lo;
+    rn = up - p;
+    if (ln < n / 8 || rn < n / 8) {  /* highly unbalanced partition? */
+      if (--bad == 0) {  /* too many bad partitions? */
+        heapsort(k, lo, up);  /* ensure O(n log n) */
+        return;
+      }
+      /* break patterns that may be causing the bad partitions */
+      if (ln >= INSLIMIT) {
+        swapv(lo, lo + ln / 4);
+        swapv(p - 1, p - ln / 4);
+        if (ln > NINTHERLIMIT) {
+          swapv(lo + 1, lo + (ln / 4 + 1));
+          swapv(lo + 2, lo + (ln / 4 + 2));
+          swapv(p - 2, p - (ln / 4 + 1));
+          swapv(p - 3, p - (ln / 4 + 2));
+        }
+      }
+      if (rn >= INSLIMIT) {
+        swapv(p + 1, p + (1 + rn / 4));
+        swapv(up, up + 1 - rn / 4);
+        if (rn > NINTHERLIMIT) {
+          swapv(p + 2, p + (2 + rn / 4));
+          swapv(p + 3, p + (3 + rn / 4));
+          swapv(up - 1, up - rn / 4);
+          swapv(up - 2, up - (1 + rn / 4));
+        }
+      }
+    }
+    else if (done && partialinssort(k, lo, p - 1) &&
+                     partialinssort(k, p + 1, up))
+      return;  /* interval seems to be already sorted */
+    /* recurse into the smaller interval, loop for the larger one */
+    if (ln < rn) {
+      auxsort(k, lo, p - 1, bad, leftmost);
+      lo = p + 1;
+      leftmost = 0;
+    }
+    else {
+      auxsort(k, p + 1, up, bad, 0);
+      up = p - 1;
+    }
+  }
+  if (lo < up)
+    inssort(k, lo, up);
+}
+
+
+/*
+** Try to sort elements t[1 .. n] with their primitive order, working
+** directly over the array part. That is only possible when all of them
+** are in the array part and are all integers, all floats (without
+** NaNs), or all strings; otherwise, returns 0 (and does nothing).
+** Moving values inside a table needs no barriers.
+*/
+int luaH_sortarray (Table *t, unsigned int n) {
+  TValue *a = t->array;
+  unsigned int i;
+  int k;
+  int bad = 1;
+  if (n < 2 || n > t->sizearray)
+    return 0;
+  switch (ttype(&a[0])) {
+    case LUA_TNUMINT: k = SORTINT; break;
+    case LUA_TNUMFLT: k = SORTFLT; break;
+    case LUA_TSHRSTR: case LUA_TLNGSTR: k = SORTSTR; break;
+    default: return 0;
+  }
+  for (i = 0; i < n; i++) {
+    const TValue *o = &a[i];
+    if (k == SORTINT ? !ttisinteger(o) :
+        k == SORTFLT ? !ttisfloat(o) || luai_numisnan(fltvalue(o)) :
+                       !ttisstring(o))
+      return 0;
+  }
+  for (i = n; i > 1; i >>= 1)
+    bad++;  /* allow about log2(n) bad partitions */
+  auxsort(k, a, a + n - 1, bad, 1);
+  return 1;
+}
+
+/* }============================================================= */
+
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
@@ -35,6 +35,21 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/*
+** Large tables keep one "card" for each slice of CARDSIZE slots of their
+** array part, followed by one for each slice of their hash part. The
+** back barrier marks the card of the written slot, so that the
+** collector traverses again only the slices that changed.
+*/
+#define CARDSHIFT	7
+#define CARDSIZE	(1u << CARDSHIFT)
+#define numcards(n)	(((n) + CARDSIZE - 1) >> CARDSHIFT)
+#define cardsof(t)	(numcards((t)->sizearray) + numcards(sizenode(t)))
+
+/* minimum number of slots for a table to have cards */
+#define MINCARDSLOTS	(8 * CARDSIZE)
+
+
 /* returns the key, given the value of a table entry */
 #define keyfromval(v) \
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
@@ -45,6 +60,8 @@ LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getstrhint (Table *t, TString *key,
+                                         unsigned int *hint);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
@@ -52,9 +69,16 @@ LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC unsigned int luaH_keypos (lua_State *L, Table *t,
+                                    const TValue *key);
+LUAI_FUNC unsigned int luaH_nextpos (lua_State *L, Table *t, unsigned int i,
+                                     StkId key);
+LUAI_FUNC void luaH_poskey (Table *t, unsigned int i, TValue *key);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
+LUAI_FUNC int luaH_sortarray (Table *t, unsigned int n);
 
 
 #if defined(LUA_DEBUG)
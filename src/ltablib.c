@@ -33,6 +33,26 @@
 #define aux_getn(L,n,w)	(checktab(L, n, (w) | TAB_L), luaL_len(L, n))
 
 
+/*
+** Check whether 'arg' is a table whose accesses 'what' can be done with
+** raw operations, that is, a table without the corresponding
+** metamethods ('__index' for reads, '__newindex' for writes)
+*/
+static int rawaccess (lua_State *L, int arg, int what) {
+  if (lua_type(L, arg) != LUA_TTABLE)
+    return 0;
+  if ((what & TAB_R) && luaL_getmetafield(L, arg, "__index") != LUA_TNIL) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  if ((what & TAB_W) && luaL_getmetafield(L, arg, "__newindex") != LUA_TNIL) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+
 static int checkfield (lua_State *L, const char *key, int n) {
   lua_pushstring(L, key);
   return (lua_rawget(L, -n) != LUA_TNIL);
@@ -139,7 +159,9 @@ static int tmove (lua_State *L) {
     n = e - f + 1;  /* number of elements to move */
     luaL_argcheck(L, t <= LUA_MAXINTEGER - n + 1, 4,
                   "destination wrap around");
-    if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
+    if (rawaccess(L, 1, TAB_R) && rawaccess(L, tt, TAB_W))
+      lua_rawmove(L, 1, f, e, t, tt);  /* plain tables: move in bulk */
+    else if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
       for (i = 0; i < n; i++) {
         lua_geti(L, 1, f + i);
         lua_seti(L, tt, t + i);
@@ -173,6 +195,8 @@ static int tconcat (lua_State *L) {
   const char *sep = luaL_optlstring(L, 2, "", &lsep);
   lua_Integer i = luaL_optinteger(L, 3, 1);
   last = luaL_optinteger(L, 4, last);
+  if (lua_type(L, 1) == LUA_TTABLE && lua_rawconcat(L, 1, sep, lsep, i, last))
+    return 1;  /* all values were strings or numbers */
   luaL_buffinit(L, &b);
   for (; i < last; i++) {
     addfield(L, &b, i);
@@ -185,6 +209,46 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Capacity management
+** =======================================================
+*/
+
+static int checksize (lua_State *L, int arg) {
+  lua_Integer n = luaL_optinteger(L, arg, 0);
+  luaL_argcheck(L, 0 <= n && n <= INT_MAX, arg, "size out of range");
+  return (int)n;
+}
+
+
+static int tnew (lua_State *L) {
+  int narr = checksize(L, 1);
+  int nrec = checksize(L, 2);
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+static int treserve (lua_State *L) {
+  int narr, nrec;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  narr = checksize(L, 2);
+  nrec = checksize(L, 3);
+  lua_reservetable(L, 1, narr, nrec);
+  return 0;
+}
+
+
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -212,6 +276,10 @@ static int unpack (lua_State *L) {
   n = (lua_Unsigned)e - i;  /* number of elements minus 1 (avoid overflows) */
   if (n >= (unsigned int)INT_MAX  || !lua_checkstack(L, (int)(++n)))
     return luaL_error(L, "too many results to unpack");
+  if (rawaccess(L, 1, TAB_R)) {  /* plain table? */
+    lua_rawunpack(L, 1, i, (int)n);
+    return (int)n;
+  }
   for (; i < e; i++) {  /* push arg[i..e - 1] (to avoid overflows) */
     lua_geti(L, 1, i);
   }
@@ -225,9 +293,8 @@ static int unpack (lua_State *L) {
 
 /*
 ** {======================================================
-** Quicksort
-** (based on 'Algorithms in MODULA-3', Robert Sedgewick;
-**  Addison-Wesley, 1993.)
+** Sort
+** (pattern-defeating quicksort, after Orson Peters' 'pdqsort')
 ** =======================================================
 */
 
@@ -236,47 +303,33 @@ static int unpack (lua_State *L) {
 typedef unsigned int IdxT;
 
 
-/*
-** Produce a "random" 'unsigned int' to randomize pivot choice. This
-** macro is used only when 'sort' detects a big imbalance in the result
-** of a partition. (If you don't want/need this "randomness", ~0 is a
-** good choice.)
-*/
-#if !defined(l_randomizePivot)		/* { */
+/* intervals smaller than this are sorted by insertion */
+#define INSLIMIT	12u
+
+/* intervals larger than this use Tukey's ninther as pivot */
+#define NINTHERLIMIT	128u
 
-#include <time.h>
+/* maximum number of moves for a "partial" insertion sort */
+#define PARTIALLIMIT	8u
 
-/* size of 'e' measured in number of 'unsigned int's */
-#define sof(e)		(sizeof(e) / sizeof(unsigned int))
 
 /*
-** Use 'time' and 'clock' as sources of "randomness". Because we don't
-** know the types 'clock_t' and 'time_t', we cannot cast them to
-** anything without risking overflows. A safe way to use their values
-** is to copy them to an array of a known type and use the array values.
+** State of a sort: element access goes through the API, using raw
+** accesses when the table has no metamethods that could interfere.
 */
-static unsigned int l_randomizePivot (void) {
-  clock_t c = clock();
-  time_t t = time(NULL);
-  unsigned int buff[sof(c) + sof(t)];
-  unsigned int i, rnd = 0;
-  memcpy(buff, &c, sof(c) * sizeof(unsigned int));
-  memcpy(buff + sof(c), &t, sof(t) * sizeof(unsigned int));
-  for (i = 0; i < sof(buff); i++)
-    rnd += buff[i];
-  return rnd;
-}
+typedef struct SortS {
+  lua_State *L;
+  int (*geti) (lua_State *L, int idx, lua_Integer n);
+  void (*seti) (lua_State *L, int idx, lua_Integer n);
+} SortS;
 
-#endif					/* } */
 
+#define geti(s,i)	((s)->geti((s)->L, 1, (i)))
+#define seti(s,i)	((s)->seti((s)->L, 1, (i)))
 
-/* arrays larger than 'RANLIMIT' may use randomized pivots */
-#define RANLIMIT	100u
 
-
-static void set2 (lua_State *L, IdxT i, IdxT j) {
-  lua_seti(L, 1, i);
-  lua_seti(L, 1, j);
+static int badorder (lua_State *L) {
+  return luaL_error(L, "invalid order function for sorting");
 }
 
 
@@ -300,122 +353,284 @@ static int sort_comp (lua_State *L, int a, int b) {
 }
 
 
+/* a[i] < a[j]? */
+static int lessthan (SortS *s, IdxT i, IdxT j) {
+  int res;
+  geti(s, i);
+  geti(s, j);
+  res = sort_comp(s->L, -2, -1);
+  lua_pop(s->L, 2);
+  return res;
+}
+
+
+static void swap (SortS *s, IdxT i, IdxT j) {
+  geti(s, i);
+  geti(s, j);
+  seti(s, i);  /* a[i] = old a[j] */
+  seti(s, j);  /* a[j] = old a[i] */
+}
+
+
+static void sort2 (SortS *s, IdxT i, IdxT j) {
+  if (lessthan(s, j, i))
+    swap(s, i, j);
+}
+
+
+static void sort3 (SortS *s, IdxT i, IdxT j, IdxT k) {
+  sort2(s, i, j);
+  sort2(s, j, k);
+  sort2(s, i, j);
+}
+
+
+/*
+** Insertion sort of a[lo .. up]. If 'limit' is not zero, gives up
+** (returning 0) after moving more than 'limit' elements.
+*/
+static int inssort (SortS *s, IdxT lo, IdxT up, IdxT limit) {
+  lua_State *L = s->L;
+  IdxT i;
+  IdxT moves = 0;
+  for (i = lo + 1; i <= up; i++) {
+    IdxT j = i;
+    if (limit != 0 && moves > limit)
+      return 0;
+    geti(s, i);  /* element to be inserted */
+    while (j > lo) {
+      geti(s, j - 1);
+      if (!sort_comp(L, -2, -1)) {  /* not a[i] < a[j - 1]? */
+        lua_pop(L, 1);
+        break;
+      }
+      seti(s, j--);  /* move a[j - 1] up */
+    }
+    seti(s, j);  /* put element in its place */
+    moves += i - j;
+  }
+  return 1;
+}
+
+
+static void siftdown (SortS *s, IdxT lo, IdxT i, IdxT n) {
+  IdxT c;
+  while ((c = 2 * i + 1) < n) {
+    if (c + 1 < n && lessthan(s, lo + c, lo + c + 1))
+      c++;  /* larger child */
+    if (!lessthan(s, lo + i, lo + c))
+      break;
+    swap(s, lo + i, lo + c);
+    i = c;
+  }
+}
+
+
+static void heapsort (SortS *s, IdxT lo, IdxT up) {
+  IdxT n = up - lo + 1;
+  IdxT i;
+  for (i = n / 2; i > 0; i--)
+    siftdown(s, lo, i - 1, n);
+  for (i = n - 1; i > 0; i--) {
+    swap(s, lo, lo + i);
+    siftdown(s, lo, 0, i);
+  }
+}
+
+
 /*
-** Does the partition: Pivot P is at the top of the stack.
-** precondition: a[lo] <= P == a[up-1] <= a[up],
-** so it only needs to do the partition from lo + 1 to up - 2.
-** Pos-condition: a[lo .. i - 1] <= a[i] == P <= a[i + 1 .. up]
-** returns 'i'.
+** Partition a[lo .. up] around pivot P = a[lo], putting elements
+** equal to P on its right. Sets '*done' when no element was out of
+** place. Returns the final position of P. A consistent order function
+** never lets the scans leave the interval; otherwise, raises an error.
+** Elements found by the scans stay on the stack, so that a swap needs
+** only two sets.
 */
-static IdxT partition (lua_State *L, IdxT lo, IdxT up) {
-  IdxT i = lo;  /* will be incremented before first use */
-  IdxT j = up - 1;  /* will be decremented before first use */
-  /* loop invariant: a[lo .. i] <= P <= a[j .. up] */
-  for (;;) {
-    /* next loop: repeat ++i while a[i] < P */
-    while (lua_geti(L, 1, ++i), sort_comp(L, -1, -2)) {
-      if (i == up - 1)  /* a[i] < P  but a[up - 1] == P  ?? */
-        luaL_error(L, "invalid order function for sorting");
-      lua_pop(L, 1);  /* remove a[i] */
+static IdxT partright (SortS *s, IdxT lo, IdxT up, int *done) {
+  lua_State *L = s->L;
+  IdxT i = lo;
+  IdxT j = up + 1;
+  int top;
+  geti(s, lo);  /* push pivot */
+  top = lua_gettop(L);
+  /* repeat ++i while a[i] < P */
+  while (geti(s, ++i), sort_comp(L, -1, -2)) {
+    if (i == up) badorder(L);
+    lua_pop(L, 1);
+  }
+  if (i - 1 == lo) {  /* no element < P yet? guard the scan */
+    /* repeat --j while P <= a[j] and j > i */
+    while (--j > i && (geti(s, j), !sort_comp(L, -1, -3)))
+      lua_pop(L, 1);
+  }
+  else {  /* an element < P in [lo + 1, i - 1] stops the scan */
+    while (geti(s, --j), !sort_comp(L, -1, -3)) {
+      if (j == lo + 1) badorder(L);
+      lua_pop(L, 1);
     }
-    /* after the loop, a[i] >= P and a[lo .. i - 1] < P */
-    /* next loop: repeat --j while P < a[j] */
-    while (lua_geti(L, 1, --j), sort_comp(L, -3, -1)) {
-      if (j < i)  /* j < i  but  a[j] > P ?? */
-        luaL_error(L, "invalid order function for sorting");
-      lua_pop(L, 1);  /* remove a[j] */
+  }
+  *done = (i >= j);
+  while (i < j) {  /* a[i] >= P and a[j] < P are on the stack */
+    seti(s, i);  /* a[i] = a[j] */
+    seti(s, j);  /* a[j] = old a[i] */
+    while (geti(s, ++i), sort_comp(L, -1, -2)) {
+      if (i == up) badorder(L);
+      lua_pop(L, 1);
     }
-    /* after the loop, a[j] <= P and a[j + 1 .. up] >= P */
-    if (j < i) {  /* no elements out of place? */
-      /* a[lo .. i - 1] <= P <= a[j + 1 .. i .. up] */
-      lua_pop(L, 1);  /* pop a[j] */
-      /* swap pivot (a[up - 1]) with a[i] to satisfy pos-condition */
-      set2(L, up - 1, i);
-      return i;
+    while (geti(s, --j), !sort_comp(L, -1, -3)) {
+      if (j == lo + 1) badorder(L);
+      lua_pop(L, 1);
     }
-    /* otherwise, swap a[i] - a[j] to restore invariant and repeat */
-    set2(L, i, j);
   }
+  lua_settop(L, top);  /* remove elements left by the scans */
+  geti(s, i - 1);
+  seti(s, lo);  /* a[lo] = a[i - 1] */
+  seti(s, i - 1);  /* a[i - 1] = P (and pop it) */
+  return i - 1;
 }
 
 
 /*
-** Choose an element in the middle (2nd-3th quarters) of [lo,up]
-** "randomized" by 'rnd'
+** Partition a[lo .. up] around pivot P = a[lo], putting elements
+** equal to P on its left. Used when P is equal to the element just
+** before 'lo' (and so no element in the interval is smaller than P).
 */
-static IdxT choosePivot (IdxT lo, IdxT up, unsigned int rnd) {
-  IdxT r4 = (up - lo) / 4;  /* range/4 */
-  IdxT p = rnd % (r4 * 2) + (lo + r4);
-  lua_assert(lo + r4 <= p && p <= up - r4);
-  return p;
+static IdxT partleft (SortS *s, IdxT lo, IdxT up) {
+  lua_State *L = s->L;
+  IdxT i = lo;
+  IdxT j = up + 1;
+  int top;
+  geti(s, lo);  /* push pivot */
+  top = lua_gettop(L);
+  /* repeat --j while P < a[j] */
+  while (geti(s, --j), sort_comp(L, -2, -1)) {
+    if (j == lo) badorder(L);
+    lua_pop(L, 1);
+  }
+  if (j == up) {  /* no element > P yet? guard the scan */
+    /* repeat ++i while a[i] <= P and i < j */
+    while (++i < j && (geti(s, i), !sort_comp(L, -3, -1)))
+      lua_pop(L, 1);
+  }
+  else {
+    while (geti(s, ++i), !sort_comp(L, -3, -1)) {
+      if (i == up) badorder(L);
+      lua_pop(L, 1);
+    }
+  }
+  while (i < j) {  /* a[j] <= P and a[i] > P are on the stack */
+    seti(s, j);  /* a[j] = a[i] */
+    seti(s, i);  /* a[i] = old a[j] */
+    while (geti(s, --j), sort_comp(L, -2, -1)) {
+      if (j == lo) badorder(L);
+      lua_pop(L, 1);
+    }
+    while (geti(s, ++i), !sort_comp(L, -3, -1)) {
+      if (i == up) badorder(L);
+      lua_pop(L, 1);
+    }
+  }
+  lua_settop(L, top);  /* remove elements left by the scans */
+  geti(s, j);
+  seti(s, lo);  /* a[lo] = a[j] */
+  seti(s, j);  /* a[j] = P (and pop it) */
+  return j;
 }
 
 
-/*
-** QuickSort algorithm (recursive function)
-*/
-static void auxsort (lua_State *L, IdxT lo, IdxT up,
-                                   unsigned int rnd) {
-  while (lo < up) {  /* loop for tail recursion */
-    IdxT p;  /* Pivot index */
-    IdxT n;  /* to be used later */
-    /* sort elements 'lo', 'p', and 'up' */
-    lua_geti(L, 1, lo);
-    lua_geti(L, 1, up);
-    if (sort_comp(L, -1, -2))  /* a[up] < a[lo]? */
-      set2(L, lo, up);  /* swap a[lo] - a[up] */
-    else
-      lua_pop(L, 2);  /* remove both values */
-    if (up - lo == 1)  /* only 2 elements? */
-      return;  /* already sorted */
-    if (up - lo < RANLIMIT || rnd == 0)  /* small interval or no randomize? */
-      p = (lo + up)/2;  /* middle element is a good pivot */
-    else  /* for larger intervals, it is worth a random pivot */
-      p = choosePivot(lo, up, rnd);
-    lua_geti(L, 1, p);
-    lua_geti(L, 1, lo);
-    if (sort_comp(L, -2, -1))  /* a[p] < a[lo]? */
-      set2(L, p, lo);  /* swap a[p] - a[lo] */
-    else {
-      lua_pop(L, 1);  /* remove a[lo] */
-      lua_geti(L, 1, up);
-      if (sort_comp(L, -1, -2))  /* a[up] < a[p]? */
-        set2(L, p, up);  /* swap a[up] - a[p] */
-      else
-        lua_pop(L, 2);
+static void auxsort (SortS *s, IdxT lo, IdxT up, int bad, int leftmost) {
+  while (up - lo + 1 >= INSLIMIT) {
+    IdxT n = up - lo + 1;
+    IdxT mid = lo + n / 2;
+    IdxT p, ln, rn;
+    int done;
+    if (n > NINTHERLIMIT) {  /* use ninther, moving it to 'lo' */
+      sort3(s, lo, mid, up);
+      sort3(s, lo + 1, mid - 1, up - 1);
+      sort3(s, lo + 2, mid + 1, up - 2);
+      sort3(s, mid - 1, mid, mid + 1);
+      swap(s, lo, mid);
+    }
+    else  /* use median of three, moving it to 'lo' */
+      sort3(s, mid, lo, up);
+    if (!leftmost && !lessthan(s, lo - 1, lo)) {
+      /* pivot equals an element on the left; all of them go there */
+      lo = partleft(s, lo, up) + 1;
+      continue;
     }
-    if (up - lo == 2)  /* only 3 elements? */
-      return;  /* already sorted */
-    lua_geti(L, 1, p);  /* get middle element (Pivot) */
-    lua_pushvalue(L, -1);  /* push Pivot */
-    lua_geti(L, 1, up - 1);  /* push a[up - 1] */
-    set2(L, p, up - 1);  /* swap Pivot (a[p]) with a[up - 1] */
-    p = partition(L, lo, up);
-    /* a[lo .. p - 1] <= a[p] == P <= a[p + 1 .. up] */
-    if (p - lo < up - p) {  /* lower interval is smaller? */
-      auxsort(L, lo, p - 1, rnd);  /* call recursively for lower interval */
-      n = p - lo;  /* size of smaller interval */
-      lo = p + 1;  /* tail call for [p + 1 .. up] (upper interval) */
+    p = partright(s, lo, up, &done);
+    ln = p - lo;
+    rn = up - p;
+    if (ln < n / 8 || rn < n / 8) {  /* highly unbalanced partition? */
+      if (--bad == 0) {  /* too many bad partitions? */
+        heapsort(s, lo, up);  /* ensure O(n log n) */
+        return;
+      }
+      /* break patterns that may be causing the bad partitions */
+      if (ln >= INSLIMIT) {
+        swap(s, lo, lo + ln / 4);
+        swap(s, p - 1, p - ln / 4);
+        if (ln > NINTHERLIMIT) {
+          swap(s, lo + 1, lo + (ln / 4 + 1));
+          swap(s, lo + 2, lo + (ln / 4 + 2));
+          swap(s, p - 2, p - (ln / 4 + 1));
+          swap(s, p - 3, p - (ln / 4 + 2));
+        }
+      }
+      if (rn >= INSLIMIT) {
+        swap(s, p + 1, p + (1 + rn / 4));
+        swap(s, up, up + 1 - rn / 4);
+        if (rn > NINTHERLIMIT) {
+          swap(s, p + 2, p + (2 + rn / 4));
+          swap(s, p + 3, p + (3 + rn / 4));
+          swap(s, up - 1, up - rn / 4);
+          swap(s, up - 2, up - (1 + rn / 4));
+        }
+      }
+    }
+    else if (done && inssort(s, lo, p - 1, PARTIALLIMIT) &&
+                     inssort(s, p + 1, up, PARTIALLIMIT))
+      return;  /* interval seems to be already sorted */
+    /* recurse into the smaller interval, loop for the larger one */
+    if (ln < rn) {
+      if (ln > 1) auxsort(s, lo, p - 1, bad, leftmost);
+      lo = p + 1;
+      leftmost = 0;
     }
     else {
-      auxsort(L, p + 1, up, rnd);  /* call recursively for upper interval */
-      n = up - p;  /* size of smaller interval */
-      up = p - 1;  /* tail call for [lo .. p - 1]  (lower interval) */
+      if (rn > 1) auxsort(s, p + 1, up, bad, 0);
+      up = p - 1;
     }
-    if ((up - lo) / 128 > n) /* partition too imbalanced? */
-      rnd = l_randomizePivot();  /* try a new randomization */
-  }  /* tail call auxsort(L, lo, up, rnd) */
+  }
+  if (lo < up)
+    inssort(s, lo, up, 0);
 }
 
 
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
+    SortS s;
+    int bad = 1;
+    lua_Integer i;
     luaL_argcheck(L, n < INT_MAX, 1, "array too big");
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
+    else if (lua_type(L, 1) == LUA_TTABLE && lua_rawsort(L, 1, n))
+      return 0;  /* homogeneous array sorted directly */
     lua_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    s.L = L;
+    if (rawaccess(L, 1, TAB_RW)) {
+      s.geti = lua_rawgeti;
+      s.seti = lua_rawseti;
+    }
+    else {
+      s.geti = lua_geti;
+      s.seti = lua_seti;
+    }
+    for (i = n; i > 1; i >>= 1)
+      bad++;  /* allow about log2(n) bad partitions */
+    auxsort(&s, 1, (IdxT)n, bad, 1);
   }
   return 0;
 }
@@ -424,14 +639,17 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
 #if defined(LUA_COMPAT_MAXN)
   {"maxn", maxn},
 #endif
   {"insert", tinsert},
+  {"new", tnew},
   {"pack", pack},
   {"unpack", unpack},
   {"remove", tremove},
+  {"reserve", treserve},
   {"move", tmove},
   {"sort", sort},
   {NULL, NULL}
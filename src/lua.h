@@ -281,6 +281,7 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
+LUA_API int (lua_heapsnapshot) (lua_State *L, lua_Writer writer, void *data);
 
 
 /*
@@ -308,10 +309,71 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCTHREADS		10
+#define LUA_GCSWEEPTHREAD	11
+#define LUA_GCATOMICTIME	12
+#define LUA_GCFINBUDGET		13
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** memory and collector statistics
+*/
+
+#define LUA_NUMSTATS	(LUA_NUMTAGS + 1)  /* basic types plus prototypes */
+
+typedef struct lua_Stats {
+  size_t objects[LUA_NUMSTATS];  /* live objects of each type */
+  size_t bytes[LUA_NUMSTATS];  /* memory used by them */
+  size_t totalbytes;  /* memory in use */
+  lua_Unsigned allocs;  /* blocks allocated */
+  lua_Unsigned frees;  /* blocks freed */
+  lua_Unsigned allocbytes;  /* bytes allocated (including block growth) */
+  lua_Unsigned cycles;  /* collection cycles completed */
+  lua_Unsigned steps;  /* incremental steps */
+  lua_Unsigned markbytes;  /* memory traversed while marking */
+  lua_Unsigned swept;  /* objects visited while sweeping */
+  lua_Unsigned finalizers;  /* finalizers called */
+  lua_Unsigned finpending;  /* objects waiting for their finalizers */
+  lua_Unsigned fintime;  /* time spent in finalizers (microseconds) */
+  lua_Unsigned finmaxtime;  /* longest finalizer call (microseconds) */
+  lua_Unsigned atomictime;  /* duration of last atomic step (microseconds) */
+} lua_Stats;
+
+LUA_API void (lua_getstats) (lua_State *L, lua_Stats *s);
+
+
+/*
+** allocation profiler
+*/
+
+#define LUA_PROFTOP	0
+#define LUA_PROFFOLDED	1
+
+LUA_API int (lua_allocprofile) (lua_State *L, int interval);
+LUA_API int (lua_allocreport) (lua_State *L, lua_Writer writer, void *data,
+                               int mode, int n);
+
+
+/*
+** type profiles
+*/
+
+LUA_API int (lua_typeprofile) (lua_State *L, int on);
+LUA_API int (lua_dumpprofile) (lua_State *L, lua_Writer writer, void *data);
+LUA_API int (lua_loadprofile) (lua_State *L, int fidx, const char *s,
+                               size_t len);
+
+
+/*
+** arenas
+*/
+
+LUA_API void (lua_pusharena) (lua_State *L);
+LUA_API int (lua_poparena) (lua_State *L);
+
+
 /*
 ** miscellaneous functions
 */
@@ -323,6 +385,17 @@ LUA_API int   (lua_next) (lua_State *L, int idx);
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
 
+LUA_API void  (lua_reservetable) (lua_State *L, int idx, int narr, int nrec);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
+LUA_API void  (lua_setiterators) (lua_State *L, lua_CFunction nextf,
+                                                lua_CFunction ipairsf);
+LUA_API int   (lua_rawsort) (lua_State *L, int idx, lua_Integer n);
+LUA_API int   (lua_rawconcat) (lua_State *L, int idx, const char *sep,
+                               size_t lsep, lua_Integer i, lua_Integer j);
+LUA_API void  (lua_rawunpack) (lua_State *L, int idx, lua_Integer i, int n);
+LUA_API void  (lua_rawmove) (lua_State *L, int idx1, lua_Integer f,
+                             lua_Integer e, lua_Integer t, int idx2);
+
 LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
@@ -431,6 +504,11 @@ LUA_API const char *(lua_setupvalue) (lua_State *L, int funcindex, int n);
 LUA_API void *(lua_upvalueid) (lua_State *L, int fidx, int n);
 LUA_API void  (lua_upvaluejoin) (lua_State *L, int fidx1, int n1,
                                                int fidx2, int n2);
+LUA_API int (lua_gettabhint) (lua_State *L, int fidx, int n, int *line,
+                                            int *narr, int *nrec);
+LUA_API const char *(lua_gettrace) (lua_State *L, int fidx, int n, int *line,
+                                    lua_Integer *entries, lua_Integer *exits,
+                                    lua_Integer *iterations);
 
 LUA_API void (lua_sethook) (lua_State *L, lua_Hook func, int mask, int count);
 LUA_API lua_Hook (lua_gethook) (lua_State *L);
@@ -454,6 +532,7 @@ struct lua_Debug {
   char short_src[LUA_IDSIZE]; /* (S) */
   /* private part */
   struct CallInfo *i_ci;  /* active function */
+  int i_inl;  /* inlined call shown as this frame (-1 if none) */
 };
 
 /* }====================================================================== */
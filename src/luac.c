@@ -19,6 +19,7 @@
 #include "lauxlib.h"
 
 #include "lobject.h"
+#include "lopt.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -30,7 +31,9 @@ static void PrintFunction(const Proto* f, int full);
 
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
+static int optimizing=0;		/* optimize bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static const char* module=NULL;		/* C module to compile into */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -56,8 +59,10 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -C name  output C source for module 'name' compiled ahead of time\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       optimize bytecodes\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -86,6 +91,12 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-C"))			/* compile to C module */
+  {
+   module=argv[++i];
+   if (module==NULL || *module==0 || *module=='-')
+    usage("'-C' needs argument");
+  }
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -95,6 +106,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -175,13 +188,17 @@ static int pmain(lua_State* L)
   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
  }
  f=combine(L,argc);
+ if (optimizing) luaK_optimize(L,(Proto*)f);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
+  if (module!=NULL)
+   luaU_dumpC(L,f,module,writer,D,stripping);
+  else
+   luaU_dump(L,f,writer,D,stripping);
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
@@ -322,7 +339,7 @@ static void PrintCode(const Proto* f)
     printf("%d",MYK(ax));
     break;
   }
-  switch (o)
+  switch (genericop(o))
   {
    case OP_LOADK:
     printf("\t; "); PrintConstant(f,bx);
@@ -62,6 +62,16 @@
 #define LUA_USE_POSIX
 #define LUA_USE_DLOPEN		/* needs an extra library: -ldl */
 #define LUA_USE_READLINE	/* needs some extra libraries */
+#define LUA_USE_PTHREADS	/* needs an extra library: -lpthread */
+#endif
+
+
+/*
+@@ LUA_USE_JIT compiles hot Lua functions to machine code (see 'ljit.c').
+** It is available only on x86-64 Linux; define LUA_NOJIT to turn it off.
+*/
+#if defined(LUA_USE_LINUX) && defined(__x86_64__) && !defined(LUA_NOJIT)
+#define LUA_USE_JIT
 #endif
 
 
@@ -69,6 +79,7 @@
 #define LUA_USE_POSIX
 #define LUA_USE_DLOPEN		/* MacOS does not need -ldl */
 #define LUA_USE_READLINE	/* needs an extra library: -lreadline */
+#define LUA_USE_PTHREADS	/* MacOS does not need -lpthread */
 #endif
 
 
@@ -732,6 +743,25 @@
 #endif
 
 
+/*
+@@ LUAI_LARGEOBJ is the size (in bytes) from which strings and userdata
+** go to the collector's large-object list, and from which the standard
+** allocator ('luaL_newstate') maps blocks directly from the system.
+** CHANGE it if you want a different threshold.
+*/
+#define LUAI_LARGEOBJ		(256 * 1024)
+
+
+/*
+@@ LUAI_GCFINBUDGET is the default time (in microseconds) that each
+** incremental collection step may spend calling finalizers. Zero keeps
+** the original pacing, which only counts finalizers.
+** CHANGE it if your finalizers are slow (e.g., they close files or
+** sockets).
+*/
+#define LUAI_GCFINBUDGET	0
+
+
 /*
 @@ LUA_EXTRASPACE defines the size of a raw memory area associated with
 ** a Lua state with very fast access.
@@ -0,0 +1,600 @@
+/*
+** $Id: luasnap.c $
+** Lua heap snapshot reader (summarizes and compares heap snapshots)
+** See Copyright Notice in lua.h
+*/
+
+#define luasnap_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lheap.h"
+
+#define PROGNAME	"luasnap"	/* default program name */
+#define MAXDEPTH	6		/* default depth of the paths */
+#define MAXLINES	20		/* default number of lines in listings */
+#define MAXKEYS		64		/* larger tables collapse their keys */
+#define MAXCHAIN	64		/* maximum depth of the paths */
+
+static int maxdepth=MAXDEPTH;		/* length of the paths */
+static int maxlines=MAXLINES;		/* lines in listings */
+static const char* progname=PROGNAME;	/* actual program name */
+static const char* input;		/* file being read */
+
+typedef struct Obj
+{
+ int tt;				/* type tag (0 for the root set) */
+ size_t size;				/* own size */
+ size_t retained;			/* size of its subtree of first paths */
+ size_t count;				/* objects in that subtree */
+ unsigned int parent;			/* first object through which it is reached */
+ unsigned int nrefs;			/* number of references it holds */
+ int depth;				/* length of its path (0 if not known) */
+ int lkind;				/* how its parent refers to it */
+ lua_Unsigned larg;			/* argument of that reference */
+ const unsigned char* preview;		/* first bytes of a string */
+ size_t len;				/* length of a string */
+ const unsigned char* refs;		/* its references in the snapshot */
+} Obj;
+
+typedef struct Snap
+{
+ unsigned int n;			/* number of objects */
+ unsigned int registry;			/* id of the registry */
+ Obj* o;				/* objects 0 (root set) to n */
+ unsigned char* buff;			/* contents of the file */
+ const unsigned char* end;		/* end of 'buff' */
+} Snap;
+
+typedef struct Group
+{
+ char* path;				/* owner path */
+ int side;				/* 0 for old snapshot, 1 for new */
+ size_t bytes;
+} Group;
+
+static void fatal(const char* message)
+{
+ fprintf(stderr,"%s: %s\n",progname,message);
+ exit(EXIT_FAILURE);
+}
+
+static void cannot(const char* what)
+{
+ fprintf(stderr,"%s: cannot %s %s: %s\n",progname,what,input,strerror(errno));
+ exit(EXIT_FAILURE);
+}
+
+static void bad(const char* why)
+{
+ fprintf(stderr,"%s: %s: %s\n",progname,input,why);
+ exit(EXIT_FAILURE);
+}
+
+static void* xmalloc(size_t size)
+{
+ void* p=malloc(size!=0 ? size : 1);
+ if (p==NULL) fatal("not enough memory");
+ return p;
+}
+
+static void usage(const char* message)
+{
+ if (*message=='-')
+  fprintf(stderr,"%s: unrecognized option '%s'\n",progname,message);
+ else
+  fprintf(stderr,"%s: %s\n",progname,message);
+ fprintf(stderr,
+  "usage: %s [options] snapshot [newsnapshot]\n"
+  "With one snapshot, summarize it; with two, show what grew between them.\n"
+  "Available options are:\n"
+  "  -d n     group objects by paths of at most n steps (default %d)\n"
+  "  -n n     list at most n lines (default %d)\n"
+  "  --       stop handling options\n"
+  ,progname,MAXDEPTH,MAXLINES);
+ exit(EXIT_FAILURE);
+}
+
+#define IS(s)	(strcmp(argv[i],s)==0)
+
+static int doargs(int argc, char* argv[])
+{
+ int i;
+ if (argv[0]!=NULL && *argv[0]!=0) progname=argv[0];
+ for (i=1; i<argc; i++)
+ {
+  if (*argv[i]!='-')			/* end of options; keep it */
+   break;
+  else if (IS("--"))			/* end of options; skip it */
+  {
+   ++i;
+   break;
+  }
+  else if (IS("-d") || IS("-n"))	/* numeric options */
+  {
+   int v;
+   if (i+1>=argc || (v=atoi(argv[i+1]))<=0) usage("'-d' and '-n' need a positive number");
+   if (IS("-d")) maxdepth=(v<MAXCHAIN) ? v : MAXCHAIN; else maxlines=v;
+   ++i;
+  }
+  else					/* unknown option */
+   usage(argv[i]);
+ }
+ if (i>=argc || argc-i>2) usage("need one or two snapshots");
+ return i;
+}
+
+/* reading */
+
+static lua_Unsigned getvarint(Snap* S, const unsigned char** p)
+{
+ lua_Unsigned x=0;
+ int shift=0;
+ for (;;)
+ {
+  int b;
+  if (*p>=S->end) bad("truncated snapshot");
+  b=*(*p)++;
+  x|=(lua_Unsigned)(b&0x7f)<<shift;
+  if (b<0x80) return x;
+  shift+=7;
+  if (shift>=64) bad("bad number in snapshot");
+ }
+}
+
+static unsigned int getid(Snap* S, const unsigned char** p)
+{
+ lua_Unsigned id=getvarint(S,p);
+ if (id>S->n) bad("bad object id in snapshot");
+ return (unsigned int)id;
+}
+
+/* read next reference at '*p'; return 0 at the end of the references */
+static int getref(Snap* S, const unsigned char** p, int* kind, lua_Unsigned* arg, unsigned int* id)
+{
+ if (*p>=S->end) bad("truncated snapshot");
+ *kind=*(*p)++;
+ if (*kind==HR_END) return 0;
+ *arg=hrhasarg(*kind&~HR_WEAK) ? getvarint(S,p) : 0;
+ *id=getid(S,p);
+ return 1;
+}
+
+static int isstring(int tt)
+{
+ return (tt&0x0f)==LUA_TSTRING;
+}
+
+static void readsnap(Snap* S, const char* name)
+{
+ FILE* f;
+ long size;
+ const unsigned char* p;
+ unsigned int i;
+ input=name;
+ f=fopen(name,"rb");
+ if (f==NULL) cannot("open");
+ if (fseek(f,0,SEEK_END)!=0 || (size=ftell(f))<0 || fseek(f,0,SEEK_SET)!=0) cannot("seek");
+ S->buff=xmalloc((size_t)size);
+ if (fread(S->buff,1,(size_t)size,f)!=(size_t)size) cannot("read");
+ fclose(f);
+ S->end=S->buff+size;
+ p=S->buff;
+ if ((size_t)size<sizeof(LUA_HEAPSIG) || memcmp(p,LUA_HEAPSIG,sizeof(LUA_HEAPSIG)-1)!=0)
+  bad("not a heap snapshot");
+ p+=sizeof(LUA_HEAPSIG)-1;
+ if (*p++!=LUA_HEAPVERSION) bad("version mismatch");
+ S->n=(unsigned int)getvarint(S,&p);
+ if (S->n>(size_t)size) bad("bad object count");
+ S->o=xmalloc((S->n+2)*sizeof(Obj));
+ memset(S->o,0,(S->n+2)*sizeof(Obj));
+ S->registry=0;
+ for (i=0; i<=S->n; i++)
+ {
+  Obj* o=&S->o[i];
+  int kind;
+  lua_Unsigned arg;
+  unsigned int id;
+  o->tt=(int)getvarint(S,&p);
+  o->size=(size_t)getvarint(S,&p);
+  o->parent=(unsigned int)getvarint(S,&p);
+  if (o->parent>S->n+1) bad("bad parent in snapshot");
+  if (i>0 && isstring(o->tt))
+  {
+   o->len=(size_t)getvarint(S,&p);
+   o->preview=p;
+   p+=(o->len<LUA_HEAPPREVIEW) ? o->len : LUA_HEAPPREVIEW;
+  }
+  o->refs=p;
+  while (getref(S,&p,&kind,&arg,&id))
+  {
+   o->nrefs++;
+   if (i==0 && kind==HR_REGISTRY) S->registry=id;
+  }
+ }
+}
+
+/* paths */
+
+static const char* typename(int tt)
+{
+ switch (tt)
+ {
+  case LUA_TSTRING: return "string";
+  case LUA_TSTRING|(1<<4): return "string";
+  case LUA_TTABLE: return "table";
+  case LUA_TFUNCTION: return "function";
+  case LUA_TFUNCTION|(2<<4): return "cfunction";
+  case LUA_TUSERDATA: return "userdata";
+  case LUA_TTHREAD: return "thread";
+  case LUA_NUMTAGS: return "proto";
+  default: return "?";
+ }
+}
+
+/* give each object the reference through which its parent reaches it */
+static void setlabels(Snap* S)
+{
+ unsigned int i;
+ for (i=0; i<=S->n; i++)
+ {
+  const unsigned char* p=S->o[i].refs;
+  int kind;
+  lua_Unsigned arg;
+  unsigned int id;
+  while (getref(S,&p,&kind,&arg,&id))
+  {
+   Obj* o=&S->o[id];
+   if (!(kind&HR_WEAK) && id>0 && o->parent==i && o->lkind==0)
+   {
+    o->lkind=kind;
+    o->larg=arg;
+   }
+  }
+ }
+}
+
+/* is object 'i' the start of a path ("_G" or a root)? */
+static int isstart(Snap* S, unsigned int i)
+{
+ Obj* o=&S->o[i];
+ return o->parent==0 || (o->parent==S->registry && o->lkind==HR_INT && o->larg==4);
+}
+
+static int depthof(Snap* S, unsigned int i)
+{
+ Obj* o=&S->o[i];
+ if (o->depth==0)
+ {
+  unsigned int j=i;
+  int d=1;
+  while (!isstart(S,j) && S->o[S->o[j].parent].depth==0)	/* find known depth */
+  {
+   j=S->o[j].parent;
+   if (++d>(int)S->n) bad("bad parent in snapshot");
+  }
+  if (!isstart(S,j)) d+=S->o[S->o[j].parent].depth;
+  for (j=i; S->o[j].depth==0; j=S->o[j].parent)		/* set them all */
+  {
+   S->o[j].depth=d--;
+   if (isstart(S,j)) break;
+  }
+ }
+ return o->depth;
+}
+
+static int isname(const unsigned char* s, size_t l)
+{
+ size_t i;
+ if (l==0 || l>LUA_HEAPPREVIEW || isdigit(s[0])) return 0;
+ for (i=0; i<l; i++)
+  if (!isalnum(s[i]) && s[i]!='_') return 0;
+ return 1;
+}
+
+/* append label of object 'i' to 'b' (of size 'sz'); 'group' collapses keys */
+static void label(Snap* S, unsigned int i, char* b, size_t sz, int group)
+{
+ Obj* o=&S->o[i];
+ Obj* p=&S->o[o->parent];
+ size_t l=strlen(b);
+ b+=l; sz-=l;
+ if (o->parent==S->registry && o->lkind==HR_INT && o->larg==4)
+  { snprintf(b,sz,"_G"); return; }
+ switch (o->lkind)
+ {
+  case HR_KEY:
+  {
+   Obj* k=&S->o[o->larg<=S->n ? o->larg : 0];
+   if (group && p->nrefs>MAXKEYS)
+    snprintf(b,sz,"[*]");
+   else if (!isstring(k->tt))
+    snprintf(b,sz,"[%s]",typename(k->tt));
+   else if (isname(k->preview,k->len))
+    snprintf(b,sz,".%.*s",(int)k->len,(const char*)k->preview);
+   else
+   {
+    size_t n=(k->len<LUA_HEAPPREVIEW) ? k->len : LUA_HEAPPREVIEW;
+    size_t j;
+    char s[LUA_HEAPPREVIEW+1];
+    for (j=0; j<n; j++) s[j]=isprint(k->preview[j]) && k->preview[j]!='"' ? k->preview[j] : '?';
+    s[n]=0;
+    snprintf(b,sz,"[\"%s%s\"]",s,(k->len>n) ? "..." : "");
+   }
+   break;
+  }
+  case HR_INT:
+   if (group) snprintf(b,sz,"[*]");
+   else
+   {
+    lua_Unsigned z=o->larg;
+    lua_Integer v=(z&1) ? -(lua_Integer)(z>>1)-1 : (lua_Integer)(z>>1);
+    snprintf(b,sz,"[" LUA_INTEGER_FMT "]",(LUAI_UACINT)v);
+   }
+   break;
+  case HR_OTHER:	snprintf(b,sz,"[?]"); break;
+  case HR_ISKEY:	snprintf(b,sz,"(key)"); break;
+  case HR_META:		snprintf(b,sz,"(metatable)"); break;
+  case HR_UVALUE:	snprintf(b,sz,"(uservalue)"); break;
+  case HR_UPVAL:
+   if (group) snprintf(b,sz,"(upvalue)");
+   else snprintf(b,sz,"(upvalue %d)",(int)o->larg);
+   break;
+  case HR_STACK:	snprintf(b,sz,"(stack)"); break;
+  case HR_PROTO:	snprintf(b,sz,"(proto)"); break;
+  case HR_CONST:	snprintf(b,sz,"(constant)"); break;
+  case HR_DEBUG:	snprintf(b,sz,"(debug)"); break;
+  case HR_REGISTRY:	snprintf(b,sz,"registry"); break;
+  case HR_MAINTHREAD:	snprintf(b,sz,"mainthread"); break;
+  case HR_BASICMT:	snprintf(b,sz,"(metatable of %s)",typename((int)o->larg)); break;
+  case HR_FINALIZE:	snprintf(b,sz,"(finalizing)"); break;
+  case HR_FIXED:	snprintf(b,sz,"(fixed)"); break;
+  default:		snprintf(b,sz,"(?)"); break;
+ }
+}
+
+/* path of object 'i', or of its ancestor at 'maxdepth' steps */
+static char* path(Snap* S, unsigned int i, int group)
+{
+ unsigned int chain[MAXCHAIN];
+ static char* b=NULL;
+ static size_t bsize=0;
+ int d=0;
+ size_t need=(size_t)maxdepth*(LUA_HEAPPREVIEW+16)+64;
+ if (bsize<need) { free(b); b=xmalloc(need); bsize=need; }
+ *b=0;
+ if (S->o[i].parent==S->n+1) return strcpy(b,"(not strongly reachable)");
+ while (depthof(S,i)>maxdepth) i=S->o[i].parent;
+ for (;;)
+ {
+  chain[d++]=i;
+  if (isstart(S,i) || d==MAXCHAIN) break;
+  i=S->o[i].parent;
+ }
+ while (d>0) label(S,chain[--d],b,bsize,group);
+ return b;
+}
+
+/* retained sizes: sums over the tree of first paths, deepest objects first */
+static Snap* sorting;
+
+static int cmpdepth(const void* a, const void* b)
+{
+ int da=sorting->o[*(const unsigned int*)a].depth;
+ int db=sorting->o[*(const unsigned int*)b].depth;
+ return (da<db)-(da>db);
+}
+
+static void retain(Snap* S)
+{
+ unsigned int* ids=xmalloc((S->n+1)*sizeof(unsigned int));
+ unsigned int i,m=0;
+ for (i=1; i<=S->n; i++)
+ {
+  Obj* o=&S->o[i];
+  o->retained=o->size;
+  o->count=1;
+  if (o->parent<=S->n)
+  {
+   depthof(S,i);
+   ids[m++]=i;
+  }
+ }
+ sorting=S;
+ qsort(ids,m,sizeof(unsigned int),cmpdepth);
+ for (i=0; i<m; i++)
+ {
+  Obj* o=&S->o[ids[i]];
+  if (!isstart(S,ids[i]))
+  {
+   S->o[o->parent].retained+=o->retained;
+   S->o[o->parent].count+=o->count;
+  }
+ }
+ free(ids);
+}
+
+static void load(Snap* S, const char* name)
+{
+ readsnap(S,name);
+ setlabels(S);
+ retain(S);
+}
+
+/* listings */
+
+typedef struct Totals
+{
+ size_t count[LUA_NUMTAGS+1+2];
+ size_t bytes[LUA_NUMTAGS+1+2];
+} Totals;
+
+static int typeslot(int tt)
+{
+ if (tt==(LUA_TFUNCTION|(2<<4))) return LUA_NUMTAGS+1;
+ return tt&0x0f;
+}
+
+static void totals(Snap* S, Totals* T)
+{
+ unsigned int i;
+ memset(T,0,sizeof(*T));
+ for (i=1; i<=S->n; i++)
+ {
+  int t=typeslot(S->o[i].tt);
+  if (t>LUA_NUMTAGS+1) continue;
+  T->count[t]++;
+  T->bytes[t]+=S->o[i].size;
+ }
+}
+
+static const int listed[]={ LUA_TTABLE, LUA_TSTRING, LUA_TFUNCTION, LUA_NUMTAGS+1,
+                            LUA_TUSERDATA, LUA_TTHREAD, LUA_NUMTAGS, -1 };
+
+static Snap* ranking;
+
+static int cmpretained(const void* a, const void* b)
+{
+ size_t ra=ranking->o[*(const unsigned int*)a].retained;
+ size_t rb=ranking->o[*(const unsigned int*)b].retained;
+ return (ra<rb)-(ra>rb);
+}
+
+static void summary(Snap* S)
+{
+ Totals T;
+ size_t count=0,bytes=0;
+ unsigned int* ids=xmalloc((S->n+1)*sizeof(unsigned int));
+ unsigned int i,m=0;
+ int k;
+ totals(S,&T);
+ printf("%-12s %10s %14s\n","type","count","bytes");
+ for (k=0; listed[k]>=0; k++)
+ {
+  int t=listed[k];
+  const char* name=(t==LUA_NUMTAGS+1) ? "cfunction" : typename(t);
+  if (T.count[t]==0) continue;
+  printf("%-12s %10zu %14zu\n",name,T.count[t],T.bytes[t]);
+  count+=T.count[t];
+  bytes+=T.bytes[t];
+ }
+ printf("%-12s %10zu %14zu\n\n","total",count,bytes);
+ for (i=1; i<=S->n; i++)
+  if (S->o[i].parent<=S->n && S->o[i].depth<=maxdepth) ids[m++]=i;
+ ranking=S;
+ qsort(ids,m,sizeof(unsigned int),cmpretained);
+ printf("%14s %10s  %s\n","retained","objects","path");
+ for (i=0; i<m && i<(unsigned int)maxlines; i++)
+ {
+  Obj* o=&S->o[ids[i]];
+  printf("%14zu %10zu  %s (%s)\n",o->retained,o->count,path(S,ids[i],0),typename(o->tt));
+ }
+ free(ids);
+}
+
+static int cmpgroup(const void* a, const void* b)
+{
+ return strcmp(((const Group*)a)->path,((const Group*)b)->path);
+}
+
+typedef struct Delta
+{
+ const char* path;
+ long long count;
+ long long bytes;
+} Delta;
+
+static int cmpdelta(const void* a, const void* b)
+{
+ long long da=((const Delta*)a)->bytes;
+ long long db=((const Delta*)b)->bytes;
+ return (da<db)-(da>db);
+}
+
+static size_t groups(Snap* S, int side, Group* g)
+{
+ unsigned int i;
+ for (i=1; i<=S->n; i++)
+ {
+  const char* p=path(S,i,1);
+  g[i-1].path=strcpy(xmalloc(strlen(p)+1),p);
+  g[i-1].side=side;
+  g[i-1].bytes=S->o[i].size;
+ }
+ return S->n;
+}
+
+static void diff(Snap* A, Snap* B)
+{
+ Totals TA,TB;
+ size_t n=(size_t)A->n+B->n;
+ Group* g=xmalloc(n*sizeof(Group));
+ Delta* d=xmalloc(n*sizeof(Delta));
+ size_t i,m=0;
+ long long count=0,bytes=0;
+ int k;
+ totals(A,&TA);
+ totals(B,&TB);
+ printf("%-12s %10s %14s\n","type","+count","+bytes");
+ for (k=0; listed[k]>=0; k++)
+ {
+  int t=listed[k];
+  const char* name=(t==LUA_NUMTAGS+1) ? "cfunction" : typename(t);
+  long long dc=(long long)TB.count[t]-(long long)TA.count[t];
+  long long db=(long long)TB.bytes[t]-(long long)TA.bytes[t];
+  if (dc==0 && db==0) continue;
+  printf("%-12s %+10lld %+14lld\n",name,dc,db);
+  count+=dc;
+  bytes+=db;
+ }
+ printf("%-12s %+10lld %+14lld\n\n","total",count,bytes);
+ groups(A,0,g);
+ groups(B,1,g+A->n);
+ qsort(g,n,sizeof(Group),cmpgroup);
+ for (i=0; i<n; )
+ {
+  size_t j=i;
+  Delta* e=&d[m];
+  e->path=g[i].path;
+  e->count=e->bytes=0;
+  for (; j<n && strcmp(g[j].path,g[i].path)==0; j++)
+  {
+   int s=g[j].side ? 1 : -1;
+   e->count+=s;
+   e->bytes+=s*(long long)g[j].bytes;
+  }
+  if (e->count!=0 || e->bytes!=0) m++;
+  i=j;
+ }
+ qsort(d,m,sizeof(Delta),cmpdelta);
+ printf("%14s %10s  %s\n","+bytes","+objects","owner path");
+ for (i=0; i<m && i<(size_t)maxlines && d[i].bytes>0; i++)
+  printf("%+14lld %+10lld  %s\n",d[i].bytes,d[i].count,d[i].path);
+ for (i=0; i<n; i++) free(g[i].path);
+ free(g);
+ free(d);
+}
+
+int main(int argc, char* argv[])
+{
+ Snap A,B;
+ int i=doargs(argc,argv);
+ load(&A,argv[i]);
+ if (i+1<argc)
+ {
+  load(&B,argv[i+1]);
+  diff(&A,&B);
+ }
+ else
+  summary(&A);
+ return EXIT_SUCCESS;
+}
@@ -14,11 +14,13 @@
 
 #include "lua.h"
 
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopt.h"
 #include "lstring.h"
 #include "lundump.h"
 #include "lzio.h"
@@ -194,11 +196,49 @@ static void LoadDebug (LoadState *S, Proto *f) {
     f->locvars[i].endpc = LoadInt(S);
   }
   n = LoadInt(S);
+  f->inlines = luaM_newvector(S->L, n, InlineInfo);
+  f->sizeinlines = n;
+  for (i = 0; i < n; i++) {
+    f->inlines[i].startpc = LoadInt(S);
+    f->inlines[i].endpc = LoadInt(S);
+    f->inlines[i].line = LoadInt(S);
+    f->inlines[i].fn = LoadInt(S);
+    f->inlines[i].base = LoadByte(S);
+    f->inlines[i].fidx = LoadByte(S);
+  }
+  n = LoadInt(S);
   for (i = 0; i < n; i++)
     f->upvalues[i].name = LoadString(S);
 }
 
 
+/*
+** Check that each inlined call of 'f' covers exactly the code of its
+** function, so that the debug interface can map it back to that function
+*/
+static void checkinlines (LoadState *S, Proto *f) {
+  int i;
+  int last = 0;  /* end of previous inlined call */
+  for (i = 0; i < f->sizeinlines; i++) {
+    const InlineInfo *ii = &f->inlines[i];
+    const Proto *ip;
+    int pc, n;
+    int size = 0;
+    if (ii->startpc < last || ii->endpc > f->sizecode ||
+        ii->fn < 0 || ii->fn >= f->sizep || ii->fidx >= f->maxstacksize)
+      error(S, "bad inlined calls in");
+    ip = f->p[ii->fn];
+    n = ip->sizecode - 1;
+    for (pc = 0; pc < n; pc++)
+      size += inlinedsize(ip->code[pc], pc, n);
+    if (n < 1 || ii->endpc - ii->startpc != size ||
+        ii->base + ip->maxstacksize > f->maxstacksize)
+      error(S, "bad inlined calls in");
+    last = ii->endpc;
+  }
+}
+
+
 static void LoadFunction (LoadState *S, Proto *f, TString *psource) {
   f->source = LoadString(S);
   if (f->source == NULL)  /* no source in dump? */
@@ -213,6 +253,12 @@ static void LoadFunction (LoadState *S, Proto *f, TString *psource) {
   LoadUpvalues(S, f);
   LoadProtos(S, f);
   LoadDebug(S, f);
+  checkinlines(S, f);
+  if (!luaK_checkintops(S->L, f))
+    error(S, "unproven integer operands in");
+  luaK_fuse(f);  /* do not trust superinstructions from the chunk */
+  luaF_inittabsites(S->L, f);
+  luaF_initkslots(S->L, f);
 }
 
 
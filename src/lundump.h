@@ -29,4 +29,8 @@ LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
 
+/* dump one chunk as a C module compiled ahead of time; from ldumpc.c */
+LUAI_FUNC int luaU_dumpC (lua_State* L, const Proto* f, const char* modname,
+                          lua_Writer w, void* data, int strip);
+
 #endif
@@ -18,10 +18,12 @@
 
 #include "lua.h"
 
+#include "laot.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -215,7 +217,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
         /* no metamethod and (now) there is an entry with given key */
         setobj2t(L, cast(TValue *, slot), val);  /* set its new value */
         invalidateTMcache(h);
-        luaC_barrierback(L, h, val);
+        luaC_barriercard(L, h, slot, val);
         return;
       }
       /* else will try the metamethod */
@@ -245,7 +247,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** and it uses 'strcoll' (to respect locales) for each segments
 ** of the strings.
 */
-static int l_strcmp (const TString *ls, const TString *rs) {
+int luaV_strcmp (const TString *ls, const TString *rs) {
   const char *l = getstr(ls);
   size_t ll = tsslen(ls);
   const char *r = getstr(rs);
@@ -366,7 +368,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LTnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return luaV_strcmp(tsvalue(l), tsvalue(r)) < 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0)  /* no metamethod? */
     luaG_ordererror(L, l, r);  /* error */
   return res;
@@ -386,7 +388,7 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LEnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return luaV_strcmp(tsvalue(l), tsvalue(r)) <= 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0)  /* try 'le' */
     return res;
   else {  /* try 'lt': */
@@ -511,6 +513,65 @@ void luaV_concat (lua_State *L, int total) {
 }
 
 
+/*
+** Concatenate 't[i] .. sep .. t[i + 1] .. sep .. t[j]' (with i <= j),
+** computing the total length first and then copying each piece
+** directly to the result. Elements are read raw: a present value is
+** what a regular access would give, and any element that is not a
+** string or a number (including absent ones) makes the function return
+** NULL without doing anything, so that the caller can handle it.
+*/
+TString *luaV_concattable (lua_State *L, Table *t, const char *sep,
+                           size_t lsep, lua_Integer i, lua_Integer j) {
+  char nbuff[MAXNUMBER2STR];
+  char sbuff[LUAI_MAXSHORTLEN];
+  size_t tl = 0;
+  size_t l;
+  lua_Integer k;
+  TString *ts = NULL;
+  char *buff;
+  lua_assert(i <= j);
+  for (k = i; ; k++) {  /* collect total length */
+    const TValue *o = luaH_getint(t, k);
+    if (ttisstring(o))
+      l = vslen(o);
+    else if (ttisnumber(o))
+      l = luaO_tostringbuff(o, nbuff);
+    else
+      return NULL;
+    if (l >= (MAX_SIZE/sizeof(char)) - tl)
+      luaG_runerror(L, "string length overflow");
+    tl += l;
+    if (k == j) break;
+    if (lsep >= (MAX_SIZE/sizeof(char)) - tl)
+      luaG_runerror(L, "string length overflow");
+    tl += lsep;
+  }
+  if (tl <= LUAI_MAXSHORTLEN)  /* is result a short string? */
+    buff = sbuff;
+  else {  /* long string; copy pieces directly to final result */
+    ts = luaS_createlngstrobj(L, tl);
+    buff = getstr(ts);
+  }
+  for (k = i, tl = 0; ; k++) {
+    const TValue *o = luaH_getint(t, k);
+    if (ttisstring(o)) {
+      l = vslen(o);
+      memcpy(buff + tl, svalue(o), l * sizeof(char));
+    }
+    else {  /* a number, as checked in the first pass */
+      l = luaO_tostringbuff(o, nbuff);
+      memcpy(buff + tl, nbuff, l * sizeof(char));
+    }
+    tl += l;
+    if (k == j) break;
+    memcpy(buff + tl, sep, lsep * sizeof(char));
+    tl += lsep;
+  }
+  return (ts != NULL) ? ts : luaS_newlstr(L, buff, tl);
+}
+
+
 /*
 ** Main operation 'ra' = #rb'.
 */
@@ -627,7 +688,7 @@ static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
 ** create a new Lua closure, push it in the stack, and initialize
 ** its upvalues. Note that the closure is not cached if prototype is
 ** already black (which means that 'cache' was already cleared by the
-** GC).
+** GC) or if the closure belongs to an arena, which may free it.
 */
 static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
                          StkId ra) {
@@ -645,11 +706,122 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
     ncl->upvals[i]->refcount++;
     /* new closure is white, so we do not need a barrier here */
   }
-  if (!isblack(p))  /* cache will not break GC invariant? */
+  if (!isblack(p) && !islocal(ncl))  /* cache will not break GC invariant? */
     p->cache = ncl;  /* save it on cache for reuse */
 }
 
 
+/*
+** Update the size hints of table-constructor site 'ts' with the sizes
+** actually reached by the last table created there: the last non-nil
+** position in its array part and the number of non-nil entries in its
+** hash part. (Both counts are proportional to the work already done
+** to allocate and fill that table.)
+*/
+void luaV_updatetabsite (TabSite *ts) {
+  Table *t = ts->last;
+  unsigned int na = t->sizearray;
+  unsigned int nh = 0;
+  while (na > 0 && ttisnil(&t->array[na - 1]))
+    na--;
+  if (!isdummy(t)) {
+    Node *n;
+    for (n = gnode(t, 0); n < gnode(t, sizenode(t)); n++) {
+      if (!ttisnil(gval(n)))
+        nh++;
+    }
+  }
+  ts->sizearray = na;
+  ts->sizenode = nh;
+}
+
+
+/*
+** create a new table for instruction OP_NEWTABLE at position 'pc',
+** presizing it with the larger of the constructor's own sizes and the
+** sizes previously reached by tables from the same site. Like the
+** closure cache, the site's reference to the new table is weak and is
+** not kept if the prototype is already black or the table is local to
+** an arena.
+*/
+static void newtable (lua_State *L, Proto *p, int pc, StkId ra,
+                      unsigned int na, unsigned int nh) {
+  TabSite *ts = luaF_gettabsite(p, pc);
+  Table *t = luaH_new(L);
+  sethvalue(L, ra, t);
+  if (ts != NULL) {
+    if (ts->last != NULL)
+      luaV_updatetabsite(ts);
+    if (ts->sizearray > na) na = ts->sizearray;
+    if (ts->sizenode > nh) nh = ts->sizenode;
+    ts->last = (isblack(p) || islocal(t)) ? NULL : t;
+  }
+  if (na != 0 || nh != 0)
+    luaH_resize(L, t, na, nh);
+}
+
+
+/*
+** Key of the last element visited by a generic 'for' running 'next'
+** natively, given its state (the table) and its control variable
+** (holding the traversal position instead of that key)
+*/
+void luaV_forkey (const TValue *state, const TValue *ctl, TValue *key) {
+  lua_assert(ttisforpos(ctl));
+  if (ttistable(state))
+    luaH_poskey(hvalue(state), cast(unsigned int, val_(ctl).i), key);
+  else  /* state changed through the debug library */
+    setnilvalue(key);
+}
+
+
+/*
+** Run one step of the generic 'for' at 'ra' without calling its
+** generator, when that is the stock 'next' or 'ipairs' iterator (as
+** registered with 'lua_setiterators') over a table. A native 'next'
+** keeps the traversal position in the control variable, so that it
+** does not have to look up the previous key again. Loop values go to
+** 'ra + 3'. Returns 1 if the loop goes on, 0 if it ends, and -1 if the
+** step must be done by a regular call (e.g., when a hook wants to see
+** that call, or a 'next' traversal starts from a given key).
+*/
+static int fornative (lua_State *L, StkId ra, int nres) {
+  StkId ctl = ra + 2;
+  Table *t;
+  if (!ttislcf(ra) || !ttistable(ra + 1) ||
+      (L->hookmask & (LUA_MASKCALL | LUA_MASKRET)))  /* calls observed? */
+    return -1;
+  t = hvalue(ra + 1);
+  if (fvalue(ra) == G(L)->nextf && (ttisnil(ctl) || ttisforpos(ctl))) {
+    unsigned int i = ttisnil(ctl) ? 0 : cast(unsigned int, val_(ctl).i);
+    i = luaH_nextpos(L, t, i, ra + 3);
+    if (i == 0) {  /* no more elements? */
+      setnilvalue(ra + 3);
+      return 0;
+    }
+    setforpos(ctl, i);
+  }
+  else if (fvalue(ra) == G(L)->ipairsf && ttisinteger(ctl)) {
+    lua_Integer n = intop(+, ivalue(ctl), 1);
+    const TValue *v = luaH_getint(t, n);
+    if (ttisnil(v)) {  /* end of the loop? */
+      if (fasttm(L, t->metatable, TM_INDEX) != NULL)
+        return -1;  /* no; let '__index' give the value */
+      setnilvalue(ra + 3);
+      return 0;
+    }
+    setivalue(ra + 3, n);
+    setobj2s(L, ra + 4, v);
+    setivalue(ctl, n);
+  }
+  else
+    return -1;
+  for (ctl = ra + 5; ctl < ra + 3 + nres; ctl++)
+    setnilvalue(ctl);  /* extra loop variables */
+  return 1;
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -657,7 +829,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = genericop(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -721,66 +893,72 @@ void luaV_finishOp (lua_State *L) {
 
 
 /*
-** some macros for common tasks in 'luaV_execute'
+** Macros 'RA', 'RKB', 'Protect', 'checkGC', etc. are in 'laot.h', as
+** code compiled ahead of time shares them.
 */
 
 
-#define RA(i)	(base+GETARG_A(i))
-#define RB(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgR, base+GETARG_B(i))
-#define RC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgR, base+GETARG_C(i))
-#define RKB(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, \
-	ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
-#define RKC(i)	check_exp(getCMode(GET_OPCODE(i)) == OpArgK, \
-	ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
+/*
+** After a backward jump, go to the machine code of the function, if
+** it has (or now gets) one. (With line or count hooks, or while
+** recording types, that code would give control back right away.)
+*/
+#if defined(LUA_USE_JIT)
+#define jitloop()  \
+  { if ((cl->p->aot != NULL || luaJ_count(L, cl->p)) && \
+        !(L->hookmask & HOOKINSTR)) goto newframe; }
+
+/*
+** After the integer loop ending at instruction 'i' jumps back, run its
+** trace, if it has (or now gets) one (see 'luaJ_trace')
+*/
+#define jittrace(i)  \
+  { if (cl->p->loops != NULL && \
+        !(L->hookmask & HOOKINSTR) && \
+        luaJ_trace(L, ci, cast_int(ci->u.l.savedpc - cl->p->code) - 1 - \
+                          GETARG_sBx(i))) goto newframe; }
+#else
+#define jitloop()	{ }
+#define jittrace(i)	{ }
+#endif
 
 
 /* execute a jump instruction */
 #define dojump(ci,i,e) \
   { int a = GETARG_A(i); \
     if (a != 0) luaF_close(L, ci->u.l.base + a - 1); \
-    ci->u.l.savedpc += GETARG_sBx(i) + e; }
+    ci->u.l.savedpc += GETARG_sBx(i) + e; \
+    if (GETARG_sBx(i) < 0) jitloop(); }
 
 /* for test instructions, execute the jump instruction that follows it */
 #define donextjump(ci)	{ i = *ci->u.l.savedpc; dojump(ci, i, 1); }
 
 
-#define Protect(x)	{ {x;}; base = ci->u.l.base; }
-
-#define checkGC(L,c)  \
-	{ luaC_condGC(L, L->top = (c),  /* limit of live values */ \
-                         Protect(L->top = ci->top));  /* restore top */ \
-           luai_threadyield(L); }
-
-
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(ci->u.l.savedpc++); \
-  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
+  if (L->hookmask & HOOKINSTR) \
     Protect(luaG_traceexec(L)); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
   lua_assert(base == ci->u.l.base); \
   lua_assert(base <= L->top && L->top < L->stack + L->stacksize); \
 }
 
-#define vmdispatch(o)	switch(o)
-#define vmcase(l)	case l:
-#define vmbreak		break
-
-
 /*
-** copy of 'luaV_gettable', but protecting the call to potential
-** metamethod (which can reallocate the stack)
+** End of the first half of a superinstruction: run its second half (the
+** next instruction) going straight to its code at label 'lbl', unless
+** there are hooks to call before it
 */
-#define gettableProtected(L,t,k,v)  { const TValue *slot; \
-  if (luaV_fastget(L,t,k,slot,luaH_get)) { setobj2s(L, v, slot); } \
-  else Protect(luaV_finishget(L,t,k,v,slot)); }
-
-
-/* same for 'luaV_settable' */
-#define settableProtected(L,t,k,v) { const TValue *slot; \
-  if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
-    Protect(luaV_finishset(L,t,k,v,slot)); }
+#define fusenext(lbl)	{ \
+  if (L->hookmask & HOOKINSTR) vmbreak; \
+  i = *(ci->u.l.savedpc++); \
+  ra = RA(i); \
+  goto lbl; \
+}
 
+#define vmdispatch(o)	switch(o)
+#define vmcase(l)	case l:
+#define vmbreak		break
 
 
 void luaV_execute (lua_State *L) {
@@ -792,6 +970,25 @@ void luaV_execute (lua_State *L) {
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
+  if (cl->p->aot != NULL) {  /* function compiled ahead of time? */
+    int b = (*cl->p->aot)(L);  /* run it until it calls or returns */
+    if (b == AOT_CALL) {  /* called a Lua function? */
+      ci = L->ci;
+      goto newframe;  /* restart luaV_execute over new Lua function */
+    }
+    else if (b == AOT_INTERP)  /* stopped inside the function? */
+      lua_assert(ci == L->ci);  /* interpret it from its saved 'pc' */
+    else if (ci->callstatus & CIST_FRESH)  /* returned like OP_RETURN */
+      return;  /* external invocation: return */
+    else {  /* invocation via reentry: continue execution */
+      ci = L->ci;
+      if (b) L->top = ci->top;
+      lua_assert(isLua(ci));
+      goto newframe;  /* restart luaV_execute over new Lua function */
+    }
+  }
+  else if (luaJ_count(L, cl->p))  /* function became hot? */
+    goto newframe;  /* run its new machine code */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
   /* main loop of interpreter */
@@ -829,27 +1026,33 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_GETUPVAL) {
-        int b = GETARG_B(i);
-        setobj2s(L, ra, cl->upvals[b]->v);
+        UpVal *uv = cl->upvals[GETARG_B(i)];
+        luaC_upvalread(L, uv);
+        setobj2s(L, ra, uv->v);
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        UpVal *uv = cl->upvals[GETARG_B(i)];
+        TValue *upval = uv->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        luaC_upvalread(L, uv);
+        gettabupProtected(L, upval, GETARG_C(i), rc, ra);
         vmbreak;
       }
-      vmcase(OP_GETTABLE) {
+      vmcase(OP_GETTABLE)
+      l_gettable: {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
         gettableProtected(L, rb, rc, ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
-        TValue *upval = cl->upvals[GETARG_A(i)]->v;
+        UpVal *uv = cl->upvals[GETARG_A(i)];
+        TValue *upval = uv->v;
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        settableProtected(L, upval, rb, rc);
+        luaC_upvalread(L, uv);
+        settabupProtected(L, upval, GETARG_B(i), rb, rc);
         vmbreak;
       }
       vmcase(OP_SETUPVAL) {
@@ -867,10 +1070,8 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
-        Table *t = luaH_new(L);
-        sethvalue(L, ra, t);
-        if (b != 0 || c != 0)
-          luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
+        newtable(L, cl->p, pcRel(ci->u.l.savedpc, cl->p), ra,
+                 luaO_fb2int(b), luaO_fb2int(c));
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1127,7 +1328,8 @@ void luaV_execute (lua_State *L) {
         }
         vmbreak;
       }
-      vmcase(OP_CALL) {
+      vmcase(OP_CALL)
+      l_call: {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
@@ -1196,6 +1398,8 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            jittrace(i);
+            jitloop();
           }
         }
         else {  /* floating loop */
@@ -1207,6 +1411,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            jitloop();
           }
         }
         vmbreak;
@@ -1241,6 +1446,18 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_TFORCALL) {
         StkId cb = ra + 3;  /* call base */
+        int res = fornative(L, ra, GETARG_C(i));
+        if (res >= 0) {  /* step done natively? */
+          i = *(ci->u.l.savedpc++);  /* go to next instruction */
+          lua_assert(GET_OPCODE(i) == OP_TFORLOOP);
+          if (res) {  /* continue loop? (control variable already set) */
+            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+            jitloop();
+          }
+          vmbreak;
+        }
+        if (ttisforpos(ra + 2))  /* generator changed during the loop? */
+          luaV_forkey(ra + 1, ra + 2, ra + 2);
         setobjs2s(L, cb+2, ra+2);
         setobjs2s(L, cb+1, ra+1);
         setobjs2s(L, cb, ra);
@@ -1257,6 +1474,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           jitloop();
         }
         vmbreak;
       }
@@ -1314,9 +1532,94 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_IADD) {
+        setivalue(ra, intop(+, ivalue(RKB(i)), ivalue(RKC(i))));
+        vmbreak;
+      }
+      vmcase(OP_ISUB) {
+        setivalue(ra, intop(-, ivalue(RKB(i)), ivalue(RKC(i))));
+        vmbreak;
+      }
+      vmcase(OP_IEQ) {
+        if ((ivalue(RKB(i)) == ivalue(RKC(i))) != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_ILT) {
+        if ((ivalue(RKB(i)) < ivalue(RKC(i))) != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_ILE) {
+        if ((ivalue(RKB(i)) <= ivalue(RKC(i))) != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_IGETTABLE) {
+        const TValue *slot;
+        StkId rb = RB(i);
+        TValue *rc = RKC(i);
+        if (luaV_fastget(L, rb, ivalue(rc), slot, luaH_getint)) {
+          setobj2s(L, ra, slot);
+        }
+        else Protect(luaV_finishget(L, rb, rc, ra, slot));
+        vmbreak;
+      }
+      vmcase(OP_ISETTABLE) {
+        const TValue *slot;
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (!luaV_fastset(L, ra, ivalue(rb), slot, luaH_getint, rc))
+          Protect(luaV_finishset(L, ra, rb, rc, slot));
+        vmbreak;
+      }
+      vmcase(OP_MOVECALL) {
+        setobjs2s(L, ra, RB(i));
+        fusenext(l_call);
+      }
+      vmcase(OP_LOADKCALL) {
+        TValue *rb = k + GETARG_Bx(i);
+        setobj2s(L, ra, rb);
+        fusenext(l_call);
+      }
+      vmcase(OP_GETUPGET) {
+        UpVal *uv = cl->upvals[GETARG_B(i)];
+        TValue *upval = uv->v;
+        TValue *rc = RKC(i);
+        luaC_upvalread(L, uv);
+        gettabupProtected(L, upval, GETARG_C(i), rc, ra);
+        fusenext(l_gettable);
+      }
     }
   }
 }
 
 /* }================================================================== */
 
+
+/*
+** {==================================================================
+** Internal functions used by code compiled ahead of time
+** ===================================================================
+*/
+
+LUAI_DDEF const AOTRuntime luaV_aotruntime = {
+  luaV_tonumber_, luaV_tointeger, luaV_finishget, luaV_finishset,
+  luaV_equalobj, luaV_lessthan, luaV_lessequal, luaV_concat, luaV_objlen,
+  luaV_div, luaV_mod, luaV_shiftl, luaV_forkey, forlimit, fornative,
+  getcached, pushclosure, newtable, luaO_fb2int, luaT_trybinTM,
+  luaD_precall, luaD_poscall, luaD_call, luaD_growstack, luaF_close,
+  luaH_get, luaH_getstr, luaH_getstrhint, luaH_getint, luaH_setint,
+  luaH_resizearray,
+  luaC_step, luaC_barrierback_, luaC_barriercard_, luaC_upvalbarrier_,
+  luaC_upvalread_, luaC_escape_, luaG_runerror, luaG_traceexec
+};
+
+/* }================================================================== */
+
@@ -82,7 +82,7 @@
    ? (slot = NULL, 0) \
    : (slot = f(hvalue(t), k), \
      ttisnil(slot) ? 0 \
-     : (luaC_barrierback(L, hvalue(t), v), \
+     : (luaC_barriercard(L, hvalue(t), slot, v), \
         setobj2t(L, cast(TValue *,slot), v), \
         1)))
 
@@ -94,6 +94,7 @@
 
 
 LUAI_FUNC int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2);
+LUAI_FUNC int luaV_strcmp (const TString *ls, const TString *rs);
 LUAI_FUNC int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r);
 LUAI_FUNC int luaV_tonumber_ (const TValue *obj, lua_Number *n);
@@ -105,6 +106,11 @@ LUAI_FUNC void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 LUAI_FUNC void luaV_finishOp (lua_State *L);
 LUAI_FUNC void luaV_execute (lua_State *L);
 LUAI_FUNC void luaV_concat (lua_State *L, int total);
+LUAI_FUNC TString *luaV_concattable (lua_State *L, Table *t, const char *sep,
+                                     size_t lsep, lua_Integer i, lua_Integer j);
+LUAI_FUNC void luaV_updatetabsite (TabSite *ts);
+LUAI_FUNC void luaV_forkey (const TValue *state, const TValue *ctl,
+                             TValue *key);
 LUAI_FUNC lua_Integer luaV_div (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);